@@ -3,6 +3,8 @@
 /// Contains audio samples and allows some operations
 
 #include "AudioSignal.hpp"
+#include "BiquadFilter.hpp"
+#include "MixKernels.hpp"
 
 #include <array>
 #include <doctest.h>
@@ -12,13 +14,15 @@
 #include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <memory>
 #include <numbers>
+#include <span>
+#include <utility>
+#include <vector>
 
 
 namespace mnome {
 
-const size_t halfStepsInOctave = 12;
-
 using namespace std;
 
 AudioSignal::AudioSignal(const AudioSignalConfiguration& as_config, double lengthS)
@@ -27,62 +31,36 @@ AudioSignal::AudioSignal(const AudioSignalConfiguration& as_config, double lengt
 }
 
 AudioSignal::AudioSignal(const AudioSignalConfiguration& as_config, AudioDataType&& audio_data)
-    : config{as_config}, data{audio_data}
+    : config{as_config}, data{std::move(audio_data)}
 {
 }
 
-void biquad_2nd_order_df1_normalized(vector<SampleType>& data, double gain, double biquad_y0_factor,
-                                     double biquad_y1_factor)
-{
-    constexpr const size_t NZEROS = 2;
-    constexpr const size_t NPOLES = 2;
-
-    std::array<double, NZEROS + 1> biquad_x{};
-    std::array<double, NPOLES + 1> biquad_y{};
+/// Highest cutoff frequency relative to the sample rate that still leaves room for the transition band
+constexpr double MAX_RELATIVE_CUTOFF = 0.45;
 
-    for (auto& sample : data) {
-        biquad_x[0] = biquad_x[1];
-        biquad_x[1] = biquad_x[2];
-        biquad_x[2] = sample / gain;
-        biquad_y[0] = biquad_y[1];
-        biquad_y[1] = biquad_y[2];
-        biquad_y[2] = (biquad_x[0] + biquad_x[2]) + (2 * biquad_x[1]) + (biquad_y0_factor * biquad_y[0]) +
-                      (biquad_y1_factor * biquad_y[1]);
-        sample      = static_cast<SampleType>(biquad_y[2]);
-    }
-}
-
-// Generated with http://www-users.cs.york.ac.uk/~fisher/mkfilter/ - no license given -
-// and adjusted to work as a standalone function.
 void AudioSignal::lowPass20KHz()
 {
-    /* Digital filter designed by mkfilter/mkshape/gencode   A.J. Fisher
-     *    Command line: /www/usr/fisher/helpers/mkfilter -Bu -Lp -o 2 -a 4.1666666667e-01
-     * 0.0000000000e+00 -l */
-
-    constexpr const double GAIN             = 1.450734152e+00;
-    constexpr const double biquad_y0_factor = -0.4775922501;
-    constexpr const double biquad_y1_factor = -1.2796324250;
-    biquad_2nd_order_df1_normalized(data, GAIN, biquad_y0_factor, biquad_y1_factor);
+    constexpr double cutoff = 20'000;
+    filter(designButterworth(FilterType::lowPass, config.sampleRate,
+                             min(cutoff, MAX_RELATIVE_CUTOFF * config.sampleRate), 2));
 }
-// Generated with http://www-users.cs.york.ac.uk/~fisher/mkfilter/ - no license given -
-// and adjusted to work as a standalone function.
+
 void AudioSignal::highPass20Hz()
 {
-    /* Digital filter designed by mkfilter/mkshape/gencode   A.J. Fisher
-     *    Command line: /www/usr/fisher/helpers/mkfilter -Bu -Lp -o 2 -a 4.1666666667e-01
-     * 0.0000000000e+00 -l */
-    constexpr double GAIN             = 1.001852916e+00;
-    constexpr double biquad_y0_factor = -0.9963044430;
-    constexpr double biquad_y1_factor = 1.9962976018;
-    biquad_2nd_order_df1_normalized(data, GAIN, biquad_y0_factor, biquad_y1_factor);
+    constexpr double cutoff = 20;
+    filter(designButterworth(FilterType::highPass, config.sampleRate, cutoff, 2));
+}
+
+void AudioSignal::filter(span<const BiquadCoefficients> sections)
+{
+    BiquadCascade cascade(sections, config.channels);
+    cascade.process(data);
 }
 
 /// Fade a signal in and out
-/// \param  data  signal to be faded
-/// \param  fadeInSamples  number of samples on which the fading in is done
-/// \param  fadeOutSamples  number of samples on which the fading out is done
-void AudioSignal::fadeInOut(size_t fadeInSamples, size_t fadeOutSamples)
+/// \param  fadeInFrames  number of frames on which the fading in is done
+/// \param  fadeOutFrames  number of frames on which the fading out is done
+void AudioSignal::fadeInOut(size_t fadeInFrames, size_t fadeOutFrames)
 {
     // *Exponential Fading* is used because it is more pleasant to ear than linear fading.
     //
@@ -94,22 +72,31 @@ void AudioSignal::fadeInOut(size_t fadeInSamples, size_t fadeOutSamples)
     //    r = (1 / fs) ** (1 / steps)
     //       where fs = factor at start
     //              r = ratio
+    //
+    // All channels of a frame are multiplied with the same factor.
+    const size_t channels = max<size_t>(config.channels, 1);
+    const size_t frames   = numberFrames();
+    fadeInFrames          = min(fadeInFrames, frames);
+    fadeOutFrames         = min(fadeOutFrames, frames);
 
     // apply all factors for the fade in
     double startValue  = 1.0 / INT16_MAX;
-    double fadeInRatio = pow(1.0 / startValue, 1.0 / fadeInSamples);
+    double fadeInRatio = pow(1.0 / startValue, 1.0 / fadeInFrames);
     double factor      = startValue;
-    for (size_t samIdx = 0; samIdx < fadeInSamples; ++samIdx) {
-        data[samIdx] *= factor;
+    for (size_t frame = 0; frame < fadeInFrames; ++frame) {
+        for (size_t channel = 0; channel < channels; ++channel) {
+            data[(frame * channels) + channel] *= factor;
+        }
         factor *= fadeInRatio;
     };
 
     // apply all factors for the fade out
-    double fadeOutRatio = 1.0 / pow(1.0 / startValue, 1.0 / fadeOutSamples);
-    size_t fadeOutIndex = max(static_cast<size_t>(0), data.size() - fadeOutSamples);
+    double fadeOutRatio = 1.0 / pow(1.0 / startValue, 1.0 / fadeOutFrames);
     factor              = fadeOutRatio;
-    for (size_t samIdx = fadeOutIndex; samIdx < data.size(); ++samIdx) {
-        data[samIdx] *= factor;
+    for (size_t frame = frames - fadeOutFrames; frame < frames; ++frame) {
+        for (size_t channel = 0; channel < channels; ++channel) {
+            data[(frame * channels) + channel] *= factor;
+        }
         factor *= fadeOutRatio;
     };
 }
@@ -119,14 +106,24 @@ const AudioDataType& AudioSignal::getAudioData() const
     return data;
 }
 
+const AudioSignalConfiguration& AudioSignal::getConfiguration() const
+{
+    return config;
+}
+
 size_t AudioSignal::numberSamples() const
 {
     return data.size();
 }
 
+size_t AudioSignal::numberFrames() const
+{
+    return config.channels == 0 ? 0 : data.size() / config.channels;
+}
+
 double AudioSignal::length() const
 {
-    return static_cast<double>(data.size()) / config.sampleRate;
+    return static_cast<double>(numberFrames()) / config.sampleRate;
 }
 
 void AudioSignal::resizeSamples(size_t numberSamples, SampleType value)
@@ -148,9 +145,7 @@ AudioSignal& AudioSignal::operator+=(const AudioSignal& summand)
     if (max_length > data.size()) {
         data.resize(max_length, static_cast<SampleType>(0));
     }
-    for (size_t index = 0; index < summand.data.size(); ++index) {
-        data[index] += summand.data[index];
-    }
+    mixAdd(data, summand.data);
     return *this;
 }
 
@@ -163,12 +158,20 @@ AudioSignal& AudioSignal::operator-=(const AudioSignal& summand)
     if (max_length > data.size()) {
         data.resize(max_length, static_cast<SampleType>(0));
     }
-    for (size_t index = 0; index < summand.data.size(); ++index) {
-        data[index] -= summand.data[index];
-    }
+    mixSubtract(data, summand.data);
     return *this;
 }
 
+void AudioSignal::applyGain(SampleType gain)
+{
+    mixApplyGain(data, gain);
+}
+
+void AudioSignal::clamp(SampleType low, SampleType high)
+{
+    mixClamp(data, low, high);
+}
+
 AudioSignal operator+(AudioSignal summand1, const AudioSignal& summand2)
 {
     if (!summand1.mixingPossibile(summand2)) {
@@ -188,39 +191,160 @@ AudioSignal operator-(AudioSignal minuend, const AudioSignal& subtrahend)
 }
 
 
+SharedAudioSignal::SharedAudioSignal(AudioSignal audioSignal)
+    : signal{std::make_shared<const AudioSignal>(std::move(audioSignal))}
+{
+}
+
+SharedAudioSignal::SharedAudioSignal(std::shared_ptr<const AudioSignal> sharedSignal) : signal{std::move(sharedSignal)}
+{
+}
+
+auto SharedAudioSignal::get() const -> const AudioSignal*
+{
+    return signal.get();
+}
+
+auto SharedAudioSignal::operator*() const -> const AudioSignal&
+{
+    return *signal;
+}
+
+auto SharedAudioSignal::operator->() const -> const AudioSignal*
+{
+    return signal.get();
+}
+
+SharedAudioSignal::operator bool() const
+{
+    return static_cast<bool>(signal);
+}
+
+auto SharedAudioSignal::useCount() const -> long
+{
+    return signal.use_count();
+}
+
+
+/// Samples that are computed in parallel by the phasors of one partial
+constexpr size_t PHASOR_LANES = 8;
+
+/// Number of samples after which the phasors are set to their exact phase again
+constexpr size_t PHASOR_RESYNC_INTERVAL = 32 * PHASOR_LANES;
+
+/// Add a sine wave to a signal
+///
+/// Each lane holds a phasor that is rotated by PHASOR_LANES samples per step. The lanes are independent of each
+/// other, so that the inner loop can be vectorized.
+static void addPartial(span<double> signal, double frequency, double sampleRate, double amplitude)
+{
+    const double omega   = 2 * numbers::pi * frequency / sampleRate;
+    const double stepCos = cos(omega * PHASOR_LANES);
+    const double stepSin = sin(omega * PHASOR_LANES);
+
+    array<double, PHASOR_LANES> real{};
+    array<double, PHASOR_LANES> imag{};
+    for (size_t start = 0; start < signal.size(); start += PHASOR_RESYNC_INTERVAL) {
+        // starting each interval at the exact phase keeps the rounding errors of the rotations from adding up
+        for (size_t lane = 0; lane < PHASOR_LANES; ++lane) {
+            const double phase = omega * static_cast<double>(start + lane);
+            real[lane]         = cos(phase);
+            imag[lane]         = sin(phase);
+        }
+
+        const size_t end    = min(start + PHASOR_RESYNC_INTERVAL, signal.size());
+        size_t       samIdx = start;
+        for (; samIdx + PHASOR_LANES <= end; samIdx += PHASOR_LANES) {
+            for (size_t lane = 0; lane < PHASOR_LANES; ++lane) {
+                signal[samIdx + lane] += amplitude * imag[lane];
+                const double nextReal = (real[lane] * stepCos) - (imag[lane] * stepSin);
+                imag[lane]            = (real[lane] * stepSin) + (imag[lane] * stepCos);
+                real[lane]            = nextReal;
+            }
+        }
+        for (size_t lane = 0; samIdx < end; ++samIdx, ++lane) {
+            signal[samIdx] += amplitude * imag[lane];
+        }
+    }
+}
+
+PartialAmplitudes defaultPartialAmplitudes(std::uint8_t overtones)
+{
+    constexpr double gainFactor         = 0.5;
+    constexpr double harmonicGainFactor = 0.5;
+
+    PartialAmplitudes amplitudes{gainFactor};
+    double            gain = harmonicGainFactor;
+    for (size_t harmonic = 0; harmonic < overtones; ++harmonic) {
+        gain *= harmonicGainFactor;
+        amplitudes.push_back(gainFactor * gain);
+    }
+    return amplitudes;
+}
+
 AudioSignal generateTone(const AudioSignalConfiguration& audioConfig, const ToneConfiguration& toneConfig)
 {
-    const auto sampleRate   = audioConfig.sampleRate;
-    const auto lengthS      = toneConfig.length;
-    const auto freq         = toneConfig.frequency;
-    const auto addHarmonics = toneConfig.overtones;
-    const auto samples      = static_cast<size_t>(floor(sampleRate * lengthS));
-    const auto gainFactor   = 0.5;
-
-    AudioDataType data;
-    data.reserve(samples);
-
-    for (size_t samIdx = 0; samIdx < samples; samIdx++) {
-        double sample = sin(samIdx * 2 * numbers::pi * freq / sampleRate);
-
-        // add harmonics
-        const double harmonicGainFactor = gainFactor;
-        double       gain               = harmonicGainFactor;
-        for (size_t harmonic = 0; harmonic < addHarmonics; ++harmonic) {
-            gain *= harmonicGainFactor;
-            sample += gain * sin(samIdx * 2 * numbers::pi * (harmonic + 2) * freq / sampleRate);
+    return generateTone(audioConfig, toneConfig.length, toneConfig.frequency,
+                        defaultPartialAmplitudes(toneConfig.overtones));
+}
+
+AudioSignal generateTone(const AudioSignalConfiguration& audioConfig, double lengthS, double frequency,
+                         span<const double> amplitudes)
+{
+    const auto samples = static_cast<size_t>(floor(audioConfig.sampleRate * lengthS));
+
+    vector<double> tone(samples, 0.0);
+    for (size_t partial = 0; partial < amplitudes.size(); ++partial) {
+        if (amplitudes[partial] != 0) {
+            addPartial(tone, static_cast<double>(partial + 1) * frequency, audioConfig.sampleRate,
+                       amplitudes[partial]);
         }
-        for (size_t channelIdx = 0; channelIdx < audioConfig.channels; ++channelIdx) {
-            data.emplace_back(static_cast<SampleType>(gainFactor * sample));
+    }
+
+    const size_t  channels = audioConfig.channels;
+    AudioDataType data(samples * channels);
+    for (size_t samIdx = 0; samIdx < samples; ++samIdx) {
+        for (size_t channelIdx = 0; channelIdx < channels; ++channelIdx) {
+            data[(samIdx * channels) + channelIdx] = static_cast<SampleType>(tone[samIdx]);
         }
     }
     return AudioSignal(audioConfig, std::move(data));
 }
 
-double halfToneOffset(double baseFreq, size_t offset)
+AudioSignal resample(const AudioSignal& signal, double sampleRate)
 {
-    return baseFreq * pow(pow(2, 1.0 / halfStepsInOctave), offset);
-};
+    const auto& config = signal.getConfiguration();
+    if (config.sampleRate == sampleRate || config.channels == 0) {
+        return signal;
+    }
+
+    // frequencies above the new Nyquist frequency would fold back into the audible range
+    auto source = signal;
+    if (sampleRate < config.sampleRate) {
+        source.filter(designButterworth(FilterType::lowPass, config.sampleRate, MAX_RELATIVE_CUTOFF * sampleRate, 4));
+    }
+
+    const size_t channels     = config.channels;
+    const auto&  input        = source.getAudioData();
+    const size_t inputFrames  = input.size() / channels;
+    const double step         = config.sampleRate / sampleRate;  // input frames per output frame
+    const auto   outputFrames = static_cast<size_t>(llround(static_cast<double>(inputFrames) / step));
+
+    AudioDataType output(outputFrames * channels);
+    for (size_t frame = 0; frame < outputFrames; ++frame) {
+        const double position = static_cast<double>(frame) * step;
+        const auto   index    = min(static_cast<size_t>(position), inputFrames - 1);
+        const size_t next     = min(index + 1, inputFrames - 1);
+        const auto   fraction = static_cast<SampleType>(position - static_cast<double>(index));
+        for (size_t channel = 0; channel < channels; ++channel) {
+            const SampleType current = input[(index * channels) + channel];
+            output[(frame * channels) + channel] =
+                current + (fraction * (input[(next * channels) + channel] - current));
+        }
+    }
+    return AudioSignal(AudioSignalConfiguration{.sampleRate = sampleRate, .channels = config.channels},
+                       std::move(output));
+}
 
 TEST_CASE("AudioSignalTest")
 {
@@ -254,6 +378,133 @@ TEST_CASE("AudioSignalTest")
     for (size_t idx = 0; idx < op_plus.getAudioData().size(); ++idx) {
         CHECK_EQ(op_plus.getAudioData()[idx], 0);
     }
+
+    AudioSignal scaled = sine440hz1;
+    scaled.applyGain(4);
+    scaled.clamp(-1, 1);
+    for (size_t idx = 0; idx < scaled.getAudioData().size(); ++idx) {
+        CHECK_EQ(scaled.getAudioData()[idx], std::clamp(4 * sine440hz1.getAudioData()[idx], -1.0F, 1.0F));
+    }
+}
+
+TEST_CASE("AudioSignalTest - fading interleaved channels")
+{
+    const auto  audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 2};
+    AudioSignal signal(audioConfig, AudioDataType(200, 1.0F));
+    CHECK_EQ(signal.numberFrames(), 100);
+    CHECK_EQ(signal.length(), 0.1);
+
+    signal.fadeInOut(10, 20);
+    const auto& data = signal.getAudioData();
+    for (size_t frame = 0; frame < signal.numberFrames(); ++frame) {
+        CHECK_EQ(data[2 * frame], data[(2 * frame) + 1]);
+    }
+    CHECK_LT(data[0], 0.001F);
+    CHECK_LT(data[18], data[20]);  // frame 9 is still faded in, frame 10 is not
+    CHECK_EQ(data[20], 1.0F);
+    CHECK_EQ(data[2 * 79], 1.0F);
+    CHECK_LT(data[2 * 80], 1.0F);
+    CHECK_LT(data[199], 0.001F);
+}
+
+TEST_CASE("AudioSignalTest - shared signals are not copied")
+{
+    const auto    audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    AudioDataType data(100, 0.5F);
+    const auto*   samples = data.data();
+
+    // the samples are moved into the signal and from there into the shared signal
+    auto signal = AudioSignal(audioConfig, std::move(data));
+    CHECK_EQ(signal.getAudioData().data(), samples);
+    const SharedAudioSignal shared(std::move(signal));
+    CHECK_EQ(shared->getAudioData().data(), samples);
+
+    const auto copy = shared;
+    CHECK_EQ(copy.get(), shared.get());
+    CHECK_EQ((*copy).numberSamples(), 100);
+    CHECK_FALSE(SharedAudioSignal());
+}
+
+TEST_CASE("AudioSignalTest - resampling")
+{
+    const auto toneConfig = ToneConfiguration{.length = 0.1, .frequency = 1'000, .overtones = 0};
+    const auto original   = generateTone(AudioSignalConfiguration{.sampleRate = 48'000, .channels = 2}, toneConfig);
+
+    for (const double sampleRate : {44'100.0, 96'000.0}) {
+        CAPTURE(sampleRate);
+        const auto audioConfig = AudioSignalConfiguration{.sampleRate = sampleRate, .channels = 2};
+        const auto converted   = resample(original, sampleRate);
+        const auto expected    = generateTone(audioConfig, toneConfig);
+        CHECK_EQ(converted.getConfiguration().sampleRate, sampleRate);
+        CHECK_EQ(converted.getConfiguration().channels, 2);
+        REQUIRE_EQ(converted.numberSamples(), expected.numberSamples());
+
+        // the low pass delays the signal slightly, the first and last milliseconds are left out
+        const size_t margin = static_cast<size_t>(sampleRate / 1'000) * 2;
+        double       error  = 0;
+        for (size_t idx = margin; idx + margin < expected.numberSamples(); ++idx) {
+            error = max(error, static_cast<double>(abs(converted.getAudioData()[idx] - expected.getAudioData()[idx])));
+        }
+        CHECK_LT(error, sampleRate < 48'000 ? 0.05 : 0.005);
+    }
+
+    CHECK_EQ(resample(original, 48'000).getAudioData(), original.getAudioData());
+}
+
+TEST_CASE("AudioSignalTest - tone generation matches direct evaluation of sin")
+{
+    // the former implementation that evaluates sin() for every sample and partial
+    auto referenceTone = [](const AudioSignalConfiguration& audioConfig,
+                            const ToneConfiguration&        toneConfig) -> AudioDataType {
+        const auto    samples = static_cast<size_t>(floor(audioConfig.sampleRate * toneConfig.length));
+        AudioDataType data;
+        for (size_t samIdx = 0; samIdx < samples; samIdx++) {
+            const double phase  = static_cast<double>(samIdx) * 2 * numbers::pi * toneConfig.frequency;
+            double       sample = sin(phase / audioConfig.sampleRate);
+            double       gain   = 0.5;
+            for (size_t harmonic = 0; harmonic < toneConfig.overtones; ++harmonic) {
+                gain *= 0.5;
+                sample += gain * sin(phase * static_cast<double>(harmonic + 2) / audioConfig.sampleRate);
+            }
+            for (size_t channelIdx = 0; channelIdx < audioConfig.channels; ++channelIdx) {
+                data.emplace_back(static_cast<SampleType>(0.5 * sample));
+            }
+        }
+        return data;
+    };
+
+    const std::array toneConfigs{
+        std::pair{AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1},
+                  ToneConfiguration{.length = 0.05, .frequency = 493.88, .overtones = 1}},
+        std::pair{AudioSignalConfiguration{.sampleRate = 44'100, .channels = 2},
+                  ToneConfiguration{.length = 2.0, .frequency = 1000, .overtones = 8}},
+        std::pair{AudioSignalConfiguration{.sampleRate = 96'000, .channels = 1},
+                  ToneConfiguration{.length = 4.0, .frequency = 55, .overtones = 32}},
+    };
+
+    constexpr double maxError = 1e-6;
+    for (const auto& [audioConfig, toneConfig] : toneConfigs) {
+        const auto reference = referenceTone(audioConfig, toneConfig);
+        const auto tone      = generateTone(audioConfig, toneConfig);
+        REQUIRE_EQ(tone.getAudioData().size(), reference.size());
+
+        double error = 0;
+        for (size_t idx = 0; idx < reference.size(); ++idx) {
+            error = max(error, static_cast<double>(abs(tone.getAudioData()[idx] - reference[idx])));
+        }
+        CHECK_LT(error, maxError);
+    }
+}
+
+TEST_CASE("AudioSignalTest - equal temperament at compile time")
+{
+    static_assert(HALF_STEP_RATIOS[0] == 1.0);
+    static_assert(halfToneOffset(440, HALF_STEPS_IN_OCTAVE) == 880.0);
+    static_assert(halfToneOffset(440, 2 * HALF_STEPS_IN_OCTAVE) == 1760.0);
+    for (size_t offset = 0; offset < 4 * HALF_STEPS_IN_OCTAVE; ++offset) {
+        const double expected = 440 * pow(2, static_cast<double>(offset) / HALF_STEPS_IN_OCTAVE);
+        CHECK_EQ(halfToneOffset(440, offset), doctest::Approx(expected).epsilon(1e-15));
+    }
 }
 
 
@@ -1,5 +1,8 @@
+#include <array>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <span>
 #include <vector>
 
 #ifndef MNOME_AUDIOSIGNAL_HPP
@@ -10,6 +13,11 @@ namespace mnome {
 using SampleType    = float;
 using AudioDataType = std::vector<SampleType>;
 
+struct BiquadCoefficients;
+
+
+/// Sample rate that is used when there is no device to take it from
+constexpr double DEFAULT_SAMPLE_RATE = 48'000;  // [Hz]
 
 struct AudioSignalConfiguration
 {
@@ -40,19 +48,35 @@ public:
     // usual initialization
     explicit AudioSignal(const AudioSignalConfiguration& config, AudioDataType&& data);
 
+    /// Butterworth low pass of second order at 20 kHz or slightly below the Nyquist frequency for low sample rates
     void lowPass20KHz();
+    /// Butterworth high pass of second order at 20 Hz
     void highPass20Hz();
-    void fadeInOut(size_t fadeInSamples, size_t fadeOutSamples);
+    /// Apply cascaded second-order sections to all channels
+    void filter(std::span<const BiquadCoefficients> sections);
+    /// Fade all channels in and out exponentially
+    /// \param  fadeInFrames  number of frames at the start that are faded in
+    /// \param  fadeOutFrames  number of frames at the end that are faded out
+    void fadeInOut(size_t fadeInFrames, size_t fadeOutFrames);
 
     [[nodiscard]] auto getAudioData() const -> const AudioDataType&;
+    [[nodiscard]] auto getConfiguration() const -> const AudioSignalConfiguration&;
 
+    /// Number of samples of all channels
     [[nodiscard]] auto numberSamples() const -> size_t;
+    /// Number of samples per channel
+    [[nodiscard]] auto numberFrames() const -> size_t;
     [[nodiscard]] auto length() const -> double;
 
     void resizeSamples(size_t numberSamples, SampleType value = 0);
 
     [[nodiscard]] auto mixingPossibile(const AudioSignal& other) const -> bool;
 
+    /// Multiply all samples with a factor
+    void applyGain(SampleType gain);
+    /// Limit all samples to [low, high]
+    void clamp(SampleType low, SampleType high);
+
     auto operator+=(const AudioSignal& summand) -> AudioSignal&;
     auto operator-=(const AudioSignal& summand) -> AudioSignal&;
 };
@@ -61,11 +85,92 @@ auto operator+(AudioSignal summand1, const AudioSignal& summand) -> AudioSignal;
 auto operator-(AudioSignal minuend, const AudioSignal& subtrahend) -> AudioSignal;
 
 
+/// Audio signal that is shared instead of copied and cannot be changed anymore
+///
+/// Copies refer to the same samples. A signal is moved into it, so handing over a temporary does not copy the samples
+/// either.
+class SharedAudioSignal
+{
+private:
+    std::shared_ptr<const AudioSignal> signal;
+
+public:
+    SharedAudioSignal() = default;
+    SharedAudioSignal(AudioSignal audioSignal);
+    SharedAudioSignal(std::shared_ptr<const AudioSignal> sharedSignal);
+
+    /// Signal that is shared, nullptr when there is none
+    [[nodiscard]] auto get() const -> const AudioSignal*;
+
+    auto operator*() const -> const AudioSignal&;
+    auto operator->() const -> const AudioSignal*;
+    explicit operator bool() const;
+
+    /// Number of SharedAudioSignals that share the signal
+    [[nodiscard]] auto useCount() const -> long;
+};
+
+
+/// Amplitudes of the partials of a tone, index 0 is the fundamental and index n is the n-th overtone
+using PartialAmplitudes = std::vector<double>;
+
+/// Amplitudes of a tone generated from a ToneConfiguration, each overtone has half the amplitude of its predecessor
+auto defaultPartialAmplitudes(std::uint8_t overtones) -> PartialAmplitudes;
+
 /// Generate specific tone as an AudioSignal
 auto generateTone(const AudioSignalConfiguration& audioConfig, const ToneConfiguration& toneConfig) -> AudioSignal;
 
-/// Calculate frequency certain half steps away from a base frequency
-auto halfToneOffset(double baseFreq, size_t offset) -> double;
+/// Generate a tone with an arbitrary number of partials
+///
+/// The partials are computed by rotating phasors that are set to their exact phase every few hundred samples.
+/// The result differs by less than 1e-6 from evaluating sin() for every sample.
+/// \param  lengthS  length of the tone [s]
+/// \param  frequency  frequency of the fundamental [Hz]
+/// \param  amplitudes  amplitude of each partial
+auto generateTone(const AudioSignalConfiguration& audioConfig, double lengthS, double frequency,
+                  std::span<const double> amplitudes) -> AudioSignal;
+
+/// Convert a signal to another sample rate
+///
+/// Meant for short sounds that are converted once, not for streaming. The samples are interpolated linearly, when the
+/// rate is lowered the signal is low-pass filtered below the new Nyquist frequency first.
+/// \return  copy of \p signal when it already has \p sampleRate
+auto resample(const AudioSignal& signal, double sampleRate) -> AudioSignal;
+
+/// Number of half steps of an octave
+constexpr size_t HALF_STEPS_IN_OCTAVE = 12;
+
+/// Frequency ratios of the half steps of an octave in equal temperament, 2^(n / 12)
+///
+/// Computed at compile time by Newton's method for x^12 = 2^n, which converges from above when it starts at 1 + n / 12.
+constexpr auto HALF_STEP_RATIOS = []() -> std::array<double, HALF_STEPS_IN_OCTAVE> {
+    std::array<double, HALF_STEPS_IN_OCTAVE> ratios{};
+    for (size_t step = 0; step < HALF_STEPS_IN_OCTAVE; ++step) {
+        const auto power = static_cast<double>(std::uint64_t{1} << step);
+        double     ratio = 1 + (static_cast<double>(step) / HALF_STEPS_IN_OCTAVE);
+        while (true) {
+            double ratio11 = 1;
+            for (size_t factor = 0; factor < HALF_STEPS_IN_OCTAVE - 1; ++factor) {
+                ratio11 *= ratio;
+            }
+            const double next = ratio - (((ratio11 * ratio) - power) / (HALF_STEPS_IN_OCTAVE * ratio11));
+            if (next >= ratio) {
+                break;
+            }
+            ratio = next;
+        }
+        ratios[step] = ratio;
+    }
+    return ratios;
+}();
+
+/// Calculate frequency certain half steps away from a base frequency, evaluated at compile time for constants
+/// \param  offset  half steps above \p baseFreq, less than 64 octaves
+constexpr auto halfToneOffset(double baseFreq, size_t offset) -> double
+{
+    const auto octaves = static_cast<double>(std::uint64_t{1} << (offset / HALF_STEPS_IN_OCTAVE));
+    return baseFreq * HALF_STEP_RATIOS[offset % HALF_STEPS_IN_OCTAVE] * octaves;
+}
 
 };  // namespace mnome
 
@@ -0,0 +1,269 @@
+/// AudioSink
+///
+/// Output devices that pull blocks of samples from the BeatPlayer
+
+#include "AudioSink.hpp"
+
+#include <doctest.h>
+#include <miniaudio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <print>
+#include <span>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+auto DeviceBufferInfo::bufferSizeInFrames() const -> uint32_t
+{
+    return periodSizeInFrames * periods;
+}
+
+
+auto DeviceBufferInfo::outputLatency() const -> chrono::duration<double, milli>
+{
+    if (sampleRate == 0) {
+        return chrono::duration<double, milli>(0);
+    }
+    return chrono::duration<double>(static_cast<double>(bufferSizeInFrames()) / sampleRate);
+}
+
+
+MiniaudioSink::MiniaudioSink(MiniaudioBackend deviceBackend) : backend{deviceBackend}
+{
+}
+
+MiniaudioSink::~MiniaudioSink()
+{
+    close();
+}
+
+auto MiniaudioSink::open(const AudioSignalConfiguration& audioConfig, const DeviceBufferConfiguration& bufferConfig,
+                         RenderCallback callback, void* userData) -> optional<DeviceBufferInfo>
+{
+    close();
+    renderCallback = callback;
+    callbackData   = userData;
+
+    const ma_backend nullBackend = ma_backend_null;
+    ma_result        result      = (backend == MiniaudioBackend::null)
+                                       ? ma_context_init(&nullBackend, 1, nullptr, &context)
+                                       : ma_context_init(nullptr, 0, nullptr, &context);
+    if (result != MA_SUCCESS) {
+        std::println("Error: mini audio context failed to initialize");
+        return nullopt;
+    }
+
+    ma_device_config deviceConfig  = ma_device_config_init(ma_device_type_playback);
+    deviceConfig.playback.format   = ma_format_f32;
+    deviceConfig.playback.channels = audioConfig.channels;
+    deviceConfig.sampleRate        = static_cast<ma_uint32>(audioConfig.sampleRate);
+    deviceConfig.dataCallback      = dataCallback;
+    deviceConfig.pUserData         = this;
+
+    // fall back to larger periods when the backend rejects small ones
+    uint32_t periodSizeMs = max(bufferConfig.periodSizeInMilliseconds, 1U);
+    uint32_t periods      = max(bufferConfig.periods, 1U);
+    while (true) {
+        deviceConfig.periodSizeInMilliseconds = periodSizeMs;
+        deviceConfig.periods                  = periods;
+        result                                = ma_device_init(&context, &deviceConfig, &device);
+        if (result == MA_SUCCESS || (periodSizeMs >= DEFAULT_PERIOD_SIZE_MS && periods >= DEFAULT_PERIODS)) {
+            break;
+        }
+        periodSizeMs = max(min(periodSizeMs * 2, DEFAULT_PERIOD_SIZE_MS), periodSizeMs);
+        periods      = max(periods, DEFAULT_PERIODS);
+        std::println("Device buffer rejected by the backend, trying {} periods of {} ms", periods, periodSizeMs);
+    }
+    if (result != MA_SUCCESS) {
+        cout << "Device initialization failed, aborting\n";
+        ma_context_uninit(&context);
+        return nullopt;
+    }
+    deviceOpen = true;
+    return DeviceBufferInfo{
+        .periodSizeInFrames = device.playback.internalPeriodSizeInFrames,
+        .periods            = device.playback.internalPeriods,
+        .sampleRate         = device.sampleRate,
+        .channels           = static_cast<uint8_t>(device.playback.channels),
+    };
+}
+
+auto MiniaudioSink::start() -> bool
+{
+    if (!deviceOpen) {
+        return false;
+    }
+    if (ma_device_start(&device) != MA_SUCCESS) {
+        cout << "Device could not be started, aborting\n";
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MiniaudioSink::close()
+{
+    if (deviceOpen) {
+        ma_device_uninit(&device);
+        ma_context_uninit(&context);
+        deviceOpen = false;
+    }
+}
+
+void MiniaudioSink::dataCallback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+{
+    const auto* sink = static_cast<MiniaudioSink*>(pDevice->pUserData);
+    sink->renderCallback(sink->callbackData, static_cast<SampleType*>(pOutput), frameCount);
+    (void)pInput;
+}
+
+
+VirtualSink::VirtualSink(double deviceSampleRate, uint8_t deviceChannels)
+    : nativeSampleRate{deviceSampleRate}, nativeChannels{deviceChannels}
+{
+}
+
+auto VirtualSink::open(const AudioSignalConfiguration& audioConfig, const DeviceBufferConfiguration& bufferConfig,
+                       RenderCallback callback, void* userData) -> optional<DeviceBufferInfo>
+{
+    close();
+    const bool   nativeRate = audioConfig.sampleRate == NATIVE_SAMPLE_RATE;
+    const double sampleRate = nativeRate ? nativeSampleRate : audioConfig.sampleRate;
+    const auto   periodFrames =
+        static_cast<uint32_t>(lround(sampleRate * max(bufferConfig.periodSizeInMilliseconds, 1U) / 1000.0));
+    bufferInfo = DeviceBufferInfo{
+        .periodSizeInFrames = max(periodFrames, 1U),
+        .periods            = max(bufferConfig.periods, 1U),
+        .sampleRate         = static_cast<uint32_t>(sampleRate),
+        .channels           = (audioConfig.channels == NATIVE_CHANNELS) ? nativeChannels : audioConfig.channels,
+    };
+    renderCallback = callback;
+    callbackData   = userData;
+    channels       = bufferInfo.channels;
+    framesPulled   = 0;
+    block.assign(static_cast<size_t>(bufferInfo.periodSizeInFrames) * channels, 0);
+    return bufferInfo;
+}
+
+auto VirtualSink::start() -> bool
+{
+    running = renderCallback != nullptr;
+    return running;
+}
+
+void VirtualSink::close()
+{
+    running        = false;
+    renderCallback = nullptr;
+    callbackData   = nullptr;
+}
+
+auto VirtualSink::pull(uint64_t frames, const function<void(span<const SampleType>)>& consume) -> uint64_t
+{
+    if (!running) {
+        return 0;
+    }
+    uint64_t rendered = 0;
+    while (rendered < frames) {
+        renderCallback(callbackData, block.data(), bufferInfo.periodSizeInFrames);
+        if (consume) {
+            consume(block);
+        }
+        rendered += bufferInfo.periodSizeInFrames;
+    }
+    framesPulled += rendered;
+    return rendered;
+}
+
+auto VirtualSink::skip(uint64_t frames) -> uint64_t
+{
+    if (!running) {
+        return 0;
+    }
+    uint64_t skipped = 0;
+    while (skipped < frames) {
+        renderCallback(callbackData, nullptr, bufferInfo.periodSizeInFrames);
+        skipped += bufferInfo.periodSizeInFrames;
+    }
+    framesPulled += skipped;
+    return skipped;
+}
+
+auto VirtualSink::renderedFrames() const -> uint64_t
+{
+    return framesPulled;
+}
+
+auto VirtualSink::simulatedTime() const -> chrono::duration<double>
+{
+    return chrono::duration<double>(
+        bufferInfo.sampleRate == 0 ? 0 : static_cast<double>(framesPulled) / bufferInfo.sampleRate);
+}
+
+
+TEST_CASE("AudioSinkTest - virtual sink pulls whole periods")
+{
+    struct Counter
+    {
+        uint64_t frames{0};
+        uint32_t calls{0};
+    } counter;
+    auto callback = [](void* userData, SampleType* output, uint32_t frameCount) -> void {
+        auto* count = static_cast<Counter*>(userData);
+        if (output != nullptr) {
+            fill_n(output, frameCount * 2, 0.25F);
+        }
+        count->frames += frameCount;
+        ++count->calls;
+    };
+
+    VirtualSink sink;
+    const auto  info = sink.open(AudioSignalConfiguration{.sampleRate = 48'000, .channels = 2},
+                                 DeviceBufferConfiguration{.periodSizeInMilliseconds = 5, .periods = 3}, callback,
+                                 &counter);
+    REQUIRE(info.has_value());
+    CHECK_EQ(info->sampleRate, 48'000);
+    CHECK_EQ(info->channels, 2);
+    CHECK_EQ(info->periodSizeInFrames, 240);
+    CHECK_EQ(info->bufferSizeInFrames(), 720);
+    CHECK_EQ(sink.pull(1000), 0);  // not started yet
+
+    REQUIRE(sink.start());
+    size_t samples = 0;
+    CHECK_EQ(sink.pull(1000, [&](span<const SampleType> block) -> void { samples += block.size(); }), 1200);
+    CHECK_EQ(counter.calls, 5);
+    CHECK_EQ(counter.frames, 1200);
+    CHECK_EQ(samples, 2400);
+    CHECK_EQ(sink.renderedFrames(), 1200);
+    CHECK_EQ(sink.simulatedTime().count(), doctest::Approx(0.025));
+
+    // blocks without an output buffer pass on the clock as well
+    CHECK_EQ(sink.skip(480), 480);
+    CHECK_EQ(counter.calls, 7);
+    CHECK_EQ(sink.renderedFrames(), 1680);
+
+    sink.close();
+    CHECK_EQ(sink.pull(1000), 0);
+
+    VirtualSink nativeSink(44'100, 2);
+    const auto  nativeInfo =
+        nativeSink.open(AudioSignalConfiguration{.sampleRate = NATIVE_SAMPLE_RATE, .channels = NATIVE_CHANNELS},
+                        DeviceBufferConfiguration{}, callback, &counter);
+    REQUIRE(nativeInfo.has_value());
+    CHECK_EQ(nativeInfo->sampleRate, 44'100);
+    CHECK_EQ(nativeInfo->channels, 2);
+    CHECK_EQ(nativeInfo->periodSizeInFrames, 4'410);
+}
+
+}  // namespace mnome
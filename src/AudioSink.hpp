@@ -0,0 +1,171 @@
+/// AudioSink
+///
+/// Output devices that pull blocks of samples from the BeatPlayer
+
+#ifndef MNOME_AUDIOSINK_H
+#define MNOME_AUDIOSINK_H
+
+#include "AudioSignal.hpp"
+
+#include <miniaudio.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+#include <vector>
+
+
+namespace mnome {
+
+constexpr std::uint32_t DEFAULT_PERIOD_SIZE_MS     = 100;  // [ms]
+constexpr std::uint32_t DEFAULT_PERIODS            = 2;
+constexpr std::uint32_t LOW_LATENCY_PERIOD_SIZE_MS = 5;  // [ms]
+
+/// Sample rate that requests the rate the device runs at, so that nothing has to be resampled
+constexpr double NATIVE_SAMPLE_RATE = 0;
+
+/// Number of channels that requests the channels of the device
+constexpr std::uint8_t NATIVE_CHANNELS = 0;
+
+/// Requested buffering of the audio device
+struct DeviceBufferConfiguration
+{
+    std::uint32_t periodSizeInMilliseconds{DEFAULT_PERIOD_SIZE_MS};
+    std::uint32_t periods{DEFAULT_PERIODS};
+};
+
+/// Buffering that has been negotiated with the audio device
+struct DeviceBufferInfo
+{
+    std::uint32_t periodSizeInFrames{0};
+    std::uint32_t periods{0};
+    std::uint32_t sampleRate{0};  //< rate of the samples that the render callback renders
+    std::uint8_t  channels{0};    //< number of interleaved channels that the render callback renders
+
+    /// Number of frames that are buffered by the device
+    [[nodiscard]] auto bufferSizeInFrames() const -> std::uint32_t;
+
+    /// Time it takes until a rendered frame is played back by the device
+    [[nodiscard]] auto outputLatency() const -> std::chrono::duration<double, std::milli>;
+};
+
+/// Fills a block of interleaved samples, \p output is nullptr when the device did not pass a buffer
+using RenderCallback = void (*)(void* userData, SampleType* output, std::uint32_t frameCount);
+
+/// Device that calls a render callback whenever it needs samples
+class AudioSink
+{
+public:
+    AudioSink()          = default;
+    virtual ~AudioSink() = default;
+
+    AudioSink(const AudioSink&)                    = delete;
+    AudioSink(AudioSink&&)                         = delete;
+    auto operator=(const AudioSink&) -> AudioSink& = delete;
+    auto operator=(AudioSink&&) -> AudioSink&      = delete;
+
+    /// Open the device, \p callback is not called before start()
+    /// \param  audioConfig  format of the rendered samples, NATIVE_SAMPLE_RATE and NATIVE_CHANNELS select the format
+    ///                      of the device
+    /// \return  negotiated buffering and sample rate, nothing when the device could not be opened
+    virtual auto open(const AudioSignalConfiguration& audioConfig, const DeviceBufferConfiguration& bufferConfig,
+                      RenderCallback callback, void* userData) -> std::optional<DeviceBufferInfo> = 0;
+
+    /// Start calling the render callback of the open device
+    /// \return  false when the device could not be started, it is closed then
+    virtual auto start() -> bool = 0;
+
+    /// Stop calling the render callback and close the device
+    virtual void close() = 0;
+};
+
+/// Backends of the miniaudio sink
+enum class MiniaudioBackend
+{
+    system,  //< default device of the system
+    null,    //< miniaudio's null device, runs in real time without any sound
+};
+
+/// Audio device of the system, opened with miniaudio
+class MiniaudioSink : public AudioSink
+{
+private:
+    MiniaudioBackend backend;
+    RenderCallback   renderCallback{nullptr};
+    void*            callbackData{nullptr};
+    bool             deviceOpen{false};
+    ma_context       context{};
+    ma_device        device{};
+
+public:
+    explicit MiniaudioSink(MiniaudioBackend deviceBackend = MiniaudioBackend::system);
+    ~MiniaudioSink() override;
+
+    MiniaudioSink(const MiniaudioSink&)                    = delete;
+    MiniaudioSink(MiniaudioSink&&)                         = delete;
+    auto operator=(const MiniaudioSink&) -> MiniaudioSink& = delete;
+    auto operator=(MiniaudioSink&&) -> MiniaudioSink&      = delete;
+
+    /// \note  Period sizes that the backend rejects are enlarged up to DEFAULT_PERIOD_SIZE_MS. miniaudio converts the
+    ///        samples when a rate other than NATIVE_SAMPLE_RATE is requested that the device does not run at.
+    auto open(const AudioSignalConfiguration& audioConfig, const DeviceBufferConfiguration& bufferConfig,
+              RenderCallback callback, void* userData) -> std::optional<DeviceBufferInfo> override;
+    auto start() -> bool override;
+    void close() override;
+
+private:
+    /// Called by miniaudio whenever it needs new samples
+    static void dataCallback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount);
+};
+
+/// Device that only pulls blocks when it is told to, on a simulated clock
+///
+/// Nothing runs in the background: pull() calls the render callback on the calling thread, one period per call.
+/// Thousands of seconds of playback can be simulated in a fraction of the time and every frame can be inspected.
+class VirtualSink : public AudioSink
+{
+private:
+    double                  nativeSampleRate;
+    std::uint8_t            nativeChannels;
+    RenderCallback          renderCallback{nullptr};
+    void*                   callbackData{nullptr};
+    DeviceBufferInfo        bufferInfo;
+    std::uint8_t            channels{0};
+    std::uint64_t           framesPulled{0};
+    std::vector<SampleType> block;
+    bool                    running{false};
+
+public:
+    /// Ctor
+    /// \param  deviceSampleRate  rate that is used when NATIVE_SAMPLE_RATE is requested
+    /// \param  deviceChannels  channels that are used when NATIVE_CHANNELS is requested
+    explicit VirtualSink(double deviceSampleRate = DEFAULT_SAMPLE_RATE, std::uint8_t deviceChannels = 1);
+
+    auto open(const AudioSignalConfiguration& audioConfig, const DeviceBufferConfiguration& bufferConfig,
+              RenderCallback callback, void* userData) -> std::optional<DeviceBufferInfo> override;
+    auto start() -> bool override;
+    void close() override;
+
+    /// Pull blocks of one period until at least \p frames frames have been rendered
+    /// \param  consume  called with every rendered block of interleaved samples
+    /// \return  number of rendered frames, 0 when the device has not been started
+    auto pull(std::uint64_t frames, const std::function<void(std::span<const SampleType>)>& consume = {})
+        -> std::uint64_t;
+
+    /// Pull blocks of one period without an output buffer until at least \p frames frames have passed, like a
+    /// backend that drops the samples
+    /// \return  number of passed frames, 0 when the device has not been started
+    auto skip(std::uint64_t frames) -> std::uint64_t;
+
+    /// Number of frames that have been rendered since the device was opened, the simulated clock
+    [[nodiscard]] auto renderedFrames() const -> std::uint64_t;
+
+    /// Time that the rendered frames take to play back
+    [[nodiscard]] auto simulatedTime() const -> std::chrono::duration<double>;
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_AUDIOSINK_H
@@ -3,83 +3,168 @@
 /// Plays a beat
 
 #include "BeatPlayer.hpp"
-#include <miniaudio.h>
+#include "AudioSink.hpp"
+#include "Trace.hpp"
+
+#include <doctest.h>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
-#include <bits/chrono.h>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <numbers>
+#include <optional>
 #include <print>
-#include <sstream>
-#include <string_view>
+#include <thread>
+#include <span>
+#include <stdexcept>
 #include <vector>
 
 
 using namespace std;
 
 
-constexpr double FADE_MIN_PERCENTAGE     = 0.30;
-constexpr double FADE_MIN_TIME           = 0.025;   // [s]
-constexpr size_t PLAYBACK_MIN_ALSA_WRITE = 100;     // [ms]
-constexpr size_t PLAYBACK_RATE           = 48'000;  // [Hz]
+constexpr double FADE_MIN_PERCENTAGE = 0.30;
+constexpr double FADE_MIN_TIME       = 0.025;  // [s]
 
 
 namespace mnome {
 
 
-/// Return the time it takes to playback a number of samples
-/// \param[in]  samples  number of samples
-auto getDuration(size_t samples) -> double
+/// Current time of the steady clock in nanoseconds
+static auto steadyClockNanoseconds() -> int64_t
 {
-    return static_cast<double>(samples) / PLAYBACK_RATE;
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
 }
 
 
-/// Return the time it takes to playback a number of samples
-/// \param[in]  time  time in seconds
-/// \return     samples  number of samples that resemble \p time samples
-auto getNumbersOfSamples(double time) -> size_t
+BeatPlayer::BeatPlayer(const DeviceBufferConfiguration& deviceBuffer, std::unique_ptr<AudioSink> audioSink,
+                       uint8_t channels)
+    : scheduler(AudioSignalConfiguration{.sampleRate = DEFAULT_SAMPLE_RATE, .channels = 1}),
+      outputConfig{.sampleRate = DEFAULT_SAMPLE_RATE, .channels = 1}, requestedChannels{channels},
+      bufferConfig{deviceBuffer}, sink{std::move(audioSink)}
 {
-    return static_cast<size_t>(round(time * PLAYBACK_RATE));
+    if (!sink) {
+        sink = std::make_unique<MiniaudioSink>();
+    }
+    // opening the device takes long, do it before the first start
+    openDevice();
 }
 
 
-auto generateTone(ToneConfiguration tone) -> vector<int16_t>
+BeatPlayer::~BeatPlayer()
 {
-    auto samples = static_cast<size_t>(floor(PLAYBACK_RATE * tone.length));
+    stop();
+    closeDevice();
+}
 
-    vector<int16_t> data;
-    data.reserve(samples);
 
-    for (size_t samIdx = 0; samIdx < samples; samIdx++) {
-        double sample = sin(static_cast<double>(samIdx * 2) * numbers::pi * tone.frequency / PLAYBACK_RATE);
+auto prepareBeatSound(AudioSignal sound) -> AudioSignal
+{
+    // Fade the beats in and out to avoid click/pop noises because of too sudden amplitude changes
+    const double lengthS      = sound.length();
+    const double rampingTime  = min(lengthS * FADE_MIN_PERCENTAGE, FADE_MIN_TIME);
+    const auto   rampingSteps = static_cast<size_t>(round(rampingTime * sound.getConfiguration().sampleRate));
+    sound.fadeInOut(rampingSteps, rampingSteps);
+    return sound;
+}
 
-        // add harmonics
-        constexpr double harmonicGain = 0.5;
-        constexpr double initialGain  = 0.5;
-        constexpr double volume       = 0.5;
-        double           gain         = initialGain;
-        for (size_t harmonic = 0; harmonic < tone.overtones; ++harmonic) {
-            gain *= harmonicGain;
-            sample += gain * sin(static_cast<double>(samIdx * 2 * (harmonic + 2)) * numbers::pi * tone.frequency /
-                                 PLAYBACK_RATE);
-        }
-        data.emplace_back(static_cast<int16_t>(INT16_MAX * volume * sample));
+auto prepareBeatSounds(const SharedAudioSignal& beat, const SharedAudioSignal& accentuatedBeat) -> BeatSounds
+{
+    const auto& accent = (accentuatedBeat && accentuatedBeat->numberSamples() != 0) ? accentuatedBeat : beat;
+    return BeatSounds{.accent = prepareBeatSound(*accent), .beat = prepareBeatSound(*beat)};
+}
+
+
+auto PreparedSoundCache::prepare(const SharedAudioSignal& source, double sampleRate) -> SharedAudioSignal
+{
+    const auto cached = ranges::find_if(entries, [&](const Entry& entry) -> bool {
+        return entry.source.get() == source.get() && entry.sampleRate == sampleRate;
+    });
+    if (cached != entries.end()) {
+        return cached->prepared;
     }
-    return data;
+    erase_if(entries, [](const Entry& entry) -> bool { return entry.source.useCount() == 1; });
+    // resample() copies the sound when it has the rate already, the source is never changed
+    auto prepared = SharedAudioSignal(prepareBeatSound(resample(*source, sampleRate)));
+    entries.push_back(Entry{.source = source, .sampleRate = sampleRate, .prepared = prepared});
+    return prepared;
 }
 
+auto PreparedSoundCache::size() const -> size_t
+{
+    return entries.size();
+}
 
-BeatPlayer::~BeatPlayer()
+
+auto BeatPlayer::prepareForDevice(const SharedAudioSignal& beatSound, const SharedAudioSignal& accentSound)
+    -> BeatSounds
 {
-    stop();
+    // sounds that were not generated at the rate of the device are converted once here instead of in every callback
+    // the mono sounds are spread over the output channels by the scheduler, no copies per channel are needed
+    const double sampleRate = outputConfig.sampleRate;
+    const auto&  accent     = (accentSound->numberSamples() == 0) ? beatSound : accentSound;
+    return BeatSounds{.accent = preparedVariants.prepare(accent, sampleRate),
+                      .beat   = preparedVariants.prepare(beatSound, sampleRate)};
+}
+
+
+void BeatPlayer::prepareSounds()
+{
+    MNOME_TRACE_SPAN("BeatPlayer::prepareSounds");
+    if (!beat || !accentuatedBeat) {
+        return;
+    }
+    auto sounds        = prepareForDevice(beat, accentuatedBeat);
+    sounds.accentGains = accentGains;
+    sounds.beatGains   = beatGains;
+    retire(std::move(preparedSounds));
+    preparedSounds = std::make_shared<const BeatSounds>(std::move(sounds));
+    if (isRunning()) {
+        submitCommand(PlayerCommand{.change = SchedulerChange{.sounds = preparedSounds.get()}});
+    }
+}
+
+
+auto BeatPlayer::prepareLayerSounds(const LayerSounds& sounds) -> std::shared_ptr<const BeatSounds>
+{
+    return std::make_shared<const BeatSounds>(prepareForDevice(sounds.beat, sounds.accent));
+}
+
+
+void BeatPlayer::prepareLayers()
+{
+    auto layers = *beatLayers;
+    for (size_t layer = 0; layer < layers.size(); ++layer) {
+        layers[layer].sounds = prepareLayerSounds(layerSounds[layer]);
+    }
+    publishLayers(std::move(layers));
+}
+
+
+void BeatPlayer::publishLayers(BeatLayers layers)
+{
+    retire(std::move(beatLayers));
+    beatLayers = std::make_shared<const BeatLayers>(std::move(layers));
+    if (isRunning()) {
+        submitCommand(PlayerCommand{.change = SchedulerChange{.layers = beatLayers.get()}});
+    }
+}
+
+
+void BeatPlayer::printPlaybackState() const
+{
+    if (tempoProgram) {
+        cout << std::format("Playing {} with the tempo program {}\n", beatPattern->toString(), toString(*tempoProgram));
+        return;
+    }
+    cout << std::format("Playing {} at {} bpm\n", beatPattern->toString(), beatRate);
 }
 
 
@@ -90,191 +175,471 @@ void BeatPlayer::start()
         cout << "Error: BeatPlayer is already running, but was started again\n";
         return;
     }
-    if (!beat || !accentuatedBeat) {
+    if (!preparedSounds) {
         cout << "Error: No beat audio signal has been set\n";
+        return;
     }
-    auto localBeat            = AudioSignal(*beat);
-    auto localAccentuatedBeat = AudioSignal(*accentuatedBeat);
-    playBackBuffer.clear();
-
-    const double beatIntervalLength  = static_cast<double>(beatRate) / 60.0;
-    const auto   beatIntervalSamples = static_cast<size_t>(floor(1.0 / beatIntervalLength * PLAYBACK_RATE));
-    auto pause = AudioSignal(AudioSignalConfiguration{.sampleRate = PLAYBACK_RATE, .channels = 1}, beatIntervalLength);
-
-    const auto& pattern = beatPattern.getBeatPattern();
-
-    if (0 == localBeat.numberSamples()) {
+    if (0 == beat->numberSamples()) {
         cout << "Warning: the beat is silence, you will not hear anything.\n";
     }
-    if (pattern.empty()) {
+    if (beatPattern->getCompiledPattern().beats == 0) {
         cout << "Not playing, beat pattern is empty\n";
         return;
     }
-    const double lengthS = localBeat.length();
 
-    // Fade the beat in and out to avoid click/pop noises because of too sudden amplitude changes
-    const auto rampingSteps = (lengthS * FADE_MIN_PERCENTAGE < FADE_MIN_TIME)
-                                  ? getNumbersOfSamples(lengthS * FADE_MIN_PERCENTAGE)
-                                  : getNumbersOfSamples(FADE_MIN_TIME);
+    if (!deviceOpen && !openDevice()) {
+        return;
+    }
+
+    // the output starts with the first frame of the next block that the device requests
+    firstFrameTime.store(0, memory_order_release);
+    startRequestTime.store(steadyClockNanoseconds(), memory_order_release);
+    running = true;
+    submitCommand(PlayerCommand{
+        .type   = PlayerCommand::Type::start,
+        .change = SchedulerChange{.bpm     = tempoProgram ? 0 : beatRate,
+                                  .tempo   = tempoProgram.get(),
+                                  .pattern = &beatPattern->getCompiledPattern(),
+                                  .sounds  = preparedSounds.get(),
+                                  .layers  = beatLayers.get()},
+    });
 
-    // Since fadeInOut only uses the first x and last y samples,
-    // make sure not to fade out zero values
-    auto adjustBuffer = [&beatIntervalSamples, &rampingSteps](AudioSignal& signal) -> void {
-        if (signal.numberSamples() > beatIntervalSamples) {
-            signal.resizeSamples(beatIntervalSamples, 0);
-            signal.fadeInOut(rampingSteps, rampingSteps);
-        }
-        else {
-            signal.fadeInOut(rampingSteps, rampingSteps);
-            signal.resizeSamples(beatIntervalSamples, 0);
-        }
-    };
+    printPlaybackState();
+}
 
-    // prepare the sounds for each beat pattern type
-    adjustBuffer(localBeat);
-    adjustBuffer(pause);
-    if (localAccentuatedBeat.numberSamples() == 0) {
-        localAccentuatedBeat = AudioSignal(static_cast<const AudioSignal&>(localBeat));
-    }
-    else {
-        adjustBuffer(localAccentuatedBeat);
-    }
 
-    // fill the playback buffer according to the pattern
-    auto playBackBufferIterator = back_inserter(playBackBuffer);
-    for (const auto& beatType : pattern) {
-        switch (beatType) {
-        case BeatType::accent:
-            playBackBufferIterator = copy(begin(localAccentuatedBeat.getAudioData()),
-                                          end(localAccentuatedBeat.getAudioData()), playBackBufferIterator);
+void BeatPlayer::dataCallback(void* userData, SampleType* pOutput, uint32_t frameCount)
+{
+    MNOME_TRACE_SPAN("BeatPlayer::render");
+    auto*      player       = static_cast<BeatPlayer*>(userData);
+    const auto callbackTime = CallbackMonitor::Clock::now();
+    player->callbackMonitor.begin(callbackTime, frameCount, pOutput != nullptr);
+
+    const auto samples = (pOutput != nullptr) ? frameCount * player->outputConfig.channels : 0U;
+    auto       output  = span<SampleType>(pOutput, samples);
+
+    // take over all commands that have been queued since the last block
+    bool started = false;
+    while (const auto command = player->commands.pop()) {
+        switch (command->type) {
+        case PlayerCommand::Type::start:
+            // the changes that are still pending are dropped with the reset
+            player->scheduler.reset();
+            player->scheduler.requestChange(command->change);
+            player->outputEnabled = true;
+            started               = true;
             break;
-        case BeatType::beat:
-            playBackBufferIterator =
-                copy(begin(localBeat.getAudioData()), end(localBeat.getAudioData()), playBackBufferIterator);
+        case PlayerCommand::Type::stop:
+            player->scheduler.reset();
+            player->outputEnabled = false;
             break;
-        case BeatType::pause:
-            cout << "pause is inserted\n";
-            playBackBufferIterator =
-                copy(begin(pause.getAudioData()), end(pause.getAudioData()), playBackBufferIterator);
+        case PlayerCommand::Type::change:
+            player->scheduler.requestChange(command->change);
             break;
+        case PlayerCommand::Type::gain:
+            player->scheduler.setGain(command->gain);
+            break;
+        }
+    }
+
+    if (player->outputEnabled) {
+        const auto blockTime = chrono::nanoseconds(callbackTime.time_since_epoch()).count() + player->outputLatency;
+        if (pOutput != nullptr) {
+            player->renderBlock(output, blockTime);
+        }
+        else {
+            player->skipBlock(frameCount, blockTime);
         }
     }
+    else {
+        ranges::fill(output, static_cast<SampleType>(0));
+    }
+    player->appliedChange.store(player->scheduler.lastAppliedChange(), memory_order_release);
+    player->startedBars.store(player->outputEnabled ? player->scheduler.startedBars() : 0, memory_order_relaxed);
+    if (started) {
+        MNOME_TRACE_INSTANT("BeatPlayer::firstCallback");
+        player->firstFrameTime.store(steadyClockNanoseconds(), memory_order_release);
+    }
+    player->callbackMonitor.end(CallbackMonitor::Clock::now());
+}
 
-    cout << std::format("Playing {} at {} bpm\n", beatPattern.toString(), beatRate);
 
-    startAudio();
+void BeatPlayer::renderBlock(span<SampleType> output, int64_t blockTime)
+{
+    scheduler.setBlockTime(blockTime);
+    scheduler.render(output);
+    recordChangeFrames();
 }
 
+void BeatPlayer::skipBlock(uint32_t frameCount, int64_t blockTime)
+{
+    // onsets, bars and changes advance with the frames of the device, the samples are rendered and dropped
+    const size_t channels      = outputConfig.channels;
+    const size_t scratchFrames = scratch.size() / channels;
+    const double frameTime     = 1e9 / outputConfig.sampleRate;  // [ns]
+    uint64_t     skipped       = 0;
+    while (skipped < frameCount && scratchFrames > 0) {
+        const auto frames = min<uint64_t>(frameCount - skipped, scratchFrames);
+        renderBlock(span(scratch).first(frames * channels),
+                    blockTime + llround(static_cast<double>(skipped) * frameTime));
+        skipped += frames;
+    }
+}
 
-void miniaudio_data_callback(ma_device* pDevice, void* pOutput, const void* pInput, ma_uint32 frameCount)
+auto BeatPlayer::openDevice() -> bool
 {
-    auto* buffer = static_cast<ma_audio_buffer*>(pDevice->pUserData);
-    if (buffer == nullptr) {
-        cout << "Buffer is empty\n";
-        cout.flush();
-        return;
+    MNOME_TRACE_SPAN("BeatPlayer::openDevice");
+    const auto deviceBuffer = sink->open(AudioSignalConfiguration{.sampleRate = NATIVE_SAMPLE_RATE,
+                                                                  .channels   = requestedChannels},
+                                         bufferConfig, dataCallback, this);
+    if (!deviceBuffer) {
+        return false;
     }
-    ma_audio_buffer_read_pcm_frames(buffer, pOutput, frameCount, static_cast<ma_bool32>(true));
-    (void)pInput;
+    bufferInfo = *deviceBuffer;
+
+    // everything is rendered in the format of the device, so that it does not have to convert the samples
+    if (bufferInfo.sampleRate != outputConfig.sampleRate || bufferInfo.channels != outputConfig.channels) {
+        outputConfig = AudioSignalConfiguration{.sampleRate = static_cast<double>(bufferInfo.sampleRate),
+                                                .channels   = bufferInfo.channels};
+        scheduler    = BeatScheduler(outputConfig);
+        prepareSounds();
+        prepareLayers();
+    }
+
+    // the device keeps running, start and stop only gate the output
+    scheduler.setGain(gainFactor);
+    scheduler.setOnsetLog(&onsetLog);
+    outputLatency = chrono::duration_cast<chrono::nanoseconds>(bufferInfo.outputLatency()).count();
+    callbackMonitor.configure(bufferInfo.periodSizeInFrames, bufferInfo.bufferSizeInFrames(), bufferInfo.sampleRate);
+    scratch.assign(static_cast<size_t>(bufferInfo.periodSizeInFrames) * outputConfig.channels, 0);
+    if (!sink->start()) {
+        // the device and its context are released even when the sink left them open
+        sink->close();
+        return false;
+    }
+    deviceOpen = true;
+    return true;
 }
 
+void BeatPlayer::closeDevice()
+{
+    if (deviceOpen) {
+        sink->close();
+        deviceOpen = false;
+    }
+}
 
-void BeatPlayer::startAudio()
+void BeatPlayer::stop()
 {
     lock_guard<recursive_mutex> lockGuard(setterMutex);
     if (isRunning()) {
-        cout << "Audio playback was started though it is already running\n";
-        return;
+        cout << "Stopping playback\n";
+        submitCommand(PlayerCommand{.type = PlayerCommand::Type::stop, .change = {}});
+        running = false;
     }
-    running          = true;
-    ma_result result = ma_context_init(nullptr, 0, nullptr, &context);
-    if (result != MA_SUCCESS) {
-        std::println("Error: mini audio context failed to initialize");
+}
+
+/// Last change that a thread has handed to a player
+struct ThreadChange
+{
+    const BeatPlayer* player{nullptr};
+    uint64_t          sequence{0};
+};
+
+static thread_local ThreadChange threadChange;
+
+/// Bar at which the changes of a thread take effect, see BeatPlayer::setChangeBar()
+struct ThreadChangeBar
+{
+    const BeatPlayer*  player{nullptr};
+    optional<uint64_t> bar;
+};
+
+static thread_local ThreadChangeBar threadChangeBar;
+
+void BeatPlayer::submitCommand(PlayerCommand command)
+{
+    releaseRetired();
+    if (!deviceOpen) {
+        // start() hands over all parameters once a device has been opened
         return;
     }
+    if (command.type == PlayerCommand::Type::start || command.type == PlayerCommand::Type::change) {
+        command.change.sequence = ++changeSequence;
+        command.change.boundary = changeBoundary;
+        threadChange            = ThreadChange{.player = this, .sequence = changeSequence};
+    }
+    if (command.type == PlayerCommand::Type::change && threadChangeBar.player == this && threadChangeBar.bar) {
+        // the scheduler counts the bars from 0
+        command.change.boundary = ChangeBoundary::bar;
+        command.change.bar      = max<uint64_t>(*threadChangeBar.bar, 1) - 1;
+    }
 
-    ma_format sample_format = ma_format_f32;
+    // the callback drains the queue with every block, it is only full when commands are flooding in
+    constexpr auto retryInterval = chrono::milliseconds(1);
+    constexpr auto retries       = 1000;
+    for (auto retry = 0; !commands.push(command); ++retry) {
+        if (retry == retries) {
+            cout << "Error: the audio device does not take any commands\n";
+            return;
+        }
+        this_thread::sleep_for(retryInterval);
+    }
+}
 
-    // put the playback buffer inside the ma_audio_buffer structure
-    buf_config = ma_audio_buffer_config_init(sample_format, 1, playBackBuffer.size(), playBackBuffer.data(), nullptr);
-    result     = ma_audio_buffer_init(&buf_config, &buf);
-    if (result != MA_SUCCESS) {
-        cout << "Audio buffer initialization failed, aborting\n";
-        running = false;
+void BeatPlayer::recordChangeFrames()
+{
+    const auto applied = scheduler.changesOfLastBlock();
+    if (applied.empty()) {
         return;
     }
+    MNOME_TRACE_INSTANT("BeatPlayer::changeApplied");
 
-    deviceConfig                          = ma_device_config_init(ma_device_type_playback);
-    deviceConfig.playback.format          = sample_format;
-    deviceConfig.playback.channels        = 1;
-    deviceConfig.sampleRate               = PLAYBACK_RATE;
-    deviceConfig.periods                  = 2;
-    deviceConfig.periodSizeInMilliseconds = PLAYBACK_MIN_ALSA_WRITE;
-    deviceConfig.dataCallback             = miniaudio_data_callback;
-    deviceConfig.pUserData                = &buf;
+    // changes that were merged took effect together, only the latest ones are kept
+    const uint64_t kept = changeFrames.size();
+    for (const auto& changes : applied) {
+        const uint64_t first = max(changes.first, (changes.last >= kept) ? changes.last - kept + 1 : 1);
+        for (uint64_t sequence = first; sequence <= changes.last; ++sequence) {
+            auto& slot = changeFrames[sequence % changeFrames.size()];
+            slot.sequence.store(0, memory_order_relaxed);
+            atomic_thread_fence(memory_order_release);
+            slot.frame.store(changes.frame, memory_order_relaxed);
+            slot.sequence.store(sequence, memory_order_release);
+        }
+    }
+}
 
-    result = ma_device_init(&context, &deviceConfig, &device);
-    if (result != MA_SUCCESS) {
-        cout << "Device initialization failed, aborting\n";
-        running = false;
-        return;
+void BeatPlayer::retire(std::shared_ptr<const void> replaced)
+{
+    if (replaced) {
+        retired.emplace_back(changeSequence + 1, std::move(replaced));
     }
+}
 
-    ma_device_start(&device);
+void BeatPlayer::releaseRetired()
+{
+    const auto applied = appliedChange.load(memory_order_acquire);
+    erase_if(retired, [applied](const auto& entry) -> bool { return entry.first <= applied; });
 }
 
-void BeatPlayer::stop()
+void BeatPlayer::setBPM(size_t bpm)
 {
-    lock_guard<recursive_mutex> lockGuard(setterMutex);
+    lock_guard<recursive_mutex> guard(setterMutex);
+    beatRate = bpm;
+    retire(std::move(tempoProgram));
     if (isRunning()) {
-        cout << "Stopping playback\n";
-        ma_device_uninit(&device);
-        ma_audio_buffer_uninit(&buf);
-        ma_context_uninit(&context);
-        running = false;
+        submitCommand(PlayerCommand{.change = SchedulerChange{.bpm = bpm}});
+        printPlaybackState();
     }
 }
 
-void BeatPlayer::restart()
+auto BeatPlayer::getBPM() const -> size_t
+{
+    return beatRate;
+}
+
+void BeatPlayer::setTempo(const BpmProgram& program)
 {
     lock_guard<recursive_mutex> guard(setterMutex);
+    try {
+        checkBpmProgram(program);
+    }
+    catch (const invalid_argument& e) {
+        cout << std::format("Error: the tempo program cannot be played: {}\n", e.what());
+        return;
+    }
+    beatRate = program.front().bpm;
+    retire(std::move(tempoProgram));
+    tempoProgram = std::make_shared<const BpmProgram>(program);
     if (isRunning()) {
-        stop();
-        start();
+        submitCommand(PlayerCommand{.change = SchedulerChange{.tempo = tempoProgram.get()}});
+        printPlaybackState();
     }
 }
 
-void BeatPlayer::setBPM(size_t bpm)
+auto BeatPlayer::getTempoProgram() const -> std::shared_ptr<const BpmProgram>
+{
+    return tempoProgram;
+}
+
+auto BeatPlayer::getAccentuatedPattern() const -> const MetronomeBeats&
+{
+    return *beatPattern;
+}
+
+auto BeatPlayer::getAudioConfiguration() const -> AudioSignalConfiguration
+{
+    return outputConfig;
+}
+
+auto BeatPlayer::getBeatSounds() const -> std::shared_ptr<const BeatSounds>
+{
+    return preparedSounds;
+}
+
+void BeatPlayer::setChangeBoundary(ChangeBoundary boundary)
 {
     lock_guard<recursive_mutex> guard(setterMutex);
-    beatRate = bpm;
-    restart();
+    changeBoundary = boundary;
 }
 
-auto BeatPlayer::getBPM() const -> size_t
+void BeatPlayer::setChangeBar(std::optional<std::uint64_t> bar)
 {
-    return beatRate;
+    threadChangeBar = ThreadChangeBar{.player = this, .bar = bar};
+}
+
+auto BeatPlayer::getStartedBars() const -> std::uint64_t
+{
+    // the bars of the previous playback may be published until the callback has taken over the start
+    if (firstFrameTime.load(memory_order_acquire) == 0) {
+        return 0;
+    }
+    return startedBars.load(memory_order_relaxed);
 }
 
-void BeatPlayer::setAccentuatedBeat(const AudioSignal& newBeat)
+void BeatPlayer::waitForBar(std::uint64_t bar) const
+{
+    // the callback must not wait for the control threads, so it is polled instead of notifying them
+    constexpr auto pollInterval = chrono::milliseconds(1);
+    while (isRunning() && getStartedBars() < bar) {
+        this_thread::sleep_for(pollInterval);
+    }
+}
+
+auto BeatPlayer::getSubmittedChanges() -> std::uint64_t
 {
     lock_guard<recursive_mutex> guard(setterMutex);
-    accentuatedBeat = std::make_unique<AudioSignal>(newBeat);
-    restart();
+    return changeSequence;
 }
 
-void BeatPlayer::setBeat(const AudioSignal& newBeat)
+auto BeatPlayer::getThreadChange() const -> std::uint64_t
+{
+    return (threadChange.player == this) ? threadChange.sequence : 0;
+}
+
+auto BeatPlayer::getAppliedChanges() const -> std::uint64_t
+{
+    return appliedChange.load(memory_order_acquire);
+}
+
+auto BeatPlayer::getChangeFrame(std::uint64_t sequence) const -> std::optional<std::uint64_t>
+{
+    const auto& slot = changeFrames[sequence % changeFrames.size()];
+    if (sequence == 0 || slot.sequence.load(memory_order_acquire) != sequence) {
+        return nullopt;
+    }
+    const uint64_t frame = slot.frame.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (slot.sequence.load(memory_order_relaxed) != sequence) {
+        return nullopt;
+    }
+    return frame;
+}
+
+void BeatPlayer::setGain(SampleType gain)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    gainFactor = gain;
+    submitCommand(PlayerCommand{.type = PlayerCommand::Type::gain, .change = {}, .gain = gain});
+}
+
+void BeatPlayer::setAccentuatedBeat(SharedAudioSignal newBeat)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    accentuatedBeat = std::move(newBeat);
+    prepareSounds();
+}
+
+void BeatPlayer::setBeat(SharedAudioSignal newBeat)
 {
     lock_guard<recursive_mutex> guard(setterMutex);
-    beat = std::make_unique<AudioSignal>(newBeat);
-    restart();
+    beat = std::move(newBeat);
+    prepareSounds();
+}
+
+void BeatPlayer::setBeatSounds(SharedAudioSignal newBeat, SharedAudioSignal newAccentuatedBeat)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    beat            = std::move(newBeat);
+    accentuatedBeat = std::move(newAccentuatedBeat);
+    prepareSounds();
+}
+
+void BeatPlayer::setLayer(size_t index, const MetronomeBeats& pattern, size_t subdivision, SharedAudioSignal layerBeat,
+                          SharedAudioSignal layerAccent)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    if (index > beatLayers->size() || index >= MAX_BEAT_LAYERS) {
+        cout << std::format("Error: layer {} cannot be set, there are {} of at most {} layers\n", index,
+                            beatLayers->size(), MAX_BEAT_LAYERS);
+        return;
+    }
+    auto sounds = LayerSounds{.beat = std::move(layerBeat), .accent = std::move(layerAccent)};
+    auto layer  = BeatLayer{
+         .pattern     = pattern.getBeatPattern(),
+         .subdivision = max<size_t>(subdivision, 1),
+         .sounds      = prepareLayerSounds(sounds),
+    };
+
+    // the other layers share their sounds with the current ones, their voices keep sounding
+    auto layers = *beatLayers;
+    if (index == layers.size()) {
+        layers.push_back(std::move(layer));
+        layerSounds.push_back(std::move(sounds));
+    }
+    else {
+        layers[index]      = std::move(layer);
+        layerSounds[index] = std::move(sounds);
+    }
+    publishLayers(std::move(layers));
+}
+
+void BeatPlayer::removeLayer(size_t index)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    if (index >= beatLayers->size()) {
+        return;
+    }
+    auto layers = *beatLayers;
+    layers.erase(layers.begin() + static_cast<ptrdiff_t>(index));
+    layerSounds.erase(layerSounds.begin() + static_cast<ptrdiff_t>(index));
+    publishLayers(std::move(layers));
+}
+
+auto BeatPlayer::getLayers() const -> std::shared_ptr<const BeatLayers>
+{
+    return beatLayers;
+}
+
+void BeatPlayer::setChannelGains(BeatType type, const ChannelGains& gains)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    switch (type) {
+    case BeatType::accent:
+        accentGains = gains;
+        break;
+    case BeatType::beat:
+        beatGains = gains;
+        break;
+    case BeatType::pause:
+        return;
+    }
+    prepareSounds();
 }
 
 void BeatPlayer::setAccentuatedPattern(const MetronomeBeats& pattern)
 {
     lock_guard<recursive_mutex> guard(setterMutex);
-    beatPattern = pattern;
-    restart();
+    if (isRunning() && pattern.getCompiledPattern().beats == 0) {
+        cout << "Not changing the pattern, beat pattern is empty\n";
+        return;
+    }
+    retire(std::move(beatPattern));
+    beatPattern = std::make_shared<const MetronomeBeats>(pattern);
+    if (isRunning()) {
+        submitCommand(PlayerCommand{.change = SchedulerChange{.pattern = &beatPattern->getCompiledPattern()}});
+        printPlaybackState();
+    }
 }
 
 auto BeatPlayer::isRunning() const -> bool
@@ -282,49 +647,401 @@ auto BeatPlayer::isRunning() const -> bool
     return running;
 }
 
+void BeatPlayer::setDeviceBuffer(const DeviceBufferConfiguration& deviceBuffer)
+{
+    lock_guard<recursive_mutex> guard(setterMutex);
+    const bool                  wasRunning = isRunning();
 
-MetronomeBeats::MetronomeBeats(std::string_view strPattern)
+    // without a running callback everything that was handed over can be dropped
+    closeDevice();
+    running       = false;
+    outputEnabled = false;
+    while (commands.pop()) {
+    }
+
+    bufferConfig = deviceBuffer;
+    if (openDevice() && wasRunning) {
+        start();
+    }
+}
+
+auto BeatPlayer::getDeviceBufferInfo() const -> std::optional<DeviceBufferInfo>
 {
-    fromString(strPattern);
+    if (!deviceOpen) {
+        return nullopt;
+    }
+    return bufferInfo;
 }
-MetronomeBeats::MetronomeBeats(BeatPatternType otherPattern) : pattern(std::move(otherPattern))
+
+auto BeatPlayer::getStartLatency() const -> std::optional<std::chrono::nanoseconds>
 {
+    const auto first   = firstFrameTime.load(memory_order_acquire);
+    const auto request = startRequestTime.load(memory_order_acquire);
+    if (first == 0 || first < request) {
+        return nullopt;
+    }
+    return chrono::nanoseconds(first - request);
 }
 
-void MetronomeBeats::fromString(string_view strPattern)
+auto BeatPlayer::getCallbackStatistics() const -> CallbackStatistics
 {
-    pattern.clear();
-    for (const char& character : strPattern) {
-        const auto convertedType = static_cast<BeatType>(character);
+    return callbackMonitor.snapshot();
+}
 
-        // the following switch will ignore all non valid conversions of character to
-        // MetronomeBeats::BeatType
-        switch (convertedType) {
-        case BeatType::accent:
-            pattern.push_back(BeatType::accent);
-            break;
-        case BeatType::beat:
-            pattern.push_back(BeatType::beat);
-            break;
-        case BeatType::pause:
-            pattern.push_back(BeatType::pause);
-            break;
+auto BeatPlayer::getOnsetLog() const -> const OnsetLog&
+{
+    return onsetLog;
+}
+
+
+/// Pull frames from a virtual sink and return the frames at which a sound starts
+static auto pullOnsets(VirtualSink& sink, uint64_t frames) -> vector<uint64_t>
+{
+    vector<uint64_t> onsets;
+    uint64_t         position = sink.renderedFrames();
+    SampleType       previous = 0;
+    sink.pull(frames, [&](span<const SampleType> block) -> void {
+        for (const auto sample : block) {
+            if (sample != 0 && previous == 0) {
+                onsets.push_back(position);
+            }
+            previous = sample;
+            ++position;
         }
-    }
+    });
+    return onsets;
 }
 
-auto MetronomeBeats::toString() const -> std::string
+/// Virtual device that opens but does not start
+class StalledSink : public VirtualSink
+{
+private:
+    bool& deviceOpen;
+
+public:
+    explicit StalledSink(bool& openFlag) : deviceOpen{openFlag} {}
+
+    auto open(const AudioSignalConfiguration& audioConfig, const DeviceBufferConfiguration& bufferConfig,
+              RenderCallback callback, void* userData) -> optional<DeviceBufferInfo> override
+    {
+        auto info  = VirtualSink::open(audioConfig, bufferConfig, callback, userData);
+        deviceOpen = info.has_value();
+        return info;
+    }
+
+    auto start() -> bool override
+    {
+        return false;
+    }
+
+    void close() override
+    {
+        VirtualSink::close();
+        deviceOpen = false;
+    }
+};
+
+TEST_CASE("BeatPlayerTest - playback into a virtual device")
 {
-    std::stringstream sStream;
-    for (const auto& type : pattern) {
-        sStream << static_cast<char>(type);
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    auto       sink        = std::make_unique<VirtualSink>(48'000);
+    auto&      device      = *sink;
+
+    // periods of 480 frames
+    BeatPlayer player(DeviceBufferConfiguration{.periodSizeInMilliseconds = 10, .periods = 2}, std::move(sink));
+    player.setBeat(AudioSignal(audioConfig, AudioDataType(100, 0.5F)));
+    player.setAccentuatedBeat(AudioSignal(audioConfig, AudioDataType(100, 1.0F)));
+    player.setAccentuatedPattern(MetronomeBeats("!+.+"));
+    player.setBPM(120);
+    REQUIRE(player.getDeviceBufferInfo().has_value());
+    CHECK_EQ(player.getDeviceBufferInfo()->periodSizeInFrames, 480);
+
+    SUBCASE("onsets are exact to the sample")
+    {
+        CHECK(pullOnsets(device, 4'800).empty());  // nothing is played before the start
+
+        uint64_t cursor = player.getOnsetLog().appended();
+        player.start();
+        constexpr uint64_t start    = 4'800;
+        constexpr uint64_t interval = 24'000;  // frames per beat at 120 bpm
+
+        const vector<uint64_t> expected{start,
+                                        start + interval,
+                                        start + 3 * interval,
+                                        start + 4 * interval,
+                                        start + 5 * interval,
+                                        start + 7 * interval};
+        CHECK_EQ(pullOnsets(device, 8 * interval), expected);
+
+        // the onsets are recorded with frames since the start and the time at which the device plays them
+        vector<OnsetRecord> onsets;
+        CHECK_EQ(player.getOnsetLog().read(cursor, onsets), 0);
+        REQUIRE_EQ(onsets.size(), expected.size());
+        CHECK_EQ(onsets[2].frame, 3 * interval);
+        CHECK_EQ(onsets[3].bar, 2);
+        CHECK_EQ(onsets[3].type, BeatType::accent);
+        CHECK_GT(onsets[3].deviceTime, onsets[0].deviceTime);
+
+        // the beat at which the change is applied is still on the old grid
+        player.setBPM(240);
+        const vector<uint64_t> faster{start + 8 * interval, start + 8 * interval + interval / 2,
+                                      start + 8 * interval + 3 * interval / 2};
+        CHECK_EQ(pullOnsets(device, 2 * interval), faster);
+
+        player.stop();
+        CHECK(pullOnsets(device, 2 * interval).empty());
+
+        const auto stats = player.getCallbackStatistics();
+        CHECK_EQ(stats.callbacks, device.renderedFrames() / 480);
+        CHECK_EQ(stats.shortReads, 0);
+        CHECK_EQ(stats.missingBuffers, 0);
+    }
+
+    SUBCASE("blocks without an output buffer pass on the beat")
+    {
+        constexpr uint64_t interval = 24'000;  // frames per beat at 120 bpm
+        uint64_t           cursor   = player.getOnsetLog().appended();
+        player.start();
+
+        // the device drops the first two beats, the third one is a pause
+        CHECK_EQ(device.skip(2 * interval), 2 * interval);
+        const vector<uint64_t> expected{3 * interval, 4 * interval};
+        CHECK_EQ(pullOnsets(device, 3 * interval), expected);
+        CHECK_EQ(player.getStartedBars(), 2);
+
+        // the onsets of the dropped blocks are recorded, too
+        vector<OnsetRecord> onsets;
+        CHECK_EQ(player.getOnsetLog().read(cursor, onsets), 0);
+        REQUIRE_EQ(onsets.size(), 4);
+        CHECK_EQ(onsets[1].frame, interval);
+        CHECK_GT(onsets[1].deviceTime, onsets[0].deviceTime);
+        CHECK_EQ(player.getCallbackStatistics().missingBuffers, 2 * interval / 480);
+    }
+
+    SUBCASE("changes at a bar of the device clock")
+    {
+        player.start();
+        player.setAccentuatedPattern(MetronomeBeats("|"));  // would silence the playback
+        CHECK_EQ(player.getAccentuatedPattern().toString(), "!+.+");
+        CHECK_EQ(player.getStartedBars(), 0);  // the device has not taken over the start yet
+        CHECK_EQ(pullOnsets(device, 480), vector<uint64_t>{0});
+        CHECK_EQ(player.getStartedBars(), 1);
+
+        // bars of 96000 frames at 120 bpm, the third one is played at 240 bpm
+        const auto started = player.getSubmittedChanges();
+        player.setChangeBar(3);
+        player.setBPM(240);
+        // a change of another thread meanwhile, e.g. of the REPL during an `at bar` of a script, is not moved
+        uint64_t replChange = 0;
+        thread([&player, &replChange]() -> void {
+            player.setAccentuatedPattern(MetronomeBeats("!+.+"));
+            replChange = player.getThreadChange();
+        }).join();
+        player.setChangeBar(nullopt);
+        const auto change = started + 1;
+        CHECK_EQ(replChange, started + 2);
+        CHECK_FALSE(player.getChangeFrame(change));
+
+        // a thread only sees its own changes
+        CHECK_EQ(player.getThreadChange(), change);
+        thread([&player]() -> void { CHECK_EQ(player.getThreadChange(), 0); }).join();
+        const vector<uint64_t> expected{24'000, 72'000, 96'000, 120'000, 168'000, 192'000, 204'000, 228'000};
+        CHECK_EQ(pullOnsets(device, 240'000 - 480), expected);
+        CHECK_EQ(player.getStartedBars(), 3);
+
+        // the frames at which the changes took effect, counted from the start
+        CHECK_EQ(player.getAppliedChanges(), replChange);
+        CHECK_EQ(player.getChangeFrame(started), 0);
+        CHECK_EQ(player.getChangeFrame(change), 192'000);
+        CHECK_EQ(player.getChangeFrame(replChange), 24'000);
+        player.waitForBar(3);  // returns right away
+
+        player.stop();
+        player.waitForBar(100);  // returns when the playback is stopped
     }
-    return sStream.str();
+
+    SUBCASE("an hour of playback in a fraction of the time")
+    {
+        player.setBPM(90);
+        player.start();
+        constexpr uint64_t interval = 32'000;  // frames per beat at 90 bpm
+        constexpr uint64_t duration = 3'600 * 48'000;
+
+        uint64_t   onsets   = 0;
+        uint64_t   last     = 0;
+        uint64_t   position = 0;
+        SampleType previous = 0;
+        auto       count    = [&](span<const SampleType> block) -> void {
+            for (const auto sample : block) {
+                if (sample != 0 && previous == 0) {
+                    ++onsets;
+                    last = position;
+                }
+                previous = sample;
+                ++position;
+            }
+        };
+        CHECK_EQ(device.pull(duration, count), duration);
+        CHECK_EQ(device.simulatedTime().count(), doctest::Approx(3'600));
+
+        // 5400 beats, one in four is a pause
+        CHECK_EQ(onsets, 4'050);
+        CHECK_EQ(last, 5'399 * interval);
+    }
+}
+
+TEST_CASE("BeatPlayerTest - rendering at the native rate of the device")
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    auto       sink        = std::make_unique<VirtualSink>(44'100);
+    auto&      device      = *sink;
+
+    BeatPlayer player(DeviceBufferConfiguration{.periodSizeInMilliseconds = 10, .periods = 2}, std::move(sink));
+    CHECK_EQ(player.getAudioConfiguration().sampleRate, 44'100);
+    CHECK_EQ(player.getDeviceBufferInfo()->periodSizeInFrames, 441);
+
+    // sounds of another rate are converted once
+    player.setBeat(AudioSignal(audioConfig, AudioDataType(4'800, 0.5F)));
+    player.setAccentuatedBeat(AudioSignal(audioConfig, AudioDataType(4'800, 1.0F)));
+    player.setAccentuatedPattern(MetronomeBeats("!+++"));
+    player.setBPM(120);
+    const auto sounds = player.getBeatSounds();
+    REQUIRE(sounds);
+    CHECK_EQ(sounds->beat->getConfiguration().sampleRate, 44'100);
+    CHECK_EQ(sounds->beat->numberSamples(), 4'410);
+
+    player.start();
+    constexpr uint64_t interval = 22'050;  // frames per beat at 120 bpm and 44.1 kHz
+
+    const vector<uint64_t> expected{0, interval, 2 * interval, 3 * interval};
+    CHECK_EQ(pullOnsets(device, 4 * interval), expected);
+}
+
+TEST_CASE("BeatPlayerTest - sounds are prepared once and shared")
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    BeatPlayer player(DeviceBufferConfiguration{.periodSizeInMilliseconds = 10, .periods = 2},
+                      std::make_unique<VirtualSink>(48'000));
+    const SharedAudioSignal beat(AudioSignal(audioConfig, AudioDataType(100, 0.5F)));
+    player.setBeatSounds(beat, AudioSignal(audioConfig, AudioDataType{}));
+    player.setBPM(120);
+
+    // the accent falls back to the beat, both share one faded variant
+    const auto sounds = player.getBeatSounds();
+    REQUIRE(sounds);
+    CHECK_EQ(sounds->accent.get(), sounds->beat.get());
+    CHECK_NE(sounds->beat.get(), beat.get());
+
+    // starting, stopping and changing the tempo or the gains keep the samples
+    player.start();
+    player.setBPM(90);
+    player.stop();
+    player.start();
+    player.setChannelGains(BeatType::beat, routeGains(0, 0.5));
+    player.stop();
+    CHECK_EQ(player.getBeatSounds()->beat.get(), sounds->beat.get());
+
+    PreparedSoundCache cache;
+    const auto         prepared = cache.prepare(beat, 24'000);
+    CHECK_EQ(prepared->numberSamples(), 50);
+    CHECK_EQ(cache.prepare(beat, 24'000).get(), prepared.get());
+    CHECK_EQ(cache.size(), 1);
+    // variants of sounds that are not used anymore are dropped
+    CHECK_NE(cache.prepare(AudioSignal(audioConfig, AudioDataType(10, 0.5F)), 24'000).get(), prepared.get());
+    CHECK_EQ(cache.size(), 2);
+    cache.prepare(AudioSignal(audioConfig, AudioDataType(10, 0.5F)), 24'000);
+    CHECK_EQ(cache.size(), 2);
+}
+
+TEST_CASE("BeatPlayerTest - layers are played along with the pattern")
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    auto       sink        = std::make_unique<VirtualSink>(48'000);
+    auto&      device      = *sink;
+
+    BeatPlayer player(DeviceBufferConfiguration{.periodSizeInMilliseconds = 10, .periods = 2}, std::move(sink));
+    player.setBeat(AudioSignal(audioConfig, AudioDataType(100, 0.5F)));
+    player.setAccentuatedBeat(AudioSignal(audioConfig, AudioDataType(100, 0.5F)));
+    player.setAccentuatedPattern(MetronomeBeats("!+++"));
+    player.setBPM(120);
+    constexpr uint64_t bar = 4 * 24'000;  // frames per bar at 120 bpm
+
+    // three against four
+    const auto layerSound = AudioSignal(audioConfig, AudioDataType(100, 0.25F));
+    player.setLayer(0, MetronomeBeats("!++"), 1, layerSound, layerSound);
+    player.setLayer(2, MetronomeBeats("+"), 1, layerSound, layerSound);  // no gaps
+    REQUIRE_EQ(player.getLayers()->size(), 1);
+
+    player.start();
+    const vector<uint64_t> expected{0, 24'000, 32'000, 48'000, 64'000, 72'000};
+    CHECK_EQ(pullOnsets(device, bar), expected);
+
+    // a second layer of five against four joins at the next beat, the first one is not touched
+    player.setLayer(1, MetronomeBeats("+++++"), 1, layerSound, layerSound);
+    const vector<uint64_t> joined{bar,          bar + 19'200, bar + 24'000, bar + 32'000, bar + 38'400,
+                                  bar + 48'000, bar + 57'600, bar + 64'000, bar + 72'000, bar + 76'800};
+    CHECK_EQ(pullOnsets(device, bar), joined);
+
+    player.removeLayer(0);
+    REQUIRE_EQ(player.getLayers()->size(), 1);
+    CHECK_EQ(player.getLayers()->front().steps(), 5);
 }
 
-auto MetronomeBeats::getBeatPattern() const -> const std::vector<mnome::BeatType>&
+TEST_CASE("BeatPlayerTest - routing beats to the channels of the device")
 {
-    return pattern;
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    auto       sink        = std::make_unique<VirtualSink>(48'000, 4);
+    auto&      device      = *sink;
+
+    BeatPlayer player(DeviceBufferConfiguration{.periodSizeInMilliseconds = 10, .periods = 2}, std::move(sink));
+    CHECK_EQ(player.getAudioConfiguration().channels, 4);
+    player.setBeat(AudioSignal(audioConfig, AudioDataType(4'800, 0.5F)));
+    player.setAccentuatedBeat(AudioSignal(audioConfig, AudioDataType(4'800, 1.0F)));
+    player.setAccentuatedPattern(MetronomeBeats("!+"));
+    player.setBPM(120);
+    player.setChannelGains(BeatType::accent, routeGains(3));
+    player.setChannelGains(BeatType::beat, panGains(4, -1));
+
+    // sum of the absolute samples per channel, per beat
+    array<array<double, 4>, 2> levels{};
+    uint64_t                   position = 0;
+    player.start();
+    device.pull(48'000, [&](span<const SampleType> block) -> void {
+        for (const auto sample : block) {
+            const auto frame = position / 4;
+            if (frame < 48'000) {
+                levels.at(frame / 24'000).at(position % 4) += abs(sample);
+            }
+            ++position;
+        }
+    });
+    CHECK_EQ(levels[0][0], 0);
+    CHECK_EQ(levels[0][2], 0);
+    CHECK_GT(levels[0][3], 0);
+    CHECK_GT(levels[1][0], 0);
+    CHECK_EQ(levels[1][1], 0);
+    CHECK_EQ(levels[1][3], 0);
+
+    // a requested number of channels takes precedence over the channels of the device
+    BeatPlayer mono(DeviceBufferConfiguration{}, std::make_unique<VirtualSink>(48'000, 2), 1);
+    CHECK_EQ(mono.getAudioConfiguration().channels, 1);
+}
+
+TEST_CASE("BeatPlayerTest - a device that does not start is closed again")
+{
+    bool       deviceOpen = false;
+    BeatPlayer player(DeviceBufferConfiguration{}, std::make_unique<StalledSink>(deviceOpen));
+    CHECK_FALSE(deviceOpen);
+
+    // every start tries to open it again
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    player.setBeat(AudioSignal(audioConfig, AudioDataType(100, 0.5F)));
+    player.setAccentuatedBeat(AudioSignal(audioConfig, AudioDataType(100, 1.0F)));
+    player.setAccentuatedPattern(MetronomeBeats("!+"));
+    player.setBPM(120);
+    player.start();
+    CHECK_FALSE(deviceOpen);
+    CHECK_FALSE(player.isRunning());
 }
 
 }  // namespace mnome
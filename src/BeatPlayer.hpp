@@ -6,14 +6,22 @@
 #define MNOME_BEATPLAYER_H
 
 #include "AudioSignal.hpp"
+#include "AudioSink.hpp"
+#include "BeatScheduler.hpp"
+#include "CallbackMonitor.hpp"
+#include "MetronomeBeats.hpp"
+#include "OnsetLog.hpp"
+#include "SpscQueue.hpp"
 
-#include <format>
 #include <memory>
-#include <miniaudio.h>
 
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
-#include <string_view>
+#include <optional>
+#include <span>
 #include <utility>
 #include <vector>
 
@@ -22,60 +30,142 @@ namespace mnome {
 
 constexpr size_t DEFAULT_BPM = 100;
 
-/// Types of metronome beats: accent, normal beat and pause
-enum class BeatType : char
-{
-    accent = '!',
-    beat   = '+',
-    pause  = '.',
-};
+/// Fade a beat sound so that it can be mixed without click/pop noises
+auto prepareBeatSound(AudioSignal sound) -> AudioSignal;
 
-/// A list of beats is a beat pattern
-using BeatPatternType = std::vector<mnome::BeatType>;
+/// Fade the beat sounds so that they can be mixed without click/pop noises
+/// \param  accentuatedBeat  sound of the accent, \p beat is used for it when it is empty
+auto prepareBeatSounds(const SharedAudioSignal& beat, const SharedAudioSignal& accentuatedBeat) -> BeatSounds;
 
-/// A beat pattern is a list of different beat types
-class MetronomeBeats
+/// Beat sounds that have been prepared for a sample rate, each sound is prepared once per rate
+///
+/// Preparing a sound again hands out the variant that has been made before. Changing the gains or the layers or
+/// opening the device again at the same rate neither resamples nor copies any samples.
+class PreparedSoundCache
 {
 private:
-    BeatPatternType pattern{BeatType::beat};
+    struct Entry
+    {
+        SharedAudioSignal source;  //< keeps the address of the source from being reused
+        double            sampleRate{0};
+        SharedAudioSignal prepared;
+    };
+    std::vector<Entry> entries;
 
 public:
-    explicit MetronomeBeats(std::string_view strPattern);
-    explicit MetronomeBeats(BeatPatternType otherPattern);
+    /// Faded variant of a sound at a sample rate, see prepareBeatSound()
+    /// \note  Variants of sounds that only the cache refers to are dropped
+    auto prepare(const SharedAudioSignal& source, double sampleRate) -> SharedAudioSignal;
 
-    void               fromString(std::string_view strPattern);
-    [[nodiscard]] auto toString() const -> std::string;
-
-    [[nodiscard]] auto getBeatPattern() const -> const BeatPatternType&;
+    /// Number of variants that are kept
+    [[nodiscard]] auto size() const -> size_t;
 };
 
-
 /// Plays a beat at a certain number of times per minute
 class BeatPlayer
 {
 private:
     // data members
-    size_t                       beatRate{DEFAULT_BPM};
-    std::unique_ptr<AudioSignal> beat;
-    std::unique_ptr<AudioSignal> accentuatedBeat;
-    AudioDataType                playBackBuffer;
-    MetronomeBeats               beatPattern{"!+++"};
-
-    // synchronization
+    size_t                                beatRate{DEFAULT_BPM};
+    std::shared_ptr<const BpmProgram>     tempoProgram;  //< played instead of beatRate when set
+    SharedAudioSignal                     beat;
+    SharedAudioSignal                     accentuatedBeat;
+    PreparedSoundCache                    preparedVariants;  //< faded sounds of the beats and layers per sample rate
+    std::shared_ptr<const BeatSounds>     preparedSounds;    //< faded beat sounds that the scheduler mixes
+    ChannelGains                          accentGains;
+    ChannelGains                          beatGains;
+    std::shared_ptr<const BeatLayers>     beatLayers{std::make_shared<const BeatLayers>()};
+    std::shared_ptr<const MetronomeBeats> beatPattern{std::make_shared<const MetronomeBeats>("!+++")};
+    BeatScheduler                         scheduler;
+    ChangeBoundary                        changeBoundary{ChangeBoundary::beat};
+    SampleType                            gainFactor{1.0F};
+
+    // synchronization of the control threads
     std::recursive_mutex setterMutex;
     std::atomic_bool     requestStop{false};
     std::atomic_bool     running{false};
 
-    // miniaudio
-    ma_context             context{};
-    ma_device_config       deviceConfig{};
-    ma_device              device{};
-    ma_audio_buffer_config buf_config{};
-    ma_audio_buffer        buf{};
+    /// Request for the audio callback
+    struct PlayerCommand
+    {
+        enum class Type : std::uint8_t
+        {
+            start,
+            stop,
+            change,
+            gain,
+        };
+
+        Type            type{Type::change};
+        SchedulerChange change;     //< parameters for start and change
+        SampleType      gain{1.0F};  //< factor for gain
+    };
+
+    /// Number of commands that can be queued for the audio callback
+    static constexpr size_t COMMAND_QUEUE_SIZE = 64;
+
+    // Commands are pushed while setterMutex is held and drained by the audio callback at the start of each block.
+    // The callback never waits for the control threads.
+    SpscQueue<PlayerCommand, COMMAND_QUEUE_SIZE> commands;
+    std::uint64_t                                changeSequence{0};
+    std::atomic<std::uint64_t>                   appliedChange{0};
+    std::atomic<std::uint64_t>                   startedBars{0};  //< published by the audio callback
+
+    /// Frame at which a change took effect, written by the audio callback like the events of a TraceBuffer
+    struct ChangeFrame
+    {
+        std::atomic<std::uint64_t> sequence{0};  //< of the change, 0 while the slot is written
+        std::atomic<std::uint64_t> frame{0};
+    };
+
+    // frames of the latest changes, a change that was merged into a later one took effect with it
+    std::array<ChangeFrame, COMMAND_QUEUE_SIZE> changeFrames;
+
+    /// Sounds of a layer as they have been set, before they are prepared for the device
+    struct LayerSounds
+    {
+        SharedAudioSignal beat;
+        SharedAudioSignal accent;
+    };
+
+    /// Sounds of beatLayers, kept to prepare them again when the device changes
+    std::vector<LayerSounds> layerSounds;
+
+    /// Pattern, sounds and layers that were replaced, kept alive until the change replacing them has been applied
+    std::vector<std::pair<std::uint64_t, std::shared_ptr<const void>>> retired;
+
+    // start latency as steady clock time stamps [ns]
+    std::atomic<std::int64_t> startRequestTime{0};
+    std::atomic<std::int64_t> firstFrameTime{0};
+
+    /// Gates the output, only accessed by the audio callback
+    bool outputEnabled{false};
+
+    /// One period of samples that is rendered when the device passes no output buffer, sized when it is opened
+    std::vector<SampleType> scratch;
+
+    /// Statistics that the audio callback records and the control threads read
+    CallbackMonitor callbackMonitor;
+
+    /// Onsets that the scheduler has started, stamped with the time at which the device plays them
+    OnsetLog     onsetLog;
+    std::int64_t outputLatency{0};  //< [ns] from the callback until its first frame leaves the device
+
+    // the device is opened once and kept running while the player exists
+    AudioSignalConfiguration   outputConfig;
+    std::uint8_t               requestedChannels;
+    DeviceBufferConfiguration  bufferConfig;
+    DeviceBufferInfo           bufferInfo;
+    bool                       deviceOpen{false};
+    std::unique_ptr<AudioSink> sink;
 
 
 public:
-    BeatPlayer() = default;
+    /// Ctor
+    /// \param  audioSink  device that plays the beats, the default audio device of the system when it is nullptr
+    /// \param  channels  number of output channels, NATIVE_CHANNELS for the channels of the device
+    explicit BeatPlayer(const DeviceBufferConfiguration& deviceBuffer = {}, std::unique_ptr<AudioSink> audioSink = {},
+                        std::uint8_t channels = NATIVE_CHANNELS);
     ~BeatPlayer();
 
     // Delete other constructors
@@ -85,15 +175,38 @@ public:
     auto operator=(BeatPlayer&&) -> BeatPlayer&&     = delete;
 
     /// Set the sound of the beat that is played back
-    /// \param  newBeat  samples the represent the beat
-    void setBeat(const AudioSignal& newBeat);
+    /// \param  newBeat  samples the represent the beat, shared and not copied
+    void setBeat(SharedAudioSignal newBeat);
 
     /// Set the sound of the beat that is played back
-    /// \param  newBeat  samples the represent the accentuated beat
-    void setAccentuatedBeat(const AudioSignal& newBeat);
+    /// \param  newBeat  samples the represent the accentuated beat, shared and not copied
+    void setAccentuatedBeat(SharedAudioSignal newBeat);
 
+    /// Set the sounds of the beat and the accentuated beat at once, they are prepared for the device only once
+    void setBeatSounds(SharedAudioSignal newBeat, SharedAudioSignal newAccentuatedBeat);
+
+    /// Change the beat pattern, a pattern without beats is ignored during playback like by start()
     void setAccentuatedPattern(const MetronomeBeats& pattern);
 
+    /// Play a pattern along with the main pattern, e.g. three against four
+    /// \param  index  layer to be replaced, a layer is added when it is the number of layers
+    /// \param  subdivision  passes through \p pattern per pass through the main pattern
+    /// \param  layerBeat, layerAccent  sounds of the layer
+    /// \note  The other layers are not touched, the change takes effect at the next beat
+    void setLayer(size_t index, const MetronomeBeats& pattern, size_t subdivision, SharedAudioSignal layerBeat,
+                  SharedAudioSignal layerAccent);
+
+    /// Stop playing a layer, the following layers move up
+    void removeLayer(size_t index);
+
+    /// Layers that are played along with the main pattern
+    [[nodiscard]] auto getLayers() const -> std::shared_ptr<const BeatLayers>;
+
+    /// Set the level of a beat type per output channel, see panGains() and routeGains()
+    /// \param  type  accent or beat, pauses have no sound
+    /// \param  gains  empty for full level on all channels
+    void setChannelGains(BeatType type, const ChannelGains& gains);
+
     /// Start the BeatPlayer
     void start();
 
@@ -106,8 +219,62 @@ public:
     void setBPM(size_t bpm);
 
     /// Get the current bpm setting
+    /// \return  the tempo at the start of the tempo program when one is played
     [[nodiscard]] auto getBPM() const -> size_t;
 
+    /// Play a tempo program, e.g. ramps or a tempo trainer, instead of a constant tempo
+    /// \note  The program starts again from its first bar with every start(), setBPM() ends it
+    void setTempo(const BpmProgram& program);
+
+    /// Get the tempo program that is played
+    /// \return  nullptr when a constant tempo is played
+    [[nodiscard]] auto getTempoProgram() const -> std::shared_ptr<const BpmProgram>;
+
+    /// Get the current beat pattern
+    [[nodiscard]] auto getAccentuatedPattern() const -> const MetronomeBeats&;
+
+    /// Format the beats are rendered in, the native sample rate and channels of the device once it has been opened
+    [[nodiscard]] auto getAudioConfiguration() const -> AudioSignalConfiguration;
+
+    /// Get the faded sounds that are played back
+    /// \return  nullptr when no beat has been set
+    [[nodiscard]] auto getBeatSounds() const -> std::shared_ptr<const BeatSounds>;
+
+    /// Select whether changes during playback take effect at the next beat or at the next bar
+    void setChangeBoundary(ChangeBoundary boundary);
+
+    /// Let the following changes of the calling thread take effect at the start of a certain bar instead of the next
+    /// beat or bar, the changes of other threads are not moved
+    /// \param  bar  counted from 1 since the start like getStartedBars(), std::nullopt for setChangeBoundary() again
+    void setChangeBar(std::optional<std::uint64_t> bar);
+
+    /// Number of bars that have been started since the last start(), the clock of the device
+    /// \return  0 while the playback is stopped or has not reached its first frame yet
+    [[nodiscard]] auto getStartedBars() const -> std::uint64_t;
+
+    /// Block until a bar has been started or the playback has been stopped
+    /// \param  bar  counted from 1 since the start like getStartedBars()
+    void waitForBar(std::uint64_t bar) const;
+
+    /// Sequence number of the last change of the playback that has been handed to the audio callback
+    [[nodiscard]] auto getSubmittedChanges() -> std::uint64_t;
+
+    /// Sequence number of the last change that the calling thread has handed to the audio callback
+    /// \return  0 when the thread has not changed the playback
+    [[nodiscard]] auto getThreadChange() const -> std::uint64_t;
+
+    /// Sequence number up to which the audio callback has applied all changes, some of them may have been dropped
+    [[nodiscard]] auto getAppliedChanges() const -> std::uint64_t;
+
+    /// Frame at which a change took effect, counted from the first frame since the start of the playback
+    /// \param  sequence  of the change, see getSubmittedChanges()
+    /// \return  nothing while the change is pending, when it was dropped or is too old to be remembered
+    [[nodiscard]] auto getChangeFrame(std::uint64_t sequence) const -> std::optional<std::uint64_t>;
+
+    /// Change the volume
+    /// \param  gain  factor that all samples are multiplied with
+    void setGain(SampleType gain);
+
     /// Change the beat that is played back
     /// \param  beatData  The beat that is played back
     void setAccentuatedBeatData(const AudioSignal& beatData);
@@ -120,42 +287,80 @@ public:
     /// Indicates whether the audio playback is running
     [[nodiscard]] auto isRunning() const -> bool;
 
+    /// Change the buffering of the audio device
+    /// \note  The device is opened again, the playback continues afterwards
+    void setDeviceBuffer(const DeviceBufferConfiguration& deviceBuffer);
+
+    /// Buffering that has been negotiated with the audio device
+    /// \return  nothing when there is no open device
+    [[nodiscard]] auto getDeviceBufferInfo() const -> std::optional<DeviceBufferInfo>;
+
+    /// Time from the last start() until its first frame was handed to the device
+    /// \return  nothing when the first frame has not been rendered yet
+    [[nodiscard]] auto getStartLatency() const -> std::optional<std::chrono::nanoseconds>;
+
+    /// Run time, block sizes and xruns of the audio callback since the device has been opened
+    [[nodiscard]] auto getCallbackStatistics() const -> CallbackStatistics;
+
+    /// Onsets of all sounds that have been started, see OnsetLog::read()
+    [[nodiscard]] auto getOnsetLog() const -> const OnsetLog&;
+
 private:
-    /// Start the audio playback
-    void startAudio();
+    /// Fade the beat sounds so that they can be mixed without click/pop noises and hand them to the scheduler
+    void prepareSounds();
 
-    /// Restart the audio playback
-    void restart();
-};
+    /// Variants of a beat and an accent at the rate of the device
+    /// \param  accentSound  the beat is used for the accent when it is empty
+    auto prepareForDevice(const SharedAudioSignal& beatSound, const SharedAudioSignal& accentSound) -> BeatSounds;
 
+    /// Prepare the sounds of a layer for the device
+    [[nodiscard]] auto prepareLayerSounds(const LayerSounds& sounds) -> std::shared_ptr<const BeatSounds>;
 
-}  // namespace mnome
+    /// Prepare the sounds of all layers again, after the format of the device has changed
+    void prepareLayers();
 
+    /// Replace the layers and hand them to the scheduler
+    void publishLayers(BeatLayers layers);
 
-// use BeatType in std::format
-template <>
-struct std::formatter<mnome::BeatType, char>
-{
-    template <class ParseContext>
-    constexpr auto parse(ParseContext& ctx) -> ParseContext::iterator
-    {
-        auto iter = ctx.begin();
-        if (iter == ctx.end()) {
-            return iter;
-        }
-        if (iter != ctx.end() && *iter != '}') {
-            throw std::format_error("Invalid format args for mnome::BeatType.");
-        }
-        return iter;
-    }
-
-    template <class FmtContext>
-    auto format(mnome::BeatType beatType, FmtContext& ctx) const -> FmtContext::iterator
-    {
-        *ctx.out() = std::to_underlying(beatType);
-        return ctx.out();
-    }
+    /// Print pattern and bpm that are played
+    void printPlaybackState() const;
+
+    /// Open the audio device and start it with the output gated
+    /// \return  true when the device is running
+    auto openDevice() -> bool;
+
+    /// Stop and close the audio device
+    void closeDevice();
+
+    /// Hand a command over to the audio callback
+    /// \note  Sequence and boundary of the change of start and change commands are set by this function
+    void submitCommand(PlayerCommand command);
+
+    /// Keep pattern or sounds alive until the next change has been applied
+    void retire(std::shared_ptr<const void> replaced);
+
+    /// Release everything that has been replaced by changes that the scheduler has applied
+    void releaseRetired();
+
+    /// Remember the frames at which the changes that the scheduler has applied in the last block took effect
+    /// \note  Only called by the audio callback
+    void recordChangeFrames();
+
+    /// Render a block and remember the frames of the changes that took effect in it
+    /// \param  blockTime  [ns] of the steady clock at which its first frame leaves the device
+    /// \note  Only called by the audio callback
+    void renderBlock(std::span<SampleType> output, std::int64_t blockTime);
+
+    /// Let a block pass that the device takes no samples of, the beat goes on as if it had been played
+    /// \note  Only called by the audio callback
+    void skipBlock(std::uint32_t frameCount, std::int64_t blockTime);
+
+    /// Called by the audio device whenever it needs new samples
+    static void dataCallback(void* userData, SampleType* pOutput, std::uint32_t frameCount);
 };
 
 
+}  // namespace mnome
+
+
 #endif  //  MNOME_BEATPLAYER_H
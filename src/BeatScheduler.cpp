@@ -0,0 +1,1147 @@
+/// BeatScheduler
+///
+/// Renders a beat pattern block by block by mixing the beat sounds at their onsets
+
+#include "BeatScheduler.hpp"
+#include "MixKernels.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <numbers>
+#include <span>
+#include <utility>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+void SchedulerChange::merge(const SchedulerChange& newer)
+{
+    sequence = newer.sequence;
+    boundary = newer.boundary;
+    bar      = newer.bar;
+    if (newer.bpm != 0) {
+        bpm   = newer.bpm;
+        tempo = nullptr;
+    }
+    if (newer.tempo != nullptr) {
+        tempo = newer.tempo;
+        bpm   = 0;
+    }
+    if (newer.pattern != nullptr) {
+        pattern = newer.pattern;
+    }
+    if (newer.sounds != nullptr) {
+        sounds = newer.sounds;
+    }
+    if (newer.layers != nullptr) {
+        layers = newer.layers;
+    }
+}
+
+void SchedulerChange::dropReplaced(const SchedulerChange& newer)
+{
+    if (newer.bpm != 0 || newer.tempo != nullptr) {
+        bpm   = 0;
+        tempo = nullptr;
+    }
+    if (newer.pattern != nullptr) {
+        pattern = nullptr;
+    }
+    if (newer.sounds != nullptr) {
+        sounds = nullptr;
+    }
+    if (newer.layers != nullptr) {
+        layers = nullptr;
+    }
+}
+
+
+auto BeatLayer::steps() const -> size_t
+{
+    return pattern.size() * subdivision;
+}
+
+
+auto panGains(uint8_t channels, double pan, double gain) -> ChannelGains
+{
+    ChannelGains gains(channels, 0);
+    if (channels <= 1) {
+        gains.assign(channels, static_cast<SampleType>(gain));
+        return gains;
+    }
+    // position between two neighboring channels, the power of both adds up to the power of the sound
+    const double position = (clamp(pan, -1.0, 1.0) + 1) / 2 * (channels - 1);
+    const auto   left     = min(static_cast<size_t>(position), static_cast<size_t>(channels) - 2);
+    const double fraction = position - static_cast<double>(left);
+    gains[left]           = static_cast<SampleType>(gain * cos(fraction * numbers::pi / 2));
+    gains[left + 1]       = static_cast<SampleType>(gain * sin(fraction * numbers::pi / 2));
+    return gains;
+}
+
+auto routeGains(uint8_t channel, double gain) -> ChannelGains
+{
+    ChannelGains gains(static_cast<size_t>(channel) + 1, 0);
+    gains[channel] = static_cast<SampleType>(gain);
+    return gains;
+}
+
+
+BeatClock::BeatClock(double sampleRate, size_t bpm)
+    : framesPerSecond{static_cast<uint64_t>(llround(sampleRate))},
+      piece{.ramp     = TempoRamp::hold,
+            .startBpm = static_cast<double>(bpm),
+            .endBpm   = static_cast<double>(bpm),
+            .beats    = 0},
+      denominator{max<uint64_t>(bpm, 1)}
+{
+}
+
+BeatClock::BeatClock(double sampleRate, const BpmProgram* tempoProgram, size_t barLength)
+    : framesPerSecond{static_cast<uint64_t>(llround(sampleRate))},
+      program{(tempoProgram != nullptr && !tempoProgram->empty()) ? tempoProgram : nullptr},
+      beatsPerBar{max<size_t>(barLength, 1)}
+{
+    loadPiece();
+}
+
+auto BeatClock::nextInterval() -> size_t
+{
+    const uint64_t current = onsetFrame;
+    ++beat;
+    const auto next = position(beat, 0, 1);
+    if (piece.beats != 0 && beat >= piece.beats) {
+        // the next piece starts exactly at this onset, its first frame is the frame of the onset
+        startFraction = next.fraction;
+        ++segmentPiece;
+        loadPiece();
+        beat       = 0;
+        onsetFrame = 0;
+    }
+    else {
+        onsetFrame = next.frame;
+    }
+    return static_cast<size_t>(next.frame - current);
+}
+
+auto BeatClock::offset(uint64_t steps, uint64_t divisions) const -> size_t
+{
+    return static_cast<size_t>(position(beat, steps, divisions).frame - onsetFrame);
+}
+
+auto BeatClock::bpm() const -> double
+{
+    return piece.bpmAt(static_cast<double>(beat));
+}
+
+void BeatClock::setBeatsPerBar(size_t beats)
+{
+    beatsPerBar = max<size_t>(beats, 1);
+}
+
+void BeatClock::loadPiece()
+{
+    if (program == nullptr) {
+        return;
+    }
+    while (segment < program->size() && (*program)[segment].pieces() != 0 &&
+           segmentPiece >= (*program)[segment].pieces()) {
+        ++segment;
+        segmentPiece = 0;
+    }
+    if (segment < program->size()) {
+        piece = (*program)[segment].piece(segmentPiece, beatsPerBar);
+    }
+    else {
+        const auto lastBpm = static_cast<double>(program->back().endBpm());
+        piece = TempoPiece{.ramp = TempoRamp::hold, .startBpm = lastBpm, .endBpm = lastBpm, .beats = 0};
+    }
+    denominator = max<uint64_t>(static_cast<uint64_t>(llround(piece.startBpm)), 1);
+}
+
+auto BeatClock::position(uint64_t beatIdx, uint64_t steps, uint64_t divisions) const -> FramePosition
+{
+    if (piece.ramp == TempoRamp::hold) {
+        // (beatIdx + steps / divisions) * 60 * sampleRate / bpm as a fraction of integers
+        const uint64_t dividend  = ((beatIdx * divisions) + steps) * 60 * framesPerSecond;
+        const uint64_t divisor   = divisions * denominator;
+        const double   remainder = static_cast<double>(dividend % divisor) / static_cast<double>(divisor);
+        const double   fraction  = startFraction + remainder;
+        const uint64_t carry     = (fraction >= 1) ? 1 : 0;
+        return FramePosition{.frame = (dividend / divisor) + carry, .fraction = fraction - static_cast<double>(carry)};
+    }
+    const double beatPosition =
+        static_cast<double>(beatIdx) + (static_cast<double>(steps) / static_cast<double>(divisions));
+    const double exact = startFraction + (static_cast<double>(framesPerSecond) * piece.secondsUntil(beatPosition));
+    const double frame = floor(exact);
+    return FramePosition{.frame = static_cast<uint64_t>(frame), .fraction = exact - frame};
+}
+
+
+BeatScheduler::BeatScheduler(const AudioSignalConfiguration& audioConfig) : config{audioConfig}
+{
+}
+
+void BeatScheduler::setSounds(const BeatSounds* newSounds)
+{
+    sounds = newSounds;
+    dropReplacedVoices();
+}
+
+void BeatScheduler::setPattern(const CompiledPattern* newPattern)
+{
+    pattern    = newPattern;
+    beatEvents = LayerSteps{};
+    if (pattern == nullptr || patternIndex >= pattern->beats) {
+        patternIndex = 0;
+    }
+    if (pattern != nullptr) {
+        clock.setBeatsPerBar(pattern->beats);
+    }
+}
+
+void BeatScheduler::setBPM(size_t bpm)
+{
+    tempoProgram = nullptr;
+    clock        = BeatClock(config.sampleRate, bpm);
+}
+
+void BeatScheduler::setTempo(const BpmProgram* program)
+{
+    tempoProgram = program;
+    clock        = BeatClock(config.sampleRate, program, (pattern != nullptr) ? pattern->beats : 1);
+}
+
+void BeatScheduler::setLayers(const BeatLayers* newLayers)
+{
+    layers = newLayers;
+    layerSteps.fill(LayerSteps{});
+    dropReplacedVoices();
+}
+
+void BeatScheduler::setGain(SampleType newGain)
+{
+    gain = newGain;
+}
+
+void BeatScheduler::setOnsetLog(OnsetLog* log)
+{
+    onsetLog = log;
+}
+
+void BeatScheduler::setBlockTime(int64_t nanoseconds)
+{
+    blockTime = nanoseconds;
+}
+
+void BeatScheduler::reset()
+{
+    patternIndex     = 0;
+    barIndex         = 0;
+    framesUntilOnset = 0;
+    framesSinceOnset = 0;
+    beatEvents       = LayerSteps{};
+    layerSteps.fill(LayerSteps{});
+    voices.fill(Voice{});
+    pendingCount   = 0;
+    appliedCount   = 0;
+    renderedFrames = 0;
+    // a tempo program starts again, too
+    if (tempoProgram != nullptr) {
+        setTempo(tempoProgram);
+    }
+}
+
+void BeatScheduler::requestChange(const SchedulerChange& change)
+{
+    requestedChange = change.sequence;
+    // the parameters of the newest change are the ones that are played in the end
+    for (auto& pending : span(pendingChanges).first(pendingCount)) {
+        pending.change.dropReplaced(change);
+    }
+    if (pendingCount > 0) {
+        auto&      last         = pendingChanges[pendingCount - 1].change;
+        const bool sameBoundary = last.boundary == change.boundary &&
+                                  (change.boundary == ChangeBoundary::beat || last.bar == change.bar);
+        if (sameBoundary || pendingCount == MAX_PENDING_CHANGES) {
+            last.merge(change);
+            return;
+        }
+    }
+    pendingChanges[pendingCount] = PendingChange{.change = change, .first = change.sequence};
+    ++pendingCount;
+}
+
+auto BeatScheduler::lastAppliedChange() const -> uint64_t
+{
+    return appliedChange;
+}
+
+auto BeatScheduler::lastAppliedChangeFrame() const -> uint64_t
+{
+    return appliedChangeFrame;
+}
+
+auto BeatScheduler::changesOfLastBlock() const -> span<const AppliedChanges>
+{
+    return span(appliedChanges).first(appliedCount);
+}
+
+auto BeatScheduler::startedBars() const -> uint64_t
+{
+    return barIndex;
+}
+
+auto BeatScheduler::isPlayable() const -> bool
+{
+    return sounds != nullptr && pattern != nullptr && pattern->beats != 0 && clock.bpm() > 0;
+}
+
+void BeatScheduler::render(span<SampleType> output)
+{
+    ranges::fill(output, static_cast<SampleType>(0));
+    const size_t   channels = config.channels;
+    size_t         frames   = output.size() / channels;
+    const uint64_t blockEnd = renderedFrames + frames;
+    blockFrame              = renderedFrames;
+    appliedCount            = 0;
+
+    // without a running beat there is no onset to wait for
+    if (pendingCount > 0 && !isPlayable()) {
+        applyPendingChanges(renderedFrames, false);
+    }
+    if (!isPlayable()) {
+        renderedFrames = blockEnd;
+        return;
+    }
+
+    while (frames > 0) {
+        // steps at the very end of a beat are played before the next beat is scheduled
+        size_t framesUntilStep = triggerSteps();
+        if (framesUntilOnset == 0) {
+            if (pendingCount > 0) {
+                applyPendingChanges(renderedFrames, true);
+                if (!isPlayable()) {
+                    renderedFrames = blockEnd;
+                    return;
+                }
+            }
+            if (patternIndex == 0) {
+                ++barIndex;
+            }
+            beatClock = clock;
+            scheduleBeatEvents();
+            scheduleLayerSteps();
+            patternIndex     = (patternIndex + 1) % pattern->beats;
+            framesUntilOnset = clock.nextInterval();
+            framesSinceOnset = 0;
+            framesUntilStep  = triggerSteps();
+        }
+        const size_t chunkFrames = min({frames, framesUntilOnset, framesUntilStep});
+        mixVoices(output.first(chunkFrames * channels));
+        output = output.subspan(chunkFrames * channels);
+        frames -= chunkFrames;
+        framesUntilOnset -= chunkFrames;
+        framesSinceOnset += chunkFrames;
+        renderedFrames += chunkFrames;
+    }
+}
+
+void BeatScheduler::applyPendingChanges(uint64_t frame, bool dueOnly)
+{
+    size_t waiting = 0;
+    for (const auto& pending : span(pendingChanges).first(pendingCount)) {
+        const auto& change = pending.change;
+        if (dueOnly && change.boundary == ChangeBoundary::bar && (patternIndex != 0 || barIndex < change.bar)) {
+            pendingChanges[waiting] = pending;
+            ++waiting;
+            continue;
+        }
+        if (change.bpm != 0) {
+            setBPM(change.bpm);
+        }
+        if (change.pattern != nullptr) {
+            setPattern(change.pattern);
+        }
+        // the bars of the program have the length of the new pattern
+        if (change.tempo != nullptr) {
+            setTempo(change.tempo);
+        }
+        if (change.sounds != nullptr) {
+            setSounds(change.sounds);
+        }
+        if (change.layers != nullptr) {
+            setLayers(change.layers);
+        }
+        appliedChanges[appliedCount] = AppliedChanges{.first = pending.first, .last = change.sequence, .frame = frame};
+        ++appliedCount;
+        appliedChangeFrame = frame;
+    }
+    pendingCount = waiting;
+    // a change that still waits holds back the ones that were requested after it
+    appliedChange = (pendingCount > 0) ? max(appliedChange, pendingChanges[0].first - 1) : requestedChange;
+}
+
+void BeatScheduler::scheduleBeatEvents()
+{
+    // the events are ordered by their beat, the ones of the current beat follow each other
+    const auto& events = pattern->events;
+    const auto  first  = ranges::lower_bound(events, patternIndex, {}, &PatternEvent::beat);
+    const auto  last   = ranges::lower_bound(first, events.end(), patternIndex + 1, {}, &PatternEvent::beat);
+    beatEvents.next    = static_cast<size_t>(first - events.begin());
+    beatEvents.end     = static_cast<size_t>(last - events.begin());
+    if (beatEvents.next < beatEvents.end) {
+        beatEvents.offset = beatClock.offset(first->steps, first->divisions);
+    }
+}
+
+auto BeatScheduler::triggerSteps() -> size_t
+{
+    // the pattern goes first, so that its onsets are recorded before those of the layers at the same frame
+    const size_t framesUntilEvent = triggerBeatEvents();
+    return min(framesUntilEvent, triggerLayerSteps());
+}
+
+auto BeatScheduler::triggerBeatEvents() -> size_t
+{
+    while (beatEvents.next < beatEvents.end && beatEvents.offset <= framesSinceOnset) {
+        const auto& event = pattern->events[beatEvents.next];
+        triggerSound(event.type, *sounds, event.gain);
+        if (++beatEvents.next < beatEvents.end) {
+            const auto& nextEvent = pattern->events[beatEvents.next];
+            beatEvents.offset     = beatClock.offset(nextEvent.steps, nextEvent.divisions);
+        }
+    }
+    return (beatEvents.next < beatEvents.end) ? beatEvents.offset - framesSinceOnset : numeric_limits<size_t>::max();
+}
+
+/// Sound and gains of a beat type
+/// \return  nullptr for pauses
+static auto soundOf(BeatType type, const BeatSounds& beatSounds) -> pair<const AudioSignal*, const ChannelGains*>
+{
+    switch (type) {
+    case BeatType::accent:
+        return {beatSounds.accent.get(), &beatSounds.accentGains};
+    case BeatType::beat:
+        return {beatSounds.beat.get(), &beatSounds.beatGains};
+    case BeatType::pause:
+        break;
+    }
+    return {nullptr, nullptr};
+}
+
+void BeatScheduler::triggerSound(BeatType type, const BeatSounds& beatSounds, SampleType velocity, uint8_t layer)
+{
+    const auto [sound, gains] = soundOf(type, beatSounds);
+    if (sound == nullptr) {
+        return;
+    }
+    voices[nextVoice] = Voice{
+        .sound = sound, .gains = gains, .velocity = velocity, .position = 0, .type = type, .layer = layer};
+    nextVoice         = (nextVoice + 1) % MAX_VOICES;
+
+    if (onsetLog != nullptr) {
+        constexpr double nanosecondsPerSecond = 1e9;
+        const double     offset = static_cast<double>(renderedFrames - blockFrame) / config.sampleRate;
+        onsetLog->append(OnsetRecord{.frame      = renderedFrames,
+                                     .deviceTime = blockTime + static_cast<int64_t>(offset * nanosecondsPerSecond),
+                                     .bar        = barIndex,
+                                     .beat       = static_cast<uint32_t>(cycleBeat),
+                                     .layer      = layer,
+                                     .type       = type});
+    }
+}
+
+auto BeatScheduler::activeLayers() const -> size_t
+{
+    return (layers == nullptr) ? 0 : min(layers->size(), MAX_BEAT_LAYERS);
+}
+
+void BeatScheduler::scheduleLayerSteps()
+{
+    cycleBeat  = patternIndex;
+    cycleBeats = pattern->beats;
+    for (size_t layer = 0; layer < activeLayers(); ++layer) {
+        const auto& beatLayer = (*layers)[layer];
+        const auto  steps     = beatLayer.steps();
+        auto&       state     = layerSteps[layer];
+        if (steps == 0 || !beatLayer.sounds) {
+            state = LayerSteps{};
+            continue;
+        }
+        // the steps of the current beat are ceil(cycleBeat * steps / cycleBeats) up to
+        // ceil((cycleBeat + 1) * steps / cycleBeats)
+        state.next   = ((cycleBeat * steps) + cycleBeats - 1) / cycleBeats;
+        state.end    = (((cycleBeat + 1) * steps) + cycleBeats - 1) / cycleBeats;
+        state.offset = layerStepOffset(state.next, steps);
+    }
+}
+
+auto BeatScheduler::layerStepOffset(size_t step, size_t steps) const -> size_t
+{
+    // step lies at beat step * cycleBeats / steps of the cycle, that is (step * cycleBeats - cycleBeat * steps) / steps
+    // of the way through the current beat
+    return beatClock.offset((step * cycleBeats) - (cycleBeat * steps), steps);
+}
+
+auto BeatScheduler::triggerLayerSteps() -> size_t
+{
+    size_t framesUntilStep = numeric_limits<size_t>::max();
+    for (size_t layer = 0; layer < activeLayers(); ++layer) {
+        const auto& beatLayer = (*layers)[layer];
+        auto&       state     = layerSteps[layer];
+        while (state.next < state.end && state.offset <= framesSinceOnset) {
+            triggerSound(beatLayer.pattern[state.next % beatLayer.pattern.size()], *beatLayer.sounds, 1,
+                         static_cast<uint8_t>(layer + 1));
+            ++state.next;
+            state.offset = layerStepOffset(state.next, beatLayer.steps());
+        }
+        if (state.next < state.end) {
+            framesUntilStep = min(framesUntilStep, state.offset - framesSinceOnset);
+        }
+    }
+    return framesUntilStep;
+}
+
+auto BeatScheduler::soundsOf(uint8_t layer) const -> const BeatSounds*
+{
+    if (layer == 0) {
+        return sounds;
+    }
+    return (layers != nullptr && layer <= layers->size()) ? (*layers)[layer - 1].sounds.get() : nullptr;
+}
+
+void BeatScheduler::dropReplacedVoices()
+{
+    for (auto& voice : voices) {
+        if (voice.sound == nullptr) {
+            continue;
+        }
+        // the replaced sounds go away once the change is applied, even when their prepared sound is shared
+        const BeatSounds* source = soundsOf(voice.layer);
+        const auto [sound, gains] =
+            (source != nullptr) ? soundOf(voice.type, *source) : pair<const AudioSignal*, const ChannelGains*>{};
+        if (sound == voice.sound) {
+            voice.gains = gains;
+        }
+        else {
+            voice = Voice{};
+        }
+    }
+}
+
+/// Mix interleaved frames of a sound into interleaved output frames with a gain per output channel
+///
+/// Output channel c takes channel c % sourceChannels of the sound, so a mono sound is spread over all channels.
+static void mixChannels(span<SampleType> output, size_t outputChannels, span<const SampleType> source,
+                        size_t sourceChannels, const ChannelGains& gains, SampleType gain)
+{
+    const size_t frames = output.size() / outputChannels;
+    for (size_t channel = 0; channel < outputChannels; ++channel) {
+        const SampleType channelGain = gains.empty() ? gain : (channel < gains.size() ? gain * gains[channel] : 0);
+        if (channelGain == 0) {
+            continue;
+        }
+        const size_t sourceChannel = channel % sourceChannels;
+        for (size_t frame = 0; frame < frames; ++frame) {
+            output[(frame * outputChannels) + channel] +=
+                channelGain * source[(frame * sourceChannels) + sourceChannel];
+        }
+    }
+}
+
+void BeatScheduler::mixVoices(span<SampleType> output)
+{
+    const size_t outputChannels = config.channels;
+    for (auto& voice : voices) {
+        if (voice.sound == nullptr) {
+            continue;
+        }
+        const auto&  data           = voice.sound->getAudioData();
+        const size_t sourceChannels = max<size_t>(voice.sound->getConfiguration().channels, 1);
+        const size_t soundFrames    = data.size() / sourceChannels;
+        const size_t frames         = min(output.size() / outputChannels, soundFrames - voice.position);
+        const auto   voiceGain      = gain * voice.velocity;
+        const auto   source         = span(data).subspan(voice.position * sourceChannels, frames * sourceChannels);
+        const auto   destination    = output.first(frames * outputChannels);
+
+        // sounds in the format of the output need no routing
+        if (sourceChannels == outputChannels && voice.gains->empty()) {
+            mixMultiplyAdd(destination, source, voiceGain);
+        }
+        else {
+            mixChannels(destination, outputChannels, source, sourceChannels, *voice.gains, voiceGain);
+        }
+        voice.position += frames;
+        if (voice.position >= soundFrames) {
+            voice = Voice{};
+        }
+    }
+    // overlapping voices must not exceed the range of the output
+    mixClamp(output, -1, 1);
+}
+
+
+TEST_CASE("BeatSchedulerTest - onsets across block boundaries")
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    // 600 bpm: one beat every 4800 frames
+    constexpr size_t bpm            = 600;
+    constexpr size_t intervalFrames = 4800;
+
+    // impulses make the onsets visible in the output, the beat lasts for three samples
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{1.0F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.5F, 0.5F, 0.5F}),
+    };
+
+    BeatScheduler scheduler(audioConfig);
+    scheduler.setSounds(&sounds);
+    const auto pattern = MetronomeBeats("!+.+").getCompiledPattern();
+    scheduler.setPattern(&pattern);
+    scheduler.setBPM(bpm);
+
+    // render with a block size that does not divide the beat interval
+    constexpr size_t   blockSize = 1000;
+    AudioDataType      rendered;
+    vector<SampleType> block(blockSize);
+    for (size_t blockIdx = 0; blockIdx < 24; ++blockIdx) {
+        scheduler.render(block);
+        rendered.insert(rendered.end(), block.begin(), block.end());
+    }
+
+    const vector<SampleType> expectedOnsets{1.0F, 0.5F, 0.0F, 0.5F, 1.0F};
+    for (size_t beatIdx = 0; beatIdx < expectedOnsets.size(); ++beatIdx) {
+        const size_t onset = beatIdx * intervalFrames;
+        CHECK_EQ(rendered[onset], expectedOnsets[beatIdx]);
+        CHECK_EQ(rendered[onset + 2], (expectedOnsets[beatIdx] == 0.5F) ? 0.5F : 0.0F);
+        CHECK_EQ(rendered[onset + 3], 0.0F);
+    }
+    CHECK_EQ(count_if(rendered.begin(), rendered.end(), [](SampleType sample) { return sample != 0; }), 1 + 3 + 3 + 1);
+}
+
+TEST_CASE("BeatSchedulerTest - overlapping sounds are mixed")
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    // 6000 bpm at 1 kHz: one beat every 10 frames, but the sound is 15 frames long
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType(15, 0.375F)),
+        .beat   = AudioSignal(audioConfig, AudioDataType(15, 0.375F)),
+    };
+
+    BeatScheduler scheduler(audioConfig);
+    scheduler.setSounds(&sounds);
+    const auto pattern = MetronomeBeats("+").getCompiledPattern();
+    scheduler.setPattern(&pattern);
+    scheduler.setBPM(6000);
+
+    vector<SampleType> block(30);
+    scheduler.render(block);
+    CHECK_EQ(block[9], 0.375F);
+    CHECK_EQ(block[10], 0.75F);
+    CHECK_EQ(block[14], 0.75F);
+    CHECK_EQ(block[15], 0.375F);
+
+    // the sum is limited to the range of the output
+    scheduler.reset();
+    scheduler.setGain(2);
+    scheduler.render(block);
+    CHECK_EQ(block[9], 0.75F);
+    CHECK_EQ(block[10], 1.0F);
+}
+
+TEST_CASE("BeatSchedulerTest - panning and routing to output channels")
+{
+    const auto mono   = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    const auto stereo = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 2};
+    const auto quad   = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 4};
+
+    CHECK_EQ(panGains(1, 0.5, 0.5), ChannelGains{0.5F});
+    const auto center = panGains(2, 0);
+    REQUIRE_EQ(center.size(), 2);
+    CHECK_EQ(center[0], doctest::Approx(sqrt(0.5)));
+    CHECK_EQ(center[1], doctest::Approx(sqrt(0.5)));
+    const ChannelGains left{1.0F, 0.0F};
+    CHECK_EQ(panGains(2, -1), left);
+    const auto right = panGains(4, 1);
+    CHECK_EQ(right[3], doctest::Approx(1.0));
+    CHECK_EQ(right[0] + right[1] + right[2], doctest::Approx(0.0));
+    const ChannelGains third{0.0F, 0.0F, 0.25F};
+    CHECK_EQ(routeGains(2, 0.25), third);
+
+    // 6000 bpm at 1 kHz: one beat every 10 frames
+    const auto pattern = MetronomeBeats("!+").getCompiledPattern();
+
+    SUBCASE("mono sounds are placed on the output channels")
+    {
+        const BeatSounds sounds{
+            .accent      = AudioSignal(mono, AudioDataType{1.0F, 0.5F}),
+            .beat        = AudioSignal(mono, AudioDataType{1.0F}),
+            .accentGains = routeGains(3),
+            .beatGains   = panGains(4, -1, 0.5),
+        };
+        BeatScheduler scheduler(quad);
+        scheduler.setSounds(&sounds);
+        scheduler.setPattern(&pattern);
+        scheduler.setBPM(6000);
+
+        vector<SampleType> block(20 * 4);
+        scheduler.render(block);
+        const vector<SampleType> accent{0, 0, 0, 1.0F, 0, 0, 0, 0.5F, 0, 0, 0, 0};
+        const vector<SampleType> beat{0.5F, 0, 0, 0, 0, 0, 0, 0};
+        CHECK(ranges::equal(span(block).first(accent.size()), accent));
+        CHECK(ranges::equal(span(block).subspan(10 * 4, beat.size()), beat));
+    }
+
+    SUBCASE("sounds with the channels of the output are mixed channel by channel")
+    {
+        const BeatSounds sounds{
+            .accent    = AudioSignal(stereo, AudioDataType{1.0F, -1.0F}),
+            .beat      = AudioSignal(stereo, AudioDataType{0.5F, -0.5F}),
+            .beatGains = ChannelGains{0.0F, 1.0F},
+        };
+        BeatScheduler scheduler(stereo);
+        scheduler.setSounds(&sounds);
+        scheduler.setPattern(&pattern);
+        scheduler.setBPM(6000);
+
+        vector<SampleType> block(20 * 2);
+        scheduler.render(block);
+        CHECK_EQ(block[0], 1.0F);
+        CHECK_EQ(block[1], -1.0F);
+        CHECK_EQ(block[20], 0.0F);
+        CHECK_EQ(block[21], -0.5F);
+        CHECK_EQ(count_if(block.begin(), block.end(), [](SampleType sample) { return sample != 0; }), 3);
+    }
+
+    SUBCASE("a sounding voice moves to the gains of the new sounds")
+    {
+        // new gains share the prepared sound, the old sounds and their gains are gone once the change is applied
+        auto sounds = make_unique<BeatSounds>(BeatSounds{
+            .accent      = AudioSignal(mono, AudioDataType(8, 0.5F)),
+            .beat        = AudioSignal(mono, AudioDataType(8, 0.5F)),
+            .accentGains = routeGains(0),
+        });
+        BeatScheduler scheduler(stereo);
+        scheduler.setSounds(sounds.get());
+        scheduler.setPattern(&pattern);
+        scheduler.setBPM(6000);
+
+        vector<SampleType> block(4 * 2);
+        scheduler.render(block);
+        CHECK_EQ(block[6], 0.5F);
+        CHECK_EQ(block[7], 0.0F);
+
+        const BeatSounds routed{
+            .accent      = sounds->accent,
+            .beat        = sounds->beat,
+            .accentGains = routeGains(1),
+        };
+        scheduler.setSounds(&routed);
+        sounds.reset();
+        scheduler.render(block);
+        CHECK_EQ(block[0], 0.0F);
+        CHECK_EQ(block[1], 0.5F);
+
+        // a voice whose sound is replaced ends
+        const BeatSounds replaced{
+            .accent = AudioSignal(mono, AudioDataType(8, 0.25F)),
+            .beat   = routed.beat,
+        };
+        scheduler.setSounds(&replaced);
+        vector<SampleType> untilBeat(2 * 2);
+        scheduler.render(untilBeat);
+        CHECK(ranges::all_of(untilBeat, [](SampleType sample) -> bool { return sample == 0; }));
+    }
+}
+
+/// Render \p frames frames and return the offsets of all non zero samples
+static auto renderOnsets(BeatScheduler& scheduler, size_t frames, size_t blockSize, size_t offset) -> vector<size_t>
+{
+    vector<size_t>     onsets;
+    vector<SampleType> block(blockSize);
+    for (size_t frame = 0; frame < frames; frame += blockSize) {
+        scheduler.render(block);
+        for (size_t idx = 0; idx < blockSize; ++idx) {
+            if (block[idx] != 0) {
+                onsets.push_back(offset + frame + idx);
+            }
+        }
+    }
+    return onsets;
+}
+
+TEST_CASE("BeatSchedulerTest - onset timeline is continuous across live changes")
+{
+    const auto       audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{1.0F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.5F}),
+    };
+    const auto       pattern     = MetronomeBeats("!+++").getCompiledPattern();
+    const auto       pattern2    = MetronomeBeats("!+").getCompiledPattern();
+    constexpr size_t blockSize   = 480;
+    constexpr size_t interval600 = 4800;  // frames per beat at 600 bpm
+    constexpr size_t interval400 = 7200;  // frames per beat at 400 bpm
+
+    BeatScheduler scheduler(audioConfig);
+    scheduler.setSounds(&sounds);
+    scheduler.setPattern(&pattern);
+    scheduler.setBPM(600);
+
+    SUBCASE("change at the next beat")
+    {
+        // the change is requested in the middle of the third beat
+        auto onsets = renderOnsets(scheduler, 2 * interval600 + 2400, blockSize, 0);
+        scheduler.requestChange(SchedulerChange{.sequence = 1, .boundary = ChangeBoundary::beat, .bpm = 400});
+        CHECK_EQ(scheduler.lastAppliedChange(), 0);
+        const auto later = renderOnsets(scheduler, 3 * interval400, blockSize, 2 * interval600 + 2400);
+        onsets.insert(onsets.end(), later.begin(), later.end());
+        CHECK_EQ(scheduler.lastAppliedChange(), 1);
+        CHECK_EQ(scheduler.lastAppliedChangeFrame(), 3 * interval600);
+
+        const vector<size_t> expected{0, interval600, 2 * interval600, 3 * interval600, 3 * interval600 + interval400,
+                                      3 * interval600 + 2 * interval400};
+        CHECK_EQ(onsets, expected);
+    }
+
+    SUBCASE("change at the next bar")
+    {
+        auto onsets = renderOnsets(scheduler, interval600 + 2400, blockSize, 0);
+        scheduler.requestChange(
+            SchedulerChange{.sequence = 1, .boundary = ChangeBoundary::bar, .bpm = 400, .pattern = &pattern2});
+        const auto later = renderOnsets(scheduler, 5 * interval600, blockSize, interval600 + 2400);
+        onsets.insert(onsets.end(), later.begin(), later.end());
+        CHECK_EQ(scheduler.lastAppliedChange(), 1);
+
+        // the bar is finished at the old tempo before the new pattern starts
+        const vector<size_t> expected{0, interval600, 2 * interval600, 3 * interval600, 4 * interval600,
+                                      4 * interval600 + interval400};
+        CHECK_EQ(onsets, expected);
+    }
+
+    SUBCASE("change at a specific bar")
+    {
+        scheduler.requestChange(SchedulerChange{.sequence = 1, .boundary = ChangeBoundary::bar, .bar = 2, .bpm = 400});
+        const auto onsets = renderOnsets(scheduler, 8 * interval600 + 2 * interval400, blockSize, 0);
+        CHECK_EQ(scheduler.lastAppliedChange(), 1);
+        CHECK_EQ(scheduler.lastAppliedChangeFrame(), 8 * interval600);
+        CHECK_EQ(scheduler.startedBars(), 3);
+
+        vector<size_t> expected;
+        for (size_t beat = 0; beat <= 8; ++beat) {
+            expected.push_back(beat * interval600);
+        }
+        expected.push_back(8 * interval600 + interval400);
+        CHECK_EQ(onsets, expected);
+    }
+
+    SUBCASE("a change at the next beat does not wait for an earlier change at a specific bar")
+    {
+        scheduler.requestChange(SchedulerChange{.sequence = 1, .boundary = ChangeBoundary::bar, .bar = 2, .bpm = 400});
+        scheduler.requestChange(SchedulerChange{.sequence = 2, .boundary = ChangeBoundary::beat, .pattern = &pattern2});
+        auto onsets = renderOnsets(scheduler, blockSize, blockSize, 0);
+        REQUIRE_EQ(scheduler.changesOfLastBlock().size(), 1);
+        CHECK_EQ(scheduler.changesOfLastBlock()[0].first, 2);
+        CHECK_EQ(scheduler.changesOfLastBlock()[0].frame, 0);
+        // the change at the bar is still pending
+        CHECK_EQ(scheduler.lastAppliedChange(), 0);
+
+        // two beats per bar from the start, the tempo changes with the third bar
+        const auto later = renderOnsets(scheduler, 4 * interval600 + interval400, blockSize, blockSize);
+        onsets.insert(onsets.end(), later.begin(), later.end());
+        CHECK_EQ(scheduler.lastAppliedChange(), 2);
+        CHECK_EQ(scheduler.lastAppliedChangeFrame(), 4 * interval600);
+        const vector<size_t> expected{0, interval600, 2 * interval600, 3 * interval600, 4 * interval600,
+                                      4 * interval600 + interval400};
+        CHECK_EQ(onsets, expected);
+    }
+
+    SUBCASE("a later change replaces what a pending change would set")
+    {
+        scheduler.requestChange(SchedulerChange{.sequence = 1, .boundary = ChangeBoundary::bar, .bpm = 400});
+        scheduler.requestChange(SchedulerChange{.sequence = 2, .boundary = ChangeBoundary::beat, .bpm = 300});
+        const auto onsets = renderOnsets(scheduler, 6 * 9600, blockSize, 0);
+        CHECK_EQ(scheduler.lastAppliedChange(), 2);
+
+        // 300 bpm from the start, the change at the next bar has nothing left to set
+        vector<size_t> expected;
+        for (size_t beat = 0; beat < 6; ++beat) {
+            expected.push_back(beat * 9600);
+        }
+        CHECK_EQ(onsets, expected);
+    }
+}
+
+TEST_CASE("BeatSchedulerTest - polyrhythm layers")
+{
+    // 600 bpm at 1 kHz: one beat every 100 frames, one cycle of "!+++" every 400 frames
+    const auto       audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{0.5F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.5F}),
+    };
+    const auto layerSounds = make_shared<const BeatSounds>(BeatSounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{0.25F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.25F}),
+    });
+    const auto pattern = MetronomeBeats("!+++").getCompiledPattern();
+
+    BeatScheduler scheduler(audioConfig);
+    scheduler.setSounds(&sounds);
+    scheduler.setPattern(&pattern);
+    scheduler.setBPM(600);
+
+    SUBCASE("three against four")
+    {
+        const BeatLayers layers{
+            BeatLayer{.pattern = MetronomeBeats("!++").getBeatPattern(), .subdivision = 1, .sounds = layerSounds}};
+        scheduler.setLayers(&layers);
+
+        OnsetLog log;
+        scheduler.setOnsetLog(&log);
+        scheduler.setBlockTime(1'000'000'000);
+        const vector<size_t> expected{0, 100, 133, 200, 266, 300, 400, 500, 533, 600, 666, 700};
+        CHECK_EQ(renderOnsets(scheduler, 768, 64, 0), expected);
+
+        // the sounds of the pattern and of the layer are recorded with their position in the bar
+        uint64_t            cursor = 0;
+        vector<OnsetRecord> onsets;
+        CHECK_EQ(log.read(cursor, onsets), 0);
+        REQUIRE_EQ(onsets.size(), 14);
+        const auto first = OnsetRecord{
+            .frame = 0, .deviceTime = 1'000'000'000, .bar = 1, .beat = 0, .layer = 0, .type = BeatType::accent};
+        const auto layerStep = OnsetRecord{
+            .frame = 133, .deviceTime = 1'005'000'000, .bar = 1, .beat = 1, .layer = 1, .type = BeatType::beat};
+        const auto secondBar = OnsetRecord{
+            .frame = 400, .deviceTime = 1'016'000'000, .bar = 2, .beat = 0, .layer = 1, .type = BeatType::accent};
+        CHECK_EQ(onsets[0], first);
+        CHECK_EQ(onsets[1].layer, 1);
+        CHECK_EQ(onsets[3], layerStep);
+        CHECK_EQ(onsets[8], secondBar);
+    }
+
+    SUBCASE("five against seven stays on the exact grid at an awkward tempo")
+    {
+        // two passes through the layer pattern per cycle: 10 steps against 7 beats
+        const auto       pattern7 = MetronomeBeats("+++++++").getCompiledPattern();
+        const BeatLayers layers{
+            BeatLayer{.pattern = MetronomeBeats("+++++").getBeatPattern(), .subdivision = 2, .sounds = layerSounds}};
+        BeatScheduler scheduler7(audioConfig);
+        scheduler7.setSounds(&sounds);
+        scheduler7.setPattern(&pattern7);
+        scheduler7.setBPM(113);
+        scheduler7.setLayers(&layers);
+
+        constexpr size_t   frames = 600'000;
+        vector<size_t>     layerOnsets;
+        vector<SampleType> block(1000);
+        for (size_t frame = 0; frame < frames; frame += block.size()) {
+            scheduler7.render(block);
+            for (size_t idx = 0; idx < block.size(); ++idx) {
+                if (block[idx] == 0.25F || block[idx] == 0.75F) {
+                    layerOnsets.push_back(frame + idx);
+                }
+            }
+        }
+        // step n lies at beat n * 7 / 10
+        REQUIRE_EQ(layerOnsets.size(), (frames * 113 * 10 / (60'000 * 7)) + 1);
+        bool allOnTime = true;
+        for (size_t step = 0; step < layerOnsets.size(); ++step) {
+            allOnTime = allOnTime && (layerOnsets[step] == step * 7 * 60'000 / (10 * 113));
+        }
+        CHECK(allOnTime);
+    }
+
+    SUBCASE("changing a layer keeps the other layers sounding")
+    {
+        const auto longSounds = make_shared<const BeatSounds>(BeatSounds{
+            .accent = AudioSignal(audioConfig, AudioDataType(30, 0.125F)),
+            .beat   = AudioSignal(audioConfig, AudioDataType(30, 0.125F)),
+        });
+        const auto       once = MetronomeBeats("!").getBeatPattern();
+        const BeatLayers layers{BeatLayer{.pattern = once, .subdivision = 1, .sounds = longSounds},
+                                BeatLayer{.pattern = once, .subdivision = 1, .sounds = layerSounds}};
+        scheduler.setLayers(&layers);
+
+        vector<SampleType> block(10);
+        scheduler.render(block);
+        CHECK_EQ(block[0], 0.875F);
+        CHECK_EQ(block[1], 0.125F);
+
+        // the second layer is muted while the sound of the first one is playing
+        const BeatLayers changed{layers[0], BeatLayer{.pattern = MetronomeBeats(".").getBeatPattern(),
+                                                      .subdivision = 1,
+                                                      .sounds      = layerSounds}};
+        scheduler.setLayers(&changed);
+        vector<SampleType> rest(400);
+        scheduler.render(rest);
+        CHECK_EQ(rest[19], 0.125F);
+        CHECK_EQ(rest[20], 0.0F);
+        CHECK_EQ(rest[390], 0.625F);
+    }
+}
+
+TEST_CASE("BeatSchedulerTest - tempo programs")
+{
+    const auto       audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{1.0F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.5F}),
+    };
+
+    SUBCASE("a ramp over thousands of bars stays on its exact curve")
+    {
+        const auto       pattern = MetronomeBeats("!").getCompiledPattern();
+        const auto       program = parseBpmProgram("60-240:2000,240");
+        constexpr double bars    = 2000;
+        BeatScheduler    scheduler(audioConfig);
+        scheduler.setSounds(&sounds);
+        scheduler.setPattern(&pattern);
+        scheduler.setTempo(&program);
+
+        // beat n of the ramp lies at 60 * bars / (240 - 60) * ln(1 + (240 - 60) * n / (bars * 60)) seconds
+        auto exactOnset = [&](double beat) -> double {
+            return 1'000 * 60 * bars / 180 * log1p(180 * beat / (bars * 60));
+        };
+        const double rampEnd = exactOnset(bars);
+        const auto   onsets  = renderOnsets(scheduler, static_cast<size_t>(rampEnd) + 1000, 1000, 0);
+        REQUIRE_GE(onsets.size(), 2000 + 4);
+        bool allOnTime = true;
+        for (size_t beat = 0; beat < 2000; ++beat) {
+            allOnTime = allOnTime && (onsets[beat] == static_cast<size_t>(exactOnset(static_cast<double>(beat))));
+        }
+        CHECK(allOnTime);
+        // the held tempo continues from the exact end of the ramp, 250 frames per beat at 240 bpm
+        CHECK_EQ(onsets[2000], static_cast<size_t>(rampEnd));
+        CHECK_EQ(onsets[2003], static_cast<size_t>(rampEnd + 750));
+    }
+
+    SUBCASE("a tempo trainer carries fractions of frames from step to step")
+    {
+        // two beats per bar, 20 bpm faster every bar: 600, 500 and 428.57 frames per beat, then 400
+        const auto    pattern = MetronomeBeats("!+").getCompiledPattern();
+        const auto    program = parseBpmProgram("100+20/1:3,150");
+        BeatScheduler scheduler(audioConfig);
+        scheduler.setSounds(&sounds);
+        scheduler.setPattern(&pattern);
+        scheduler.setTempo(&program);
+
+        const vector<size_t> expected{0, 600, 1200, 1700, 2200, 2628, 3057, 3457, 3857, 4257};
+        CHECK_EQ(renderOnsets(scheduler, 4400, 64, 0), expected);
+
+        // a reset starts the program again
+        scheduler.reset();
+        const vector<size_t> restarted{0, 600, 1200};
+        CHECK_EQ(renderOnsets(scheduler, 1300, 100, 0), restarted);
+    }
+
+    SUBCASE("a tempo program replaces the bpm at the next bar")
+    {
+        const auto    pattern = MetronomeBeats("!+").getCompiledPattern();
+        const auto    program = parseBpmProgram("600~300:1");
+        BeatScheduler scheduler(audioConfig);
+        scheduler.setSounds(&sounds);
+        scheduler.setPattern(&pattern);
+        scheduler.setBPM(600);
+        scheduler.requestChange(SchedulerChange{.sequence = 1, .boundary = ChangeBoundary::bar, .bar = 2, .bpm = 300});
+        scheduler.requestChange(
+            SchedulerChange{.sequence = 2, .boundary = ChangeBoundary::bar, .bar = 2, .tempo = &program});
+
+        // beat x of the ramp lies at 60 / (600 * rate) * (1 - e^(-rate * x)) seconds with rate = ln(1 / 2) / 2
+        const auto onsets = renderOnsets(scheduler, 1000, 100, 0);
+        const auto second = static_cast<size_t>(1'000 * 120 * (sqrt(2.0) - 1) / (600 * log(2.0)));
+        const auto third  = static_cast<size_t>(1'000 * 120 / (600 * log(2.0)));
+        CHECK_EQ(scheduler.lastAppliedChange(), 2);
+        const vector<size_t> expected{0, 100, 200, 300, 400, 400 + second, 400 + third, 400 + third + 200};
+        CHECK_EQ(onsets, expected);
+    }
+}
+
+TEST_CASE("BeatSchedulerTest - subdivisions, tuplets and velocity of compiled patterns")
+{
+    // 600 bpm at 1 kHz: one beat every 100 frames
+    const auto       audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{1.0F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.5F}),
+    };
+    const auto pattern = MetronomeBeats("![+@50 +] [+++]").getCompiledPattern();
+
+    BeatScheduler scheduler(audioConfig);
+    scheduler.setSounds(&sounds);
+    scheduler.setPattern(&pattern);
+    scheduler.setBPM(600);
+
+    vector<SampleType> rendered(400);
+    for (size_t frame = 0; frame < rendered.size(); frame += 64) {
+        scheduler.render(span(rendered).subspan(frame, min<size_t>(64, rendered.size() - frame)));
+    }
+    const vector<pair<size_t, SampleType>> expected{{0, 1.0F},   {100, 0.25F}, {150, 0.5F}, {200, 0.5F},
+                                                    {233, 0.5F}, {266, 0.5F},  {300, 1.0F}};
+    for (const auto& [frame, level] : expected) {
+        CHECK_EQ(rendered[frame], level);
+    }
+    CHECK_EQ(count_if(rendered.begin(), rendered.end(), [](SampleType sample) { return sample != 0; }),
+             expected.size());
+}
+
+TEST_CASE("BeatClockTest - no drift over hours at awkward tempos")
+{
+    constexpr uint64_t sampleRate = 48'000;
+    constexpr uint64_t hours      = 10;
+
+    for (const uint64_t bpm : {7, 113, 257}) {
+        BeatClock      clock(sampleRate, bpm);
+        uint64_t       onset     = 0;
+        const uint64_t beats     = hours * 60 * bpm;
+        bool           allOnTime = true;
+        for (uint64_t beatIdx = 1; beatIdx <= beats; ++beatIdx) {
+            onset += clock.nextInterval();
+            // exact onset time in frames, rounded down
+            allOnTime = allOnTime && (onset == beatIdx * 60 * sampleRate / bpm);
+        }
+        CHECK(allOnTime);
+        // after the whole session the clock is exactly at the end of the last beat
+        CHECK_EQ(onset, hours * 3600 * sampleRate);
+    }
+}
+
+TEST_CASE("BeatSchedulerTest - onsets stay on the exact beat grid")
+{
+    // a low sample rate keeps an hour of rendered audio quick
+    const auto       audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{1.0F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{1.0F}),
+    };
+    const auto       pattern   = MetronomeBeats("!+").getCompiledPattern();
+    constexpr size_t frames    = 3'600'000;
+    constexpr size_t blockSize = 1000;
+
+    for (const size_t bpm : {7, 113, 257}) {
+        BeatScheduler scheduler(audioConfig);
+        scheduler.setSounds(&sounds);
+        scheduler.setPattern(&pattern);
+        scheduler.setBPM(bpm);
+
+        const auto onsets = renderOnsets(scheduler, frames, blockSize, 0);
+        REQUIRE_EQ(onsets.size(), 60 * bpm);
+        bool allOnTime = true;
+        for (size_t beatIdx = 0; beatIdx < onsets.size(); ++beatIdx) {
+            allOnTime = allOnTime && (onsets[beatIdx] == beatIdx * 60 * 1'000 / bpm);
+        }
+        CHECK(allOnTime);
+    }
+}
+
+}  // namespace mnome
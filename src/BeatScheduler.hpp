@@ -0,0 +1,367 @@
+/// BeatScheduler
+///
+/// Renders a beat pattern block by block by mixing the beat sounds at their onsets
+
+#ifndef MNOME_BEATSCHEDULER_H
+#define MNOME_BEATSCHEDULER_H
+
+#include "AudioSignal.hpp"
+#include "MetronomeBeats.hpp"
+#include "OnsetLog.hpp"
+#include "TempoProgram.hpp"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+
+namespace mnome {
+
+/// Gain of a sound per output channel
+///
+/// Empty plays the sound at full level on all channels, channels beyond the size are silent.
+using ChannelGains = std::vector<SampleType>;
+
+/// Gains that place a sound between the output channels with a constant power pan law
+/// \param  pan  -1 = first channel, 1 = last channel, positions in between are spread evenly over the channels
+/// \param  gain  level of the sound
+auto panGains(std::uint8_t channels, double pan, double gain = 1) -> ChannelGains;
+
+/// Gains that route a sound to a single output channel
+/// \param  channel  index of the channel, starting at 0
+auto routeGains(std::uint8_t channel, double gain = 1) -> ChannelGains;
+
+/// Sounds that are mixed into the output, one per audible beat type
+///
+/// A sound with one channel is spread over all output channels, a sound with as many channels as the output is mixed
+/// channel by channel. The samples are shared, copies of the sounds do not copy them.
+struct BeatSounds
+{
+    SharedAudioSignal accent;
+    SharedAudioSignal beat;
+    ChannelGains      accentGains{};
+    ChannelGains      beatGains{};
+};
+
+
+/// Maximum number of layers that are played along with the main pattern
+constexpr size_t MAX_BEAT_LAYERS = 8;
+
+/// Pattern that is played along with the main pattern, e.g. for polyrhythms
+///
+/// The steps of a layer are spread evenly over one pass through the main pattern, the cycle: a layer "!++" plays three
+/// against the four beats of "!+++". Every cycle starts the layer again, so it stays locked to the main pattern.
+struct BeatLayer
+{
+    BeatPatternType                   pattern;
+    size_t                            subdivision{1};  //< passes through the layer pattern per cycle
+    std::shared_ptr<const BeatSounds> sounds;
+
+    /// Number of steps per cycle
+    [[nodiscard]] auto steps() const -> size_t;
+};
+
+/// Layers that are played along with the main pattern, only the first MAX_BEAT_LAYERS are played
+using BeatLayers = std::vector<BeatLayer>;
+
+
+/// Onset at which a requested change takes effect
+enum class ChangeBoundary
+{
+    beat,  //< next beat
+    bar,   //< first beat of the next pass through the pattern, or of a specific bar
+};
+
+
+/// Change of the scheduler parameters while rendering, members that are not set are kept
+struct SchedulerChange
+{
+    std::uint64_t          sequence{0};  //< increasing identifier of the change
+    ChangeBoundary         boundary{ChangeBoundary::beat};
+    std::uint64_t          bar{0};  //< with ChangeBoundary::bar: earliest bar to start with the change, 0 = next bar
+    size_t                 bpm{0};  //< 0 keeps the current bpm
+    const BpmProgram*      tempo{nullptr};  //< replaces the bpm, nullptr keeps the current tempo
+    const CompiledPattern* pattern{nullptr};
+    const BeatSounds*      sounds{nullptr};
+    const BeatLayers*      layers{nullptr};  //< nullptr keeps the layers, an empty list removes them
+
+    /// Take over sequence, boundary and bar and all parameters that are set in \p newer
+    void merge(const SchedulerChange& newer);
+
+    /// Keep only the parameters that \p newer does not set, a newer change wins over one that is applied later
+    void dropReplaced(const SchedulerChange& newer);
+};
+
+
+/// Changes that took effect at the same onset
+struct AppliedChanges
+{
+    std::uint64_t first{0};  //< sequence number of the first change, the changes up to last are merged
+    std::uint64_t last{0};
+    std::uint64_t frame{0};  //< at which they took effect, counted from the first frame after the last reset
+};
+
+
+/// Exact onset positions for a constant tempo or a tempo program
+///
+/// Every onset is placed on the frame at or right before its exact position, the error stays below one frame
+/// regardless of how long the clock runs. The position of an onset is evaluated from the start of its tempo piece
+/// (see TempoPiece), nothing is summed up beat by beat: the beat interval 60 * sampleRate / bpm of a constant tempo
+/// is kept as a fraction of integers, ramps are integrated in closed form. Only the fraction of a frame at which a
+/// piece starts is carried over from the piece before.
+class BeatClock
+{
+private:
+    /// Position in frames from the first frame of the current piece
+    struct FramePosition
+    {
+        std::uint64_t frame{0};
+        double        fraction{0};  //< [0, 1)
+    };
+
+    std::uint64_t     framesPerSecond{0};
+    const BpmProgram* program{nullptr};
+    size_t            beatsPerBar{1};
+    size_t            segment{0};       //< segment of the program that is played
+    std::uint64_t     segmentPiece{0};  //< piece of the segment that is played
+    TempoPiece        piece;
+    std::uint64_t     denominator{1};    //< bpm of a constant tempo
+    double            startFraction{0};  //< fraction of a frame by which the piece starts after its first frame
+    std::uint64_t     beat{0};           //< current onset, counted from the start of the piece
+    std::uint64_t     onsetFrame{0};     //< frame of the current onset
+
+public:
+    BeatClock() = default;
+    BeatClock(double sampleRate, size_t bpm);
+
+    /// Clock that follows a tempo program from its first beat on
+    /// \param  tempoProgram  valid program (see checkBpmProgram()), must stay alive as long as the clock
+    /// \param  barLength  number of beats per bar of the program
+    BeatClock(double sampleRate, const BpmProgram* tempoProgram, size_t barLength);
+
+    /// Advance to the next onset
+    /// \return  number of frames from the current onset to the next one
+    auto nextInterval() -> size_t;
+
+    /// Frames from the current onset to the position \p steps / \p divisions of the way to the next onset
+    /// \note  Rounded down to a frame like the onsets, the error does not add up either
+    [[nodiscard]] auto offset(std::uint64_t steps, std::uint64_t divisions) const -> size_t;
+
+    /// Tempo at the current onset, 0 when there is no tempo
+    [[nodiscard]] auto bpm() const -> double;
+
+    /// Change the length of the bars of the program
+    /// \note  Takes effect with the next piece of the program
+    void setBeatsPerBar(size_t beats);
+
+private:
+    /// Make the current piece of the program the piece that is played, the last tempo is held when the program ends
+    void loadPiece();
+
+    /// Exact position of beat + steps / divisions of the current piece
+    [[nodiscard]] auto position(std::uint64_t beatIdx, std::uint64_t steps, std::uint64_t divisions) const
+        -> FramePosition;
+};
+
+
+/// Renders a beat pattern into consecutive blocks of audio
+///
+/// Only the beat sounds are kept in memory, nothing is rendered ahead of time. Every onset starts a voice that
+/// plays the sound of its beat type, voices are mixed into the output until their sound has ended. The onsets of the
+/// compiled pattern are walked beat by beat, onsets within a beat are placed like the steps of the layers.
+///
+/// The layers are placed within each beat of the main pattern, the cost per block grows with the number of onsets and
+/// layers but not with the length of their patterns. Tempo programs cost the same, every onset of a ramp is
+/// evaluated in closed form.
+///
+/// Pattern, tempo program, sounds and layers are not owned by the scheduler, they must stay alive until a change that
+/// replaces them has been applied (see lastAppliedChange()).
+class BeatScheduler
+{
+private:
+    /// A sound that is currently played back
+    struct Voice
+    {
+        const AudioSignal*  sound{nullptr};
+        const ChannelGains* gains{nullptr};  //< owned by the sounds of the layer, rebound when they are replaced
+        SampleType          velocity{1};
+        size_t              position{0};  //< next frame of sound to be played
+        BeatType            type{BeatType::pause};
+        std::uint8_t        layer{0};  //< 0 for the main pattern, n for the n-th layer
+    };
+
+    /// Steps of a layer or onsets of the pattern that fall into the current beat of the main pattern
+    struct LayerSteps
+    {
+        size_t next{0};    //< step of the cycle that is played next
+        size_t end{0};     //< first step of the cycle that falls into the next beat
+        size_t offset{0};  //< frames from the onset of the current beat to step next
+    };
+
+    /// Maximum number of sounds that may overlap, the oldest voice is replaced when exceeded
+    static constexpr size_t MAX_VOICES = 16;
+
+    AudioSignalConfiguration config;
+    const BeatSounds*        sounds{nullptr};
+    const CompiledPattern*   pattern{nullptr};
+    const BpmProgram*        tempoProgram{nullptr};  //< nullptr for a constant tempo
+    BeatClock                clock;
+    size_t                   patternIndex{0};
+    std::uint64_t            barIndex{0};   //< bar that starts at the next first beat of the pattern
+    LayerSteps               beatEvents{};  //< onsets of the pattern in the current beat, indices of its events
+    size_t                   framesUntilOnset{0};
+    SampleType               gain{1.0F};
+
+    // layers are placed relative to the onset of the current beat of the main pattern
+    const BeatLayers*                       layers{nullptr};
+    std::array<LayerSteps, MAX_BEAT_LAYERS> layerSteps{};
+    BeatClock                               beatClock;  //< clock at the onset of the current beat
+    size_t                                  cycleBeat{0};
+    size_t                                  cycleBeats{1};
+    size_t                                  framesSinceOnset{0};
+
+    std::array<Voice, MAX_VOICES> voices{};
+    size_t                        nextVoice{0};
+
+    /// Requested changes that wait for their boundary
+    struct PendingChange
+    {
+        SchedulerChange change;
+        std::uint64_t   first{0};  //< sequence number of the first change that was merged into it
+    };
+
+    /// Maximum number of changes with different boundaries that wait at once, further ones are merged into the last
+    static constexpr size_t MAX_PENDING_CHANGES = 8;
+
+    std::array<PendingChange, MAX_PENDING_CHANGES>  pendingChanges{};  //< ordered by sequence number
+    size_t                                          pendingCount{0};
+    std::array<AppliedChanges, MAX_PENDING_CHANGES> appliedChanges{};  //< during the last block
+    size_t                                          appliedCount{0};
+
+    std::uint64_t requestedChange{0};     //< latest change that has been requested
+    std::uint64_t appliedChange{0};       //< changes up to it have been applied
+    std::uint64_t appliedChangeFrame{0};  //< frame at which the last applied change took effect
+    std::uint64_t renderedFrames{0};      //< since the last reset, up to the frame that is rendered
+
+    // onsets are stamped with the time at which the device plays them
+    OnsetLog*     onsetLog{nullptr};
+    std::int64_t  blockTime{0};   //< [ns] at which the first frame of the block leaves the device
+    std::uint64_t blockFrame{0};  //< first frame of the block
+
+public:
+    explicit BeatScheduler(const AudioSignalConfiguration& audioConfig);
+
+    /// Set the sounds that are mixed at the onsets
+    /// \param  newSounds  sounds to be played, nullptr renders silence
+    void setSounds(const BeatSounds* newSounds);
+
+    /// Set the pattern that is walked through beat by beat
+    /// \param  newPattern  onsets to be played, see compilePattern(), nullptr renders silence
+    void setPattern(const CompiledPattern* newPattern);
+
+    /// Set the beats per minute
+    /// \note  The new tempo starts with the next onset
+    void setBPM(size_t bpm);
+
+    /// Set a tempo program, it starts with the next onset
+    /// \param  program  tempo to be played (see checkBpmProgram()), nullptr renders silence
+    /// \note  The bars of the program have the length of the pattern when its pieces start
+    void setTempo(const BpmProgram* program);
+
+    /// Set the layers that are played along with the pattern
+    /// \param  newLayers  layers to be played, nullptr or an empty list for none
+    /// \note  The layers start with the next beat of the pattern, voices of layers that are kept continue to sound
+    void setLayers(const BeatLayers* newLayers);
+
+    /// Record the onsets of the sounds that are started from now on
+    /// \param  log  nullptr records nothing, must outlive the scheduler otherwise
+    void setOnsetLog(OnsetLog* log);
+
+    /// Set the time at which the first frame of the next block leaves the device
+    /// \param  nanoseconds  of the steady clock, the onsets are stamped with it
+    void setBlockTime(std::int64_t nanoseconds);
+
+    /// Set the factor that all samples are multiplied with
+    /// \note  Takes effect immediately
+    void setGain(SampleType newGain);
+
+    /// Start again at the first beat of the pattern and drop all sounding voices and pending changes
+    void reset();
+
+    /// Request a change that is applied at the next onset that matches its boundary
+    /// \note  It is merged with the last pending change of the same boundary and bar, pending changes with other
+    ///        boundaries wait on their own but lose the parameters that \p change sets
+    void requestChange(const SchedulerChange& change);
+
+    /// Sequence number up to which all changes have been applied
+    /// \note  A change that waits for a later bar holds back the number of the changes that were requested after it
+    [[nodiscard]] auto lastAppliedChange() const -> std::uint64_t;
+
+    /// Frame at which the last change took effect, counted from the first frame after the last reset
+    [[nodiscard]] auto lastAppliedChangeFrame() const -> std::uint64_t;
+
+    /// Changes that were applied during the last rendered block, in the order of their sequence numbers
+    [[nodiscard]] auto changesOfLastBlock() const -> std::span<const AppliedChanges>;
+
+    /// Number of bars that have been started since the last reset
+    [[nodiscard]] auto startedBars() const -> std::uint64_t;
+
+    /// Render the next block of audio
+    /// \param  output  interleaved samples that are overwritten
+    void render(std::span<SampleType> output);
+
+private:
+    /// Indicates whether there is anything to render
+    [[nodiscard]] auto isPlayable() const -> bool;
+
+    /// Apply the pending changes
+    /// \param  frame  position since the last reset at which they take effect
+    /// \param  dueOnly  only those whose boundary is reached at the current onset, otherwise all
+    void applyPendingChanges(std::uint64_t frame, bool dueOnly);
+
+    /// Find the onsets of the pattern that fall into the beat at the current pattern index
+    void scheduleBeatEvents();
+
+    /// Start voices for the onsets of the pattern and then for the layer steps that are due
+    /// \return  frames until the next onset or step within the current beat
+    auto triggerSteps() -> size_t;
+
+    /// Start voices for the onsets of the pattern that are due
+    /// \return  frames until the next onset of the pattern within the current beat
+    auto triggerBeatEvents() -> size_t;
+
+    /// Start a voice with the sound of a beat type
+    /// \param  layer  0 for the main pattern, n for the n-th layer, to record the onset
+    void triggerSound(BeatType type, const BeatSounds& beatSounds, SampleType velocity = 1, std::uint8_t layer = 0);
+
+    /// Number of layers that are played
+    [[nodiscard]] auto activeLayers() const -> size_t;
+
+    /// Find the steps of all layers that fall into the beat at the current pattern index
+    void scheduleLayerSteps();
+
+    /// Frames from the onset of the current beat to a step of a layer in it
+    [[nodiscard]] auto layerStepOffset(size_t step, size_t steps) const -> size_t;
+
+    /// Start voices for the layer steps that are due
+    /// \return  frames until the next layer step of the current beat
+    auto triggerLayerSteps() -> size_t;
+
+    /// Sounds of the main pattern or of a layer
+    /// \param  layer  0 for the main pattern, n for the n-th layer
+    /// \return  nullptr when there is no such layer
+    [[nodiscard]] auto soundsOf(std::uint8_t layer) const -> const BeatSounds*;
+
+    /// Let the voices play on with the gains of the new sounds of their layer, drop those whose sound was replaced
+    void dropReplacedVoices();
+
+    /// Mix all sounding voices into output and limit the result to [-1, 1]
+    void mixVoices(std::span<SampleType> output);
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_BEATSCHEDULER_H
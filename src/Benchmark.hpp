@@ -0,0 +1,178 @@
+/// Benchmark
+///
+/// Minimal helpers to measure the run time of functions and to report the results
+
+#ifndef MNOME_BENCHMARK_H
+#define MNOME_BENCHMARK_H
+
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <print>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace mnome {
+
+/// Run time of a benchmarked function
+struct BenchmarkResult
+{
+    std::string                               name;
+    size_t                                    iterations{0};
+    std::chrono::duration<double, std::micro> meanTime{0};  //< per iteration
+};
+
+
+/// Keep the compiler from optimizing away the computation of value
+template <typename T>
+inline void doNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static const void* volatile sink = nullptr;
+    sink                             = &value;
+#endif
+}
+
+
+/// Call function repeatedly and return the mean time per call
+/// \param  name  name of the benchmark
+/// \param  function  function to be measured, it is called at least once
+/// \param  minDuration  the function is called until this time has passed
+template <typename Function>
+auto measure(std::string_view name, Function&& function,
+             std::chrono::milliseconds minDuration = std::chrono::milliseconds(200)) -> BenchmarkResult
+{
+    using Clock = std::chrono::steady_clock;
+
+    size_t     iterations = 0;
+    const auto start      = Clock::now();
+    auto       elapsed    = Clock::duration{0};
+    do {
+        function();
+        ++iterations;
+        elapsed = Clock::now() - start;
+    } while (elapsed < minDuration);
+
+    return BenchmarkResult{
+        .name       = std::string(name),
+        .iterations = iterations,
+        .meanTime   = std::chrono::duration<double, std::micro>(elapsed) / static_cast<double>(iterations),
+    };
+}
+
+
+/// Parameters of one point of a parameter sweep as pairs of name and value
+using BenchmarkParameters = std::vector<std::pair<std::string, std::string>>;
+
+/// Output formats of the benchmark results
+enum class BenchmarkFormat
+{
+    table,
+    csv,
+    json,
+};
+
+/// Runs benchmarks and reports all results at the end
+class BenchmarkSuite
+{
+private:
+    struct Entry
+    {
+        std::string         group;
+        BenchmarkParameters parameters;
+        BenchmarkResult     result;
+        double              itemsPerCall{0};  //< e.g. samples, 0 when there is no throughput
+    };
+
+    std::vector<Entry>        entries;
+    std::string               filter;
+    std::chrono::milliseconds minDuration;
+
+public:
+    /// Ctor
+    /// \param  nameFilter  only benchmarks whose name contains this string are run
+    /// \param  minRunTime  time each benchmark is repeated for
+    BenchmarkSuite(std::string nameFilter, std::chrono::milliseconds minRunTime)
+        : filter{std::move(nameFilter)}, minDuration{minRunTime}
+    {
+    }
+
+    /// Measure a function unless it is filtered out, the progress is written to stderr
+    /// \param  group  what is measured, e.g. the name of the function
+    /// \param  parameters  parameters of the sweep that function uses
+    /// \param  itemsPerCall  number of items, e.g. samples, that function processes per call
+    template <typename Function>
+    void run(std::string_view group, BenchmarkParameters parameters, double itemsPerCall, Function&& function)
+    {
+        std::string name(group);
+        for (const auto& [parameter, value] : parameters) {
+            name += std::format(" {}={}", parameter, value);
+        }
+        if (name.find(filter) == std::string::npos) {
+            return;
+        }
+        std::println(stderr, "{}", name);
+        entries.push_back(Entry{
+            .group        = std::string(group),
+            .parameters   = std::move(parameters),
+            .result       = measure(name, std::forward<Function>(function), minDuration),
+            .itemsPerCall = itemsPerCall,
+        });
+    }
+
+    /// Write all results to stdout
+    void report(BenchmarkFormat format) const
+    {
+        switch (format) {
+        case BenchmarkFormat::table:
+            std::println("{:<64} {:>12} {:>14} {:>16}", "benchmark", "iterations", "mean [us]", "items/s");
+            for (const auto& entry : entries) {
+                std::println("{:<64} {:>12} {:>14.3f} {:>16.4g}", entry.result.name, entry.result.iterations,
+                             entry.result.meanTime.count(), itemsPerSecond(entry));
+            }
+            break;
+        case BenchmarkFormat::csv:
+            std::println("group,parameters,iterations,mean_us,items_per_s");
+            for (const auto& entry : entries) {
+                std::string parameters;
+                for (const auto& [parameter, value] : entry.parameters) {
+                    parameters += std::format("{}{}={}", parameters.empty() ? "" : ";", parameter, value);
+                }
+                std::println("{},{},{},{:.6f},{:.6g}", entry.group, parameters, entry.result.iterations,
+                             entry.result.meanTime.count(), itemsPerSecond(entry));
+            }
+            break;
+        case BenchmarkFormat::json:
+            std::println("[");
+            for (size_t idx = 0; idx < entries.size(); ++idx) {
+                const auto& entry = entries[idx];
+                std::string parameters;
+                for (const auto& [parameter, value] : entry.parameters) {
+                    parameters += std::format("{}\"{}\": \"{}\"", parameters.empty() ? "" : ", ", parameter, value);
+                }
+                std::println("  {{\"group\": \"{}\", \"parameters\": {{{}}}, \"iterations\": {}, \"mean_us\": {:.6f}, "
+                             "\"items_per_s\": {:.6g}}}{}",
+                             entry.group, parameters, entry.result.iterations, entry.result.meanTime.count(),
+                             itemsPerSecond(entry), idx + 1 < entries.size() ? "," : "");
+            }
+            std::println("]");
+            break;
+        }
+    }
+
+private:
+    static auto itemsPerSecond(const Entry& entry) -> double
+    {
+        const double seconds = entry.result.meanTime.count() / 1e6;
+        return seconds > 0 ? entry.itemsPerCall / seconds : 0;
+    }
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_BENCHMARK_H
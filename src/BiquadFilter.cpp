@@ -0,0 +1,252 @@
+/// BiquadFilter
+///
+/// Design of second-order filter sections for any sample rate and their application to interleaved audio
+
+#include "BiquadFilter.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <vector>
+
+
+namespace mnome {
+
+using namespace std;
+
+/// Offset added to the input of every section
+///
+/// Decaying signals would otherwise end up as subnormal numbers in the state, which are very slow to compute with on
+/// many CPUs. The offset is far below the resolution of any output format.
+constexpr SampleType DENORMAL_OFFSET = 1e-18F;
+
+auto designBiquad(FilterType type, double sampleRate, double cutoff, double quality) -> BiquadCoefficients
+{
+    const double omega = 2 * numbers::pi * cutoff / sampleRate;
+    const double alpha = sin(omega) / (2 * quality);
+    const double cosW  = cos(omega);
+    const double a0    = 1 + alpha;
+
+    BiquadCoefficients coefficients{
+        .b0 = 0,
+        .b1 = 0,
+        .b2 = 0,
+        .a1 = -2 * cosW / a0,
+        .a2 = (1 - alpha) / a0,
+    };
+    switch (type) {
+    case FilterType::lowPass:
+        coefficients.b1 = (1 - cosW) / a0;
+        coefficients.b0 = coefficients.b1 / 2;
+        break;
+    case FilterType::highPass:
+        coefficients.b1 = -(1 + cosW) / a0;
+        coefficients.b0 = -coefficients.b1 / 2;
+        break;
+    }
+    coefficients.b2 = coefficients.b0;
+    return coefficients;
+}
+
+/// First-order low or high pass with the bilinear transform
+static auto designFirstOrder(FilterType type, double sampleRate, double cutoff) -> BiquadCoefficients
+{
+    const double warped = tan(numbers::pi * cutoff / sampleRate);
+
+    BiquadCoefficients coefficients{
+        .b0 = 0,
+        .b1 = 0,
+        .b2 = 0,
+        .a1 = (warped - 1) / (warped + 1),
+        .a2 = 0,
+    };
+    switch (type) {
+    case FilterType::lowPass:
+        coefficients.b0 = warped / (warped + 1);
+        coefficients.b1 = coefficients.b0;
+        break;
+    case FilterType::highPass:
+        coefficients.b0 = 1 / (warped + 1);
+        coefficients.b1 = -coefficients.b0;
+        break;
+    }
+    return coefficients;
+}
+
+auto designButterworth(FilterType type, double sampleRate, double cutoff, size_t order) -> vector<BiquadCoefficients>
+{
+    // the poles of an analog Butterworth filter come in pairs, each pair is one section with its own Q
+    vector<BiquadCoefficients> sections;
+    for (size_t pair = 0; pair < order / 2; ++pair) {
+        const double angle = numbers::pi * static_cast<double>(2 * pair + 1) / static_cast<double>(2 * order);
+        sections.push_back(designBiquad(type, sampleRate, cutoff, 1 / (2 * sin(angle))));
+    }
+    if (order % 2 == 1) {
+        sections.push_back(designFirstOrder(type, sampleRate, cutoff));
+    }
+    return sections;
+}
+
+auto magnitudeResponse(span<const BiquadCoefficients> sections, double sampleRate, double frequency) -> double
+{
+    const auto z1 = polar(1.0, -2 * numbers::pi * frequency / sampleRate);
+    const auto z2 = z1 * z1;
+
+    complex<double> response = 1;
+    for (const auto& section : sections) {
+        response *= (section.b0 + section.b1 * z1 + section.b2 * z2) / (1.0 + section.a1 * z1 + section.a2 * z2);
+    }
+    return abs(response);
+}
+
+
+BiquadCascade::BiquadCascade(span<const BiquadCoefficients> coefficients, uint8_t channelCount)
+    : channels{channelCount}, state(2 * coefficients.size() * channelCount, 0)
+{
+    sections.reserve(coefficients.size());
+    for (const auto& section : coefficients) {
+        sections.push_back(Section{
+            .b0 = static_cast<SampleType>(section.b0),
+            .b1 = static_cast<SampleType>(section.b1),
+            .b2 = static_cast<SampleType>(section.b2),
+            .a1 = static_cast<SampleType>(section.a1),
+            .a2 = static_cast<SampleType>(section.a2),
+        });
+    }
+}
+
+void BiquadCascade::process(span<SampleType> data)
+{
+    if (channels == 0) {
+        return;
+    }
+    const size_t frames = data.size() / channels;
+    for (size_t frame = 0; frame < frames; ++frame) {
+        const auto samples = data.subspan(frame * channels, channels);
+        for (size_t secIdx = 0; secIdx < sections.size(); ++secIdx) {
+            const Section& section = sections[secIdx];
+            const auto     z1      = span(state).subspan(2 * secIdx * channels, channels);
+            const auto     z2      = span(state).subspan((2 * secIdx + 1) * channels, channels);
+            // the channels are independent of each other, the loop is vectorized for many channels
+            for (size_t channel = 0; channel < channels; ++channel) {
+                const SampleType input  = samples[channel] + DENORMAL_OFFSET;
+                const SampleType output = (section.b0 * input) + z1[channel];
+                z1[channel]             = (section.b1 * input) - (section.a1 * output) + z2[channel];
+                z2[channel]             = (section.b2 * input) - (section.a2 * output);
+                samples[channel]        = output;
+            }
+        }
+    }
+}
+
+void BiquadCascade::reset()
+{
+    ranges::fill(state, static_cast<SampleType>(0));
+}
+
+
+TEST_CASE("BiquadFilterTest - matches the former coefficients for 48 kHz")
+{
+    // former coefficients of lowPass20KHz designed by mkfilter, with H(z) = (1 + 2z^-1 + z^-2) / gain / (...)
+    const auto lowPass = designBiquad(FilterType::lowPass, 48'000, 20'000, 1 / numbers::sqrt2);
+    CHECK_EQ(lowPass.b0, doctest::Approx(1 / 1.450734152e+00).epsilon(1e-8));
+    CHECK_EQ(lowPass.b1, doctest::Approx(2 / 1.450734152e+00).epsilon(1e-8));
+    CHECK_EQ(lowPass.b2, doctest::Approx(1 / 1.450734152e+00).epsilon(1e-8));
+    CHECK_EQ(lowPass.a1, doctest::Approx(1.2796324250).epsilon(1e-8));
+    CHECK_EQ(lowPass.a2, doctest::Approx(0.4775922501).epsilon(1e-8));
+
+    // former denominator of highPass20Hz
+    const auto highPass = designBiquad(FilterType::highPass, 48'000, 20, 1 / numbers::sqrt2);
+    CHECK_EQ(highPass.a1, doctest::Approx(-1.9962976018).epsilon(1e-8));
+    CHECK_EQ(highPass.a2, doctest::Approx(0.9963044430).epsilon(1e-8));
+    CHECK_EQ(highPass.b0, doctest::Approx(1 / 1.001852916e+00).epsilon(1e-8));
+    CHECK_EQ(highPass.b1, doctest::Approx(-2 / 1.001852916e+00).epsilon(1e-8));
+}
+
+TEST_CASE("BiquadFilterTest - Butterworth responses at any sample rate")
+{
+    // the bilinear transform maps the analog Butterworth response to |H|^2 = 1 / (1 + (tan(w/2) / tan(wc/2))^(2N))
+    auto reference = [](FilterType type, double sampleRate, double cutoff, size_t order, double frequency) -> double {
+        double ratio = tan(numbers::pi * frequency / sampleRate) / tan(numbers::pi * cutoff / sampleRate);
+        if (type == FilterType::highPass) {
+            ratio = 1 / ratio;
+        }
+        return 1 / sqrt(1 + pow(ratio, 2 * static_cast<double>(order)));
+    };
+
+    for (const double sampleRate : {22'050.0, 44'100.0, 48'000.0, 96'000.0}) {
+        for (const size_t order : {1, 2, 3, 4, 8}) {
+            for (const auto type : {FilterType::lowPass, FilterType::highPass}) {
+                const double cutoff   = sampleRate / 8;
+                const auto   sections = designButterworth(type, sampleRate, cutoff, order);
+                CHECK_EQ(sections.size(), (order + 1) / 2);
+                CHECK_EQ(magnitudeResponse(sections, sampleRate, cutoff), doctest::Approx(1 / numbers::sqrt2));
+                for (double frequency = 10; frequency < sampleRate / 2; frequency *= 1.5) {
+                    CHECK_EQ(magnitudeResponse(sections, sampleRate, frequency),
+                             doctest::Approx(reference(type, sampleRate, cutoff, order, frequency)).epsilon(1e-6));
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("BiquadFilterTest - processing interleaved channels")
+{
+    constexpr double sampleRate = 48'000;
+    constexpr size_t channels   = 2;
+    constexpr size_t frames     = 48'000;
+    constexpr size_t blockSize  = 100;
+    const array      frequencies{1'000.0, 6'000.0};
+
+    const auto sections = designButterworth(FilterType::lowPass, sampleRate, 3'000, 4);
+
+    vector<SampleType> data(frames * channels);
+    for (size_t frame = 0; frame < frames; ++frame) {
+        for (size_t channel = 0; channel < channels; ++channel) {
+            const double phase                 = 2 * numbers::pi * frequencies[channel] * static_cast<double>(frame);
+            data[(frame * channels) + channel] = static_cast<SampleType>(sin(phase / sampleRate));
+        }
+    }
+
+    // the result must not depend on the block size
+    auto          wholeSignal = data;
+    BiquadCascade cascade(sections, channels);
+    cascade.process(wholeSignal);
+    cascade.reset();
+    for (size_t start = 0; start < data.size(); start += blockSize * channels) {
+        cascade.process(span(data).subspan(start, min(blockSize * channels, data.size() - start)));
+    }
+    CHECK(data == wholeSignal);
+
+    // each channel is attenuated according to its own frequency once the filter has settled, the second half of the
+    // signal contains whole periods of both sines
+    for (size_t channel = 0; channel < channels; ++channel) {
+        double energy = 0;
+        for (size_t frame = frames / 2; frame < frames; ++frame) {
+            energy += pow(data[(frame * channels) + channel], 2);
+        }
+        const double amplitude = sqrt(2 * energy / (frames / 2));
+        CHECK_EQ(amplitude, doctest::Approx(magnitudeResponse(sections, sampleRate, frequencies[channel])).epsilon(1e-3));
+    }
+}
+
+TEST_CASE("BiquadFilterTest - no subnormal numbers while decaying")
+{
+    const auto    sections = designButterworth(FilterType::lowPass, 48'000, 20, 2);
+    BiquadCascade cascade(sections, 1);
+
+    // an impulse decays below the smallest normal float after roughly 25000 samples without protection
+    vector<SampleType> data(200'000, 0);
+    data[0] = 1;
+    cascade.process(data);
+    CHECK(ranges::none_of(data, [](SampleType sample) { return fpclassify(sample) == FP_SUBNORMAL; }));
+}
+
+}  // namespace mnome
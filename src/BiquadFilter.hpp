@@ -0,0 +1,92 @@
+/// BiquadFilter
+///
+/// Design of second-order filter sections for any sample rate and their application to interleaved audio
+
+#ifndef MNOME_BIQUADFILTER_HPP
+#define MNOME_BIQUADFILTER_HPP
+
+#include "AudioSignal.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+
+namespace mnome {
+
+/// Coefficients of a second-order section normalized to a0 = 1
+///
+/// H(z) = (b0 + b1 z^-1 + b2 z^-2) / (1 + a1 z^-1 + a2 z^-2)
+struct BiquadCoefficients
+{
+    double b0{1};
+    double b1{0};
+    double b2{0};
+    double a1{0};
+    double a2{0};
+};
+
+enum class FilterType
+{
+    lowPass,
+    highPass,
+};
+
+/// Second-order low or high pass with the bilinear transform, see the Audio EQ Cookbook by R. Bristow-Johnson
+/// \param  sampleRate  [Hz]
+/// \param  cutoff  [Hz], must be below sampleRate / 2
+/// \param  quality  Q of the section, 1/sqrt(2) gives a Butterworth response
+auto designBiquad(FilterType type, double sampleRate, double cutoff, double quality) -> BiquadCoefficients;
+
+/// Butterworth filter of arbitrary order as cascaded sections, odd orders end with a first-order section
+/// \param  sampleRate  [Hz]
+/// \param  cutoff  [Hz] where the attenuation is 3 dB, must be below sampleRate / 2
+/// \param  order  order of the filter, at least 1
+auto designButterworth(FilterType type, double sampleRate, double cutoff, size_t order)
+    -> std::vector<BiquadCoefficients>;
+
+/// Magnitude of the frequency response of cascaded sections
+/// \param  frequency  [Hz]
+auto magnitudeResponse(std::span<const BiquadCoefficients> sections, double sampleRate, double frequency) -> double;
+
+
+/// Cascaded second-order sections that filter interleaved audio in place
+///
+/// The sections are computed in transposed direct form II with single precision, the state is kept between calls to
+/// process() so that a stream can be filtered block by block. The state of all channels of a section is stored next to
+/// each other, so that the computation of one frame is vectorized across the channels.
+class BiquadCascade
+{
+private:
+    /// Coefficients of one section in the precision of the computation
+    struct Section
+    {
+        SampleType b0;
+        SampleType b1;
+        SampleType b2;
+        SampleType a1;
+        SampleType a2;
+    };
+
+    std::vector<Section>    sections;
+    size_t                  channels;
+    std::vector<SampleType> state;  //< z1 of all channels, then z2 of all channels, for each section
+
+public:
+    /// Ctor
+    /// \param  coefficients  sections in the order they are applied
+    /// \param  channelCount  number of interleaved channels of the processed audio
+    BiquadCascade(std::span<const BiquadCoefficients> coefficients, std::uint8_t channelCount);
+
+    /// Filter interleaved samples in place
+    /// \param  data  whole frames of interleaved samples
+    void process(std::span<SampleType> data);
+
+    /// Forget all previous samples
+    void reset();
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_BIQUADFILTER_HPP
@@ -0,0 +1,231 @@
+/// CallbackMonitor
+///
+/// Lock-free statistics of the audio callback
+
+#include "CallbackMonitor.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+auto HistogramSnapshot::lowerBound(size_t bucket) -> uint64_t
+{
+    return bucket == 0 ? 0 : uint64_t{1} << (bucket - 1);
+}
+
+auto HistogramSnapshot::percentile(double fraction) const -> uint64_t
+{
+    if (count == 0) {
+        return 0;
+    }
+    const auto target     = std::max<uint64_t>(static_cast<uint64_t>(ceil(fraction * static_cast<double>(count))), 1);
+    uint64_t   cumulative = 0;
+    for (size_t bucket = 0; bucket + 1 < buckets.size(); ++bucket) {
+        cumulative += buckets[bucket];
+        if (cumulative >= target) {
+            return min(lowerBound(bucket + 1) - 1, max);
+        }
+    }
+    return max;
+}
+
+auto HistogramSnapshot::mean() const -> double
+{
+    return count == 0 ? 0 : static_cast<double>(sum) / static_cast<double>(count);
+}
+
+void AtomicHistogram::record(uint64_t value)
+{
+    const auto bucket = min<size_t>(bit_width(value), HISTOGRAM_BUCKETS - 1);
+    buckets[bucket].fetch_add(1, memory_order_relaxed);
+    sum.fetch_add(value, memory_order_relaxed);
+    if (value > max.load(memory_order_relaxed)) {
+        max.store(value, memory_order_relaxed);
+    }
+    count.fetch_add(1, memory_order_release);
+}
+
+auto AtomicHistogram::snapshot() const -> HistogramSnapshot
+{
+    HistogramSnapshot copy;
+    copy.count = count.load(memory_order_acquire);
+    copy.sum   = sum.load(memory_order_relaxed);
+    copy.max   = max.load(memory_order_relaxed);
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        copy.buckets[bucket] = buckets[bucket].load(memory_order_relaxed);
+    }
+    return copy;
+}
+
+void AtomicHistogram::reset()
+{
+    for (auto& bucket : buckets) {
+        bucket.store(0, memory_order_relaxed);
+    }
+    count.store(0, memory_order_relaxed);
+    sum.store(0, memory_order_relaxed);
+    max.store(0, memory_order_relaxed);
+}
+
+auto CallbackStatistics::xruns() const -> uint64_t
+{
+    return underruns + deadlineMisses;
+}
+
+void CallbackMonitor::configure(uint32_t devicePeriodFrames, uint32_t deviceBufferFrames, double deviceSampleRate)
+{
+    for (auto* counter : {&callbacks, &frames, &shortReads, &missingBuffers, &deadlineMisses, &underruns}) {
+        counter->store(0, memory_order_relaxed);
+    }
+    durationNs.reset();
+    intervalNs.reset();
+    framesRequested.reset();
+
+    periodFrames = devicePeriodFrames;
+    bufferFrames = deviceBufferFrames;
+    sampleRate   = deviceSampleRate;
+    lastStart    = {};
+    blockStart   = {};
+    blockFrames  = 0;
+}
+
+/// Time it takes to play back a number of frames
+static auto playbackTime(uint32_t frames, double sampleRate) -> chrono::duration<double>
+{
+    return chrono::duration<double>(sampleRate > 0 ? frames / sampleRate : 0);
+}
+
+void CallbackMonitor::begin(Clock::time_point now, uint32_t frameCount, bool hasOutput)
+{
+    if (lastStart != Clock::time_point{}) {
+        const auto interval = now - lastStart;
+        intervalNs.record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(interval).count()));
+        if (interval > playbackTime(bufferFrames, sampleRate)) {
+            underruns.fetch_add(1, memory_order_relaxed);
+        }
+    }
+    lastStart   = now;
+    blockStart  = now;
+    blockFrames = frameCount;
+
+    framesRequested.record(frameCount);
+    frames.fetch_add(frameCount, memory_order_relaxed);
+    if (frameCount < periodFrames) {
+        shortReads.fetch_add(1, memory_order_relaxed);
+    }
+    if (!hasOutput) {
+        missingBuffers.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void CallbackMonitor::end(Clock::time_point now)
+{
+    const auto duration = now - blockStart;
+    durationNs.record(static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(duration).count()));
+    if (duration > playbackTime(blockFrames, sampleRate)) {
+        deadlineMisses.fetch_add(1, memory_order_relaxed);
+    }
+    callbacks.fetch_add(1, memory_order_release);
+}
+
+auto CallbackMonitor::snapshot() const -> CallbackStatistics
+{
+    return CallbackStatistics{
+        .callbacks       = callbacks.load(memory_order_acquire),
+        .frames          = frames.load(memory_order_relaxed),
+        .shortReads      = shortReads.load(memory_order_relaxed),
+        .missingBuffers  = missingBuffers.load(memory_order_relaxed),
+        .deadlineMisses  = deadlineMisses.load(memory_order_relaxed),
+        .underruns       = underruns.load(memory_order_relaxed),
+        .durationNs      = durationNs.snapshot(),
+        .intervalNs      = intervalNs.snapshot(),
+        .framesRequested = framesRequested.snapshot(),
+    };
+}
+
+
+TEST_CASE("CallbackMonitorTest - histogram buckets and percentiles")
+{
+    AtomicHistogram histogram;
+    for (const uint64_t value : {0, 1, 2, 3, 100, 100, 100, 1000}) {
+        histogram.record(value);
+    }
+    histogram.record(uint64_t{1} << 40U);
+
+    const auto snapshot = histogram.snapshot();
+    CHECK_EQ(snapshot.count, 9);
+    CHECK_EQ(snapshot.max, uint64_t{1} << 40U);
+    CHECK_EQ(snapshot.buckets[0], 1);
+    CHECK_EQ(snapshot.buckets[1], 1);
+    CHECK_EQ(snapshot.buckets[2], 2);
+    CHECK_EQ(snapshot.buckets[7], 3);   // 64 - 127
+    CHECK_EQ(snapshot.buckets[10], 1);  // 512 - 1023
+    CHECK_EQ(snapshot.buckets[HISTOGRAM_BUCKETS - 1], 1);
+    CHECK_EQ(HistogramSnapshot::lowerBound(7), 64);
+
+    CHECK_EQ(snapshot.percentile(0.1), 0);
+    CHECK_EQ(snapshot.percentile(0.5), 127);
+    CHECK_EQ(snapshot.percentile(0.85), 1023);
+    CHECK_EQ(snapshot.percentile(1.0), uint64_t{1} << 40U);
+    CHECK_EQ(HistogramSnapshot{}.percentile(0.5), 0);
+
+    histogram.reset();
+    CHECK_EQ(histogram.snapshot().count, 0);
+}
+
+TEST_CASE("CallbackMonitorTest - xruns and short reads")
+{
+    using namespace chrono_literals;
+    using Clock = CallbackMonitor::Clock;
+
+    // periods of 480 frames at 48 kHz = 10 ms, 2 periods = 20 ms buffer
+    CallbackMonitor monitor;
+    monitor.configure(480, 960, 48'000);
+
+    Clock::time_point now{1s};
+    auto callback = [&](chrono::nanoseconds interval, chrono::nanoseconds duration, uint32_t frames) -> void {
+        now += interval;
+        monitor.begin(now, frames, true);
+        monitor.end(now + duration);
+    };
+    callback(0ms, 100us, 480);
+    callback(10ms, 100us, 480);
+    callback(10ms, 12ms, 480);   // slower than real time
+    callback(25ms, 100us, 480);  // longer than the whole buffer
+    callback(10ms, 100us, 240);  // half a period
+    now += 5ms;
+    monitor.begin(now, 480, false);
+    monitor.end(now);
+
+    const auto statistics = monitor.snapshot();
+    CHECK_EQ(statistics.callbacks, 6);
+    CHECK_EQ(statistics.frames, 5 * 480 + 240);
+    CHECK_EQ(statistics.deadlineMisses, 1);
+    CHECK_EQ(statistics.underruns, 1);
+    CHECK_EQ(statistics.xruns(), 2);
+    CHECK_EQ(statistics.shortReads, 1);
+    CHECK_EQ(statistics.missingBuffers, 1);
+    CHECK_EQ(statistics.intervalNs.count, 5);
+    CHECK_EQ(statistics.intervalNs.max, 25'000'000);
+    CHECK_EQ(statistics.durationNs.max, 12'000'000);
+    CHECK_EQ(statistics.framesRequested.percentile(0.1), 255);
+    CHECK_EQ(statistics.framesRequested.max, 480);
+
+    monitor.configure(480, 960, 48'000);
+    CHECK_EQ(monitor.snapshot().callbacks, 0);
+    CHECK_EQ(monitor.snapshot().durationNs.count, 0);
+}
+
+}  // namespace mnome
@@ -0,0 +1,128 @@
+/// CallbackMonitor
+///
+/// Lock-free statistics of the audio callback
+
+#ifndef MNOME_CALLBACKMONITOR_H
+#define MNOME_CALLBACKMONITOR_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace mnome {
+
+/// Number of buckets of a histogram, the last one holds everything from 2^(HISTOGRAM_BUCKETS - 2) on
+constexpr size_t HISTOGRAM_BUCKETS = 32;
+
+/// Copy of a histogram that can be evaluated by any thread
+struct HistogramSnapshot
+{
+    std::array<std::uint64_t, HISTOGRAM_BUCKETS> buckets{};
+    std::uint64_t                                count{0};
+    std::uint64_t                                sum{0};
+    std::uint64_t                                max{0};
+
+    /// Smallest value of bucket \p bucket
+    [[nodiscard]] static auto lowerBound(size_t bucket) -> std::uint64_t;
+
+    /// Value that no more than \p fraction of the recorded values exceed, rounded up to the end of its bucket
+    /// \param  fraction  e.g. 0.99 for the 99th percentile
+    [[nodiscard]] auto percentile(double fraction) const -> std::uint64_t;
+
+    [[nodiscard]] auto mean() const -> double;
+};
+
+/// Histogram with power of two buckets that one thread records into and any thread reads
+///
+/// Bucket 0 counts the value 0 and bucket i the values from 2^(i - 1) to 2^i - 1. Recording does neither lock nor
+/// allocate, so it can be done in the audio callback.
+class AtomicHistogram
+{
+private:
+    std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS> buckets{};
+    std::atomic<std::uint64_t>                                count{0};
+    std::atomic<std::uint64_t>                                sum{0};
+    std::atomic<std::uint64_t>                                max{0};
+
+public:
+    /// Add a value
+    /// \note  Only one thread may record
+    void record(std::uint64_t value);
+
+    /// Copy the current state, the buckets may be slightly ahead of count and sum while values are recorded
+    [[nodiscard]] auto snapshot() const -> HistogramSnapshot;
+
+    /// Forget all values
+    /// \note  Only when no value is recorded at the same time
+    void reset();
+};
+
+/// Statistics of the audio callback as seen by a control thread
+struct CallbackStatistics
+{
+    std::uint64_t     callbacks{0};
+    std::uint64_t     frames{0};
+    std::uint64_t     shortReads{0};      //< blocks that were smaller than one device period
+    std::uint64_t     missingBuffers{0};  //< callbacks without an output buffer
+    std::uint64_t     deadlineMisses{0};  //< callbacks that took longer than the playback of their block
+    std::uint64_t     underruns{0};       //< gaps between callbacks that were longer than the device buffer
+    HistogramSnapshot durationNs;         //< run time of the callback [ns]
+    HistogramSnapshot intervalNs;         //< time between the starts of successive callbacks [ns]
+    HistogramSnapshot framesRequested;    //< frames per callback
+
+    /// Number of detected buffer under- and overruns
+    [[nodiscard]] auto xruns() const -> std::uint64_t;
+};
+
+/// Records what the audio callback does, without locks or allocations
+///
+/// The callback calls begin() and end() around its work. Underruns cannot be observed directly, they are estimated
+/// from the time between callbacks: when the gap exceeds the whole device buffer, the device has run dry.
+class CallbackMonitor
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+private:
+    std::atomic<std::uint64_t> callbacks{0};
+    std::atomic<std::uint64_t> frames{0};
+    std::atomic<std::uint64_t> shortReads{0};
+    std::atomic<std::uint64_t> missingBuffers{0};
+    std::atomic<std::uint64_t> deadlineMisses{0};
+    std::atomic<std::uint64_t> underruns{0};
+    AtomicHistogram            durationNs;
+    AtomicHistogram            intervalNs;
+    AtomicHistogram            framesRequested;
+
+    // device buffering, only changed while the device is stopped
+    std::uint32_t periodFrames{0};
+    std::uint32_t bufferFrames{0};
+    double        sampleRate{0};
+
+    // only accessed by the audio callback
+    Clock::time_point lastStart;
+    Clock::time_point blockStart;
+    std::uint32_t     blockFrames{0};
+
+public:
+    /// Reset all statistics and set the buffering that the callbacks are compared to
+    /// \note  Only while the device is stopped
+    void configure(std::uint32_t devicePeriodFrames, std::uint32_t deviceBufferFrames, double deviceSampleRate);
+
+    /// Called at the start of the audio callback
+    /// \param  hasOutput  false when the device did not pass a buffer to write to
+    void begin(Clock::time_point now, std::uint32_t frameCount, bool hasOutput);
+
+    /// Called at the end of the audio callback
+    void end(Clock::time_point now);
+
+    /// Copy the current statistics
+    [[nodiscard]] auto snapshot() const -> CallbackStatistics;
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_CALLBACKMONITOR_H
@@ -0,0 +1,689 @@
+/// ControlServer
+///
+/// Local socket that takes the commands of the REPL from other programs and acknowledges the frame of their changes
+
+#include "ControlServer.hpp"
+
+#include "OnsetLog.hpp"
+#include "Trace.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <poll.h>
+#endif
+
+
+using namespace std;
+
+
+namespace mnome {
+
+namespace {
+
+/// Error of the last system call
+auto systemError(string_view what) -> runtime_error
+{
+    return runtime_error(std::format("{}: {}", what, error_code(errno, system_category()).message()));
+}
+
+#ifdef __linux__
+
+/// Reply to a request that may wait until its change has taken effect
+struct PendingReply
+{
+    uint64_t change{0};  //< sequence number of the change, 0 when the reply is ready
+    string   text;       //< reply when it is ready, including the line end
+};
+
+/// Connection of a client
+struct ControlClient
+{
+    int                 socket{-1};
+    string              input{};   //< received bytes of an incomplete line
+    string              output{};  //< replies that the socket has not taken yet
+    deque<PendingReply> replies{};
+    bool                writable{true};  //< false while epoll waits for the socket to take more output
+    bool                subscribed{false};  //< streams the onsets once the replies before have been sent
+    uint64_t            onsetCursor{0};
+};
+
+/// Output that a subscriber may fall behind by before it is disconnected
+constexpr size_t MAX_STREAM_BACKLOG = size_t{1} << 20;
+
+/// Socket address of a path or, starting with `@`, of a name in the abstract namespace
+auto socketAddress(string_view address) -> pair<sockaddr_un, socklen_t>
+{
+    sockaddr_un socketAddr{};
+    socketAddr.sun_family = AF_UNIX;
+    if (address.empty() || address == "@" || address.size() >= sizeof(socketAddr.sun_path)) {
+        throw runtime_error(std::format("Invalid control socket address \"{}\"", address));
+    }
+    ranges::copy(address, std::begin(socketAddr.sun_path));
+    if (address.front() == '@') {
+        socketAddr.sun_path[0] = '\0';  // the name is not terminated
+        return {socketAddr, static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + address.size())};
+    }
+    return {socketAddr, static_cast<socklen_t>(sizeof(socketAddr))};
+}
+
+/// Whether a socket file is left over by a process that does not serve it anymore
+auto isStaleSocket(const sockaddr_un& socketAddr, socklen_t length) -> bool
+{
+    error_code ec;
+    if (socketAddr.sun_path[0] == '\0' || !filesystem::is_socket(socketAddr.sun_path, ec)) {
+        return false;
+    }
+    const int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        return false;
+    }
+    const bool connected = connect(probe, reinterpret_cast<const sockaddr*>(&socketAddr), length) == 0;
+    const bool refused   = !connected && errno == ECONNREFUSED;
+    close(probe);
+    return refused;
+}
+
+/// Hand the replies of a client to its socket as far as it takes them
+/// \return  false when the connection is broken
+auto flushReplies(ControlClient& client) -> bool
+{
+    while (!client.output.empty()) {
+        const auto sent = send(client.socket, client.output.data(), client.output.size(), MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            return errno == EINTR;
+        }
+        client.output.erase(0, static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+/// Reply that is sent once a change has taken effect
+auto changeReply(const ControlClock& clock, uint64_t change) -> string
+{
+    if (const auto frame = clock.changeFrame(change)) {
+        return "ok " + to_string(*frame) + '\n';
+    }
+    return "ok\n";
+}
+
+#endif
+
+}  // namespace
+
+
+ControlServer::ControlServer(const ReplCommandList& cmds, ControlClock& controlClock)
+    : commands{cmds}, clock{controlClock}
+{
+}
+
+ControlServer::~ControlServer()
+{
+    stop();
+    waitForStop();
+}
+
+#ifdef __linux__
+
+void ControlServer::start(string_view address)
+{
+    waitForStop();
+
+    const auto [socketAddr, length] = socketAddress(address);
+    listener                        = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        throw systemError("Cannot create the control socket");
+    }
+    auto bound = bind(listener, reinterpret_cast<const sockaddr*>(&socketAddr), length) == 0;
+    if (!bound && errno == EADDRINUSE && isStaleSocket(socketAddr, length)) {
+        unlink(socketAddr.sun_path);
+        bound = bind(listener, reinterpret_cast<const sockaddr*>(&socketAddr), length) == 0;
+    }
+    if (!bound || listen(listener, SOMAXCONN) != 0) {
+        const auto error = systemError(std::format("Cannot listen on the control socket {}", address));
+        closeSockets();
+        throw error;
+    }
+    listenAddress = string(address);
+
+    wakeUp = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeUp < 0) {
+        const auto error = systemError("Cannot create the event of the control socket");
+        closeSockets();
+        throw error;
+    }
+    requestStop = false;
+    myThread    = std::make_unique<std::thread>([this]() -> void { this->run(); });
+}
+
+void ControlServer::streamOnsets(const OnsetLog* log)
+{
+    if (!isRunning()) {
+        onsets = log;
+    }
+}
+
+void ControlServer::stop()
+{
+    if (isRunning()) {
+        requestStop = true;
+        const uint64_t             event   = 1;
+        [[maybe_unused]] const auto written = write(wakeUp, &event, sizeof(event));
+    }
+}
+
+void ControlServer::closeSockets()
+{
+    if (listener >= 0) {
+        close(listener);
+        listener = -1;
+        if (!listenAddress.empty() && listenAddress.front() != '@') {
+            unlink(listenAddress.c_str());
+        }
+    }
+    if (wakeUp >= 0) {
+        close(wakeUp);
+        wakeUp = -1;
+    }
+    listenAddress.clear();
+}
+
+void ControlServer::run()
+{
+    constexpr int  maxEvents      = 64;
+    constexpr auto pollInterval   = 1;   // [ms] while replies wait for the audio callback, it must not notify anybody
+    constexpr auto streamInterval = 10;  // [ms] between two blocks of onsets
+
+    const int epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll < 0) {
+        cout << systemError("Cannot serve the control socket").what() << '\n';
+        return;
+    }
+    const auto watch = [epoll](int operation, int connection, uint32_t events) -> void {
+        epoll_event event{.events = events, .data = {.fd = connection}};
+        epoll_ctl(epoll, operation, connection, &event);
+    };
+    watch(EPOLL_CTL_ADD, listener, EPOLLIN);
+    watch(EPOLL_CTL_ADD, wakeUp, EPOLLIN);
+
+    unordered_map<int, ControlClient> clients;
+    const auto disconnect = [&clients](int connection) -> void {
+        close(connection);  // removes it from epoll, too
+        clients.erase(connection);
+    };
+
+    array<epoll_event, maxEvents> events{};
+    while (!requestStop) {
+        const bool waiting   = ranges::any_of(clients, [](const auto& client) -> bool {
+            return !client.second.replies.empty() && client.second.replies.front().change != 0;
+        });
+        const bool streaming = ranges::any_of(clients, [](const auto& client) -> bool {
+            return client.second.subscribed;
+        });
+        const int  timeout   = waiting ? pollInterval : (streaming ? streamInterval : -1);
+        const int  count     = epoll_wait(epoll, events.data(), maxEvents, timeout);
+        if (count < 0 && errno != EINTR) {
+            cout << systemError("Cannot serve the control socket").what() << '\n';
+            break;
+        }
+
+        for (const auto& event : span(events).first(static_cast<size_t>(max(count, 0)))) {
+            const int connection = event.data.fd;
+            if (connection == wakeUp) {
+                continue;
+            }
+            if (connection == listener) {
+                int accepted = -1;
+                while ((accepted = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    clients.emplace(accepted, ControlClient{.socket = accepted});
+                    watch(EPOLL_CTL_ADD, accepted, EPOLLIN | EPOLLRDHUP);
+                }
+                continue;
+            }
+
+            auto found = clients.find(connection);
+            if (found == clients.end()) {
+                continue;
+            }
+            auto& client = found->second;
+            bool  closed = (event.events & (EPOLLERR | EPOLLHUP)) != 0;
+            if ((event.events & EPOLLIN) != 0) {
+                array<char, MAX_CONTROL_LINE> buffer{};
+                ssize_t                       received = 0;
+                while ((received = recv(connection, buffer.data(), buffer.size(), 0)) > 0) {
+                    client.input.append(buffer.data(), static_cast<size_t>(received));
+                }
+                closed = closed || received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+
+                // the commands are run right away, in the order in which they arrived
+                size_t lineEnd = 0;
+                while (!client.subscribed && (lineEnd = client.input.find('\n')) != string::npos) {
+                    MNOME_TRACE_SPAN("ControlServer::command");
+                    const auto   request = trim(string_view(client.input).substr(0, lineEnd));
+                    PendingReply reply;
+                    try {
+                        if (request == SUBSCRIBE_ONSETS) {
+                            if (onsets == nullptr) {
+                                throw runtime_error("There are no onsets to stream");
+                            }
+                            client.subscribed  = true;
+                            client.onsetCursor = onsets->appended();
+                        }
+                        else {
+                            reply.change = runCommand(request);
+                        }
+                        reply.text = "ok\n";
+                    }
+                    catch (const exception& e) {
+                        string reason = e.what();
+                        ranges::replace(reason, '\n', ' ');
+                        reply.text = "error " + string(trim(reason)) + '\n';
+                    }
+                    client.replies.push_back(std::move(reply));
+                    client.input.erase(0, lineEnd + 1);
+                }
+                if (client.subscribed) {
+                    client.input.clear();  // a subscriber sends no more requests
+                }
+                if (client.input.size() > MAX_CONTROL_LINE) {
+                    client.output += "error the line is too long\n";
+                    flushReplies(client);
+                    closed = true;
+                }
+            }
+            if (closed) {
+                disconnect(connection);
+            }
+        }
+
+        // replies of changes are sent once the audio callback has applied them, or the playback has stopped
+        const bool          running = clock.isRunning();
+        const uint64_t      applied = clock.appliedChanges();
+        vector<int>         broken;
+        vector<OnsetRecord> onsetRecords;
+        for (auto& [connection, client] : clients) {
+            while (!client.replies.empty()) {
+                const auto& reply = client.replies.front();
+                if (reply.change == 0) {
+                    client.output += reply.text;
+                }
+                else if (applied >= reply.change || !running) {
+                    client.output += changeReply(clock, reply.change);
+                }
+                else {
+                    break;
+                }
+                client.replies.pop_front();
+            }
+            if (client.subscribed && client.replies.empty()) {
+                onsetRecords.clear();
+                onsets->read(client.onsetCursor, onsetRecords);
+                encodeOnsets(onsetRecords, client.output);
+            }
+            if (!flushReplies(client) || client.output.size() > MAX_STREAM_BACKLOG) {
+                broken.push_back(connection);
+                continue;
+            }
+            // epoll reports when a full socket takes output again
+            if (client.writable == !client.output.empty()) {
+                client.writable = client.output.empty();
+                watch(EPOLL_CTL_MOD, connection, EPOLLIN | EPOLLRDHUP | (client.writable ? 0U : EPOLLOUT));
+            }
+        }
+        ranges::for_each(broken, disconnect);
+    }
+
+    for (const auto& client : clients) {
+        close(client.first);
+    }
+    close(epoll);
+}
+
+#else
+
+void ControlServer::start(string_view address)
+{
+    static_cast<void>(address);
+    throw runtime_error("The control socket is only available on Linux");
+}
+
+void ControlServer::stop()
+{
+    requestStop = true;
+}
+
+void ControlServer::closeSockets() {}
+
+void ControlServer::run() {}
+
+#endif
+
+auto ControlServer::isRunning() const -> bool
+{
+    return myThread && myThread->joinable();
+}
+
+void ControlServer::waitForStop()
+{
+    if (isRunning()) {
+        myThread->join();
+    }
+    closeSockets();
+}
+
+auto ControlServer::runCommand(string_view line) -> uint64_t
+{
+    const auto   input     = trim(line);
+    const size_t separator = input.find(' ');
+    const auto   name      = input.substr(0, separator);
+    const auto   args      = (separator != string_view::npos) ? trim(input.substr(separator + 1)) : string_view{};
+    const auto   command   = commands.find(name);
+    if (command == commands.end()) {
+        throw invalid_argument('"' + string(name) + "\" is not a valid command");
+    }
+    // the clients are served by a single thread
+    if (command->second.blocking) {
+        throw invalid_argument('"' + string(name) + "\" blocks the other clients, it is only run by the REPL");
+    }
+
+    // a change of the playback takes a new sequence number, the REPL and scripts run theirs in other threads
+    const uint64_t submitted = clock.threadChange();
+    command->second.function(args);
+    const uint64_t change = clock.threadChange();
+    return (change != submitted) ? change : 0;
+}
+
+
+#ifdef __linux__
+
+namespace {
+
+/// Playback whose changes are applied by the test
+class ManualClock : public ControlClock
+{
+public:
+    atomic_bool     running{true};
+    atomic_uint64_t submitted{0};
+    atomic_uint64_t applied{0};
+
+    [[nodiscard]] auto isRunning() const -> bool override
+    {
+        return running;
+    }
+
+    [[nodiscard]] auto threadChange() -> uint64_t override
+    {
+        return submitted;
+    }
+
+    [[nodiscard]] auto appliedChanges() const -> uint64_t override
+    {
+        return applied;
+    }
+
+    /// Every change takes effect 1000 frames after the one before
+    [[nodiscard]] auto changeFrame(uint64_t sequence) const -> optional<uint64_t> override
+    {
+        if (sequence > applied) {
+            return nullopt;
+        }
+        return sequence * 1'000;
+    }
+};
+
+/// Client of the control socket
+class TestClient
+{
+private:
+    int    client{-1};
+    string received;
+
+public:
+    explicit TestClient(string_view address)
+    {
+        const auto [socketAddr, length] = socketAddress(address);
+        client                          = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        REQUIRE_EQ(connect(client, reinterpret_cast<const sockaddr*>(&socketAddr), length), 0);
+    }
+
+    ~TestClient()
+    {
+        close(client);
+    }
+
+    TestClient(const TestClient&)                    = delete;
+    TestClient(TestClient&&)                         = delete;
+    auto operator=(const TestClient&) -> TestClient& = delete;
+    auto operator=(TestClient&&) -> TestClient&      = delete;
+
+    void send(string_view requests) const
+    {
+        REQUIRE_EQ(::send(client, requests.data(), requests.size(), MSG_NOSIGNAL), requests.size());
+    }
+
+    /// Next reply line without its end
+    /// \return  nothing when no line arrives in time
+    auto reply(chrono::milliseconds timeout = chrono::seconds(5)) -> optional<string>
+    {
+        const auto deadline = chrono::steady_clock::now() + timeout;
+        size_t     lineEnd  = 0;
+        while ((lineEnd = received.find('\n')) == string::npos) {
+            if (!receive(deadline)) {
+                return nullopt;
+            }
+        }
+        auto line = received.substr(0, lineEnd);
+        received.erase(0, lineEnd + 1);
+        return line;
+    }
+
+    /// Next bytes of the connection
+    /// \return  nothing when they do not arrive in time
+    auto bytes(size_t count, chrono::milliseconds timeout = chrono::seconds(5)) -> optional<string>
+    {
+        const auto deadline = chrono::steady_clock::now() + timeout;
+        while (received.size() < count) {
+            if (!receive(deadline)) {
+                return nullopt;
+            }
+        }
+        auto data = received.substr(0, count);
+        received.erase(0, count);
+        return data;
+    }
+
+private:
+    /// Wait for data and append it to the received bytes
+    /// \return  false when nothing arrived before the deadline or the connection is closed
+    auto receive(chrono::steady_clock::time_point deadline) -> bool
+    {
+        const auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now());
+        pollfd     ready{.fd = client, .events = POLLIN, .revents = 0};
+        if (left.count() <= 0 || poll(&ready, 1, static_cast<int>(left.count())) <= 0) {
+            return false;
+        }
+        array<char, 256> buffer{};
+        const auto       count = recv(client, buffer.data(), buffer.size(), 0);
+        if (count <= 0) {
+            return false;
+        }
+        received.append(buffer.data(), static_cast<size_t>(count));
+        return true;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("ControlServerTest - replies of many clients")
+{
+    ManualClock     clock;
+    vector<string>  executed;
+    ReplCommandList commands;
+    commands.emplace("bpm", ReplCommand{.function = [&clock, &executed](string_view args) -> void {
+                                            executed.emplace_back(args);
+                                            ++clock.submitted;
+                                        },
+                                        .name     = "bpm",
+                                        .help     = ""});
+    commands.emplace("stats", ReplCommand{.function = [](string_view) -> void {}, .name = "stats", .help = ""});
+    commands.emplace("fail", ReplCommand{.function = [](string_view) -> void { throw runtime_error("no\nway"); },
+                                         .name     = "fail",
+                                         .help     = ""});
+    commands.emplace("render", ReplCommand{.function = [&executed](string_view args) -> void {
+                                               executed.emplace_back(args);
+                                           },
+                                           .name     = "render",
+                                           .help     = "",
+                                           .blocking = true});
+
+    const auto    address = std::format("@mnome-test-{}", getpid());
+    ControlServer server(commands, clock);
+    server.start(address);
+    CHECK(server.isRunning());
+    CHECK_THROWS_AS(ControlServer(commands, clock).start(address), runtime_error);
+
+    TestClient first(address);
+    TestClient second(address);
+
+    // the reply of a change waits until the change has taken effect, the replies after it wait, too
+    first.send("bpm 120\r\nstats\n");
+    second.send("stats\nfast 200\nfail\nrender click.wav 60\n");
+    CHECK_EQ(second.reply(), "ok");
+    CHECK_EQ(second.reply(), "error \"fast\" is not a valid command");
+    CHECK_EQ(second.reply(), "error no way");
+    CHECK_EQ(second.reply(), "error \"render\" blocks the other clients, it is only run by the REPL");
+    CHECK_FALSE(first.reply(chrono::milliseconds(20)));
+    CHECK_EQ(executed, vector<string>{"120"});
+
+    clock.applied = 1;
+    CHECK_EQ(first.reply(), "ok 1000");
+    CHECK_EQ(first.reply(), "ok");
+
+    // a request may arrive in pieces, a change is dropped when the playback stops
+    first.send("bp");
+    first.send("m 130\n");
+    CHECK_FALSE(first.reply(chrono::milliseconds(20)));
+    clock.running = false;
+    CHECK_EQ(first.reply(), "ok");
+    const vector<string> expected{"120", "130"};
+    CHECK_EQ(executed, expected);
+
+    server.stop();
+    server.waitForStop();
+    CHECK_FALSE(server.isRunning());
+}
+
+TEST_CASE("ControlServerTest - socket file")
+{
+    ManualClock     clock;
+    ReplCommandList commands;
+    commands.emplace("stats", ReplCommand{.function = [](string_view) -> void {}, .name = "stats", .help = ""});
+
+    const auto    file = filesystem::temp_directory_path() / std::format("mnome-test-{}.sock", getpid());
+    ControlServer server(commands, clock);
+    server.start(file.string());
+    {
+        TestClient client(file.string());
+        client.send("stats\n");
+        CHECK_EQ(client.reply(), "ok");
+    }
+    server.stop();
+    server.waitForStop();
+
+    CHECK_FALSE(filesystem::exists(file));
+
+    // a socket file that a crashed server left behind is taken over
+    const auto [socketAddr, length] = socketAddress(file.string());
+    const int crashed               = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    REQUIRE_EQ(bind(crashed, reinterpret_cast<const sockaddr*>(&socketAddr), length), 0);
+    close(crashed);
+    server.start(file.string());
+    {
+        TestClient client(file.string());
+        client.send("stats\n");
+        CHECK_EQ(client.reply(), "ok");
+    }
+    server.stop();
+    server.waitForStop();
+    CHECK_FALSE(filesystem::exists(file));
+}
+
+TEST_CASE("ControlServerTest - onset stream")
+{
+    ManualClock     clock;
+    ReplCommandList commands;
+    commands.emplace("stats", ReplCommand{.function = [](string_view) -> void {}, .name = "stats", .help = ""});
+
+    const auto    address = std::format("@mnome-test-onsets-{}", getpid());
+    ControlServer server(commands, clock);
+    server.start(address);
+    {
+        TestClient client(address);
+        client.send(string(SUBSCRIBE_ONSETS) + "\n");
+        CHECK_EQ(client.reply(), "error There are no onsets to stream");
+    }
+    server.stop();
+    server.waitForStop();
+
+    OnsetLog log;
+    log.append(OnsetRecord{.frame = 10, .deviceTime = 0, .bar = 1, .beat = 0, .layer = 0, .type = BeatType::accent});
+    server.streamOnsets(&log);
+    server.start(address);
+    {
+        // only the onsets that are appended after the subscription are streamed, requests are ignored
+        TestClient client(address);
+        client.send(string(SUBSCRIBE_ONSETS) + "\nstats\n");
+        CHECK_EQ(client.reply(), "ok");
+        const vector<OnsetRecord> onsets{
+            OnsetRecord{.frame = 500, .deviceTime = 7, .bar = 1, .beat = 1, .layer = 0, .type = BeatType::beat},
+            OnsetRecord{.frame = 1'000, .deviceTime = 8, .bar = 1, .beat = 2, .layer = 1, .type = BeatType::accent},
+        };
+        for (const auto& onset : onsets) {
+            log.append(onset);
+        }
+        const auto streamed = client.bytes(2 * ONSET_RECORD_SIZE);
+        REQUIRE(streamed);
+        CHECK_EQ(decodeOnsets(*streamed), onsets);
+        CHECK_FALSE(client.bytes(1, chrono::milliseconds(30)));
+    }
+    server.stop();
+    server.waitForStop();
+}
+
+#endif
+
+}  // namespace mnome
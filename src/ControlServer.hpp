@@ -0,0 +1,127 @@
+/// ControlServer
+///
+/// Local socket that takes the commands of the REPL from other programs and acknowledges the frame of their changes
+
+#ifndef MNOME_CONTROLSERVER_H
+#define MNOME_CONTROLSERVER_H
+
+#include "Repl.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+
+namespace mnome {
+
+/// Longest request line that a client may send, a client that exceeds it is disconnected
+constexpr size_t MAX_CONTROL_LINE = 4'096;
+
+/// Request that turns a connection into a stream of onsets, see ControlServer::streamOnsets()
+constexpr std::string_view SUBSCRIBE_ONSETS = "subscribe onsets";
+
+class OnsetLog;
+
+/// Playback whose changes the server acknowledges
+class ControlClock
+{
+public:
+    ControlClock()                                       = default;
+    ControlClock(const ControlClock&)                    = delete;
+    ControlClock(ControlClock&&)                         = delete;
+    auto operator=(const ControlClock&) -> ControlClock& = delete;
+    auto operator=(ControlClock&&) -> ControlClock&      = delete;
+    virtual ~ControlClock()                              = default;
+
+    /// Whether the playback is running, changes are not applied otherwise
+    [[nodiscard]] virtual auto isRunning() const -> bool = 0;
+
+    /// Sequence number of the last change that the calling thread has requested, changes of other threads are not seen
+    [[nodiscard]] virtual auto threadChange() -> std::uint64_t = 0;
+
+    /// Sequence number up to which all changes have been applied, some of them may have been dropped
+    [[nodiscard]] virtual auto appliedChanges() const -> std::uint64_t = 0;
+
+    /// Frame since the start of the playback at which a change took effect
+    /// \return  nothing when the change is pending, was dropped or is not known anymore
+    [[nodiscard]] virtual auto changeFrame(std::uint64_t sequence) const -> std::optional<std::uint64_t> = 0;
+};
+
+/// Serves the commands of the REPL on a Unix domain socket, many clients from a single thread
+///
+/// A client sends one command per line, e.g. `bpm 120\n`, and gets one reply per line in the same order:
+///  - `ok <frame>`  the command changed the playback and the change took effect at this frame since the start
+///  - `ok`  the command did not change the playback, or the change was dropped by a stop
+///  - `error <reason>`  the command is unknown or failed
+/// Commands are run as soon as they arrive, only the reply of a change waits until the audio callback has applied it.
+/// Blocking commands (see ReplCommand::blocking) would hold up all clients and are rejected with an `error`: `trace`,
+/// `onsets`, `buffer`, `sound` and `render` of the Mnome commands.
+/// A change at the next beat or bar is acknowledged once that beat or bar has started.
+/// After `subscribe onsets` and its `ok`, the connection carries the onsets of the playback in their binary form (see
+/// encodeOnsets()) and no more replies.
+/// \note  Linux only, the sockets are served with epoll
+class ControlServer
+{
+private:
+    ReplCommandList              commands;
+    ControlClock&                clock;
+    std::string                  listenAddress;
+    int                          listener{-1};
+    int                          wakeUp{-1};  //< event that ends the thread
+    const OnsetLog*              onsets{nullptr};
+    std::unique_ptr<std::thread> myThread;
+    std::atomic_bool             requestStop{false};
+
+public:
+    /// Ctor
+    /// \param  clock  playback whose changes are acknowledged, must outlive the server
+    ControlServer(const ReplCommandList& cmds, ControlClock& clock);
+    ~ControlServer();
+
+    ControlServer(const ControlServer&)                    = delete;
+    ControlServer(ControlServer&&)                         = delete;
+    auto operator=(const ControlServer&) -> ControlServer& = delete;
+    auto operator=(ControlServer&&) -> ControlServer&      = delete;
+
+    /// Listen on a socket and start serving it
+    /// \param  address  path of the socket file, or a name in the abstract namespace when it starts with `@`
+    /// \throw  std::runtime_error  when the socket cannot be created or the address is in use
+    void start(std::string_view address);
+
+    /// Let the clients subscribe to the onsets of a log
+    /// \param  log  must outlive the server, nullptr rejects the subscriptions
+    /// \note  Only possible when the server is not running
+    void streamOnsets(const OnsetLog* log);
+
+    /// Stops serving the clients
+    /// \note Does not block
+    void stop();
+
+    /// Indicates whether the thread is running
+    [[nodiscard]] auto isRunning() const -> bool;
+
+    /// Make sure the thread has stopped and close the socket
+    /// \note blocks until thread is finished
+    void waitForStop();
+
+private:
+    /// The method that the thread runs
+    void run();
+
+    /// Run a request line of a client
+    /// \return  sequence number of the change that the command requested, 0 when it changed nothing
+    /// \throw  std::exception  when the command is unknown, blocking or failed
+    auto runCommand(std::string_view line) -> std::uint64_t;
+
+    /// Close the sockets and remove the socket file
+    void closeSockets();
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_CONTROLSERVER_H
@@ -0,0 +1,177 @@
+/// DefaultSounds
+///
+/// Tones that are played when no sound files are given, the common sample rates are generated at compile time
+
+#include "DefaultSounds.hpp"
+
+#include "AudioSignal.hpp"
+#include "BeatScheduler.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <numbers>
+#include <span>
+#include <utility>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+namespace {
+
+/// Amplitudes of the fundamental and the overtone of the default beats, see defaultPartialAmplitudes()
+constexpr array<double, DEFAULT_BEAT_OVERTONES + 1> DEFAULT_BEAT_PARTIALS{0.5, 0.125};
+
+/// Sine that can be evaluated at compile time, std::sin cannot
+/// \param  cycles  phase in full periods, not negative
+constexpr auto sinOfCycles(double cycles) -> double
+{
+    // reduce to [-pi / 2, pi / 2], where the Taylor series converges quickly
+    double x = 2 * numbers::pi * (cycles - static_cast<double>(static_cast<uint64_t>(cycles)));
+    if (x > numbers::pi) {
+        x -= 2 * numbers::pi;
+    }
+    if (x > numbers::pi / 2) {
+        x = numbers::pi - x;
+    }
+    else if (x < -numbers::pi / 2) {
+        x = -numbers::pi - x;
+    }
+
+    // the terms up to x^23 / 23! leave an error far below the resolution of a double
+    double term   = x;
+    double result = x;
+    for (size_t power = 3; power <= 23; power += 2) {
+        term *= -x * x / static_cast<double>((power - 1) * power);
+        result += term;
+    }
+    return result;
+}
+
+/// Number of frames of a default beat, the same as generateTone() computes
+constexpr auto beatFrames(double sampleRate) -> size_t
+{
+    return static_cast<size_t>(sampleRate * DEFAULT_BEAT_LENGTH);
+}
+
+/// Mono default beat, every sample is evaluated directly instead of rotating phasors as generateTone() does
+template <size_t Frames>
+consteval auto generateBeat(double sampleRate, double frequency) -> array<SampleType, Frames>
+{
+    array<SampleType, Frames> beat{};
+    for (size_t frame = 0; frame < Frames; ++frame) {
+        const double cycles = static_cast<double>(frame) * frequency / sampleRate;
+        double       sample = 0;
+        for (size_t partial = 0; partial < DEFAULT_BEAT_PARTIALS.size(); ++partial) {
+            sample += DEFAULT_BEAT_PARTIALS[partial] * sinOfCycles(cycles * static_cast<double>(partial + 1));
+        }
+        beat[frame] = static_cast<SampleType>(sample);
+    }
+    return beat;
+}
+
+constexpr double CD_SAMPLE_RATE = 44'100;  // [Hz]
+
+// the tables are read-only data of the program, nothing is computed for them at start up
+constexpr auto BEAT_44K = generateBeat<beatFrames(CD_SAMPLE_RATE)>(CD_SAMPLE_RATE, defaultBeatFrequency());
+constexpr auto ACCENT_44K = generateBeat<beatFrames(CD_SAMPLE_RATE)>(CD_SAMPLE_RATE, defaultAccentFrequency());
+constexpr auto BEAT_48K = generateBeat<beatFrames(DEFAULT_SAMPLE_RATE)>(DEFAULT_SAMPLE_RATE, defaultBeatFrequency());
+constexpr auto ACCENT_48K =
+    generateBeat<beatFrames(DEFAULT_SAMPLE_RATE)>(DEFAULT_SAMPLE_RATE, defaultAccentFrequency());
+
+/// Default beats of the main pattern at a sample rate
+struct EmbeddedBeats
+{
+    double                 sampleRate;
+    span<const SampleType> accent;
+    span<const SampleType> beat;
+};
+
+constexpr array EMBEDDED_BEATS{
+    EmbeddedBeats{.sampleRate = CD_SAMPLE_RATE, .accent = ACCENT_44K, .beat = BEAT_44K},
+    EmbeddedBeats{.sampleRate = DEFAULT_SAMPLE_RATE, .accent = ACCENT_48K, .beat = BEAT_48K},
+};
+
+auto findEmbeddedBeats(double sampleRate, size_t layer) -> const EmbeddedBeats*
+{
+    if (layer != 0) {
+        return nullptr;
+    }
+    const auto found = ranges::find(EMBEDDED_BEATS, sampleRate, &EmbeddedBeats::sampleRate);
+    return (found == EMBEDDED_BEATS.end()) ? nullptr : &*found;
+}
+
+}  // namespace
+
+
+auto defaultBeatSounds(double sampleRate, size_t layer) -> BeatSounds
+{
+    const auto* embedded = findEmbeddedBeats(sampleRate, layer);
+    if (embedded == nullptr) {
+        return generateDefaultBeatSounds(sampleRate, layer);
+    }
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = sampleRate, .channels = 1};
+    return BeatSounds{
+        .accent = AudioSignal(audioConfig, AudioDataType(embedded->accent.begin(), embedded->accent.end())),
+        .beat   = AudioSignal(audioConfig, AudioDataType(embedded->beat.begin(), embedded->beat.end())),
+    };
+}
+
+auto generateDefaultBeatSounds(double sampleRate, size_t layer) -> BeatSounds
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = sampleRate, .channels = 1};
+    const auto toneConfig  = [&](double frequency) -> ToneConfiguration {
+        return ToneConfiguration{
+            .length = DEFAULT_BEAT_LENGTH, .frequency = frequency, .overtones = DEFAULT_BEAT_OVERTONES};
+    };
+    return BeatSounds{
+        .accent = generateTone(audioConfig, toneConfig(defaultAccentFrequency(layer))),
+        .beat   = generateTone(audioConfig, toneConfig(defaultBeatFrequency(layer))),
+    };
+}
+
+auto hasEmbeddedBeatSounds(double sampleRate, size_t layer) -> bool
+{
+    return findEmbeddedBeats(sampleRate, layer) != nullptr;
+}
+
+
+TEST_CASE("DefaultSoundsTest - tables match the generated tones")
+{
+    const auto amplitudes = defaultPartialAmplitudes(DEFAULT_BEAT_OVERTONES);
+    CHECK(ranges::equal(amplitudes, DEFAULT_BEAT_PARTIALS));
+    static_assert(sinOfCycles(0.25) > 1 - 1e-15 && sinOfCycles(0.75) < -1 + 1e-15);
+    static_assert(sinOfCycles(0) == 0.0);
+
+    for (const double sampleRate : {CD_SAMPLE_RATE, DEFAULT_SAMPLE_RATE}) {
+        REQUIRE(hasEmbeddedBeatSounds(sampleRate));
+        CHECK_FALSE(hasEmbeddedBeatSounds(sampleRate, 1));
+
+        const auto embedded  = defaultBeatSounds(sampleRate);
+        const auto generated = generateDefaultBeatSounds(sampleRate);
+        const array sounds{pair{embedded.accent, generated.accent}, pair{embedded.beat, generated.beat}};
+        for (const auto& [table, tone] : sounds) {
+            CHECK_EQ(table->getConfiguration().channels, 1);
+            REQUIRE_EQ(table->getAudioData().size(), tone->getAudioData().size());
+            double error = 0;
+            for (size_t idx = 0; idx < tone->getAudioData().size(); ++idx) {
+                error = max(error, static_cast<double>(abs(table->getAudioData()[idx] - tone->getAudioData()[idx])));
+            }
+            CHECK_LT(error, 1e-6);
+        }
+    }
+
+    // other sample rates and the layers are generated
+    CHECK_FALSE(hasEmbeddedBeatSounds(96'000));
+    CHECK_EQ(defaultBeatSounds(96'000).beat->numberSamples(), 4'800);
+    CHECK_GT(defaultBeatFrequency(1), defaultBeatFrequency());
+}
+
+}  // namespace mnome
@@ -0,0 +1,51 @@
+/// DefaultSounds
+///
+/// Tones that are played when no sound files are given, the common sample rates are generated at compile time
+
+#ifndef MNOME_DEFAULTSOUNDS_H
+#define MNOME_DEFAULTSOUNDS_H
+
+#include "AudioSignal.hpp"
+#include "BeatScheduler.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace mnome {
+
+constexpr double       TONE_A1_BASEFREQ       = 440;  // [Hz]
+constexpr size_t       QUINT_HALFSTEPS        = 7;
+constexpr size_t       LAYER_HALFSTEPS        = 4;     // the sounds of the layers are a major third apart
+constexpr double       DEFAULT_BEAT_LENGTH    = 0.05;  // [s]
+constexpr std::uint8_t DEFAULT_BEAT_OVERTONES = 1;
+
+/// Frequency of the default beat, B for the main pattern
+/// \param  layer  0 for the main pattern, the sounds of the layers from 1 on are pitched higher
+constexpr auto defaultBeatFrequency(size_t layer = 0) -> double
+{
+    return halfToneOffset(TONE_A1_BASEFREQ, 2 + (LAYER_HALFSTEPS * layer));
+}
+
+/// Frequency of the default accentuated beat, a quint above the beat
+constexpr auto defaultAccentFrequency(size_t layer = 0) -> double
+{
+    return halfToneOffset(defaultBeatFrequency(layer), QUINT_HALFSTEPS);
+}
+
+/// Sounds of the accentuated and normal beat that are played when no sound files are given, they are not faded yet
+///
+/// The sounds are mono, the scheduler spreads them over the output channels. The sounds of the main pattern at
+/// 44.1 kHz and 48 kHz are copied from tables that have been computed at compile time, all others are generated.
+/// \param  layer  0 for the main pattern, the sounds of the layers from 1 on are pitched higher
+auto defaultBeatSounds(double sampleRate, size_t layer = 0) -> BeatSounds;
+
+/// Generate the default sounds at run time, what defaultBeatSounds() does without a table
+auto generateDefaultBeatSounds(double sampleRate, size_t layer = 0) -> BeatSounds;
+
+/// Whether the default sounds of a layer at a sample rate are copied from a table
+auto hasEmbeddedBeatSounds(double sampleRate, size_t layer = 0) -> bool;
+
+}  // namespace mnome
+
+#endif  // MNOME_DEFAULTSOUNDS_H
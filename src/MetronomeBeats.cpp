@@ -0,0 +1,482 @@
+/// MetronomeBeats
+///
+/// Beat types and beat patterns
+
+#include "MetronomeBeats.hpp"
+
+#include <doctest.h>
+
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+PatternError::PatternError(size_t position, const std::string& reason)
+    : invalid_argument(std::format("Invalid pattern at character {}: {}", position + 1, reason)), index{position}
+{
+}
+
+auto PatternError::position() const -> size_t
+{
+    return index;
+}
+
+
+namespace {
+
+/// Position within a pattern in beats of the tempo as a fraction
+///
+/// Steps with the denominator of the position are added without reducing the fraction, the steps of a subdivision
+/// cost no division then.
+struct BeatPosition
+{
+    uint64_t numerator{0};
+    uint64_t denominator{1};
+
+    [[nodiscard]] static auto reduced(uint64_t num, uint64_t den) -> BeatPosition
+    {
+        const uint64_t divisor = gcd(num, den);
+        return BeatPosition{.numerator = num / divisor, .denominator = den / divisor};
+    }
+
+    /// Position \p count steps of length \p step after this one
+    [[nodiscard]] auto advance(const BeatPosition& step, uint64_t count) const -> BeatPosition
+    {
+        if (step.denominator == denominator) {
+            return BeatPosition{.numerator = numerator + (count * step.numerator), .denominator = denominator};
+        }
+        const uint64_t den = lcm(denominator, step.denominator);
+        return reduced((numerator * (den / denominator)) + (count * step.numerator * (den / step.denominator)), den);
+    }
+
+    /// Length of \p part / \p whole of this length
+    [[nodiscard]] auto scale(uint64_t part, uint64_t whole) const -> BeatPosition
+    {
+        return reduced(numerator * part, denominator * whole);
+    }
+};
+
+/// Element of the syntax tree of a pattern, the children of a node are a linked list
+struct PatternNode
+{
+    enum class Kind : uint8_t
+    {
+        step,       //< accent, beat or pause
+        group,      //< subdivision or tuplet, the children share number beats
+        repeat,     //< the children are played number times
+        signature,  //< time signature number / unit
+    };
+
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    Kind     kind{Kind::step};
+    BeatType type{BeatType::beat};
+    float    gain{1};
+    uint32_t number{1};
+    uint32_t unit{4};
+    uint64_t units{1};     //< steps of the parent that the node takes up
+    uint64_t inner{0};     //< steps of all children
+    uint64_t expanded{1};  //< steps that the node expands to, the ones of subdivisions included
+    size_t   position{0};
+    uint32_t firstChild{NONE};
+    uint32_t next{NONE};
+};
+
+/// Expands the syntax tree of a pattern into its onsets
+class PatternEmitter
+{
+private:
+    const vector<PatternNode>& nodes;
+    CompiledPattern&           compiled;
+
+public:
+    PatternEmitter(const vector<PatternNode>& patternNodes, CompiledPattern& result)
+        : nodes{patternNodes}, compiled{result}
+    {
+    }
+
+    /// Emit the onsets of the top level nodes
+    /// \return  position at the end of the pattern
+    auto emitTopLevel(uint32_t first) -> BeatPosition
+    {
+        BeatPosition       start;
+        BeatPosition       step{.numerator = 1, .denominator = 1};
+        const PatternNode* signature = nullptr;
+        uint64_t           barUnits  = 0;
+        auto               checkBar  = [&]() -> void {
+            if (signature != nullptr && barUnits % signature->number != 0) {
+                throw PatternError(signature->position, std::format("the last bar of {}/{} is not complete",
+                                                                    signature->number, signature->unit));
+            }
+        };
+        for (uint32_t idx = first; idx != PatternNode::NONE; idx = nodes[idx].next) {
+            const auto& node = nodes[idx];
+            if (node.kind == PatternNode::Kind::signature) {
+                checkBar();
+                signature = &node;
+                barUnits  = 0;
+                step      = BeatPosition::reduced(4, node.unit);
+                continue;
+            }
+            start = emitNode(node, start, step);
+            barUnits += node.units;
+        }
+        checkBar();
+        return start;
+    }
+
+private:
+    /// Emit the onsets of a node that starts at \p start and has steps of length \p step
+    /// \return  position after the node
+    auto emitNode(const PatternNode& node, const BeatPosition& start, const BeatPosition& step) -> BeatPosition
+    {
+        switch (node.kind) {
+        case PatternNode::Kind::step:
+            if (node.type != BeatType::pause) {
+                // the denominator is limited to MAX_BEAT_DIVISIONS, reducing the fraction within the beat is cheaper
+                const auto     divisions = static_cast<uint32_t>(start.denominator);
+                const auto     steps     = static_cast<uint32_t>(start.numerator % start.denominator);
+                const uint32_t divisor   = gcd(steps, divisions);
+                compiled.events.push_back(PatternEvent{
+                    .beat      = static_cast<uint32_t>(start.numerator / start.denominator),
+                    .steps     = steps / divisor,
+                    .divisions = divisions / divisor,
+                    .type      = node.type,
+                    .gain      = node.gain,
+                });
+            }
+            return limited(node, start.advance(step, 1));
+        case PatternNode::Kind::group:
+            emitChildren(node, start, limited(node, step.scale(node.number, node.inner)));
+            return limited(node, start.advance(step, node.number));
+        case PatternNode::Kind::repeat: {
+            auto end = start;
+            for (uint32_t pass = 0; pass < node.number; ++pass) {
+                end = emitChildren(node, end, step);
+            }
+            return end;
+        }
+        case PatternNode::Kind::signature:
+            break;
+        }
+        return start;
+    }
+
+    auto emitChildren(const PatternNode& node, BeatPosition start, const BeatPosition& step) -> BeatPosition
+    {
+        for (uint32_t child = node.firstChild; child != PatternNode::NONE; child = nodes[child].next) {
+            start = emitNode(nodes[child], start, step);
+        }
+        return start;
+    }
+
+    /// Keep the fractions of the positions small enough for exact arithmetic and for the scheduler
+    static auto limited(const PatternNode& node, const BeatPosition& position) -> BeatPosition
+    {
+        if (position.denominator > MAX_BEAT_DIVISIONS) {
+            throw PatternError(node.position,
+                               std::format("a beat cannot be divided into more than {} parts", MAX_BEAT_DIVISIONS));
+        }
+        return position;
+    }
+};
+
+/// Recursive descent parser of the pattern syntax, see compilePattern()
+class PatternParser
+{
+private:
+    string_view         text;
+    size_t              pos{0};
+    vector<PatternNode> nodes;
+
+public:
+    explicit PatternParser(string_view pattern) : text{pattern} {}
+
+    /// Parse the whole text and compile it
+    auto compile() -> CompiledPattern
+    {
+        nodes.reserve(text.size());
+        uint64_t       steps = 0;
+        const uint32_t first = parseSequence('\0', true, steps);
+
+        CompiledPattern compiled;
+        compiled.events.reserve(steps);
+        const auto      end = PatternEmitter(nodes, compiled).emitTopLevel(first);
+        if (end.numerator % end.denominator != 0) {
+            throw PatternError(text.size(), "the pattern does not end on a beat");
+        }
+        compiled.beats = static_cast<uint32_t>(end.numerator / end.denominator);
+        return compiled;
+    }
+
+private:
+    /// Parse nodes up to \p closing or the end of the text
+    /// \param  steps  number of steps that the nodes expand to
+    /// \return  index of the first node, PatternNode::NONE when there is none
+    auto parseSequence(char closing, bool topLevel, uint64_t& steps) -> uint32_t
+    {
+        uint32_t first = PatternNode::NONE;
+        uint32_t last  = PatternNode::NONE;
+        while (true) {
+            while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' || text[pos] == '|')) {
+                ++pos;
+            }
+            if (pos == text.size() || text[pos] == closing) {
+                return first;
+            }
+            const uint32_t node = parseNode(topLevel);
+            steps += nodes[node].expanded;
+            if (steps > MAX_PATTERN_STEPS) {
+                throw PatternError(nodes[node].position,
+                                   std::format("the pattern has more than {} steps", MAX_PATTERN_STEPS));
+            }
+            if (last == PatternNode::NONE) {
+                first = node;
+            }
+            else {
+                nodes[last].next = node;
+            }
+            last = node;
+        }
+    }
+
+    auto parseNode(bool topLevel) -> uint32_t
+    {
+        const char  character = text[pos];
+        PatternNode node{.position = pos};
+        switch (character) {
+        case to_underlying(BeatType::accent):
+        case to_underlying(BeatType::beat):
+        case to_underlying(BeatType::pause):
+            node.type = static_cast<BeatType>(character);
+            ++pos;
+            if (pos < text.size() && text[pos] == '@') {
+                if (node.type == BeatType::pause) {
+                    throw PatternError(pos, "a pause has no velocity");
+                }
+                ++pos;
+                node.gain = static_cast<float>(parseNumber("velocity", 100)) / 100;
+            }
+            break;
+        case '[':
+            node.kind = PatternNode::Kind::group;
+            parseChildren(node, ']');
+            node.number = (pos < text.size() && isDigit(text[pos])) ? parseNumber("number of beats", 64) : 1;
+            node.units  = node.number;
+            break;
+        case '(':
+            node.kind = PatternNode::Kind::repeat;
+            parseChildren(node, ')');
+            if (pos == text.size() || text[pos] != 'x') {
+                throw PatternError(pos, "a repeat needs a count like (!+)x2");
+            }
+            ++pos;
+            node.number = parseNumber("repeat count");
+            node.units  = node.inner * node.number;
+            node.expanded *= node.number;
+            break;
+        default:
+            if (!isDigit(character)) {
+                throw PatternError(pos, std::format("unexpected '{}'", character));
+            }
+            if (!topLevel) {
+                throw PatternError(pos, "a time signature cannot be part of a subdivision or repeat");
+            }
+            node.kind   = PatternNode::Kind::signature;
+            node.number = parseNumber("number of steps per bar");
+            if (pos == text.size() || text[pos] != '/') {
+                throw PatternError(pos, "a time signature needs a unit like 3/4");
+            }
+            ++pos;
+            const size_t unitPosition = pos;
+            node.unit                 = parseNumber("unit of the time signature", 64);
+            if (!has_single_bit(node.unit)) {
+                throw PatternError(unitPosition, "the unit of a time signature is a power of 2");
+            }
+            node.units    = 0;
+            node.expanded = 0;
+            break;
+        }
+        if (node.expanded > MAX_PATTERN_STEPS) {
+            throw PatternError(node.position, std::format("the pattern has more than {} steps", MAX_PATTERN_STEPS));
+        }
+        nodes.push_back(node);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    /// Parse the nodes in the brackets of a group or repeat
+    void parseChildren(PatternNode& node, char closing)
+    {
+        ++pos;
+        node.expanded   = 0;
+        node.firstChild = parseSequence(closing, false, node.expanded);
+        if (pos == text.size()) {
+            throw PatternError(node.position, std::format("'{}' is not closed", text[node.position]));
+        }
+        ++pos;
+        if (node.firstChild == PatternNode::NONE) {
+            throw PatternError(node.position, "empty brackets");
+        }
+        for (uint32_t child = node.firstChild; child != PatternNode::NONE; child = nodes[child].next) {
+            node.inner += nodes[child].units;
+        }
+    }
+
+    /// Parse a positive number up to \p maximum
+    auto parseNumber(string_view what, uint32_t maximum = MAX_PATTERN_STEPS) -> uint32_t
+    {
+        uint32_t   number = 0;
+        const auto result = from_chars(text.data() + pos, text.data() + text.size(), number);
+        if (result.ec != errc{} || number == 0 || number > maximum) {
+            throw PatternError(pos, std::format("the {} must be a number from 1 to {}", what, maximum));
+        }
+        pos = static_cast<size_t>(result.ptr - text.data());
+        return number;
+    }
+
+    [[nodiscard]] static auto isDigit(char character) -> bool
+    {
+        return character >= '0' && character <= '9';
+    }
+};
+
+}  // namespace
+
+
+auto compilePattern(string_view pattern) -> CompiledPattern
+{
+    return PatternParser(pattern).compile();
+}
+
+
+MetronomeBeats::MetronomeBeats(std::string_view strPattern)
+{
+    fromString(strPattern);
+}
+MetronomeBeats::MetronomeBeats(const BeatPatternType& otherPattern)
+{
+    string strPattern;
+    for (const auto type : otherPattern) {
+        strPattern += to_underlying(type);
+    }
+    fromString(strPattern);
+}
+
+void MetronomeBeats::fromString(string_view strPattern)
+{
+    auto newCompiled = compilePattern(strPattern);
+
+    // the beat grid shows the onsets that fall on a beat
+    BeatPatternType grid(newCompiled.beats, BeatType::pause);
+    for (const auto& event : newCompiled.events) {
+        if (event.steps == 0) {
+            grid[event.beat] = event.type;
+        }
+    }
+    text     = strPattern;
+    compiled = std::move(newCompiled);
+    pattern  = std::move(grid);
+}
+
+auto MetronomeBeats::toString() const -> std::string
+{
+    return text;
+}
+
+auto MetronomeBeats::getBeatPattern() const -> const std::vector<mnome::BeatType>&
+{
+    return pattern;
+}
+
+auto MetronomeBeats::getCompiledPattern() const -> const CompiledPattern&
+{
+    return compiled;
+}
+
+
+TEST_CASE("MetronomeBeatsTest - compiling patterns")
+{
+    const auto simple = compilePattern("!+.+");
+    CHECK_EQ(simple.beats, 4);
+    REQUIRE_EQ(simple.events.size(), 3);
+    CHECK_EQ(simple.events[0].type, BeatType::accent);
+    CHECK_EQ(simple.events[2].beat, 3);
+
+    // subdivisions, tuplets and velocity
+    const auto rich = compilePattern("![++@50] [+++]2");
+    CHECK_EQ(rich.beats, 4);
+    REQUIRE_EQ(rich.events.size(), 6);
+    CHECK_EQ(rich.events[2].beat, 1);
+    CHECK_EQ(rich.events[2].steps, 1);
+    CHECK_EQ(rich.events[2].divisions, 2);
+    CHECK_EQ(rich.events[2].gain, 0.5F);
+    CHECK_EQ(rich.events[4].beat, 2);
+    CHECK_EQ(rich.events[4].steps, 2);
+    CHECK_EQ(rich.events[4].divisions, 3);
+    CHECK_EQ(rich.events[5].beat, 3);
+    CHECK_EQ(rich.events[5].steps, 1);
+    CHECK_EQ(rich.events[5].divisions, 3);
+
+    // repeats and time signatures, a step of 6/8 lasts half a beat
+    const auto bars = compilePattern("(!+++)x3 | 6/8 !++ +++");
+    CHECK_EQ(bars.beats, 15);
+    REQUIRE_EQ(bars.events.size(), 18);
+    CHECK_EQ(bars.events[8].type, BeatType::accent);
+    CHECK_EQ(bars.events[12].beat, 12);
+    CHECK_EQ(bars.events[13].steps, 1);
+    CHECK_EQ(bars.events[13].divisions, 2);
+
+    const auto beats = MetronomeBeats("![..]+[.+]");
+    CHECK_EQ(beats.toString(), "![..]+[.+]");
+    const BeatPatternType grid{BeatType::accent, BeatType::pause, BeatType::beat, BeatType::pause};
+    CHECK_EQ(beats.getBeatPattern(), grid);
+    CHECK_EQ(MetronomeBeats(grid).toString(), "!.+.");
+    CHECK_EQ(compilePattern("").beats, 0);
+}
+
+TEST_CASE("MetronomeBeatsTest - errors report their position")
+{
+    const vector<pair<string_view, size_t>> invalid{
+        {"!+x+", 2},  {"!+[++", 2}, {"!+)", 2},      {"!(++)", 5},  {"!(++)x0", 6}, {"[]", 0},
+        {"!@101", 2}, {".@50", 1},  {"[3/4 !++]", 1}, {"3/5 !++", 2}, {"3/4 !+", 0},  {"3/8 !++", 7},
+        {"[(+)x65537]", 0},
+    };
+    auto errorPosition = [](string_view pattern) -> size_t {
+        try {
+            compilePattern(pattern);
+        }
+        catch (const PatternError& e) {
+            return e.position();
+        }
+        return string_view::npos;
+    };
+    for (const auto& [pattern, position] : invalid) {
+        CHECK_EQ(errorPosition(pattern), position);
+    }
+    // an invalid pattern keeps the former one
+    auto beats = MetronomeBeats("!++");
+    CHECK_THROWS_AS(beats.fromString("!+?"), invalid_argument);
+    CHECK_EQ(beats.toString(), "!++");
+
+    // expanding large patterns is linear in the number of onsets
+    const auto large = compilePattern("(![++@80+] (+.)x2 [+++++]2)x12500");
+    CHECK_EQ(large.events.size(), 12'500 * 11);
+    CHECK_EQ(large.beats, 12'500 * 8);
+    CHECK_THROWS_AS(compilePattern("((+)x1024)x1025"), PatternError);
+}
+
+}  // namespace mnome
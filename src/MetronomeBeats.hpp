@@ -0,0 +1,138 @@
+/// MetronomeBeats
+///
+/// Beat types and beat patterns
+
+#ifndef MNOME_METRONOMEBEATS_H
+#define MNOME_METRONOMEBEATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace mnome {
+
+/// Types of metronome beats: accent, normal beat and pause
+enum class BeatType : char
+{
+    accent = '!',
+    beat   = '+',
+    pause  = '.',
+};
+
+/// A list of beats is a beat pattern
+using BeatPatternType = std::vector<mnome::BeatType>;
+
+
+/// Onset of a sound in a compiled pattern
+///
+/// The onset lies \p steps / \p divisions of the way from the start of its beat to the next beat of the tempo.
+struct PatternEvent
+{
+    std::uint32_t beat{0};               //< beat of the pattern that the onset falls into
+    std::uint32_t steps{0};              //< [0, divisions)
+    std::uint32_t divisions{1};          //< 1 for an onset on the beat
+    BeatType      type{BeatType::beat};  //< sound of the onset, accent or beat
+    float         gain{1};               //< velocity of the onset
+};
+
+/// Pattern compiled into a flat list of onsets, pauses only take up time
+struct CompiledPattern
+{
+    std::vector<PatternEvent> events;    //< ordered by their position
+    std::uint32_t             beats{0};  //< length of the pattern in beats of the tempo
+};
+
+/// Maximum number of steps, pauses included, that a pattern may expand to
+constexpr size_t MAX_PATTERN_STEPS = size_t{1} << 20U;
+
+/// Finest subdivision of a beat that a pattern may use
+constexpr std::uint32_t MAX_BEAT_DIVISIONS = std::uint32_t{1} << 16U;
+
+/// Error in the text of a pattern
+class PatternError : public std::invalid_argument
+{
+private:
+    size_t index;
+
+public:
+    PatternError(size_t position, const std::string& reason);
+
+    /// Index of the character of the pattern at which the error was found
+    [[nodiscard]] auto position() const -> size_t;
+};
+
+/// Compile the text of a pattern into its onsets
+///
+/// The pattern is a sequence of
+///  - `!`, `+`, `.`  accent, beat and pause of one beat, `!@50` and `+@50` play at 50 % velocity
+///  - `[...]`  subdivision, the steps in the brackets share one beat, e.g. `[++]` are two eighths
+///  - `[...]N`  tuplet, the steps share N beats, e.g. `[+++]2` is a triplet over two beats
+///  - `(...)xN`  repeat, e.g. `(!+++)x3`
+///  - `N/D`  time signature, from there on a step lasts 4 / D beats and the bars of N steps have to be complete
+/// Blanks and `|` may be used to separate the bars.
+/// \throw  PatternError  with the position of the first error
+auto compilePattern(std::string_view pattern) -> CompiledPattern;
+
+
+/// A beat pattern is a list of different beat types
+///
+/// The pattern is kept as its text, its compiled onsets and its beat grid, the beat type at the start of each beat.
+class MetronomeBeats
+{
+private:
+    std::string     text{"+"};
+    CompiledPattern compiled{.events = {PatternEvent{}}, .beats = 1};
+    BeatPatternType pattern{BeatType::beat};
+
+public:
+    /// \throw  PatternError  when the text is not a valid pattern, see compilePattern()
+    explicit MetronomeBeats(std::string_view strPattern);
+    explicit MetronomeBeats(const BeatPatternType& otherPattern);
+
+    /// \throw  PatternError  when the text is not a valid pattern, the pattern is kept then
+    void               fromString(std::string_view strPattern);
+    [[nodiscard]] auto toString() const -> std::string;
+
+    /// Beat type at the start of each beat, beats that start without an onset are pauses
+    [[nodiscard]] auto getBeatPattern() const -> const BeatPatternType&;
+
+    /// Onsets of the pattern as a scheduler walks them
+    [[nodiscard]] auto getCompiledPattern() const -> const CompiledPattern&;
+};
+
+}  // namespace mnome
+
+
+// use BeatType in std::format
+template <>
+struct std::formatter<mnome::BeatType, char>
+{
+    template <class ParseContext>
+    constexpr auto parse(ParseContext& ctx) -> ParseContext::iterator
+    {
+        auto iter = ctx.begin();
+        if (iter == ctx.end()) {
+            return iter;
+        }
+        if (iter != ctx.end() && *iter != '}') {
+            throw std::format_error("Invalid format args for mnome::BeatType.");
+        }
+        return iter;
+    }
+
+    template <class FmtContext>
+    auto format(mnome::BeatType beatType, FmtContext& ctx) const -> FmtContext::iterator
+    {
+        *ctx.out() = std::to_underlying(beatType);
+        return ctx.out();
+    }
+};
+
+
+#endif  //  MNOME_METRONOMEBEATS_H
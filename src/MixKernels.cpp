@@ -0,0 +1,371 @@
+/// MixKernels
+///
+/// Vectorized arithmetic on blocks of samples, the implementation is chosen at runtime from the instruction sets the
+/// CPU supports
+
+#include "MixKernels.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MNOME_MIX_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define MNOME_TARGET(isa) __attribute__((target(isa)))
+#else
+#define MNOME_TARGET(isa)
+#endif
+
+
+namespace mnome {
+
+using namespace std;
+
+auto instructionSetName(InstructionSet instructionSet) -> string_view
+{
+    switch (instructionSet) {
+    case InstructionSet::scalar:
+        return "scalar";
+    case InstructionSet::sse2:
+        return "sse2";
+    case InstructionSet::avx2:
+        return "avx2";
+    }
+    return "unknown";
+}
+
+
+namespace {
+
+// Scalar kernels, they also process the remainders of the vectorized kernels
+
+void addScalar(span<SampleType> destination, span<const SampleType> source)
+{
+    const size_t count = min(destination.size(), source.size());
+    for (size_t idx = 0; idx < count; ++idx) {
+        destination[idx] += source[idx];
+    }
+}
+
+void subtractScalar(span<SampleType> destination, span<const SampleType> source)
+{
+    const size_t count = min(destination.size(), source.size());
+    for (size_t idx = 0; idx < count; ++idx) {
+        destination[idx] -= source[idx];
+    }
+}
+
+void multiplyAddScalar(span<SampleType> destination, span<const SampleType> source, SampleType gain)
+{
+    const size_t count = min(destination.size(), source.size());
+    for (size_t idx = 0; idx < count; ++idx) {
+        destination[idx] += gain * source[idx];
+    }
+}
+
+void applyGainScalar(span<SampleType> data, SampleType gain)
+{
+    for (auto& sample : data) {
+        sample *= gain;
+    }
+}
+
+void clampScalar(span<SampleType> data, SampleType low, SampleType high)
+{
+    for (auto& sample : data) {
+        sample = min(max(sample, low), high);
+    }
+}
+
+constexpr MixKernels SCALAR_KERNELS{
+    .instructionSet = InstructionSet::scalar,
+    .add            = addScalar,
+    .subtract       = subtractScalar,
+    .multiplyAdd    = multiplyAddScalar,
+    .applyGain      = applyGainScalar,
+    .clamp          = clampScalar,
+};
+
+
+#ifdef MNOME_MIX_X86
+
+// SSE2 kernels, 4 samples per step
+
+constexpr size_t SSE2_LANES = 4;
+
+MNOME_TARGET("sse2") void addSse2(span<SampleType> destination, span<const SampleType> source)
+{
+    const size_t count = min(destination.size(), source.size());
+    size_t       idx   = 0;
+    for (; idx + SSE2_LANES <= count; idx += SSE2_LANES) {
+        const __m128 sum = _mm_add_ps(_mm_loadu_ps(&destination[idx]), _mm_loadu_ps(&source[idx]));
+        _mm_storeu_ps(&destination[idx], sum);
+    }
+    addScalar(destination.subspan(idx), source.subspan(idx, count - idx));
+}
+
+MNOME_TARGET("sse2") void subtractSse2(span<SampleType> destination, span<const SampleType> source)
+{
+    const size_t count = min(destination.size(), source.size());
+    size_t       idx   = 0;
+    for (; idx + SSE2_LANES <= count; idx += SSE2_LANES) {
+        const __m128 difference = _mm_sub_ps(_mm_loadu_ps(&destination[idx]), _mm_loadu_ps(&source[idx]));
+        _mm_storeu_ps(&destination[idx], difference);
+    }
+    subtractScalar(destination.subspan(idx), source.subspan(idx, count - idx));
+}
+
+MNOME_TARGET("sse2") void multiplyAddSse2(span<SampleType> destination, span<const SampleType> source, SampleType gain)
+{
+    const size_t count   = min(destination.size(), source.size());
+    const __m128 factors = _mm_set1_ps(gain);
+    size_t       idx     = 0;
+    for (; idx + SSE2_LANES <= count; idx += SSE2_LANES) {
+        const __m128 scaled = _mm_mul_ps(factors, _mm_loadu_ps(&source[idx]));
+        _mm_storeu_ps(&destination[idx], _mm_add_ps(_mm_loadu_ps(&destination[idx]), scaled));
+    }
+    multiplyAddScalar(destination.subspan(idx), source.subspan(idx, count - idx), gain);
+}
+
+MNOME_TARGET("sse2") void applyGainSse2(span<SampleType> data, SampleType gain)
+{
+    const __m128 factors = _mm_set1_ps(gain);
+    size_t       idx     = 0;
+    for (; idx + SSE2_LANES <= data.size(); idx += SSE2_LANES) {
+        _mm_storeu_ps(&data[idx], _mm_mul_ps(_mm_loadu_ps(&data[idx]), factors));
+    }
+    applyGainScalar(data.subspan(idx), gain);
+}
+
+MNOME_TARGET("sse2") void clampSse2(span<SampleType> data, SampleType low, SampleType high)
+{
+    const __m128 lows  = _mm_set1_ps(low);
+    const __m128 highs = _mm_set1_ps(high);
+    size_t       idx   = 0;
+    for (; idx + SSE2_LANES <= data.size(); idx += SSE2_LANES) {
+        _mm_storeu_ps(&data[idx], _mm_min_ps(_mm_max_ps(_mm_loadu_ps(&data[idx]), lows), highs));
+    }
+    clampScalar(data.subspan(idx), low, high);
+}
+
+constexpr MixKernels SSE2_KERNELS{
+    .instructionSet = InstructionSet::sse2,
+    .add            = addSse2,
+    .subtract       = subtractSse2,
+    .multiplyAdd    = multiplyAddSse2,
+    .applyGain      = applyGainSse2,
+    .clamp          = clampSse2,
+};
+
+
+// AVX2 kernels, 8 samples per step
+
+constexpr size_t AVX2_LANES = 8;
+
+MNOME_TARGET("avx2") void addAvx2(span<SampleType> destination, span<const SampleType> source)
+{
+    const size_t count = min(destination.size(), source.size());
+    size_t       idx   = 0;
+    for (; idx + AVX2_LANES <= count; idx += AVX2_LANES) {
+        const __m256 sum = _mm256_add_ps(_mm256_loadu_ps(&destination[idx]), _mm256_loadu_ps(&source[idx]));
+        _mm256_storeu_ps(&destination[idx], sum);
+    }
+    addScalar(destination.subspan(idx), source.subspan(idx, count - idx));
+}
+
+MNOME_TARGET("avx2") void subtractAvx2(span<SampleType> destination, span<const SampleType> source)
+{
+    const size_t count = min(destination.size(), source.size());
+    size_t       idx   = 0;
+    for (; idx + AVX2_LANES <= count; idx += AVX2_LANES) {
+        const __m256 difference = _mm256_sub_ps(_mm256_loadu_ps(&destination[idx]), _mm256_loadu_ps(&source[idx]));
+        _mm256_storeu_ps(&destination[idx], difference);
+    }
+    subtractScalar(destination.subspan(idx), source.subspan(idx, count - idx));
+}
+
+// no FMA: a fused multiply-add would round differently from the other instruction sets
+MNOME_TARGET("avx2") void multiplyAddAvx2(span<SampleType> destination, span<const SampleType> source, SampleType gain)
+{
+    const size_t count   = min(destination.size(), source.size());
+    const __m256 factors = _mm256_set1_ps(gain);
+    size_t       idx     = 0;
+    for (; idx + AVX2_LANES <= count; idx += AVX2_LANES) {
+        const __m256 scaled = _mm256_mul_ps(factors, _mm256_loadu_ps(&source[idx]));
+        _mm256_storeu_ps(&destination[idx], _mm256_add_ps(_mm256_loadu_ps(&destination[idx]), scaled));
+    }
+    multiplyAddScalar(destination.subspan(idx), source.subspan(idx, count - idx), gain);
+}
+
+MNOME_TARGET("avx2") void applyGainAvx2(span<SampleType> data, SampleType gain)
+{
+    const __m256 factors = _mm256_set1_ps(gain);
+    size_t       idx     = 0;
+    for (; idx + AVX2_LANES <= data.size(); idx += AVX2_LANES) {
+        _mm256_storeu_ps(&data[idx], _mm256_mul_ps(_mm256_loadu_ps(&data[idx]), factors));
+    }
+    applyGainScalar(data.subspan(idx), gain);
+}
+
+MNOME_TARGET("avx2") void clampAvx2(span<SampleType> data, SampleType low, SampleType high)
+{
+    const __m256 lows  = _mm256_set1_ps(low);
+    const __m256 highs = _mm256_set1_ps(high);
+    size_t       idx   = 0;
+    for (; idx + AVX2_LANES <= data.size(); idx += AVX2_LANES) {
+        _mm256_storeu_ps(&data[idx], _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(&data[idx]), lows), highs));
+    }
+    clampScalar(data.subspan(idx), low, high);
+}
+
+constexpr MixKernels AVX2_KERNELS{
+    .instructionSet = InstructionSet::avx2,
+    .add            = addAvx2,
+    .subtract       = subtractAvx2,
+    .multiplyAdd    = multiplyAddAvx2,
+    .applyGain      = applyGainAvx2,
+    .clamp          = clampAvx2,
+};
+
+
+/// Indicates whether the CPU and the operating system support AVX2
+auto cpuSupportsAvx2() -> bool
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#elif defined(_MSC_VER)
+    constexpr int OSXSAVE_BIT = 27;
+    constexpr int AVX_BIT     = 28;
+    constexpr int AVX2_BIT    = 5;
+    constexpr int YMM_STATE   = 0x6;
+
+    std::array<int, 4> registers{};
+    __cpuid(registers.data(), 1);
+    const bool avx = ((registers[2] >> OSXSAVE_BIT) & 1) != 0 && ((registers[2] >> AVX_BIT) & 1) != 0;
+    if (!avx || (_xgetbv(0) & YMM_STATE) != YMM_STATE) {
+        return false;
+    }
+    __cpuidex(registers.data(), 7, 0);
+    return ((registers[1] >> AVX2_BIT) & 1) != 0;
+#else
+    return false;
+#endif
+}
+
+/// Indicates whether the CPU supports SSE2, always the case on x86-64
+auto cpuSupportsSse2() -> bool
+{
+#if defined(__x86_64__) || defined(_M_X64)
+    return true;
+#elif defined(__GNUC__) || defined(__clang__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2") != 0;
+#elif defined(_MSC_VER)
+    constexpr int SSE2_BIT = 26;
+
+    std::array<int, 4> registers{};
+    __cpuid(registers.data(), 1);
+    return ((registers[3] >> SSE2_BIT) & 1) != 0;
+#else
+    return false;
+#endif
+}
+
+#endif  // MNOME_MIX_X86
+
+}  // namespace
+
+
+auto mixKernels(InstructionSet instructionSet) -> const MixKernels*
+{
+    switch (instructionSet) {
+    case InstructionSet::scalar:
+        return &SCALAR_KERNELS;
+#ifdef MNOME_MIX_X86
+    case InstructionSet::sse2:
+        return cpuSupportsSse2() ? &SSE2_KERNELS : nullptr;
+    case InstructionSet::avx2:
+        return cpuSupportsAvx2() ? &AVX2_KERNELS : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+auto activeMixKernels() -> const MixKernels&
+{
+    static const MixKernels& active = []() -> const MixKernels& {
+        for (const auto instructionSet : {InstructionSet::avx2, InstructionSet::sse2}) {
+            if (const auto* kernels = mixKernels(instructionSet)) {
+                return *kernels;
+            }
+        }
+        return SCALAR_KERNELS;
+    }();
+    return active;
+}
+
+
+TEST_CASE("MixKernelsTest - all instruction sets match the scalar kernels")
+{
+    // odd sizes and offsets exercise the unaligned loads and the scalar remainders
+    constexpr size_t maxSize = 67;
+    vector<SampleType> source(maxSize + 1);
+    vector<SampleType> initial(maxSize + 1);
+    for (size_t idx = 0; idx < source.size(); ++idx) {
+        source[idx]  = static_cast<SampleType>(idx % 7) * 0.375F - 1.0F;
+        initial[idx] = static_cast<SampleType>(idx % 5) * -0.25F + 0.5F;
+    }
+
+    for (const auto instructionSet : {InstructionSet::scalar, InstructionSet::sse2, InstructionSet::avx2}) {
+        const auto* kernels = mixKernels(instructionSet);
+        if (kernels == nullptr) {
+            continue;
+        }
+        CAPTURE(instructionSetName(instructionSet));
+        CHECK_EQ(kernels->instructionSet, instructionSet);
+
+        for (size_t size = 0; size <= maxSize; ++size) {
+            const auto sourceBlock = span<const SampleType>(source).subspan(1, size);
+            auto       check       = [&](auto kernel, auto scalarKernel) -> void {
+                auto result   = initial;
+                auto expected = initial;
+                kernel(span(result).first(size));
+                scalarKernel(span(expected).first(size));
+                CHECK(result == expected);
+            };
+
+            check([&](span<SampleType> data) { kernels->add(data, sourceBlock); },
+                  [&](span<SampleType> data) { addScalar(data, sourceBlock); });
+            check([&](span<SampleType> data) { kernels->subtract(data, sourceBlock); },
+                  [&](span<SampleType> data) { subtractScalar(data, sourceBlock); });
+            check([&](span<SampleType> data) { kernels->multiplyAdd(data, sourceBlock, 0.3F); },
+                  [&](span<SampleType> data) { multiplyAddScalar(data, sourceBlock, 0.3F); });
+            check([&](span<SampleType> data) { kernels->applyGain(data, -0.7F); },
+                  [&](span<SampleType> data) { applyGainScalar(data, -0.7F); });
+            check([&](span<SampleType> data) { kernels->clamp(data, -0.5F, 0.25F); },
+                  [&](span<SampleType> data) { clampScalar(data, -0.5F, 0.25F); });
+        }
+    }
+
+    // the samples behind the processed block are left untouched
+    auto data = initial;
+    mixAdd(span(data).first(3), source);
+    CHECK_EQ(data[3], initial[3]);
+    CHECK_EQ(data[0], initial[0] + source[0]);
+}
+
+}  // namespace mnome
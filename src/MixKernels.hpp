@@ -0,0 +1,87 @@
+/// MixKernels
+///
+/// Vectorized arithmetic on blocks of samples, the implementation is chosen at runtime from the instruction sets the
+/// CPU supports
+
+#ifndef MNOME_MIXKERNELS_HPP
+#define MNOME_MIXKERNELS_HPP
+
+#include "AudioSignal.hpp"
+
+#include <span>
+#include <string_view>
+
+
+namespace mnome {
+
+/// Instruction sets that mixing kernels are implemented for
+enum class InstructionSet
+{
+    scalar,
+    sse2,
+    avx2,
+};
+
+/// Name of the instruction set, e.g. for benchmark output
+auto instructionSetName(InstructionSet instructionSet) -> std::string_view;
+
+/// Set of mixing kernels of one instruction set
+///
+/// All kernels process min(destination.size(), source.size()) samples. They neither allocate nor block and can be
+/// used in the audio callback.
+struct MixKernels
+{
+    InstructionSet instructionSet;
+
+    /// destination[i] += source[i]
+    void (*add)(std::span<SampleType> destination, std::span<const SampleType> source);
+    /// destination[i] -= source[i]
+    void (*subtract)(std::span<SampleType> destination, std::span<const SampleType> source);
+    /// destination[i] += gain * source[i]
+    void (*multiplyAdd)(std::span<SampleType> destination, std::span<const SampleType> source, SampleType gain);
+    /// data[i] *= gain
+    void (*applyGain)(std::span<SampleType> data, SampleType gain);
+    /// data[i] = min(max(data[i], low), high)
+    void (*clamp)(std::span<SampleType> data, SampleType low, SampleType high);
+};
+
+/// Kernels of a specific instruction set
+/// \return  nullptr when the CPU or the build does not support the instruction set
+auto mixKernels(InstructionSet instructionSet) -> const MixKernels*;
+
+/// Kernels of the best instruction set that is supported by the CPU, detected once on the first call
+auto activeMixKernels() -> const MixKernels&;
+
+/// destination[i] += source[i] with the active kernels
+inline void mixAdd(std::span<SampleType> destination, std::span<const SampleType> source)
+{
+    activeMixKernels().add(destination, source);
+}
+
+/// destination[i] -= source[i] with the active kernels
+inline void mixSubtract(std::span<SampleType> destination, std::span<const SampleType> source)
+{
+    activeMixKernels().subtract(destination, source);
+}
+
+/// destination[i] += gain * source[i] with the active kernels
+inline void mixMultiplyAdd(std::span<SampleType> destination, std::span<const SampleType> source, SampleType gain)
+{
+    activeMixKernels().multiplyAdd(destination, source, gain);
+}
+
+/// data[i] *= gain with the active kernels
+inline void mixApplyGain(std::span<SampleType> data, SampleType gain)
+{
+    activeMixKernels().applyGain(data, gain);
+}
+
+/// Limit all samples to [low, high] with the active kernels
+inline void mixClamp(std::span<SampleType> data, SampleType low, SampleType high)
+{
+    activeMixKernels().clamp(data, low, high);
+}
+
+}  // namespace mnome
+
+#endif  // MNOME_MIXKERNELS_HPP
@@ -1,15 +1,32 @@
 #include "Mnome.hpp"
 #include "AudioSignal.hpp"
 #include "BeatPlayer.hpp"
+#include "ControlServer.hpp"
+#include "DefaultSounds.hpp"
+#include "OnsetLog.hpp"
 
 #include "Repl.hpp"
+#include "Script.hpp"
+#include "SoundAsset.hpp"
+#include "Trace.hpp"
 #include "doctest.h"
 
+#include <charconv>
+#include <cmath>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <filesystem>
 #include <format>
+#include <fstream>
+#include <memory>
+#include <optional>
 #include <print>
+#include <span>
 #include <sstream>
+#include <stdexcept>
 #include <string_view>
+#include <system_error>
 #include <utility>
 
 using namespace std;
@@ -18,40 +35,275 @@ namespace mnome {
 using std::string_view;
 
 
-constexpr size_t PLAYBACK_RATE    = 48'000;  // [Hz]
-constexpr double TONE_A1_BASEFREQ = 440;     // [Hz]
-constexpr size_t QUINT_HALFSTEPS  = 7;
+/// Convert a decimal number
+/// \throw  std::invalid_argument  when \p value is not a number that fits into uint32_t
+static auto parseNumber(string_view name, string_view value) -> uint32_t
+{
+    uint32_t   number = 0;
+    const auto result = from_chars(value.data(), value.data() + value.size(), number);
+    if (result.ec != errc{} || result.ptr != value.data() + value.size()) {
+        throw invalid_argument(std::format("Invalid value \"{}\" for {}", value, name));
+    }
+    return number;
+}
 
-Mnome::Mnome()
+/// Convert a duration in seconds
+/// \throw  std::invalid_argument  when \p value is not a positive number
+static auto parseDuration(string_view name, string_view value) -> double
 {
-    // generate tone configurations
-    const auto     normalBeatHz      = halfToneOffset(TONE_A1_BASEFREQ, 2);            // base tone = B
-    const auto     accentuatedBeatHz = halfToneOffset(normalBeatHz, QUINT_HALFSTEPS);  // base tone + quint
-    constexpr auto beatDuration      = 0.05;                                           // [s]
-    constexpr auto overtones         = 1;
+    double     duration = 0;
+    const auto result   = from_chars(value.data(), value.data() + value.size(), duration);
+    if (result.ec != errc{} || result.ptr != value.data() + value.size() || duration <= 0) {
+        throw invalid_argument(std::format("Invalid value \"{}\" for {}", value, name));
+    }
+    return duration;
+}
 
-    const auto toneConfigNormal = ToneConfiguration{
-        .length    = beatDuration,
-        .frequency = normalBeatHz,
-        .overtones = overtones,
-    };
-    const auto toneConfigAccentuated = ToneConfiguration{
-        .length    = beatDuration,
-        .frequency = accentuatedBeatHz,
-        .overtones = overtones,
-    };
+/// Fail a command, the REPL prints the reason and the control socket replies with it
+/// \throw  std::invalid_argument  always
+[[noreturn]] static void failCommand(string_view reason, string_view usage)
+{
+    throw invalid_argument(string(reason) + '\n' + string(usage));
+}
+
+/// Usage of the pattern command
+static auto patternUsage() -> string
+{
+    return std::format("Command usage: pattern <pattern>\n"
+                       "  `{0}` = accentuated beat  `{1}` = normal beat  `{2}` = pause, e.g. {0}{1}{2}{1}\n"
+                       "  `[{1}{1}]` = subdivision  `[{1}{1}{1}]2` = tuplet over two beats  `{1}@50` = velocity\n"
+                       "  `({0}{1}{1}{1})x3` = repeat  `6/8` = time signature, a step lasts 4/8 beats",
+                       BeatType::accent, BeatType::beat, BeatType::pause);
+}
 
-    // generate the beat
-    const auto audioConfig = AudioSignalConfiguration{
-        .sampleRate = PLAYBACK_RATE,
-        .channels   = 1,
+auto parseCommandLine(std::span<const std::string_view> args) -> MnomeOptions
+{
+    MnomeOptions options;
+    auto         renderOptions = [&options]() -> RenderConfiguration& {
+        if (!options.render) {
+            options.render.emplace();
+        }
+        return *options.render;
     };
-    const auto accentuatedBeat = generateTone(audioConfig, toneConfigAccentuated);
-    const auto normalBeat      = generateTone(audioConfig, toneConfigNormal);
+    for (auto arg = args.begin(); arg != args.end(); ++arg) {
+        auto value = [&arg, &args]() -> string_view {
+            const auto option = *arg;
+            if (++arg == args.end()) {
+                throw invalid_argument(std::format("Missing value for {}", option));
+            }
+            return *arg;
+        };
+        if (*arg == "--low-latency") {
+            options.deviceBuffer.periodSizeInMilliseconds = LOW_LATENCY_PERIOD_SIZE_MS;
+        }
+        else if (*arg == "--period-size") {
+            options.deviceBuffer.periodSizeInMilliseconds = parseNumber("--period-size", value());
+        }
+        else if (*arg == "--periods") {
+            options.deviceBuffer.periods = parseNumber("--periods", value());
+        }
+        else if (*arg == "--null-audio") {
+            options.backend = MiniaudioBackend::null;
+        }
+        else if (*arg == "--channels") {
+            const auto channels = parseNumber("--channels", value());
+            if (channels == 0 || channels > MA_MAX_CHANNELS) {
+                throw invalid_argument(std::format("--channels must be between 1 and {}", MA_MAX_CHANNELS));
+            }
+            options.channels = static_cast<uint8_t>(channels);
+        }
+        else if (*arg == "--beat-sound") {
+            options.sounds.beat = string(value());
+        }
+        else if (*arg == "--accent-sound") {
+            options.sounds.accent = string(value());
+        }
+        else if (*arg == "--sound-cache") {
+            options.sounds.cache = string(value());
+        }
+        else if (*arg == "--render") {
+            renderOptions().outputFile = string(value());
+        }
+        else if (*arg == "--duration") {
+            renderOptions().durationS = parseDuration("--duration", value());
+        }
+        else if (*arg == "--bpm") {
+            renderOptions().bpmProgram = parseBpmProgram(value());
+        }
+        else if (*arg == "--pattern") {
+            renderOptions().pattern = MetronomeBeats(value());
+        }
+        else if (*arg == "--trace") {
+            if (!TRACING_ENABLED) {
+                throw invalid_argument("--trace needs a build with MNOME_TRACING, e.g. cmake -DMNOME_TRACING=ON");
+            }
+            options.traceFile = string(value());
+        }
+        else if (*arg == "--script") {
+            options.script = string(value());
+        }
+        else if (*arg == "--control") {
+            options.control = string(value());
+        }
+        else if (*arg == "--onsets") {
+            options.onsetFile = string(value());
+        }
+        else if (*arg == "-h" || *arg == "--help") {
+            options.showHelp = true;
+        }
+        else {
+            throw invalid_argument(std::format("Unknown option \"{}\"", *arg));
+        }
+    }
+
+    if (options.render) {
+        if (options.render->outputFile.empty()) {
+            throw invalid_argument("--duration, --bpm and --pattern are only used with --render <file>");
+        }
+        if (options.render->durationS <= 0) {
+            throw invalid_argument("--render needs the --duration of the file");
+        }
+        if (options.render->bpmProgram.empty()) {
+            options.render->bpmProgram = {TempoSegment{.bpm = DEFAULT_BPM, .bars = 0}};
+        }
+    }
+    return options;
+}
+
+/// Audio format of rendered files, there is no device to take the sample rate from
+constexpr AudioSignalConfiguration RENDER_CONFIG{
+    .sampleRate = DEFAULT_SAMPLE_RATE,
+    .channels   = 1,
+};
+
+/// Cache of the converted sound files
+static auto makeAssetCache(const BeatSoundFiles& soundFiles) -> SoundAssetCache
+{
+    if (soundFiles.cache.empty()) {
+        return SoundAssetCache();
+    }
+    return SoundAssetCache(filesystem::path(soundFiles.cache));
+}
+
+auto renderClickTrack(const RenderConfiguration& renderConfig, const BeatSoundFiles& soundFiles) -> RenderStatistics
+{
+    auto beats = defaultBeatSounds(RENDER_CONFIG.sampleRate);
+    auto cache = makeAssetCache(soundFiles);
+    if (!soundFiles.beat.empty()) {
+        beats.beat = cache.load(soundFiles.beat, RENDER_CONFIG);
+    }
+    if (!soundFiles.accent.empty()) {
+        beats.accent = cache.load(soundFiles.accent, RENDER_CONFIG);
+    }
+    return renderToWav(renderConfig, prepareBeatSounds(beats.beat, beats.accent), RENDER_CONFIG);
+}
+
+void printRenderStatistics(const RenderConfiguration& renderConfig, const RenderStatistics& statistics)
+{
+    std::println("Rendered {:.1f} s of audio to {} in {:.3f} s ({:.0f}x real time)", statistics.audioDurationS,
+                 renderConfig.outputFile, statistics.renderTime.count(), statistics.realTimeFactor());
+}
+
+namespace {
+
+/// Bars of the player for the directives of scripts
+class PlayerScriptClock : public ScriptClock
+{
+private:
+    BeatPlayer& player;
+
+public:
+    explicit PlayerScriptClock(BeatPlayer& beatPlayer) : player{beatPlayer} {}
+
+    [[nodiscard]] auto isRunning() const -> bool override
+    {
+        return player.isRunning();
+    }
+
+    [[nodiscard]] auto currentBar() const -> uint64_t override
+    {
+        return player.getStartedBars();
+    }
+
+    void waitForBar(uint64_t bar) override
+    {
+        player.waitForBar(bar);
+    }
 
-    bp.setBeat(normalBeat);
-    bp.setAccentuatedBeat(accentuatedBeat);
-    bp.setAccentuatedPattern(MetronomeBeats("!+++"));
+    void setChangeBar(optional<uint64_t> bar) override
+    {
+        player.setChangeBar(bar);
+    }
+};
+
+/// Changes of the player for the acknowledgements of the control socket
+class PlayerControlClock : public ControlClock
+{
+private:
+    BeatPlayer& player;
+
+public:
+    explicit PlayerControlClock(BeatPlayer& beatPlayer) : player{beatPlayer} {}
+
+    [[nodiscard]] auto isRunning() const -> bool override
+    {
+        return player.isRunning();
+    }
+
+    [[nodiscard]] auto threadChange() -> uint64_t override
+    {
+        return player.getThreadChange();
+    }
+
+    [[nodiscard]] auto appliedChanges() const -> uint64_t override
+    {
+        return player.getAppliedChanges();
+    }
+
+    [[nodiscard]] auto changeFrame(uint64_t sequence) const -> optional<uint64_t> override
+    {
+        return player.getChangeFrame(sequence);
+    }
+};
+
+}  // namespace
+
+/// Read a whole script
+/// \param  file  - for the standard input
+/// \throw  std::runtime_error  when the file cannot be read
+static auto readScript(const string& file) -> string
+{
+    stringstream text;
+    if (file == "-") {
+        text << cin.rdbuf();
+        return text.str();
+    }
+    ifstream stream(file, ios::binary);
+    if (!stream) {
+        throw runtime_error(std::format("Cannot read the script {}", file));
+    }
+    text << stream.rdbuf();
+    return text.str();
+}
+
+Mnome::Mnome(const MnomeOptions& options)
+    : bp{options.deviceBuffer, std::make_unique<MiniaudioSink>(options.backend), options.channels},
+      assets{makeAssetCache(options.sounds)}, scriptClock{std::make_unique<PlayerScriptClock>(bp)},
+      controlClock{std::make_unique<PlayerControlClock>(bp)}
+{
+    startup.deviceOpened = chrono::steady_clock::now() - options.launchTime;
+
+    // the sounds are resolved first and handed to the player at once, so they are prepared for the device only once,
+    // the default pattern of the player is kept
+    auto beats = defaultBeatSounds(bp.getAudioConfiguration().sampleRate);
+    if (auto sound = loadSound(options.sounds.beat)) {
+        beats.beat = std::move(*sound);
+    }
+    if (auto sound = loadSound(options.sounds.accent)) {
+        beats.accent = std::move(*sound);
+    }
+    bp.setBeatSounds(std::move(beats.beat), std::move(beats.accent));
+    startup.soundsReady = chrono::steady_clock::now() - options.launchTime;
 
     // bind keywords to function callbacks
     ReplCommandList commands;
@@ -69,21 +321,102 @@ Mnome::Mnome()
                                          .help     = "Stop playback"});
     commands.emplace("bpm", ReplCommand{.function = [this](string_view args) -> void { setBPM(args); },
                                         .name     = "bpm",
-                                        .help     = "Set the bpm to an integer value"});
+                                        .help     = "Command usage: bpm <number|bpm program>\n"
+                                                    "  Set the bpm to an integer value or play a bpm program, e.g.\n"
+                                                    "  80-160:32 (ramp), 100+4/8 (4 bpm faster every 8 bars)",
+                                        .timed    = true});
     commands.emplace("pattern",
                      ReplCommand{.function = [this](string_view args) -> void { setBeatPattern(args); },
                                  .name     = "pattern",
-                                 .help = std::format("Command usage: pattern <pattern>\n"
-                                                     "  <pattern> must be in the form of `[{0}|{1}|{2}]*`\n"
-                                                     "  `{0}` = accentuated beat  `{1}` = normal beat  `{2}` = pause",
-                                                     BeatType::accent, BeatType::accent, BeatType::pause)});
+                                 .help     = patternUsage(),
+                                 .timed    = true});
+    commands.emplace("apply", ReplCommand{.function = [this](string_view args) -> void { setChangeBoundary(args); },
+                                          .name     = "apply",
+                                          .help     = "Command usage: apply <beat|bar>\n"
+                                                      "  Apply bpm and pattern changes during playback at the next beat or bar"});
+    commands.emplace("latency", ReplCommand{.function = [this](string_view) -> void { printLatency(); },
+                                            .name     = "latency",
+                                            .help     = "Show start latency and output latency of the device"});
+    commands.emplace("stats", ReplCommand{.function = [this](string_view) -> void { printCallbackStatistics(); },
+                                          .name     = "stats",
+                                          .help     = "Show xruns, run time and block sizes of the audio callback"});
+    commands.emplace("startup", ReplCommand{.function = [this](string_view) -> void { printStartupTimes(); },
+                                            .name     = "startup",
+                                            .help     = "Show how long the start up took after the launch"});
+    commands.emplace("trace", ReplCommand{.function = [this](string_view args) -> void { writeTrace(args); },
+                                          .name     = "trace",
+                                          .help     = "Command usage: trace <file>\n"
+                                                      "  Write the recorded tracing spans as Chrome trace JSON",
+                                          .blocking = true});
+    commands.emplace("onsets", ReplCommand{.function = [this](string_view args) -> void { writeOnsets(args); },
+                                           .name     = "onsets",
+                                           .help     = "Command usage: onsets [<file>|off]\n"
+                                                       "  Write the time stamps of the beat onsets into a binary file,\n"
+                                                       "  show the file without arguments",
+                                           .blocking = true});
+    commands.emplace("buffer",
+                     ReplCommand{.function = [this](string_view args) -> void { setDeviceBuffer(args); },
+                                 .name     = "buffer",
+                                 .help     = "Command usage: buffer [low|default|<period size ms> [<periods>]]\n"
+                                             "  Change the buffering of the audio device, show it without arguments",
+                                 .blocking = true});
+    commands.emplace("gain", ReplCommand{.function = [this](string_view args) -> void { setGain(args); },
+                                         .name     = "gain",
+                                         .help     = "Command usage: gain <factor>\n"
+                                                     "  Set the volume, <factor> is between 0 and 1"});
+    commands.emplace("pan", ReplCommand{.function = [this](string_view args) -> void { setPan(args); },
+                                        .name     = "pan",
+                                        .help     = "Command usage: pan <accent|beat> <position> [<gain>]\n"
+                                                    "  Place a beat between the first (-1) and the last (1) channel",
+                                        .timed    = true});
+    commands.emplace("route", ReplCommand{.function = [this](string_view args) -> void { setRoute(args); },
+                                          .name     = "route",
+                                          .help     = "Command usage: route <accent|beat> <channel> [<gain>]\n"
+                                                      "  Play a beat on a single channel only, the first channel is 1",
+                                          .timed    = true});
+    commands.emplace("layer",
+                     ReplCommand{.function = [this](string_view args) -> void { setLayer(args); },
+                                 .name     = "layer",
+                                 .help     = "Command usage: layer [<number> <pattern> [<subdivision>]|<number> off]\n"
+                                             "  Play a pattern along with the main pattern, spread over one bar of it,\n"
+                                             "  e.g. `layer 1 !++` plays three against four, show the layers without arguments",
+                                 .timed    = true});
+    commands.emplace("sound", ReplCommand{.function = [this](string_view args) -> void { setSound(args); },
+                                          .name     = "sound",
+                                          .help     = "Command usage: sound <accent|beat> <file>\n"
+                                                      "  Play a WAV, FLAC or MP3 file as accentuated or normal beat",
+                                          .timed    = true,
+                                          .blocking = true});
+    commands.emplace("render", ReplCommand{.function = [this](string_view args) -> void { render(args); },
+                                           .name     = "render",
+                                           .help     = "Command usage: render <file> <seconds> [<bpm program>]\n"
+                                                       "  Write the current pattern into a WAV file, the bpm program is\n"
+                                                       "  e.g. 120:8,140:8,160 (<bpm>:<bars>), default is the current bpm",
+                                           .blocking = true});
     // make ENTER start and stop
     commands.emplace("", ReplCommand{.function = [this](string_view) -> void { togglePlayback(); },
                                      .name     = "<ENTER KEY>",
                                      .help     = "Shortcut for toggling playback"});
 
+    if (!options.onsetFile.empty()) {
+        onsetWriter = std::make_unique<OnsetFileWriter>(bp.getOnsetLog(), options.onsetFile);
+    }
+
     repl.setCommands(commands);
-    repl.start();
+    // the socket is opened first, the REPL cannot be stopped while it waits for input
+    if (!options.control.empty()) {
+        control = std::make_unique<ControlServer>(commands, *controlClock);
+        control->streamOnsets(&bp.getOnsetLog());
+        control->start(options.control);
+    }
+    if (options.script.empty()) {
+        repl.start();
+    }
+    else {
+        repl.startScript(readScript(options.script), *scriptClock);
+    }
+    startup.replReady = chrono::steady_clock::now() - options.launchTime;
+    MNOME_TRACE_INSTANT("Mnome::replReady");
 }
 
 void Mnome::stop()
@@ -91,21 +424,30 @@ void Mnome::stop()
     lock_guard<mutex> lockGuard(cmdMtx);
     bp.stop();
     repl.stop();
+    if (control) {
+        control->stop();
+    }
 }
 
 /// Wait for the read evaluate loop to finish
 void Mnome::waitForStop()
 {
     repl.waitForStop();
+    // without a terminal the clients keep controlling the playback until one of them sends exit
+    if (control) {
+        control->waitForStop();
+    }
 }
 
 void Mnome::stopPlayback()
 {
+    MNOME_TRACE_SPAN("Mnome::stopPlayback");
     lock_guard<mutex> lockGuard(cmdMtx);
     bp.stop();
 }
 void Mnome::startPlayback()
 {
+    MNOME_TRACE_SPAN("Mnome::startPlayback");
     lock_guard<mutex> lockGuard(cmdMtx);
     bp.start();
 }
@@ -121,40 +463,437 @@ void Mnome::togglePlayback()
 }
 void Mnome::setBPM(std::string_view args)
 {
-    auto              displayHelp = []() -> void { cout << "Command usage: bpm <number>\n"; };
+    MNOME_TRACE_SPAN("Mnome::setBPM");
+    constexpr string_view usage = "Command usage: bpm <number|bpm program>";
+    lock_guard<mutex>     lockGuard(cmdMtx);
+    BpmProgram            program;
+    try {
+        program = parseBpmProgram(args);
+    }
+    catch (const exception&) {
+        failCommand("Could not get beats per minute from \"" + string(args) + '"', usage);
+    }
+    // a single constant tempo needs no program
+    if (program.size() == 1 && program.front().ramp == TempoRamp::hold) {
+        bp.setBPM(program.front().bpm);
+    }
+    else {
+        bp.setTempo(program);
+    }
+}
+void Mnome::setBeatPattern(std::string_view args)
+{
+    MNOME_TRACE_SPAN("Mnome::setBeatPattern");
+    const auto        usage = patternUsage();
+    lock_guard<mutex> lockGuard(cmdMtx);
+    if (args.empty()) {
+        failCommand("A pattern is needed", usage);
+    }
+    try {
+        const auto pattern = MetronomeBeats(args);
+        if (pattern.getCompiledPattern().beats == 0) {
+            failCommand("The pattern has no beats", usage);
+        }
+        bp.setAccentuatedPattern(pattern);
+    }
+    catch (const PatternError& e) {
+        failCommand(string(e.what()) + "\n  " + string(args) + "\n  " + string(e.position(), ' ') + '^', usage);
+    }
+}
+
+void Mnome::setChangeBoundary(std::string_view args)
+{
+    lock_guard<mutex> lockGuard(cmdMtx);
+    if (args == "beat") {
+        bp.setChangeBoundary(ChangeBoundary::beat);
+    }
+    else if (args == "bar") {
+        bp.setChangeBoundary(ChangeBoundary::bar);
+    }
+    else {
+        failCommand("Invalid boundary \"" + string(args) + '"', "Command usage: apply <beat|bar>");
+    }
+}
+
+/// Print the negotiated buffering of the audio device
+static void printDeviceBuffer(const BeatPlayer& player)
+{
+    const auto bufferInfo = player.getDeviceBufferInfo();
+    if (bufferInfo) {
+        std::println("Device buffer: {} periods of {} frames at {} Hz = {} frames, output latency {:.1f} ms",
+                     bufferInfo->periods, bufferInfo->periodSizeInFrames, bufferInfo->sampleRate,
+                     bufferInfo->bufferSizeInFrames(), bufferInfo->outputLatency().count());
+    }
+    else {
+        std::println("Device buffer: no audio device is open");
+    }
+}
+
+void Mnome::printLatency()
+{
+    lock_guard<mutex> lockGuard(cmdMtx);
+    const auto        startLatency = bp.getStartLatency();
+    if (startLatency) {
+        std::println("Start latency: {:.3f} ms from command to first output frame",
+                     chrono::duration<double, milli>(*startLatency).count());
+    }
+    else {
+        std::println("Start latency: no playback has been started yet");
+    }
+    printDeviceBuffer(bp);
+}
+
+/// Print mean, median, 99th percentile and maximum of a histogram
+static void printHistogramSummary(string_view name, const HistogramSnapshot& histogram, double scale, string_view unit)
+{
+    std::println("{}: mean {:.1f} {}, median <= {:.1f} {}, 99% <= {:.1f} {}, max {:.1f} {}", name,
+                 histogram.mean() * scale, unit, static_cast<double>(histogram.percentile(0.5)) * scale, unit,
+                 static_cast<double>(histogram.percentile(0.99)) * scale, unit,
+                 static_cast<double>(histogram.max) * scale, unit);
+}
+
+void Mnome::printCallbackStatistics()
+{
+    lock_guard<mutex> lockGuard(cmdMtx);
+    const auto        stats = bp.getCallbackStatistics();
+    if (stats.callbacks == 0) {
+        std::println("Callback statistics: the audio device has not requested any samples yet");
+        return;
+    }
+    constexpr double nsToUs = 1e-3;
+    constexpr double nsToMs = 1e-6;
+
+    std::println("Callbacks: {} with {} frames, xruns: {} ({} underruns, {} deadline misses), {} short reads, "
+                 "{} without buffer",
+                 stats.callbacks, stats.frames, stats.xruns(), stats.underruns, stats.deadlineMisses,
+                 stats.shortReads, stats.missingBuffers);
+    printHistogramSummary("Duration", stats.durationNs, nsToUs, "us");
+    printHistogramSummary("Interval", stats.intervalNs, nsToMs, "ms");
+    printHistogramSummary("Block size", stats.framesRequested, 1, "frames");
+    if (stats.intervalNs.mean() > 0) {
+        std::println("Load: {:.2f} % of the time between callbacks",
+                     100 * stats.durationNs.mean() / stats.intervalNs.mean());
+    }
+
+    std::println("Duration histogram:");
+    const auto& buckets = stats.durationNs.buckets;
+    for (size_t bucket = 0; bucket < buckets.size(); ++bucket) {
+        if (buckets[bucket] != 0) {
+            std::println("  >= {:>10.3f} us: {}", static_cast<double>(HistogramSnapshot::lowerBound(bucket)) * nsToUs,
+                         buckets[bucket]);
+        }
+    }
+}
+
+void Mnome::setDeviceBuffer(std::string_view args)
+{
+    MNOME_TRACE_SPAN("Mnome::setDeviceBuffer");
     lock_guard<mutex> lockGuard(cmdMtx);
     if (!args.empty()) {
+        DeviceBufferConfiguration deviceBuffer;
         try {
-            size_t bpm = stoul(string(args));
-            bp.setBPM(bpm);
+            if (args == "low") {
+                deviceBuffer.periodSizeInMilliseconds = LOW_LATENCY_PERIOD_SIZE_MS;
+            }
+            else if (args != "default") {
+                const size_t argSep                   = args.find(' ');
+                deviceBuffer.periodSizeInMilliseconds = parseNumber("period size", args.substr(0, argSep));
+                if (argSep != string_view::npos) {
+                    deviceBuffer.periods = parseNumber("periods", args.substr(argSep + 1));
+                }
+            }
         }
-        catch (exception& e) {
-            std::println("Could get beats per minute from \"{}\"", args);
-            displayHelp();
-        };
+        catch (const invalid_argument& e) {
+            failCommand(e.what(), "Command usage: buffer [low|default|<period size ms> [<periods>]]");
+        }
+        bp.setDeviceBuffer(deviceBuffer);
     }
-    else {
-        displayHelp();
+    printDeviceBuffer(bp);
+}
+
+void Mnome::setGain(std::string_view args)
+{
+    MNOME_TRACE_SPAN("Mnome::setGain");
+    lock_guard<mutex> lockGuard(cmdMtx);
+    float             gain   = 0;
+    const auto        result = from_chars(args.data(), args.data() + args.size(), gain);
+    if (args.empty() || result.ec != errc{} || result.ptr != args.data() + args.size() || gain < 0 || gain > 1) {
+        failCommand("Invalid gain \"" + string(args) + '"',
+                    "Command usage: gain <factor>\n"
+                    "  Set the volume, <factor> is between 0 and 1");
     }
+    bp.setGain(gain);
 }
-void Mnome::setBeatPattern(std::string_view args)
+
+/// Arguments of the pan and route commands
+struct ChannelArguments
+{
+    BeatType type{BeatType::beat};
+    double   value{0};  //< pan position or channel
+    double   gain{1};
+};
+
+/// Parse `<accent|beat> <value> [<gain>]`
+/// \throw  std::invalid_argument  when the arguments are malformed
+static auto parseChannelArguments(string_view args) -> ChannelArguments
 {
-    auto displayHelp = []() -> void {
-        cout << std::format("Command usage: pattern <pattern>\n"
-                            "  <pattern> must be in the form of `[{0}|{1}|{2}]*`\n"
-                            "  `{0}` = accentuated beat  `{1}` = normal beat  `{2}` = pause\n",
-                            BeatType::accent, BeatType::accent, BeatType::pause);
+    ChannelArguments parsed;
+    auto             parse = [](string_view name, string_view value) -> double {
+        double     number = 0;
+        const auto result = from_chars(value.data(), value.data() + value.size(), number);
+        if (value.empty() || result.ec != errc{} || result.ptr != value.data() + value.size()) {
+            throw invalid_argument(std::format("Invalid value \"{}\" for {}", value, name));
+        }
+        return number;
     };
+
+    const size_t typeSep  = args.find(' ');
+    const auto   typeName = args.substr(0, typeSep);
+    if (typeName == "accent") {
+        parsed.type = BeatType::accent;
+    }
+    else if (typeName != "beat") {
+        throw invalid_argument(std::format("Invalid beat \"{}\", use accent or beat", typeName));
+    }
+    if (typeSep == string_view::npos) {
+        throw invalid_argument("Missing position or channel");
+    }
+    const size_t valueSep = args.find(' ', typeSep + 1);
+    parsed.value          = parse("position or channel", args.substr(typeSep + 1, valueSep - typeSep - 1));
+    if (valueSep != string_view::npos) {
+        parsed.gain = parse("gain", args.substr(valueSep + 1));
+        if (parsed.gain < 0 || parsed.gain > 1) {
+            throw invalid_argument("The gain must be between 0 and 1");
+        }
+    }
+    return parsed;
+}
+
+void Mnome::setPan(std::string_view args)
+{
     lock_guard<mutex> lockGuard(cmdMtx);
-    if (!args.empty()) {
-        if (args.contains(to_underlying(BeatType::accent)) && args.contains(to_underlying(BeatType::beat))) {
-            displayHelp();
-            return;
+    try {
+        const auto pan = parseChannelArguments(args);
+        if (pan.value < -1 || pan.value > 1) {
+            throw invalid_argument("The position must be between -1 and 1");
+        }
+        bp.setChannelGains(pan.type, panGains(bp.getAudioConfiguration().channels, pan.value, pan.gain));
+    }
+    catch (const invalid_argument& e) {
+        failCommand(e.what(), "Command usage: pan <accent|beat> <position> [<gain>]");
+    }
+}
+
+void Mnome::setRoute(std::string_view args)
+{
+    lock_guard<mutex> lockGuard(cmdMtx);
+    try {
+        const auto route    = parseChannelArguments(args);
+        const auto channels = bp.getAudioConfiguration().channels;
+        if (route.value < 1 || route.value > channels || route.value != floor(route.value)) {
+            throw invalid_argument(std::format("The channel must be between 1 and {}", channels));
+        }
+        bp.setChannelGains(route.type, routeGains(static_cast<uint8_t>(route.value - 1), route.gain));
+    }
+    catch (const invalid_argument& e) {
+        failCommand(e.what(), "Command usage: route <accent|beat> <channel> [<gain>]");
+    }
+}
+
+/// Print the layers that are played along with the main pattern
+static void printLayers(const BeatPlayer& player)
+{
+    const auto layers = player.getLayers();
+    if (layers->empty()) {
+        std::println("Layers: none");
+    }
+    for (size_t layer = 0; layer < layers->size(); ++layer) {
+        const auto& beatLayer = (*layers)[layer];
+        std::println("Layer {}: {} x {}, {} steps per bar", layer + 1, MetronomeBeats(beatLayer.pattern).toString(),
+                     beatLayer.subdivision, beatLayer.steps());
+    }
+}
+
+void Mnome::setLayer(std::string_view args)
+{
+    MNOME_TRACE_SPAN("Mnome::setLayer");
+    lock_guard<mutex> lockGuard(cmdMtx);
+    if (args.empty()) {
+        printLayers(bp);
+        return;
+    }
+    try {
+        const size_t numberSep = args.find(' ');
+        if (numberSep == string_view::npos) {
+            throw invalid_argument("A pattern or off is needed");
+        }
+        const auto number = parseNumber("layer", args.substr(0, numberSep));
+        if (number == 0 || number > MAX_BEAT_LAYERS) {
+            throw invalid_argument(std::format("The layer must be between 1 and {}", MAX_BEAT_LAYERS));
+        }
+        const size_t patternSep = args.find(' ', numberSep + 1);
+        const auto   pattern    = args.substr(numberSep + 1, patternSep - numberSep - 1);
+        if (pattern == "off") {
+            bp.removeLayer(number - 1);
+        }
+        else {
+            const auto beats       = MetronomeBeats(pattern);
+            uint32_t   subdivision = 1;
+            if (patternSep != string_view::npos) {
+                subdivision = parseNumber("subdivision", args.substr(patternSep + 1));
+            }
+            if (beats.getBeatPattern().empty() || subdivision == 0) {
+                throw invalid_argument("The layer needs a pattern and a subdivision of at least 1");
+            }
+            auto sounds = defaultBeatSounds(bp.getAudioConfiguration().sampleRate, number);
+            bp.setLayer(number - 1, beats, subdivision, std::move(sounds.beat), std::move(sounds.accent));
         }
-        bp.setAccentuatedPattern(MetronomeBeats(args));
+    }
+    catch (const invalid_argument& e) {
+        failCommand(e.what(), "Command usage: layer [<number> <pattern> [<subdivision>]|<number> off]");
+    }
+    printLayers(bp);
+}
+
+auto Mnome::convertSound(const std::filesystem::path& file) -> AudioSignal
+{
+    try {
+        // the file is converted to the format of the device once, later launches take it from the cache
+        const auto hits  = assets.hits();
+        auto       sound = assets.load(file, bp.getAudioConfiguration());
+        std::println("Loaded {} ({:.3f} s{})", file.string(), sound.length(),
+                     assets.hits() > hits ? ", from the cache" : "");
+        return sound;
+    }
+    catch (const runtime_error& e) {
+        throw runtime_error("Cannot load the sound: " + string(e.what()));
+    }
+}
+
+auto Mnome::loadSound(const std::filesystem::path& file) -> std::optional<AudioSignal>
+{
+    if (file.empty()) {
+        return nullopt;
+    }
+    try {
+        return convertSound(file);
+    }
+    catch (const runtime_error& e) {
+        std::println("{}", e.what());
+        return nullopt;
+    }
+}
+
+void Mnome::setSound(std::string_view args)
+{
+    MNOME_TRACE_SPAN("Mnome::setSound");
+    lock_guard<mutex> lockGuard(cmdMtx);
+    const size_t      typeSep = args.find(' ');
+    const auto        type    = args.substr(0, typeSep);
+    if (typeSep == string_view::npos || (type != "accent" && type != "beat")) {
+        failCommand("A beat and a file are needed", "Command usage: sound <accent|beat> <file>");
+    }
+    auto sound = convertSound(filesystem::path(args.substr(typeSep + 1)));
+    if (type == "accent") {
+        bp.setAccentuatedBeat(std::move(sound));
     }
     else {
-        displayHelp();
+        bp.setBeat(std::move(sound));
+    }
+}
+
+void Mnome::printStartupTimes() const
+{
+    const auto milliseconds = [](chrono::steady_clock::duration duration) -> double {
+        return chrono::duration<double, milli>(duration).count();
+    };
+    std::println("Startup after launch: device opened {:.1f} ms, sounds ready {:.1f} ms, REPL ready {:.1f} ms",
+                 milliseconds(startup.deviceOpened), milliseconds(startup.soundsReady),
+                 milliseconds(startup.replReady));
+}
+
+void Mnome::writeTrace(std::string_view args)
+{
+    if (!TRACING_ENABLED) {
+        throw runtime_error("Tracing is not compiled in, build with MNOME_TRACING, e.g. cmake -DMNOME_TRACING=ON");
+    }
+    if (args.empty()) {
+        failCommand("A file is needed", "Command usage: trace <file>");
+    }
+    const auto events = writeTraceFile(filesystem::path(args));
+    std::println("Wrote {} trace events to {}, open it in chrome://tracing or https://ui.perfetto.dev", events, args);
+}
+
+void Mnome::writeOnsets(std::string_view args)
+{
+    lock_guard<mutex> lockGuard(cmdMtx);
+    if (args.empty()) {
+        if (onsetWriter) {
+            std::println("Writing the onsets to {}, {} written, {} lost", onsetWriter->file().string(),
+                         onsetWriter->written(), onsetWriter->lost());
+        }
+        else {
+            cout << "The onsets are not written, command usage: onsets [<file>|off]\n";
+        }
+        return;
+    }
+    onsetWriter.reset();  // the previous file is completed first
+    if (args == "off") {
+        return;
+    }
+    onsetWriter = std::make_unique<OnsetFileWriter>(bp.getOnsetLog(), filesystem::path(args));
+}
+
+void Mnome::render(std::string_view args)
+{
+    constexpr string_view usage = "Command usage: render <file> <seconds> [<bpm program>]";
+    RenderConfiguration   renderConfig;
+    optional<BpmProgram>  bpmProgram;
+    try {
+        const size_t fileSep     = args.find(' ');
+        const size_t durationSep = args.find(' ', fileSep + 1);
+        if (args.empty() || fileSep == string_view::npos) {
+            throw invalid_argument("File and duration are needed");
+        }
+        renderConfig.outputFile = string(args.substr(0, fileSep));
+        renderConfig.durationS  = parseDuration("duration", args.substr(fileSep + 1, durationSep - fileSep - 1));
+        if (durationSep != string_view::npos) {
+            bpmProgram = parseBpmProgram(args.substr(durationSep + 1));
+        }
+    }
+    catch (const invalid_argument& e) {
+        failCommand(e.what(), usage);
+    }
+
+    // the settings are copied, a long rendering must not block the other commands
+    shared_ptr<const BeatSounds> sounds;
+    AudioSignalConfiguration     audioConfig{};
+    {
+        lock_guard<mutex> lockGuard(cmdMtx);
+        sounds = bp.getBeatSounds();
+        if (!sounds) {
+            throw runtime_error("There are no beat sounds to render");
+        }
+        audioConfig          = bp.getAudioConfiguration();
+        renderConfig.pattern = bp.getAccentuatedPattern();
+        renderConfig.layers  = *bp.getLayers();
+        if (bpmProgram) {
+            renderConfig.bpmProgram = std::move(*bpmProgram);
+        }
+        else {
+            const auto tempoProgram = bp.getTempoProgram();
+            renderConfig.bpmProgram =
+                tempoProgram ? *tempoProgram : BpmProgram{TempoSegment{.bpm = bp.getBPM(), .bars = 0}};
+        }
+    }
+
+    try {
+        // the file has the channels of the device, so that panning and routing are kept
+        const auto statistics = renderToWav(renderConfig, *sounds, audioConfig);
+        printRenderStatistics(renderConfig, statistics);
+    }
+    catch (const exception& e) {
+        throw runtime_error("Rendering failed: " + string(e.what()));
     }
 }
 
@@ -163,6 +902,60 @@ auto Mnome::isPlaying() const -> bool
     return bp.isRunning();
 }
 
+TEST_CASE("MnomeTest - command line")
+{
+    using Args = std::vector<string_view>;
+
+    const auto defaults = parseCommandLine(Args{});
+    CHECK_EQ(defaults.deviceBuffer.periodSizeInMilliseconds, DEFAULT_PERIOD_SIZE_MS);
+    CHECK_EQ(defaults.deviceBuffer.periods, DEFAULT_PERIODS);
+    CHECK_FALSE(defaults.showHelp);
+
+    CHECK_EQ(parseCommandLine(Args{"--low-latency"}).deviceBuffer.periodSizeInMilliseconds,
+             LOW_LATENCY_PERIOD_SIZE_MS);
+
+    const auto custom = parseCommandLine(Args{"--period-size", "3", "--periods", "4"});
+    CHECK_EQ(custom.deviceBuffer.periodSizeInMilliseconds, 3);
+    CHECK_EQ(custom.deviceBuffer.periods, 4);
+
+    CHECK_EQ(defaults.backend, MiniaudioBackend::system);
+    CHECK_EQ(parseCommandLine(Args{"--null-audio"}).backend, MiniaudioBackend::null);
+    CHECK_EQ(defaults.channels, NATIVE_CHANNELS);
+    CHECK_EQ(parseCommandLine(Args{"--channels", "2"}).channels, 2);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--channels", "0"}), invalid_argument);
+    const auto sounds = parseCommandLine(Args{"--beat-sound", "click.wav", "--sound-cache", "/tmp/assets"}).sounds;
+    CHECK_EQ(sounds.beat, "click.wav");
+    CHECK(sounds.accent.empty());
+    CHECK_EQ(sounds.cache, "/tmp/assets");
+    if (TRACING_ENABLED) {
+        CHECK_EQ(parseCommandLine(Args{"--trace", "mnome.json"}).traceFile, "mnome.json");
+    }
+    else {
+        CHECK_THROWS_AS(parseCommandLine(Args{"--trace", "mnome.json"}), invalid_argument);
+    }
+    CHECK_EQ(parseCommandLine(Args{"--script", "-"}).script, "-");
+    CHECK_EQ(parseCommandLine(Args{"--control", "@mnome"}).control, "@mnome");
+    CHECK_EQ(parseCommandLine(Args{"--onsets", "onsets.bin"}).onsetFile, "onsets.bin");
+
+    CHECK(parseCommandLine(Args{"--help"}).showHelp);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--periods"}), invalid_argument);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--periods", "two"}), invalid_argument);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--unknown"}), invalid_argument);
+
+    CHECK_FALSE(defaults.render.has_value());
+    const auto render = parseCommandLine(Args{"--render", "click.wav", "--duration", "90.5", "--bpm", "120:4,140"});
+    REQUIRE(render.render.has_value());
+    CHECK_EQ(render.render->outputFile, "click.wav");
+    CHECK_EQ(render.render->durationS, 90.5);
+    CHECK_EQ(render.render->bpmProgram.size(), 2);
+    CHECK_EQ(render.render->pattern.toString(), "!+++");
+    CHECK_EQ(parseCommandLine(Args{"--render", "a.wav", "--duration", "1"}).render->bpmProgram.front().bpm,
+             DEFAULT_BPM);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--render", "a.wav"}), invalid_argument);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--duration", "1"}), invalid_argument);
+    CHECK_THROWS_AS(parseCommandLine(Args{"--render", "a.wav", "--duration", "-1"}), invalid_argument);
+}
+
 // NOLINTNEXTLINE
 TEST_CASE("MnomeTest - ChangeSettingsDuringPlayback")
 {
@@ -171,7 +964,10 @@ TEST_CASE("MnomeTest - ChangeSettingsDuringPlayback")
 
     streambuf* cinbuf = cin.rdbuf();
     cin.rdbuf(stringStream.rdbuf());
-    Mnome app{};
+    // the null device needs no sound card
+    MnomeOptions options;
+    options.backend = MiniaudioBackend::null;
+    Mnome app{options};
     CHECK_NOTHROW(app.startPlayback());
     CHECK(app.isPlaying());
 
@@ -183,8 +979,34 @@ TEST_CASE("MnomeTest - ChangeSettingsDuringPlayback")
     this_thread::sleep_for(waitTime);
 
     CHECK_NOTHROW(app.setBeatPattern("!+.+"));
+    CHECK_NOTHROW(app.setPan("accent -0.5 0.8"));
+    CHECK_NOTHROW(app.setRoute("beat 1"));
+    CHECK_THROWS_AS(app.setRoute("beat 0"), invalid_argument);
+    CHECK_NOTHROW(app.setLayer("1 !++"));
+    CHECK_NOTHROW(app.setLayer("2 +++++ 2"));
+    CHECK_NOTHROW(app.setLayer("1 off"));
+    // failed commands throw, so that the control socket replies with an error
+    CHECK_THROWS_AS(app.setLayer("9 !"), invalid_argument);
+    CHECK_THROWS_AS(app.setSound("beat /nonexistent/click.wav"), runtime_error);
+    CHECK_THROWS_AS(app.setBPM("fast"), invalid_argument);
+    CHECK_THROWS_AS(app.setPan("left"), invalid_argument);
+    CHECK_THROWS_AS(app.setBeatPattern("!+["), invalid_argument);
+    CHECK_THROWS_AS(app.setBeatPattern("|"), invalid_argument);
 
     this_thread::sleep_for(waitTime);
+    CHECK_NOTHROW(app.printCallbackStatistics());
+    CHECK_NOTHROW(app.printStartupTimes());
+    CHECK_THROWS(app.writeTrace(""));
+
+    // the current settings are rendered into a file
+    const auto file = filesystem::temp_directory_path() / "mnome-test-render.wav";
+    CHECK_NOTHROW(app.render(file.string() + " 0.5"));
+    CHECK(filesystem::exists(file));
+    filesystem::remove(file);
+    CHECK_THROWS_AS(app.render("click.wav"), invalid_argument);
+    CHECK_NOTHROW(app.writeOnsets(""));
+    CHECK_THROWS_AS(app.writeOnsets("/nonexistent/onsets.bin"), runtime_error);
+    CHECK_NOTHROW(app.writeOnsets("off"));
 
     CHECK(app.isPlaying());
     CHECK_NOTHROW(app.stop());
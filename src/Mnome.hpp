@@ -3,38 +3,149 @@
 #define MNOME_H
 
 #include "BeatPlayer.hpp"
+#include "ControlServer.hpp"
+#include "OfflineRenderer.hpp"
+#include "OnsetLog.hpp"
 #include "Repl.hpp"
+#include "Script.hpp"
+#include "SoundAsset.hpp"
 
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <span>
+#include <string>
 #include <string_view>
 
 namespace mnome {
 
-extern const size_t PLAYBACK_RATE;
+/// Usage of the command line options
+constexpr std::string_view COMMAND_LINE_HELP = "Usage: mnome [options]\n"
+                                               "  --low-latency        use small device periods\n"
+                                               "  --period-size <ms>   size of a device period in milliseconds\n"
+                                               "  --periods <number>   number of device periods\n"
+                                               "  --null-audio         play into a silent device, e.g. without a sound card\n"
+                                               "  --channels <number>  number of output channels, default are those of the device\n"
+                                               "  --beat-sound <file>  play a WAV, FLAC or MP3 file as beat\n"
+                                               "  --accent-sound <file>\n"
+                                               "                       play a WAV, FLAC or MP3 file as accent\n"
+                                               "  --sound-cache <dir>  directory of the converted sound files\n"
+                                               "  --render <file>      write a WAV file instead of playing\n"
+                                               "  --duration <s>       length of the rendered file in seconds\n"
+                                               "  --bpm <program>      tempo of the rendered file, e.g. 120 or 120:8,140:8,160\n"
+                                               "                       (<bpm>:<bars>, the last tempo lasts until the end),\n"
+                                               "                       ramps 80-160:32 or 160~80:16, trainers 100+4/8\n"
+                                               "  --pattern <pattern>  beat pattern of the rendered file, e.g. ![++]++\n"
+                                               "  --trace <file>       write the tracing spans into a file at exit\n"
+                                               "  --script <file>      run a command file instead of the REPL, - for stdin\n"
+                                               "  --control <socket>   serve the commands on a local socket, @<name> for an\n"
+                                               "                       abstract name\n"
+                                               "  --onsets <file>      write the time stamps of the beat onsets into a file\n"
+                                               "  -h, --help           show this help\n";
+
+/// Audio files of the beat sounds, a tone is generated for an empty file
+struct BeatSoundFiles
+{
+    std::string beat;
+    std::string accent;
+    std::string cache;  //< directory of the converted files, empty for the cache directory of the user
+};
+
+/// Options that are given on the command line
+struct MnomeOptions
+{
+    DeviceBufferConfiguration             deviceBuffer;
+    std::optional<RenderConfiguration>    render;  //< render a file instead of starting the REPL
+    MiniaudioBackend                      backend{MiniaudioBackend::system};
+    std::uint8_t                          channels{NATIVE_CHANNELS};
+    BeatSoundFiles                        sounds;
+    bool                                  showHelp{false};
+    std::string                           traceFile;  //< Chrome trace JSON that is written at exit, see Trace.hpp
+    std::string                           script;     //< commands that are run instead of the REPL, - for stdin
+    std::string                           control;    //< socket of the ControlServer, none when it is empty
+    std::string                           onsetFile;  //< binary file of the beat onsets, see encodeOnsets()
+    std::chrono::steady_clock::time_point launchTime{std::chrono::steady_clock::now()};  //< start of the process
+};
+
+/// Parse the command line arguments without the program name
+/// \throw  std::invalid_argument  when an argument is unknown or its value is malformed
+auto parseCommandLine(std::span<const std::string_view> args) -> MnomeOptions;
+
+/// Render the beat sounds into a file without opening an audio device
+/// \param  soundFiles  sounds to be used instead of the generated tones
+/// \throw  std::invalid_argument, std::runtime_error  see renderToWav() and SoundAssetCache::load()
+auto renderClickTrack(const RenderConfiguration& renderConfig, const BeatSoundFiles& soundFiles = {})
+    -> RenderStatistics;
+
+/// Print how long a rendering took compared to the duration of the rendered audio
+void printRenderStatistics(const RenderConfiguration& renderConfig, const RenderStatistics& statistics);
+
+/// Time from the launch of the process to the steps of the start up
+struct StartupTimes
+{
+    std::chrono::steady_clock::duration deviceOpened{};
+    std::chrono::steady_clock::duration soundsReady{};
+    std::chrono::steady_clock::duration replReady{};
+};
 
 /// Mnome main application class
 class Mnome
 {
-    BeatPlayer bp;
-    Repl       repl;
-    std::mutex cmdMtx;
+    BeatPlayer                       bp;
+    SoundAssetCache                  assets;
+    Repl                             repl;
+    std::mutex                       cmdMtx;
+    StartupTimes                     startup;
+    std::unique_ptr<ScriptClock>     scriptClock;   //< bars of bp for the scripts
+    std::unique_ptr<ControlClock>    controlClock;  //< changes of bp for the control socket
+    std::unique_ptr<ControlServer>   control;       //< stopped before the clocks and the player go away
+    std::unique_ptr<OnsetFileWriter> onsetWriter;   //< onsets of bp, none when they are not written
 
 public:
     /// Ctor
-    Mnome();
+    /// \throw  ScriptError, std::runtime_error  when the script of \p options is malformed or cannot be read, or the
+    ///                                          control socket or the onset file cannot be opened
+    explicit Mnome(const MnomeOptions& options = {});
 
     void stop();
 
+    /// Commands of the REPL
+    /// \throw  std::invalid_argument, std::runtime_error  when a command is malformed or fails, with the reason
     void stopPlayback();
     void startPlayback();
     void togglePlayback();
     void setBPM(std::string_view args);
     void setBeatPattern(std::string_view args);
+    void setChangeBoundary(std::string_view args);
+    void printLatency();
+    void printCallbackStatistics();
+    void setDeviceBuffer(std::string_view args);
+    void setGain(std::string_view args);
+    void setPan(std::string_view args);
+    void setRoute(std::string_view args);
+    void setLayer(std::string_view args);
+    void setSound(std::string_view args);
+    void render(std::string_view args);
+    void printStartupTimes() const;
+    void writeTrace(std::string_view args);
+    void writeOnsets(std::string_view args);
 
     [[nodiscard]] auto isPlaying() const -> bool;
 
-    /// Wait for the read evaluate loop to finish
+    /// Wait for the read evaluate loop to finish, and for the control socket when it is served
     void waitForStop();
+
+private:
+    /// Load a sound file in the format of the device
+    /// \throw  std::runtime_error  when \p file cannot be loaded
+    auto convertSound(const std::filesystem::path& file) -> AudioSignal;
+
+    /// Load a sound file in the format of the device
+    /// \return  std::nullopt when \p file is empty or cannot be loaded
+    auto loadSound(const std::filesystem::path& file) -> std::optional<AudioSignal>;
 };
 
 }  // namespace mnome
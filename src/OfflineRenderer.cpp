@@ -0,0 +1,190 @@
+/// OfflineRenderer
+///
+/// Renders a beat pattern straight into a WAV file, as fast as possible and without an audio device
+
+#include "OfflineRenderer.hpp"
+
+#include <doctest.h>
+#include <miniaudio.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+auto RenderStatistics::realTimeFactor() const -> double
+{
+    return renderTime.count() > 0 ? audioDurationS / renderTime.count() : 0;
+}
+
+/// \throw  std::invalid_argument  when there is nothing to render
+static void checkRenderConfiguration(const RenderConfiguration& renderConfig)
+{
+    if (renderConfig.pattern.getCompiledPattern().beats == 0 || renderConfig.bpmProgram.empty()) {
+        throw invalid_argument("Nothing to render: pattern and bpm program must not be empty");
+    }
+    checkBpmProgram(renderConfig.bpmProgram);
+}
+
+auto renderBeats(const RenderConfiguration& renderConfig, const BeatSounds& sounds,
+                 const AudioSignalConfiguration& audioConfig, const function<void(span<const SampleType>)>& consume)
+    -> uint64_t
+{
+    checkRenderConfiguration(renderConfig);
+    const auto& pattern = renderConfig.pattern.getCompiledPattern();
+
+    // the scheduler follows the tempo program on its own, the chunks may span any number of tempo changes
+    BeatScheduler scheduler(audioConfig);
+    scheduler.setSounds(&sounds);
+    scheduler.setPattern(&pattern);
+    scheduler.setTempo(&renderConfig.bpmProgram);
+    scheduler.setLayers(&renderConfig.layers);
+
+    const size_t       channels    = audioConfig.channels;
+    const auto         totalFrames = static_cast<uint64_t>(llround(renderConfig.durationS * audioConfig.sampleRate));
+    vector<SampleType> chunk(RENDER_CHUNK_FRAMES * channels);
+    for (uint64_t rendered = 0; rendered < totalFrames;) {
+        const auto frames = static_cast<size_t>(min<uint64_t>(RENDER_CHUNK_FRAMES, totalFrames - rendered));
+        const auto block  = span(chunk).first(frames * channels);
+        scheduler.render(block);
+        consume(block);
+        rendered += frames;
+    }
+    return totalFrames;
+}
+
+namespace {
+
+/// WAV file that is written by the miniaudio encoder
+class WavWriter
+{
+private:
+    ma_encoder  encoder{};
+    std::string fileName;
+
+public:
+    WavWriter(const std::string& file, const AudioSignalConfiguration& audioConfig) : fileName{file}
+    {
+        const ma_encoder_config encoderConfig = ma_encoder_config_init(
+            ma_encoding_format_wav, ma_format_f32, audioConfig.channels, static_cast<ma_uint32>(audioConfig.sampleRate));
+        if (ma_encoder_init_file(fileName.c_str(), &encoderConfig, &encoder) != MA_SUCCESS) {
+            throw runtime_error(std::format("Could not open \"{}\" for writing", fileName));
+        }
+    }
+    ~WavWriter()
+    {
+        ma_encoder_uninit(&encoder);
+    }
+
+    WavWriter(const WavWriter&)                    = delete;
+    WavWriter(WavWriter&&)                         = delete;
+    auto operator=(const WavWriter&) -> WavWriter& = delete;
+    auto operator=(WavWriter&&) -> WavWriter&      = delete;
+
+    void write(span<const SampleType> samples, size_t frames)
+    {
+        ma_uint64 framesWritten = 0;
+        if (ma_encoder_write_pcm_frames(&encoder, samples.data(), frames, &framesWritten) != MA_SUCCESS ||
+            framesWritten != frames) {
+            throw runtime_error(std::format("Could not write to \"{}\"", fileName));
+        }
+    }
+};
+
+}  // namespace
+
+auto renderToWav(const RenderConfiguration& renderConfig, const BeatSounds& sounds,
+                 const AudioSignalConfiguration& audioConfig) -> RenderStatistics
+{
+    checkRenderConfiguration(renderConfig);
+    const auto start = chrono::steady_clock::now();
+
+    WavWriter    writer(renderConfig.outputFile, audioConfig);
+    const size_t channels = audioConfig.channels;
+
+    const auto frames = renderBeats(renderConfig, sounds, audioConfig, [&](span<const SampleType> block) -> void {
+        writer.write(block, block.size() / channels);
+    });
+
+    return RenderStatistics{
+        .frames         = frames,
+        .audioDurationS = static_cast<double>(frames) / audioConfig.sampleRate,
+        .renderTime     = chrono::steady_clock::now() - start,
+    };
+}
+
+
+TEST_CASE("OfflineRendererTest - tempo changes at bar boundaries")
+{
+    const auto       audioConfig = AudioSignalConfiguration{.sampleRate = 1'000, .channels = 1};
+    const BeatSounds sounds{
+        .accent = AudioSignal(audioConfig, AudioDataType{1.0F}),
+        .beat   = AudioSignal(audioConfig, AudioDataType{0.5F}),
+    };
+    // one beat per bar, 6000 bpm at 1 kHz are 10 frames per beat
+    const RenderConfiguration renderConfig{
+        .outputFile = "",
+        .pattern    = MetronomeBeats("!"),
+        .bpmProgram = parseBpmProgram("6000:3,3000:2,1500"),
+        .durationS  = 0.2,
+    };
+
+    vector<size_t> onsets;
+    size_t         position = 0;
+
+    const auto frames = renderBeats(renderConfig, sounds, audioConfig, [&](span<const SampleType> block) -> void {
+        for (size_t idx = 0; idx < block.size(); ++idx) {
+            if (block[idx] != 0) {
+                onsets.push_back(position + idx);
+            }
+        }
+        position += block.size();
+    });
+
+    CHECK_EQ(frames, 200);
+    CHECK_EQ(position, 200);
+    const vector<size_t> expected{0, 10, 20, 30, 50, 70, 110, 150, 190};
+    CHECK_EQ(onsets, expected);
+}
+
+TEST_CASE("OfflineRendererTest - render to file")
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 2};
+    const auto toneConfig  = ToneConfiguration{.length = 0.05, .frequency = 440, .overtones = 1};
+    const auto tone        = generateTone(audioConfig, toneConfig);
+    const auto sounds      = BeatSounds{.accent = tone, .beat = tone};
+    const auto file        = filesystem::temp_directory_path() / "mnome-render-test.wav";
+
+    const RenderConfiguration renderConfig{
+        .outputFile = file.string(),
+        .pattern    = MetronomeBeats("!+.+"),
+        .bpmProgram = {TempoSegment{.bpm = 120, .bars = 0}},
+        .durationS  = 3.0,
+    };
+    const auto statistics = renderToWav(renderConfig, sounds, audioConfig);
+    CHECK_EQ(statistics.frames, 144'000);
+    CHECK_EQ(statistics.audioDurationS, doctest::Approx(3.0));
+    CHECK_GE(filesystem::file_size(file), statistics.frames * audioConfig.channels * sizeof(SampleType));
+    filesystem::remove(file);
+
+    CHECK_THROWS_AS(renderToWav(RenderConfiguration{.outputFile = file.string(), .pattern = MetronomeBeats("!"),
+                                                    .bpmProgram = {}, .durationS = 1},
+                                sounds, audioConfig),
+                    invalid_argument);
+}
+
+}  // namespace mnome
@@ -0,0 +1,68 @@
+/// OfflineRenderer
+///
+/// Renders a beat pattern straight into a WAV file, as fast as possible and without an audio device
+
+#ifndef MNOME_OFFLINERENDERER_H
+#define MNOME_OFFLINERENDERER_H
+
+#include "AudioSignal.hpp"
+#include "BeatScheduler.hpp"
+#include "MetronomeBeats.hpp"
+#include "TempoProgram.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+
+
+namespace mnome {
+
+/// Number of frames that are rendered and written at once
+constexpr size_t RENDER_CHUNK_FRAMES = 4096;
+
+/// What is rendered into which file
+struct RenderConfiguration
+{
+    std::string    outputFile;
+    MetronomeBeats pattern{"!+++"};
+    BeatLayers     layers{};  //< played along with the pattern
+    BpmProgram     bpmProgram;
+    double         durationS{0};  //< [s]
+};
+
+/// Outcome of a rendering
+struct RenderStatistics
+{
+    std::uint64_t                 frames{0};
+    double                        audioDurationS{0};  //< [s]
+    std::chrono::duration<double> renderTime{0};
+
+    /// Seconds of audio rendered per second of run time
+    [[nodiscard]] auto realTimeFactor() const -> double;
+};
+
+/// Render a beat pattern chunk by chunk
+/// \param  sounds  faded beat sounds, see prepareBeatSounds()
+/// \param  consume  called with each rendered chunk of interleaved samples
+/// \return  number of rendered frames
+/// \throw  std::invalid_argument  when the pattern is empty or the bpm program cannot be played, see checkBpmProgram()
+auto renderBeats(const RenderConfiguration& renderConfig, const BeatSounds& sounds,
+                 const AudioSignalConfiguration& audioConfig,
+                 const std::function<void(std::span<const SampleType>)>& consume) -> std::uint64_t;
+
+/// Render a beat pattern into a WAV file with 32 bit float samples
+///
+/// The same scheduler as for the live playback is used, only one chunk of audio is kept in memory regardless of the
+/// duration.
+/// \param  sounds  faded beat sounds, see prepareBeatSounds()
+/// \throw  std::invalid_argument  see renderBeats()
+/// \throw  std::runtime_error  when the file cannot be written
+auto renderToWav(const RenderConfiguration& renderConfig, const BeatSounds& sounds,
+                 const AudioSignalConfiguration& audioConfig) -> RenderStatistics;
+
+}  // namespace mnome
+
+#endif  // MNOME_OFFLINERENDERER_H
@@ -0,0 +1,277 @@
+/// OnsetLog
+///
+/// Time stamps of the beats that the audio callback has started, for measuring jitter and drift of the device
+
+#include "OnsetLog.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <ios>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+// beat, layer and type share one word of a slot
+constexpr unsigned LAYER_SHIFT = 8;
+constexpr unsigned BEAT_SHIFT  = 16;
+
+OnsetLog::OnsetLog(size_t capacity)
+    : slots{make_unique<Slot[]>(bit_ceil(max<size_t>(capacity, 1)))},  // NOLINT(*-avoid-c-arrays)
+      mask{bit_ceil(max<size_t>(capacity, 1)) - 1}
+{
+}
+
+void OnsetLog::append(const OnsetRecord& onset) noexcept
+{
+    const uint64_t number = next.load(memory_order_relaxed);
+    Slot&          slot   = slots[number & mask];
+
+    // odd while the onset is written, a reader that sees the odd or a different number skips the slot
+    slot.sequence.store((2 * number) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.frame.store(onset.frame, memory_order_relaxed);
+    slot.deviceTime.store(onset.deviceTime, memory_order_relaxed);
+    slot.bar.store(onset.bar, memory_order_relaxed);
+    slot.beatLayerAndType.store((uint64_t{onset.beat} << BEAT_SHIFT) | (uint64_t{onset.layer} << LAYER_SHIFT) |
+                                    static_cast<uint8_t>(onset.type),
+                                memory_order_relaxed);
+    slot.sequence.store((2 * number) + 2, memory_order_release);
+    next.store(number + 1, memory_order_release);
+}
+
+auto OnsetLog::read(uint64_t& cursor, vector<OnsetRecord>& onsets) const -> uint64_t
+{
+    const uint64_t end  = next.load(memory_order_acquire);
+    uint64_t       lost = 0;
+    if (end - cursor > capacity()) {
+        lost   = end - capacity() - cursor;
+        cursor = end - capacity();
+    }
+    for (; cursor < end; ++cursor) {
+        const Slot&    slot     = slots[cursor & mask];
+        const uint64_t sequence = slot.sequence.load(memory_order_acquire);
+        if (sequence != (2 * cursor) + 2) {
+            ++lost;
+            continue;
+        }
+        const uint64_t beatLayerAndType = slot.beatLayerAndType.load(memory_order_relaxed);
+        const auto     onset            = OnsetRecord{
+                           .frame      = slot.frame.load(memory_order_relaxed),
+                           .deviceTime = slot.deviceTime.load(memory_order_relaxed),
+                           .bar        = slot.bar.load(memory_order_relaxed),
+                           .beat       = static_cast<uint32_t>(beatLayerAndType >> BEAT_SHIFT),
+                           .layer      = static_cast<uint8_t>(beatLayerAndType >> LAYER_SHIFT),
+                           .type       = static_cast<BeatType>(beatLayerAndType & 0xFFU),
+        };
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.sequence.load(memory_order_relaxed) != sequence) {
+            ++lost;
+            continue;
+        }
+        onsets.push_back(onset);
+    }
+    return lost;
+}
+
+auto OnsetLog::appended() const -> uint64_t
+{
+    return next.load(memory_order_acquire);
+}
+
+auto OnsetLog::capacity() const -> size_t
+{
+    return mask + 1;
+}
+
+
+/// Append an unsigned number in little endian byte order
+template <typename T>
+static void appendLittleEndian(T value, size_t bytes, string& output)
+{
+    for (size_t byte = 0; byte < bytes; ++byte) {
+        output.push_back(static_cast<char>(static_cast<uint8_t>(value >> (8 * byte))));
+    }
+}
+
+/// Read an unsigned number in little endian byte order
+static auto readLittleEndian(string_view input, size_t bytes) -> uint64_t
+{
+    uint64_t value = 0;
+    for (size_t byte = 0; byte < bytes; ++byte) {
+        value |= uint64_t{static_cast<uint8_t>(input[byte])} << (8 * byte);
+    }
+    return value;
+}
+
+void encodeOnsets(span<const OnsetRecord> onsets, string& output)
+{
+    output.reserve(output.size() + (onsets.size() * ONSET_RECORD_SIZE));
+    for (const auto& onset : onsets) {
+        appendLittleEndian(onset.frame, sizeof(onset.frame), output);
+        appendLittleEndian(static_cast<uint64_t>(onset.deviceTime), sizeof(onset.deviceTime), output);
+        appendLittleEndian(onset.bar, sizeof(onset.bar), output);
+        appendLittleEndian(onset.beat, sizeof(onset.beat), output);
+        output.push_back(static_cast<char>(onset.layer));
+        output.push_back(static_cast<char>(onset.type));
+        output.append(2, '\0');
+    }
+}
+
+auto decodeOnsets(string_view input) -> vector<OnsetRecord>
+{
+    if (input.size() % ONSET_RECORD_SIZE != 0) {
+        throw invalid_argument("The onsets are cut off");
+    }
+    vector<OnsetRecord> onsets;
+    onsets.reserve(input.size() / ONSET_RECORD_SIZE);
+    for (; !input.empty(); input.remove_prefix(ONSET_RECORD_SIZE)) {
+        onsets.push_back(OnsetRecord{
+            .frame      = readLittleEndian(input.substr(0), 8),
+            .deviceTime = static_cast<int64_t>(readLittleEndian(input.substr(8), 8)),
+            .bar        = readLittleEndian(input.substr(16), 8),
+            .beat       = static_cast<uint32_t>(readLittleEndian(input.substr(24), 4)),
+            .layer      = static_cast<uint8_t>(input[28]),
+            .type       = static_cast<BeatType>(input[29]),
+        });
+    }
+    return onsets;
+}
+
+
+OnsetFileWriter::OnsetFileWriter(const OnsetLog& onsetLog, filesystem::path filePath)
+    : log{onsetLog}, path{std::move(filePath)}, stream(path, ios::binary | ios::trunc), cursor{log.appended()}
+{
+    if (!stream) {
+        throw runtime_error("Cannot write the onsets to " + path.string());
+    }
+    // the log keeps the onsets of several seconds, so they are written in a few larger blocks per second
+    constexpr auto writeInterval = chrono::milliseconds(100);
+    myThread                     = std::make_unique<std::thread>([this, writeInterval]() -> void {
+        while (!requestStop) {
+            this_thread::sleep_for(writeInterval);
+            writeOnsets();
+        }
+    });
+}
+
+OnsetFileWriter::~OnsetFileWriter()
+{
+    requestStop = true;
+    myThread->join();
+    writeOnsets();
+}
+
+auto OnsetFileWriter::file() const -> const filesystem::path&
+{
+    return path;
+}
+
+auto OnsetFileWriter::written() const -> uint64_t
+{
+    return writtenOnsets;
+}
+
+auto OnsetFileWriter::lost() const -> uint64_t
+{
+    return lostOnsets;
+}
+
+void OnsetFileWriter::writeOnsets()
+{
+    vector<OnsetRecord> onsets;
+    lostOnsets += log.read(cursor, onsets);
+    string encoded;
+    encodeOnsets(onsets, encoded);
+    stream.write(encoded.data(), static_cast<streamsize>(encoded.size()));
+    stream.flush();
+    writtenOnsets += onsets.size();
+}
+
+
+TEST_CASE("OnsetLogTest - readers")
+{
+    OnsetLog log(6);
+    CHECK_EQ(log.capacity(), 8);
+
+    const auto onset = [](uint64_t frame) -> OnsetRecord {
+        return OnsetRecord{
+            .frame = frame, .deviceTime = -1, .bar = 2, .beat = 70'000, .layer = 1, .type = BeatType::accent};
+    };
+    for (uint64_t frame = 0; frame < 5; ++frame) {
+        log.append(onset(frame));
+    }
+
+    // every reader has a cursor of its own
+    uint64_t            first = 0;
+    uint64_t            late  = log.appended();
+    vector<OnsetRecord> onsets;
+    CHECK_EQ(log.read(first, onsets), 0);
+    CHECK_EQ(first, 5);
+    REQUIRE_EQ(onsets.size(), 5);
+    CHECK_EQ(onsets[4], onset(4));
+
+    // a reader that falls behind by more than the capacity loses the oldest onsets
+    for (uint64_t frame = 5; frame < 15; ++frame) {
+        log.append(onset(frame));
+    }
+    onsets.clear();
+    CHECK_EQ(log.read(late, onsets), 2);
+    CHECK_EQ(late, 15);
+    REQUIRE_EQ(onsets.size(), 8);
+    CHECK_EQ(onsets.front().frame, 7);
+}
+
+TEST_CASE("OnsetLogTest - binary form")
+{
+    const vector<OnsetRecord> onsets{
+        OnsetRecord{.frame = 0, .deviceTime = 1'000, .bar = 1, .beat = 0, .layer = 0, .type = BeatType::accent},
+        OnsetRecord{.frame      = 0x0102'0304'0506'0708,
+                    .deviceTime = -5,
+                    .bar        = 3,
+                    .beat       = 0x0A0B'0C0D,
+                    .layer      = 2,
+                    .type       = BeatType::beat},
+    };
+    string encoded = "header";
+    encodeOnsets(onsets, encoded);
+    REQUIRE_EQ(encoded.size(), 6 + (2 * ONSET_RECORD_SIZE));
+    CHECK_EQ(encoded.substr(6 + ONSET_RECORD_SIZE, 8), string("\x08\x07\x06\x05\x04\x03\x02\x01", 8));
+    CHECK_EQ(encoded.substr(6 + ONSET_RECORD_SIZE + 24, 8), string("\x0D\x0C\x0B\x0A\x02+\0\0", 8));
+    CHECK_EQ(decodeOnsets(string_view(encoded).substr(6)), onsets);
+    CHECK_THROWS_AS(decodeOnsets(string_view(encoded).substr(5)), invalid_argument);
+
+    // the file gets the onsets that are appended while it is written
+    const auto file = filesystem::temp_directory_path() / "mnome-test-onsets.bin";
+    OnsetLog   log;
+    log.append(onsets[0]);
+    {
+        OnsetFileWriter writer(log, file);
+        log.append(onsets[1]);
+    }
+    ifstream      stream(file, ios::binary);
+    const string  content{istreambuf_iterator<char>(stream), istreambuf_iterator<char>()};
+    CHECK_EQ(decodeOnsets(content), vector<OnsetRecord>{onsets[1]});
+    stream.close();
+    filesystem::remove(file);
+}
+
+}  // namespace mnome
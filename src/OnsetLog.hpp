@@ -0,0 +1,139 @@
+/// OnsetLog
+///
+/// Time stamps of the beats that the audio callback has started, for measuring jitter and drift of the device
+
+#ifndef MNOME_ONSETLOG_H
+#define MNOME_ONSETLOG_H
+
+#include "MetronomeBeats.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+
+namespace mnome {
+
+/// Number of onsets that the log keeps, a reader that falls further behind loses the oldest ones
+constexpr size_t DEFAULT_ONSET_CAPACITY = size_t{1} << 14;
+
+/// Size of an encoded onset, see encodeOnsets()
+constexpr size_t ONSET_RECORD_SIZE = 32;
+
+/// A sound that the scheduler started
+struct OnsetRecord
+{
+    std::uint64_t frame{0};       //< since the start of the playback
+    std::int64_t  deviceTime{0};  //< [ns] of the steady clock at which the frame leaves the device, estimated
+    std::uint64_t bar{0};         //< counted from 1 since the start of the playback
+    std::uint32_t beat{0};        //< index of the beat in the main pattern, starting at 0
+    std::uint8_t  layer{0};       //< 0 for the main pattern, n for the n-th layer
+    BeatType      type{BeatType::beat};
+
+    auto operator==(const OnsetRecord&) const -> bool = default;
+};
+
+/// Ring of onsets that the audio callback appends to and any number of threads read
+///
+/// Appending neither locks nor allocates. Like the events of a TraceBuffer, each slot carries the number of the onset
+/// that was written into it last, so that a reader skips the slots that are overwritten while it copies them.
+class OnsetLog
+{
+private:
+    struct Slot
+    {
+        std::atomic<std::uint64_t> sequence{0};  //< 2 * (number + 1) when complete, odd while it is written
+        std::atomic<std::uint64_t> frame{0};
+        std::atomic<std::int64_t>  deviceTime{0};
+        std::atomic<std::uint64_t> bar{0};
+        std::atomic<std::uint64_t> beatLayerAndType{0};
+    };
+
+    std::unique_ptr<Slot[]>    slots;  // NOLINT(*-avoid-c-arrays): atomics cannot be moved into a vector
+    size_t                     mask;
+    std::atomic<std::uint64_t> next{0};
+
+public:
+    /// Ctor
+    /// \param  capacity  number of onsets that are kept, rounded up to a power of two
+    explicit OnsetLog(size_t capacity = DEFAULT_ONSET_CAPACITY);
+
+    /// Add an onset, overwrites the oldest one when the log is full
+    /// \note  Only one thread may append
+    void append(const OnsetRecord& onset) noexcept;
+
+    /// Copy the onsets that have been appended since a reader has read last
+    /// \param  cursor  number of the next onset of the reader, it is moved past the copied onsets
+    /// \param  onsets  the onsets are appended to it
+    /// \return  number of onsets that the reader has lost because they were overwritten
+    auto read(std::uint64_t& cursor, std::vector<OnsetRecord>& onsets) const -> std::uint64_t;
+
+    /// Number of onsets that have been appended, the cursor of a reader that only reads the following ones
+    [[nodiscard]] auto appended() const -> std::uint64_t;
+
+    /// Number of onsets that are kept
+    [[nodiscard]] auto capacity() const -> size_t;
+};
+
+/// Append onsets in their binary form, ONSET_RECORD_SIZE bytes each
+///
+/// The fields of OnsetRecord follow each other in little endian byte order, the layer and the character of the beat
+/// type take one byte each and are followed by two zero bytes.
+void encodeOnsets(std::span<const OnsetRecord> onsets, std::string& output);
+
+/// Read onsets in their binary form, see encodeOnsets()
+/// \throw  std::invalid_argument  when \p input is not a whole number of onsets
+auto decodeOnsets(std::string_view input) -> std::vector<OnsetRecord>;
+
+/// Writes the onsets of a log into a binary file from a thread of its own, see encodeOnsets()
+class OnsetFileWriter
+{
+private:
+    const OnsetLog&              log;
+    std::filesystem::path        path;
+    std::ofstream                stream;
+    std::uint64_t                cursor;
+    std::atomic<std::uint64_t>   writtenOnsets{0};
+    std::atomic<std::uint64_t>   lostOnsets{0};
+    std::atomic_bool             requestStop{false};
+    std::unique_ptr<std::thread> myThread;
+
+public:
+    /// Open the file and write the onsets that are appended from now on
+    /// \param  onsetLog  must outlive the writer
+    /// \throw  std::runtime_error  when the file cannot be opened
+    OnsetFileWriter(const OnsetLog& onsetLog, std::filesystem::path filePath);
+
+    /// Write the remaining onsets and close the file
+    ~OnsetFileWriter();
+
+    OnsetFileWriter(const OnsetFileWriter&)                    = delete;
+    OnsetFileWriter(OnsetFileWriter&&)                         = delete;
+    auto operator=(const OnsetFileWriter&) -> OnsetFileWriter& = delete;
+    auto operator=(OnsetFileWriter&&) -> OnsetFileWriter&      = delete;
+
+    /// File that is written
+    [[nodiscard]] auto file() const -> const std::filesystem::path&;
+
+    /// Number of onsets that have been written
+    [[nodiscard]] auto written() const -> std::uint64_t;
+
+    /// Number of onsets that were overwritten in the log before they could be written
+    [[nodiscard]] auto lost() const -> std::uint64_t;
+
+private:
+    /// Write the onsets that have been appended since the last call
+    void writeOnsets();
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_ONSETLOG_H
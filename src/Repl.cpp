@@ -3,6 +3,8 @@
 /// Recognizes given commands and executes the according functionality
 
 #include "Repl.hpp"
+#include "Script.hpp"
+#include "Trace.hpp"
 
 #include <cctype>
 #include <chrono>
@@ -20,7 +22,7 @@ constexpr std::string_view ENTER_KEY_NAME = "<ENTER KEY>";
 /// Trim first spaces of a string_view
 static inline auto ltrim(std::string_view& input) -> std::string_view&
 {
-    while (!input.empty() && 0 != std::isspace(input.front())) {
+    while (!input.empty() && 0 != std::isspace(static_cast<unsigned char>(input.front()))) {
         input.remove_prefix(1);
     }
     return input;
@@ -29,12 +31,17 @@ static inline auto ltrim(std::string_view& input) -> std::string_view&
 /// Trim trailing spaces of a string_view
 static inline auto rtrim(std::string_view& input) -> std::string_view&
 {
-    while (!input.empty() && 0 != std::isspace(input.back())) {
+    while (!input.empty() && 0 != std::isspace(static_cast<unsigned char>(input.back()))) {
         input.remove_suffix(1);
     }
     return input;
 }
 
+auto trim(std::string_view input) -> std::string_view
+{
+    return rtrim(ltrim(input));
+}
+
 Repl::Repl(ReplCommandList& cmds, std::istream& iStream, std::ostream& oStream)
     : commands{cmds}, inputStream{iStream}, outputStream{oStream}, myThread{nullptr}, requestStop{false}
 {
@@ -61,6 +68,21 @@ void Repl::start()
     myThread = std::make_unique<std::thread>([this]() -> void { this->run(); });
 }
 
+void Repl::startScript(std::string_view text, ScriptClock& clock)
+{
+    waitForStop();
+    auto script = parseScript(text, commands);
+    myThread    = std::make_unique<std::thread>([this, &clock, steps = std::move(script)]() -> void {
+        try {
+            runScript(steps, clock, requestStop);
+        }
+        catch (const std::exception& e) {
+            outputStream << e.what() << '\n';
+        }
+        requestStop = false;
+    });
+}
+
 void Repl::stop()
 {
     if (isRunning()) {
@@ -95,17 +117,24 @@ void Repl::run()
             break;
         }
 
-        std::string_view inputSV{input};
+        MNOME_TRACE_SPAN("Repl::command");
+        std::string_view          commandString;
+        std::string_view          args;
+        ReplCommandList::iterator possibleCommand;
+        {
+            MNOME_TRACE_SPAN("Repl::parse");
+            std::string_view inputSV{input};
 
-        inputSV = rtrim(ltrim(inputSV));
+            inputSV = rtrim(ltrim(inputSV));
 
-        size_t cmdSep = inputSV.find(' ', 0);
+            size_t cmdSep = inputSV.find(' ', 0);
 
-        // find command and arguments in input
-        const auto commandString = inputSV.substr(0, cmdSep);
-        auto       args =
-            (cmdSep != std::string_view::npos) ? inputSV.substr(cmdSep + 1, std::string::npos) : std::string_view{};
-        auto possibleCommand = commands.find(commandString);
+            // find command and arguments in input
+            commandString = inputSV.substr(0, cmdSep);
+            args = (cmdSep != std::string_view::npos) ? inputSV.substr(cmdSep + 1, std::string::npos)
+                                                      : std::string_view{};
+            possibleCommand = commands.find(commandString);
+        }
 
         // handle command not found
         if (std::end(commands) == possibleCommand) {
@@ -128,8 +157,8 @@ void Repl::run()
             possibleCommand->second.function(args);
         }
         catch (const std::exception& e) {
-            outputStream << std::format("Could not get that, please try again\n");
-            outputStream << e.what();
+            // the reason of a failed command comes with its usage
+            outputStream << e.what() << '\n';
         }
     }
     requestStop = false;
@@ -209,6 +238,7 @@ TEST_CASE("String trimming")
 {
     std::string_view testString = "\t \n bla \t \n";
     CHECK_EQ(ltrim(rtrim(testString)), "bla");
+    CHECK_EQ(trim(" bpm 120\r"), "bpm 120");
 }
 
 
@@ -16,6 +16,8 @@
 
 namespace mnome {
 
+class ScriptClock;
+
 using CommandFunction = std::function<void(std::string_view)>;
 
 struct ReplCommand
@@ -23,10 +25,15 @@ struct ReplCommand
     CommandFunction function;
     std::string     name;
     std::string     help;
+    bool            timed{false};     //< its changes can be scheduled for the start of a bar, see runScript()
+    bool            blocking{false};  //< reads or writes files or the device for a while, see ControlServer
 };
 
 using ReplCommandList = std::unordered_map<std::string_view, ReplCommand>;
 
+/// Remove the white space around a command line, including the carriage return of Windows line endings
+auto trim(std::string_view input) -> std::string_view;
+
 
 /// Read evaluate print loop
 class Repl
@@ -61,6 +68,11 @@ public:
     /// Start the read evaluate print loop
     void start();
 
+    /// Run a script instead of reading commands interactively, see parseScript() and runScript()
+    /// \param  clock  audio clock that the directives wait for, must outlive the run
+    /// \throw  ScriptError  when the script is malformed, nothing is run then
+    void startScript(std::string_view text, ScriptClock& clock);
+
     /// Stops the read evaluate print loop
     /// \note Does not block
     void stop();
@@ -0,0 +1,343 @@
+/// Script
+///
+/// Commands of the REPL that are read from a file and run without prompts, with directives that wait for bars
+
+#include "Script.hpp"
+
+#include "Repl.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+ScriptError::ScriptError(size_t line, const std::string& reason)
+    : invalid_argument(std::format("Script line {}: {}", line, reason)), lineNumber{line}
+{
+}
+
+auto ScriptError::line() const -> size_t
+{
+    return lineNumber;
+}
+
+
+namespace {
+
+constexpr string_view WAIT_USAGE = "usage: wait <number> bars";
+constexpr string_view AT_USAGE   = "usage: at bar <number> <command>";
+
+/// Split off the first word of a trimmed text
+auto splitWord(string_view text) -> pair<string_view, string_view>
+{
+    const size_t space = text.find_first_of(" \t");
+    if (space == string_view::npos) {
+        return {text, {}};
+    }
+    return {text.substr(0, space), trim(text.substr(space + 1))};
+}
+
+/// Convert the positive number of bars of a directive
+auto parseBars(size_t line, string_view value, string_view usage) -> uint64_t
+{
+    uint64_t   bars   = 0;
+    const auto result = from_chars(value.data(), value.data() + value.size(), bars);
+    if (value.empty() || result.ec != errc{} || result.ptr != value.data() + value.size() || bars == 0) {
+        throw ScriptError(line, std::format("\"{}\" is not a positive number, {}", value, usage));
+    }
+    return bars;
+}
+
+auto parseCommand(size_t line, string_view input, const ReplCommandList& commands) -> ScriptStep
+{
+    const auto [name, args] = splitWord(input);
+    const auto command      = commands.find(name);
+    if (command == commands.end()) {
+        throw ScriptError(line, std::format("\"{}\" is not a valid command", name));
+    }
+    return ScriptStep{.line = line, .command = &command->second, .args = string(args)};
+}
+
+auto parseStep(size_t line, string_view input, const ReplCommandList& commands) -> ScriptStep
+{
+    const auto [directive, rest] = splitWord(input);
+    if (directive == "wait") {
+        const auto [bars, unit] = splitWord(rest);
+        const auto waitBars     = parseBars(line, bars, WAIT_USAGE);
+        if (unit != "bars" && unit != "bar") {
+            throw ScriptError(line, string(WAIT_USAGE));
+        }
+        return ScriptStep{.line = line, .waitBars = waitBars};
+    }
+    if (directive == "at") {
+        const auto [unit, afterUnit] = splitWord(rest);
+        const auto [bar, command]    = splitWord(afterUnit);
+        if (unit != "bar" || command.empty()) {
+            throw ScriptError(line, string(AT_USAGE));
+        }
+        auto step = parseCommand(line, command, commands);
+        step.bar  = parseBars(line, bar, AT_USAGE);
+        return step;
+    }
+    return parseCommand(line, input, commands);
+}
+
+/// Run a command, its errors end the script
+void runCommand(const ScriptStep& step)
+{
+    try {
+        step.command->function(step.args);
+    }
+    catch (const ScriptError&) {
+        throw;
+    }
+    catch (const exception& e) {
+        throw ScriptError(step.line, e.what());
+    }
+}
+
+/// Run commands that follow each other at the same bar
+/// \param  bar  0 to run them right away
+void runCommands(span<const ScriptStep> group, uint64_t bar, ScriptClock& clock, const atomic_bool& stopRequest)
+{
+    const auto& first = group.front();
+    if (!clock.isRunning() && first.bar != 0) {
+        throw ScriptError(first.line, std::format("at bar {} needs a running playback", bar));
+    }
+    if (bar == 0 || !clock.isRunning() || clock.currentBar() >= bar) {
+        for (const auto& step : group) {
+            runCommand(step);
+        }
+        return;
+    }
+
+    // the changes are handed over while the bar before is played, the scheduler applies them at the start of the bar
+    clock.waitForBar(bar - 1);
+    if (stopRequest) {
+        return;
+    }
+    if (!clock.isRunning()) {
+        throw ScriptError(first.line, std::format("the playback stopped before bar {}", bar));
+    }
+    clock.setChangeBar(bar);
+    try {
+        for (const auto& step : group) {
+            if (step.command->timed) {
+                runCommand(step);
+            }
+        }
+    }
+    catch (...) {
+        clock.setChangeBar(nullopt);
+        throw;
+    }
+    clock.setChangeBar(nullopt);
+
+    clock.waitForBar(bar);
+    for (const auto& step : group) {
+        if (stopRequest) {
+            return;
+        }
+        if (!step.command->timed) {
+            runCommand(step);
+        }
+    }
+}
+
+/// Bar at which a step takes effect
+auto stepBar(const ScriptStep& step, uint64_t position) -> uint64_t
+{
+    return (step.bar != 0) ? step.bar : position;
+}
+
+}  // namespace
+
+
+auto parseScript(string_view text, const ReplCommandList& commands) -> Script
+{
+    Script script;
+    script.steps.reserve(static_cast<size_t>(ranges::count(text, '\n')) + 1);
+    size_t line = 0;
+    for (size_t start = 0; start < text.size();) {
+        const size_t end   = min(text.find('\n', start), text.size());
+        const auto   input = trim(text.substr(start, end - start));
+        start              = end + 1;
+        ++line;
+        if (!input.empty() && input.front() != '#') {
+            script.steps.push_back(parseStep(line, input, commands));
+        }
+    }
+    return script;
+}
+
+void runScript(const Script& script, ScriptClock& clock, const atomic_bool& stopRequest)
+{
+    const auto& steps    = script.steps;
+    uint64_t    position = 0;  // bar at which the commands without a bar take effect, 0 = right away
+    size_t      next     = 0;
+    while (next < steps.size() && !stopRequest) {
+        const auto& step = steps[next];
+        if (step.command == nullptr) {
+            if (!clock.isRunning()) {
+                throw ScriptError(step.line, "wait needs a running playback");
+            }
+            // the first bar is played from the start on, even before the device has rendered it
+            position = max({position, clock.currentBar(), uint64_t{1}}) + step.waitBars;
+            ++next;
+            continue;
+        }
+
+        const uint64_t bar = stepBar(step, position);
+        size_t         end = next + 1;
+        while (end < steps.size() && steps[end].command != nullptr && stepBar(steps[end], position) == bar) {
+            ++end;
+        }
+        runCommands(span(steps).subspan(next, end - next), bar, clock, stopRequest);
+        next = end;
+    }
+}
+
+
+namespace {
+
+/// Clock that jumps to the bar that is waited for
+class SteppingClock : public ScriptClock
+{
+public:
+    bool                           running{false};
+    uint64_t                       bar{0};
+    optional<uint64_t>             changeBar;
+    vector<pair<string, uint64_t>> log;  //< commands with the bar at which they take effect
+
+    [[nodiscard]] auto isRunning() const -> bool override
+    {
+        return running;
+    }
+
+    [[nodiscard]] auto currentBar() const -> uint64_t override
+    {
+        return bar;
+    }
+
+    void waitForBar(uint64_t waitedBar) override
+    {
+        bar = max(bar, waitedBar);
+    }
+
+    void setChangeBar(optional<uint64_t> newBar) override
+    {
+        changeBar = newBar;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("ScriptTest - parsing")
+{
+    ReplCommandList commands;
+    commands.emplace("bpm",
+                     ReplCommand{.function = [](string_view) -> void {}, .name = "bpm", .help = "", .timed = true});
+    commands.emplace("stop", ReplCommand{.function = [](string_view) -> void {}, .name = "stop", .help = ""});
+
+    const auto script = parseScript("# practice\n"
+                                    "bpm 100\r\n"
+                                    "\n"
+                                    "  wait 4 bars  \n"
+                                    "at bar 16   bpm 140\n"
+                                    "stop",
+                                    commands);
+    REQUIRE_EQ(script.steps.size(), 4);
+    CHECK_EQ(script.steps[0].line, 2);
+    CHECK_EQ(script.steps[0].command, &commands.at("bpm"));
+    CHECK_EQ(script.steps[0].args, "100");
+    CHECK_EQ(script.steps[1].waitBars, 4);
+    CHECK_EQ(script.steps[1].command, nullptr);
+    CHECK_EQ(script.steps[2].bar, 16);
+    CHECK_EQ(script.steps[2].args, "140");
+    CHECK_EQ(script.steps[3].line, 6);
+    CHECK(script.steps[3].args.empty());
+
+    const auto errorLine = [&commands](string_view text) -> size_t {
+        try {
+            static_cast<void>(parseScript(text, commands));
+        }
+        catch (const ScriptError& e) {
+            return e.line();
+        }
+        return 0;
+    };
+    CHECK_EQ(errorLine("bpm 100\nfast 120"), 2);
+    CHECK_EQ(errorLine("wait 4"), 1);
+    CHECK_EQ(errorLine("wait 0 bars"), 1);
+    CHECK_EQ(errorLine("wait four bars"), 1);
+    CHECK_EQ(errorLine("\n\nat bar 16"), 3);
+    CHECK_EQ(errorLine("at beat 16 bpm 100"), 1);
+    CHECK_EQ(errorLine("at bar 16 fast"), 1);
+
+    // every line of a long script becomes a step, bench-mnome measures how fast
+    string longScript;
+    for (size_t bar = 1; bar <= 50'000; ++bar) {
+        longScript += "at bar " + to_string(bar) + " bpm " + to_string(60 + (bar % 100)) + "\nwait 1 bars\n";
+    }
+    CHECK_EQ(parseScript(longScript, commands).steps.size(), 100'000);
+}
+
+TEST_CASE("ScriptTest - commands are scheduled against the bars")
+{
+    SteppingClock   clock;
+    ReplCommandList commands;
+    const auto      record = [&clock](string name) -> CommandFunction {
+        return [&clock, name](string_view args) -> void {
+            clock.log.emplace_back(name + (args.empty() ? "" : " ") + string(args),
+                                   clock.changeBar.value_or(clock.bar));
+        };
+    };
+    commands.emplace("start", ReplCommand{.function = [&clock](string_view) -> void { clock.running = true; },
+                                          .name     = "start",
+                                          .help     = ""});
+    commands.emplace("bpm", ReplCommand{.function = record("bpm"), .name = "bpm", .help = "", .timed = true});
+    commands.emplace("stats", ReplCommand{.function = record("stats"), .name = "stats", .help = ""});
+    const atomic_bool stopRequest{false};
+
+    // the bpm are changed while the bar before is played, stats runs once the bar has started
+    const auto script = parseScript("start\n"
+                                    "bpm 100\n"
+                                    "wait 4 bars\n"
+                                    "stats\n"
+                                    "bpm 140\n"
+                                    "at bar 8 bpm 160\n"
+                                    "wait 2 bars\n"
+                                    "bpm 180\n",
+                                    commands);
+    runScript(script, clock, stopRequest);
+    const vector<pair<string, uint64_t>> expected{
+        {"bpm 100", 0}, {"bpm 140", 5}, {"stats", 5}, {"bpm 160", 8}, {"bpm 180", 10}};
+    CHECK_EQ(clock.log, expected);
+    CHECK_FALSE(clock.changeBar);
+
+    // waiting needs a running playback
+    SteppingClock stopped;
+    CHECK_THROWS_AS(runScript(parseScript("wait 1 bar", commands), stopped, stopRequest), ScriptError);
+    CHECK_THROWS_AS(runScript(parseScript("at bar 2 bpm 90", commands), stopped, stopRequest), ScriptError);
+}
+
+}  // namespace mnome
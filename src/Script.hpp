@@ -0,0 +1,99 @@
+/// Script
+///
+/// Commands of the REPL that are read from a file and run without prompts, with directives that wait for bars
+
+#ifndef MNOME_SCRIPT_H
+#define MNOME_SCRIPT_H
+
+#include "Repl.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace mnome {
+
+/// Error in the text of a script
+class ScriptError : public std::invalid_argument
+{
+private:
+    size_t lineNumber;
+
+public:
+    ScriptError(size_t line, const std::string& reason);
+
+    /// Line of the script at which the error was found, starting at 1
+    [[nodiscard]] auto line() const -> size_t;
+};
+
+/// Command or directive of a script
+struct ScriptStep
+{
+    size_t             line{0};           //< starting at 1
+    std::uint64_t      waitBars{0};       //< `wait <bars> bars`, 0 for a command
+    std::uint64_t      bar{0};            //< `at bar <bar>`, 0 = at the position of the script
+    const ReplCommand* command{nullptr};  //< resolved when the script is parsed, nullptr for `wait`
+    std::string        args{};
+};
+
+/// Parsed script, the commands are looked up once so that running it does not search for them again
+struct Script
+{
+    std::vector<ScriptStep> steps;
+};
+
+/// Parse a script, one command or directive per line
+///
+/// A line is one of
+///  - a command of the REPL with its arguments, e.g. `bpm 120`
+///  - `wait <n> bars`  moves the position of the script n bars on, the following commands take effect there
+///  - `at bar <n> <command>`  the command takes effect at the start of bar n, counted from 1 since the start
+///  - empty or a comment starting with `#`
+/// \param  commands  commands that the script may use, they must outlive the script
+/// \throw  ScriptError  at the first line that is malformed or uses an unknown command
+auto parseScript(std::string_view text, const ReplCommandList& commands) -> Script;
+
+/// Audio clock that the directives of a script are scheduled against
+class ScriptClock
+{
+public:
+    ScriptClock()                                      = default;
+    ScriptClock(const ScriptClock&)                    = delete;
+    ScriptClock(ScriptClock&&)                         = delete;
+    auto operator=(const ScriptClock&) -> ScriptClock& = delete;
+    auto operator=(ScriptClock&&) -> ScriptClock&      = delete;
+    virtual ~ScriptClock()                             = default;
+
+    /// Whether bars are being played, waiting for a bar needs a running playback
+    [[nodiscard]] virtual auto isRunning() const -> bool = 0;
+
+    /// Number of the bar that is played, starting at 1, 0 before the first bar
+    [[nodiscard]] virtual auto currentBar() const -> std::uint64_t = 0;
+
+    /// Block until a bar has started or the playback has stopped
+    virtual void waitForBar(std::uint64_t bar) = 0;
+
+    /// Let the changes of the following commands take effect at the start of a bar
+    /// \param  bar  starting at 1, std::nullopt to take effect at the next beat or bar again
+    virtual void setChangeBar(std::optional<std::uint64_t> bar) = 0;
+};
+
+/// Run the steps of a script in order
+///
+/// Commands at a bar that is still ahead are run in two turns: the ones marked ReplCommand::timed are run while the
+/// bar before is played, so that their changes take effect exactly at the start of the bar, all others once the bar
+/// has started. Without a running playback the commands are run right away.
+/// \param  stopRequest  ends the script before the next step and any wait when it is set
+/// \throw  ScriptError  when a `wait` or `at bar` needs a running playback that is not there
+void runScript(const Script& script, ScriptClock& clock, const std::atomic_bool& stopRequest);
+
+}  // namespace mnome
+
+#endif  // MNOME_SCRIPT_H
@@ -0,0 +1,375 @@
+/// SoundAsset
+///
+/// Beat sounds that are loaded from audio files and cached on disk in the format of the playback
+
+#include "SoundAsset.hpp"
+
+#include <doctest.h>
+#include <miniaudio.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+/// Number of frames that are decoded at once
+constexpr size_t DECODE_CHUNK_FRAMES = 4096;
+
+/// Identifies asset files, a new version invalidates all cached assets, e.g. when the conversion changes
+constexpr array<char, 8> ASSET_MAGIC{'M', 'N', 'O', 'M', 'E', 'A', '0', '1'};
+
+constexpr uint64_t FNV_OFFSET_BASIS = 14'695'981'039'346'656'037U;
+constexpr uint64_t FNV_PRIME        = 1'099'511'628'211U;
+
+/// Header of an asset file, the interleaved samples follow right after it
+struct AssetHeader
+{
+    array<char, 8> magic{ASSET_MAGIC};
+    uint32_t       sampleRate{0};
+    uint32_t       channels{0};
+    uint64_t       frames{0};
+};
+
+
+/// Drop the frames at the start and at the end in which all channels are below TRIM_THRESHOLD
+static void trimSilence(AudioDataType& samples, size_t channels)
+{
+    auto isSilent = [&samples, channels](size_t frame) -> bool {
+        const auto frameSamples = span(samples).subspan(frame * channels, channels);
+        return ranges::all_of(frameSamples, [](SampleType sample) -> bool { return abs(sample) < TRIM_THRESHOLD; });
+    };
+    const size_t frames = samples.size() / channels;
+    size_t       first  = 0;
+    while (first < frames && isSilent(first)) {
+        ++first;
+    }
+    size_t last = frames;
+    while (last > first && isSilent(last - 1)) {
+        --last;
+    }
+    samples.resize(last * channels);
+    samples.erase(samples.begin(), samples.begin() + static_cast<ptrdiff_t>(first * channels));
+}
+
+auto loadSoundFile(const filesystem::path& file, const AudioSignalConfiguration& audioConfig) -> AudioSignal
+{
+    // the decoder converts to the requested format, 0 keeps the rate or channels of the file
+    const ma_decoder_config decoderConfig = ma_decoder_config_init(
+        ma_format_f32, static_cast<ma_uint32>(audioConfig.channels), static_cast<ma_uint32>(audioConfig.sampleRate));
+    ma_decoder decoder;
+    if (ma_decoder_init_file(file.string().c_str(), &decoderConfig, &decoder) != MA_SUCCESS) {
+        throw runtime_error(std::format("Cannot decode {}", file.string()));
+    }
+    const size_t channels = max<size_t>(decoder.outputChannels, 1);
+    const auto   config   = AudioSignalConfiguration{.sampleRate = static_cast<double>(decoder.outputSampleRate),
+                                                     .channels   = static_cast<uint8_t>(channels)};
+
+    AudioDataType      samples;
+    vector<SampleType> chunk(DECODE_CHUNK_FRAMES * channels);
+    while (true) {
+        ma_uint64  framesRead = 0;
+        const auto result     = ma_decoder_read_pcm_frames(&decoder, chunk.data(), DECODE_CHUNK_FRAMES, &framesRead);
+        samples.insert(samples.end(), chunk.begin(), chunk.begin() + static_cast<ptrdiff_t>(framesRead * channels));
+        if (result != MA_SUCCESS || framesRead < DECODE_CHUNK_FRAMES) {
+            break;
+        }
+    }
+    ma_decoder_uninit(&decoder);
+
+    trimSilence(samples, channels);
+    auto signal = AudioSignal(config, std::move(samples));
+    signal.fadeInOut(static_cast<size_t>(lround(ASSET_FADE_IN_TIME * config.sampleRate)),
+                     static_cast<size_t>(lround(ASSET_FADE_OUT_TIME * config.sampleRate)));
+    return signal;
+}
+
+
+MappedFile::MappedFile(const filesystem::path& file)
+{
+#ifdef _WIN32
+    fileHandle = CreateFileW(file.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                             nullptr);
+    LARGE_INTEGER fileSize{};
+    if (fileHandle == INVALID_HANDLE_VALUE || GetFileSizeEx(fileHandle, &fileSize) == 0) {
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+        fileHandle = nullptr;
+        throw runtime_error(std::format("Cannot open {}", file.string()));
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+    if (size > 0) {
+        mappingHandle = CreateFileMappingW(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        data          = (mappingHandle != nullptr)
+                            ? static_cast<const byte*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0))
+                            : nullptr;
+        if (data == nullptr) {
+            if (mappingHandle != nullptr) {
+                CloseHandle(mappingHandle);
+            }
+            CloseHandle(fileHandle);
+            throw runtime_error(std::format("Cannot map {}", file.string()));
+        }
+    }
+#else
+    const int descriptor = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (descriptor < 0) {
+        throw runtime_error(std::format("Cannot open {}", file.string()));
+    }
+    struct stat status{};
+    if (::fstat(descriptor, &status) != 0) {
+        ::close(descriptor);
+        throw runtime_error(std::format("Cannot open {}", file.string()));
+    }
+    size = static_cast<size_t>(status.st_size);
+    if (size > 0) {
+        void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            ::close(descriptor);
+            throw runtime_error(std::format("Cannot map {}", file.string()));
+        }
+        data = static_cast<const byte*>(mapping);
+    }
+    // the mapping stays valid without the descriptor
+    ::close(descriptor);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (data != nullptr) {
+        UnmapViewOfFile(data);
+    }
+    if (mappingHandle != nullptr) {
+        CloseHandle(mappingHandle);
+    }
+    if (fileHandle != nullptr) {
+        CloseHandle(fileHandle);
+    }
+#else
+    if (data != nullptr) {
+        ::munmap(const_cast<byte*>(data), size);
+    }
+#endif
+}
+
+auto MappedFile::bytes() const -> span<const byte>
+{
+    return {data, size};
+}
+
+
+auto defaultAssetCacheDirectory() -> filesystem::path
+{
+#ifdef _WIN32
+    if (const char* localAppData = getenv("LOCALAPPDATA"); localAppData != nullptr && *localAppData != '\0') {
+        return filesystem::path(localAppData) / "mnome" / "assets";
+    }
+#else
+    if (const char* cacheHome = getenv("XDG_CACHE_HOME"); cacheHome != nullptr && *cacheHome != '\0') {
+        return filesystem::path(cacheHome) / "mnome" / "assets";
+    }
+    if (const char* home = getenv("HOME"); home != nullptr && *home != '\0') {
+        return filesystem::path(home) / ".cache" / "mnome" / "assets";
+    }
+#endif
+    return {};
+}
+
+/// 64 bit FNV-1a hash
+static auto fnv1a(span<const byte> bytes, uint64_t hash = FNV_OFFSET_BASIS) -> uint64_t
+{
+    for (const auto value : bytes) {
+        hash = (hash ^ static_cast<uint64_t>(value)) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/// Read an asset that has been converted to \p audioConfig
+/// \return  nothing when the asset does not exist, is damaged or has another format
+static auto readAsset(const filesystem::path& asset, const AudioSignalConfiguration& audioConfig)
+    -> optional<AudioSignal>
+{
+    error_code errorCode;
+    if (!filesystem::exists(asset, errorCode)) {
+        return nullopt;
+    }
+    try {
+        const MappedFile mapped(asset);
+        const auto       bytes = mapped.bytes();
+        AssetHeader      header;
+        if (bytes.size() < sizeof(header)) {
+            return nullopt;
+        }
+        memcpy(&header, bytes.data(), sizeof(header));
+        const auto samples = bytes.subspan(sizeof(header));
+        if (header.magic != ASSET_MAGIC || header.channels == 0 ||
+            samples.size() != header.frames * header.channels * sizeof(SampleType) ||
+            (audioConfig.sampleRate != 0 && header.sampleRate != audioConfig.sampleRate) ||
+            (audioConfig.channels != 0 && header.channels != audioConfig.channels)) {
+            return nullopt;
+        }
+        AudioDataType data(samples.size() / sizeof(SampleType));
+        memcpy(data.data(), samples.data(), samples.size());
+        return AudioSignal(AudioSignalConfiguration{.sampleRate = static_cast<double>(header.sampleRate),
+                                                    .channels   = static_cast<uint8_t>(header.channels)},
+                           std::move(data));
+    }
+    catch (const runtime_error&) {
+        return nullopt;
+    }
+}
+
+/// Write an asset, a failure only means that the file is converted again next time
+static void writeAsset(const filesystem::path& asset, const AudioSignal& signal)
+{
+    error_code errorCode;
+    filesystem::create_directories(asset.parent_path(), errorCode);
+
+    // readers never see a partially written asset
+    auto temporary = asset;
+    temporary += ".tmp";
+    {
+        ofstream    stream(temporary, ios::binary | ios::trunc);
+        const auto& data = signal.getAudioData();
+        AssetHeader header{.sampleRate = static_cast<uint32_t>(signal.getConfiguration().sampleRate),
+                           .channels   = signal.getConfiguration().channels,
+                           .frames     = signal.numberFrames()};
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        stream.write(reinterpret_cast<const char*>(data.data()),
+                     static_cast<streamsize>(data.size() * sizeof(SampleType)));
+        if (!stream) {
+            stream.close();
+            filesystem::remove(temporary, errorCode);
+            return;
+        }
+    }
+    filesystem::rename(temporary, asset, errorCode);
+}
+
+
+SoundAssetCache::SoundAssetCache(filesystem::path cacheDirectory) : directory{std::move(cacheDirectory)}
+{
+}
+
+auto SoundAssetCache::load(const filesystem::path& file, const AudioSignalConfiguration& audioConfig) -> AudioSignal
+{
+    if (directory.empty()) {
+        ++cacheMisses;
+        return loadSoundFile(file, audioConfig);
+    }
+    const auto asset = assetPath(file, audioConfig);
+    if (auto cached = readAsset(asset, audioConfig)) {
+        ++cacheHits;
+        return std::move(*cached);
+    }
+    ++cacheMisses;
+    auto signal = loadSoundFile(file, audioConfig);
+    writeAsset(asset, signal);
+    return signal;
+}
+
+auto SoundAssetCache::assetPath(const filesystem::path& file, const AudioSignalConfiguration& audioConfig) const
+    -> filesystem::path
+{
+    // the contents of the file and the format it is converted to address the asset, its name does not matter
+    const MappedFile  source(file);
+    const AssetHeader format{.sampleRate = static_cast<uint32_t>(audioConfig.sampleRate),
+                             .channels   = audioConfig.channels,
+                             .frames     = 0};
+    const auto        hash = fnv1a(as_bytes(span(&format, 1)), fnv1a(source.bytes()));
+    return directory / std::format("{:016x}.asset", hash);
+}
+
+auto SoundAssetCache::hits() const -> uint64_t
+{
+    return cacheHits;
+}
+
+auto SoundAssetCache::misses() const -> uint64_t
+{
+    return cacheMisses;
+}
+
+
+TEST_CASE("SoundAssetTest - converted files are cached")
+{
+    const auto directory = filesystem::temp_directory_path() / "mnome-sound-asset-test";
+    filesystem::remove_all(directory);
+    filesystem::create_directories(directory);
+
+    // a short click with silence around it, written like a rendered file
+    const auto    file = directory / "click.wav";
+    AudioDataType click(4'800, 0.0F);
+    fill_n(click.begin() + 1'000, 480, 0.5F);
+    {
+        const ma_encoder_config encoderConfig =
+            ma_encoder_config_init(ma_encoding_format_wav, ma_format_f32, 1, 48'000);
+        ma_encoder              encoder;
+        REQUIRE_EQ(ma_encoder_init_file(file.string().c_str(), &encoderConfig, &encoder), MA_SUCCESS);
+        ma_encoder_write_pcm_frames(&encoder, click.data(), click.size(), nullptr);
+        ma_encoder_uninit(&encoder);
+    }
+
+    const auto      playbackConfig = AudioSignalConfiguration{.sampleRate = 44'100, .channels = 2};
+    SoundAssetCache cache(directory / "assets");
+    const auto      converted = cache.load(file, playbackConfig);
+    CHECK_EQ(converted.getConfiguration().sampleRate, 44'100);
+    CHECK_EQ(converted.getConfiguration().channels, 2);
+    REQUIRE_GT(converted.numberFrames(), 0);
+    CHECK_LT(converted.numberFrames(), 4'410);  // the silence is trimmed
+    CHECK_LT(abs(converted.getAudioData().front()), TRIM_THRESHOLD);
+    CHECK_EQ(cache.misses(), 1);
+    CHECK(filesystem::exists(cache.assetPath(file, playbackConfig)));
+
+    // the next launch maps the asset instead of converting the file
+    SoundAssetCache nextLaunch(directory / "assets");
+    const auto      cached = nextLaunch.load(file, playbackConfig);
+    CHECK_EQ(nextLaunch.hits(), 1);
+    CHECK_EQ(nextLaunch.misses(), 0);
+    CHECK_EQ(cached.getAudioData(), converted.getAudioData());
+
+    // another format is another asset, a damaged asset is converted again
+    CHECK_NE(cache.assetPath(file, AudioSignalConfiguration{.sampleRate = 48'000, .channels = 2}),
+             cache.assetPath(file, playbackConfig));
+    filesystem::resize_file(cache.assetPath(file, playbackConfig), 10);
+    CHECK_EQ(nextLaunch.load(file, playbackConfig).getAudioData(), converted.getAudioData());
+    CHECK_EQ(nextLaunch.misses(), 1);
+
+    CHECK_THROWS_AS(cache.load(directory / "missing.wav", playbackConfig), runtime_error);
+    SoundAssetCache disabled{filesystem::path{}};
+    disabled.load(file, playbackConfig);
+    CHECK_EQ(disabled.misses(), 1);
+
+    filesystem::remove_all(directory);
+}
+
+}  // namespace mnome
@@ -0,0 +1,91 @@
+/// SoundAsset
+///
+/// Beat sounds that are loaded from audio files and cached on disk in the format of the playback
+
+#ifndef MNOME_SOUNDASSET_H
+#define MNOME_SOUNDASSET_H
+
+#include "AudioSignal.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+
+namespace mnome {
+
+constexpr SampleType TRIM_THRESHOLD      = 0.001F;  // -60 dBFS
+constexpr double     ASSET_FADE_IN_TIME  = 0.0005;  // [s]
+constexpr double     ASSET_FADE_OUT_TIME = 0.005;   // [s]
+
+/// Decode an audio file and convert it into a beat sound
+///
+/// WAV, FLAC and MP3 files are converted to the sample rate and channels of \p audioConfig. Silence at the start and
+/// the end is trimmed, the rest is faded in and out briefly so that the cut does not click.
+/// \throw  std::runtime_error  when the file cannot be decoded
+auto loadSoundFile(const std::filesystem::path& file, const AudioSignalConfiguration& audioConfig) -> AudioSignal;
+
+/// Read-only view of a whole file that is mapped into memory
+class MappedFile
+{
+private:
+    const std::byte* data{nullptr};
+    size_t           size{0};
+#ifdef _WIN32
+    void* fileHandle{nullptr};
+    void* mappingHandle{nullptr};
+#endif
+
+public:
+    /// \throw  std::runtime_error  when the file cannot be opened or mapped
+    explicit MappedFile(const std::filesystem::path& file);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&)                    = delete;
+    MappedFile(MappedFile&&)                         = delete;
+    auto operator=(const MappedFile&) -> MappedFile& = delete;
+    auto operator=(MappedFile&&) -> MappedFile&      = delete;
+
+    [[nodiscard]] auto bytes() const -> std::span<const std::byte>;
+};
+
+/// Directory of the asset cache of the user, empty when there is none
+auto defaultAssetCacheDirectory() -> std::filesystem::path;
+
+/// Sound files that have been converted for the playback, stored on disk
+///
+/// An asset is addressed by a hash of the contents of its file and the format it has been converted to. Loading a
+/// cached asset maps it into memory instead of decoding, trimming and resampling the file again. Assets that cannot
+/// be written or read are converted every time.
+class SoundAssetCache
+{
+private:
+    std::filesystem::path directory;
+    std::uint64_t         cacheHits{0};
+    std::uint64_t         cacheMisses{0};
+
+public:
+    /// Ctor
+    /// \param  cacheDirectory  where the assets are stored, an empty path disables the cache
+    explicit SoundAssetCache(std::filesystem::path cacheDirectory = defaultAssetCacheDirectory());
+
+    /// Load the asset of a sound file, the file is converted only when it has not been cached yet
+    /// \throw  std::runtime_error  when the file cannot be read or decoded
+    auto load(const std::filesystem::path& file, const AudioSignalConfiguration& audioConfig) -> AudioSignal;
+
+    /// Path of the asset of a file in a certain format
+    /// \throw  std::runtime_error  when the file cannot be read
+    [[nodiscard]] auto assetPath(const std::filesystem::path& file, const AudioSignalConfiguration& audioConfig) const
+        -> std::filesystem::path;
+
+    /// Number of loads that have been served by the cache
+    [[nodiscard]] auto hits() const -> std::uint64_t;
+
+    /// Number of loads that had to convert the file
+    [[nodiscard]] auto misses() const -> std::uint64_t;
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_SOUNDASSET_H
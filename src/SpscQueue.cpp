@@ -0,0 +1,66 @@
+/// SpscQueue
+///
+/// Wait-free queue between exactly one producer and one consumer thread
+
+#include "SpscQueue.hpp"
+
+#include <doctest.h>
+
+#include <cstddef>
+#include <thread>
+
+
+namespace mnome {
+
+TEST_CASE("SpscQueueTest - order and capacity")
+{
+    SpscQueue<int, 4> queue;
+    CHECK(queue.empty());
+    CHECK_FALSE(queue.pop().has_value());
+
+    for (int item = 0; item < 4; ++item) {
+        CHECK(queue.push(item));
+    }
+    CHECK_FALSE(queue.push(4));
+
+    CHECK_EQ(queue.pop(), 0);
+    CHECK(queue.push(4));
+    for (int item = 1; item <= 4; ++item) {
+        CHECK_EQ(queue.pop(), item);
+    }
+    CHECK(queue.empty());
+}
+
+TEST_CASE("SpscQueueTest - producer and consumer thread")
+{
+    constexpr size_t      items = 100'000;
+    SpscQueue<size_t, 64> queue;
+    bool                  inOrder = true;
+
+    std::thread consumer([&queue, &inOrder]() -> void {
+        size_t expected = 0;
+        while (expected < items) {
+            if (const auto item = queue.pop()) {
+                inOrder = inOrder && (*item == expected);
+                ++expected;
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (size_t item = 0; item < items;) {
+        if (queue.push(item)) {
+            ++item;
+        }
+        else {
+            std::this_thread::yield();
+        }
+    }
+    consumer.join();
+
+    CHECK(inOrder);
+    CHECK(queue.empty());
+}
+
+}  // namespace mnome
@@ -0,0 +1,74 @@
+/// SpscQueue
+///
+/// Wait-free queue between exactly one producer and one consumer thread
+
+#ifndef MNOME_SPSCQUEUE_H
+#define MNOME_SPSCQUEUE_H
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <optional>
+#include <type_traits>
+
+
+namespace mnome {
+
+/// Size that keeps the producer and consumer indices on separate cache lines
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/// Fixed size ring buffer that never blocks, allocates or frees memory
+///
+/// push() may only be called by one thread and pop() by one other thread. Several producers have to serialize
+/// their calls to push() themselves.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+    static_assert(std::has_single_bit(Capacity), "Capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "Items must be trivially copyable");
+
+private:
+    static constexpr size_t INDEX_MASK = Capacity - 1;
+
+    std::array<T, Capacity>                      items{};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> head{0};  //< next item to be read, written by the consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> tail{0};  //< next item to be written, written by the producer
+
+public:
+    /// Append an item
+    /// \return  false when the queue is full
+    auto push(const T& item) -> bool
+    {
+        const size_t currentTail = tail.load(std::memory_order_relaxed);
+        if (currentTail - head.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items[currentTail & INDEX_MASK] = item;
+        tail.store(currentTail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Remove the oldest item
+    /// \return  nothing when the queue is empty
+    auto pop() -> std::optional<T>
+    {
+        const size_t currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        const T item = items[currentHead & INDEX_MASK];
+        head.store(currentHead + 1, std::memory_order_release);
+        return item;
+    }
+
+    /// Indicates whether there is nothing to pop, only a snapshot when the other thread is active
+    [[nodiscard]] auto empty() const -> bool
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+};
+
+}  // namespace mnome
+
+#endif  // MNOME_SPSCQUEUE_H
@@ -0,0 +1,288 @@
+/// TempoProgram
+///
+/// Tempo that changes over the bars: steps, accelerando and ritardando ramps and tempo trainers
+
+#include "TempoProgram.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+auto TempoPiece::bpmAt(double beat) const -> double
+{
+    if (beats == 0 || ramp == TempoRamp::hold) {
+        return startBpm;
+    }
+    const double progress = beat / static_cast<double>(beats);
+    if (ramp == TempoRamp::exponential) {
+        return startBpm * pow(endBpm / startBpm, progress);
+    }
+    return startBpm + ((endBpm - startBpm) * progress);
+}
+
+auto TempoPiece::secondsUntil(double beat) const -> double
+{
+    if (beats == 0 || ramp == TempoRamp::hold || endBpm == startBpm) {
+        return 60 * beat / startBpm;
+    }
+    if (ramp == TempoRamp::exponential) {
+        // bpm = startBpm * e^(rate * beat): integral of 60 / bpm is 60 / (startBpm * rate) * (1 - e^(-rate * beat))
+        const double rate = log(endBpm / startBpm) / static_cast<double>(beats);
+        return -60 * expm1(-rate * beat) / (startBpm * rate);
+    }
+    // bpm = startBpm + slope * beat: integral of 60 / bpm is 60 / slope * ln(1 + slope * beat / startBpm)
+    const double slope = (endBpm - startBpm) / static_cast<double>(beats);
+    return 60 * log1p(slope * beat / startBpm) / slope;
+}
+
+
+auto TempoSegment::pieces() const -> uint64_t
+{
+    if (bars == 0) {
+        return 0;
+    }
+    return (ramp == TempoRamp::steps) ? (bars + stepBars - 1) / max<size_t>(stepBars, 1) : 1;
+}
+
+/// Tempo of a step of a tempo trainer, never slower than 1 bpm
+static auto trainerBpm(const TempoSegment& segment, uint64_t step) -> size_t
+{
+    const auto bpm = static_cast<long long>(segment.bpm) + (static_cast<long long>(step) * segment.stepBpm);
+    return static_cast<size_t>(max(bpm, 1LL));
+}
+
+auto TempoSegment::piece(uint64_t piece, size_t beatsPerBar) const -> TempoPiece
+{
+    switch (ramp) {
+    case TempoRamp::linear:
+    case TempoRamp::exponential:
+        return TempoPiece{.ramp     = ramp,
+                          .startBpm = static_cast<double>(bpm),
+                          .endBpm   = static_cast<double>(targetBpm),
+                          .beats    = bars * beatsPerBar};
+    case TempoRamp::steps: {
+        const double stepTempo = static_cast<double>(trainerBpm(*this, piece));
+        const size_t stepBeats = (bars == 0) ? stepBars : min(stepBars, bars - (piece * stepBars));
+        return TempoPiece{
+            .ramp = TempoRamp::hold, .startBpm = stepTempo, .endBpm = stepTempo, .beats = stepBeats * beatsPerBar};
+    }
+    case TempoRamp::hold:
+        break;
+    }
+    return TempoPiece{.ramp     = TempoRamp::hold,
+                      .startBpm = static_cast<double>(bpm),
+                      .endBpm   = static_cast<double>(bpm),
+                      .beats    = bars * beatsPerBar};
+}
+
+auto TempoSegment::endBpm() const -> size_t
+{
+    switch (ramp) {
+    case TempoRamp::linear:
+    case TempoRamp::exponential:
+        return targetBpm;
+    case TempoRamp::steps:
+        return (pieces() == 0) ? bpm : trainerBpm(*this, pieces() - 1);
+    case TempoRamp::hold:
+        break;
+    }
+    return bpm;
+}
+
+
+/// Convert a positive decimal number of a bpm program
+/// \throw  std::invalid_argument  when \p value is not a number
+static auto parseProgramNumber(string_view program, string_view value) -> size_t
+{
+    size_t     number = 0;
+    const auto result = from_chars(value.data(), value.data() + value.size(), number);
+    if (value.empty() || result.ec != errc{} || result.ptr != value.data() + value.size() || number == 0) {
+        throw invalid_argument(std::format("Invalid bpm program \"{}\": \"{}\" is not a positive number", program, value));
+    }
+    return number;
+}
+
+/// Parse the tempo of a segment, everything in front of the number of bars
+static auto parseTempo(string_view program, string_view tempo) -> TempoSegment
+{
+    const size_t slash = tempo.find('/');
+    if (slash != string_view::npos) {
+        const size_t sign = tempo.find_first_of("+-");
+        if (sign == string_view::npos || sign > slash) {
+            throw invalid_argument(
+                std::format("Invalid bpm program \"{}\": \"{}\" is not a tempo trainer like 100+4/8", program, tempo));
+        }
+        const auto change = static_cast<long>(parseProgramNumber(program, tempo.substr(sign + 1, slash - sign - 1)));
+        return TempoSegment{.bpm      = parseProgramNumber(program, tempo.substr(0, sign)),
+                            .ramp     = TempoRamp::steps,
+                            .stepBpm  = (tempo[sign] == '-') ? -change : change,
+                            .stepBars = parseProgramNumber(program, tempo.substr(slash + 1))};
+    }
+    const size_t rampSep = tempo.find_first_of("-~");
+    if (rampSep != string_view::npos) {
+        return TempoSegment{.bpm       = parseProgramNumber(program, tempo.substr(0, rampSep)),
+                            .ramp      = (tempo[rampSep] == '~') ? TempoRamp::exponential : TempoRamp::linear,
+                            .targetBpm = parseProgramNumber(program, tempo.substr(rampSep + 1))};
+    }
+    return TempoSegment{.bpm = parseProgramNumber(program, tempo)};
+}
+
+auto parseBpmProgram(string_view program) -> BpmProgram
+{
+    BpmProgram bpmProgram;
+    size_t     start = 0;
+    while (start <= program.size()) {
+        const size_t end     = min(program.find(',', start), program.size());
+        const auto   segment = program.substr(start, end - start);
+        const size_t colon   = segment.find(':');
+
+        TempoSegment tempo = parseTempo(program, segment.substr(0, colon));
+        if (colon != string_view::npos) {
+            tempo.bars = parseProgramNumber(program, segment.substr(colon + 1));
+        }
+        else if (end != program.size()) {
+            throw invalid_argument(
+                std::format("Invalid bpm program \"{}\": only the last tempo may omit the number of bars", program));
+        }
+        else if (tempo.ramp == TempoRamp::linear || tempo.ramp == TempoRamp::exponential) {
+            throw invalid_argument(std::format("Invalid bpm program \"{}\": a ramp needs a number of bars", program));
+        }
+        bpmProgram.push_back(tempo);
+        start = end + 1;
+    }
+    return bpmProgram;
+}
+
+void checkBpmProgram(const BpmProgram& program)
+{
+    if (program.empty()) {
+        throw invalid_argument("The bpm program is empty");
+    }
+    for (size_t segment = 0; segment < program.size(); ++segment) {
+        const auto& tempo = program[segment];
+        if (tempo.bpm == 0 || (tempo.bars == 0 && segment + 1 < program.size())) {
+            throw invalid_argument("Every tempo needs a bpm and all but the last tempo need a number of bars");
+        }
+        if ((tempo.ramp == TempoRamp::linear || tempo.ramp == TempoRamp::exponential) &&
+            (tempo.targetBpm == 0 || tempo.bars == 0)) {
+            throw invalid_argument("A ramp needs a target tempo and a number of bars");
+        }
+        if (tempo.ramp == TempoRamp::steps && (tempo.stepBpm == 0 || tempo.stepBars == 0)) {
+            throw invalid_argument("A tempo trainer needs a change of the tempo and a number of bars per step");
+        }
+    }
+}
+
+auto toString(const BpmProgram& program) -> string
+{
+    string result;
+    for (const auto& tempo : program) {
+        if (!result.empty()) {
+            result += ',';
+        }
+        result += to_string(tempo.bpm);
+        switch (tempo.ramp) {
+        case TempoRamp::linear:
+            result += '-' + to_string(tempo.targetBpm);
+            break;
+        case TempoRamp::exponential:
+            result += '~' + to_string(tempo.targetBpm);
+            break;
+        case TempoRamp::steps:
+            result += ((tempo.stepBpm < 0) ? '-' : '+') + to_string(labs(tempo.stepBpm)) + '/' +
+                      to_string(tempo.stepBars);
+            break;
+        case TempoRamp::hold:
+            break;
+        }
+        if (tempo.bars != 0) {
+            result += ':' + to_string(tempo.bars);
+        }
+    }
+    return result;
+}
+
+
+TEST_CASE("TempoProgramTest - bpm program")
+{
+    const auto program = parseBpmProgram("120:8,140:4,160");
+    REQUIRE_EQ(program.size(), 3);
+    CHECK_EQ(program[0].bpm, 120);
+    CHECK_EQ(program[0].bars, 8);
+    CHECK_EQ(program[1].bpm, 140);
+    CHECK_EQ(program[1].bars, 4);
+    CHECK_EQ(program[2].bpm, 160);
+    CHECK_EQ(program[2].bars, 0);
+
+    CHECK_EQ(parseBpmProgram("90").size(), 1);
+    CHECK_EQ(parseBpmProgram("90:2").front().bars, 2);
+    CHECK_THROWS_AS(parseBpmProgram(""), invalid_argument);
+    CHECK_THROWS_AS(parseBpmProgram("120,140"), invalid_argument);
+    CHECK_THROWS_AS(parseBpmProgram("120:0,140"), invalid_argument);
+    CHECK_THROWS_AS(parseBpmProgram("fast"), invalid_argument);
+    CHECK_THROWS_AS(parseBpmProgram("120:8,"), invalid_argument);
+}
+
+TEST_CASE("TempoProgramTest - ramps and trainers")
+{
+    const auto program = parseBpmProgram("80-160:16,160~120:8,100+4/8:20,90-5/2");
+    REQUIRE_EQ(program.size(), 4);
+    CHECK_EQ(program[0].ramp, TempoRamp::linear);
+    CHECK_EQ(program[0].targetBpm, 160);
+    CHECK_EQ(program[1].ramp, TempoRamp::exponential);
+    CHECK_EQ(program[1].endBpm(), 120);
+    CHECK_EQ(program[2].ramp, TempoRamp::steps);
+    CHECK_EQ(program[2].stepBpm, 4);
+    CHECK_EQ(program[2].stepBars, 8);
+    CHECK_EQ(program[3].stepBpm, -5);
+    CHECK_EQ(program[3].pieces(), 0);
+    CHECK_EQ(toString(program), "80-160:16,160~120:8,100+4/8:20,90-5/2");
+    CHECK_NOTHROW(checkBpmProgram(program));
+
+    // the last step of a trainer is cut off at the end of the segment
+    CHECK_EQ(program[2].pieces(), 3);
+    CHECK_EQ(program[2].endBpm(), 108);
+    const auto lastStep = program[2].piece(2, 4);
+    CHECK_EQ(lastStep.startBpm, 108);
+    CHECK_EQ(lastStep.beats, 16);
+    // a trainer that slows down stops at 1 bpm
+    CHECK_EQ(program[3].piece(100, 1).startBpm, 1);
+
+    CHECK_THROWS_AS(parseBpmProgram("80-160"), invalid_argument);
+    CHECK_THROWS_AS(parseBpmProgram("100/8:4"), invalid_argument);
+    CHECK_THROWS_AS(parseBpmProgram("100+0/8"), invalid_argument);
+    CHECK_THROWS_AS(checkBpmProgram(BpmProgram{}), invalid_argument);
+    CHECK_THROWS_AS(checkBpmProgram(BpmProgram{TempoSegment{.bpm = 100, .ramp = TempoRamp::linear}}), invalid_argument);
+
+    // the closed forms match a numerical integration of 60 / bpm over the beats
+    for (const auto ramp : {TempoRamp::linear, TempoRamp::exponential}) {
+        const TempoPiece piece{.ramp = ramp, .startBpm = 80, .endBpm = 200, .beats = 64};
+        constexpr size_t steps   = 100'000;
+        double           seconds = 0;
+        for (size_t step = 0; step < steps; ++step) {
+            const double beat = (static_cast<double>(step) + 0.5) * 40 / steps;
+            seconds += 60 / piece.bpmAt(beat) * 40 / steps;
+        }
+        CHECK_EQ(piece.secondsUntil(40), doctest::Approx(seconds).epsilon(1e-9));
+        CHECK_EQ(piece.bpmAt(64), doctest::Approx(200));
+    }
+}
+
+}  // namespace mnome
@@ -0,0 +1,91 @@
+/// TempoProgram
+///
+/// Tempo that changes over the bars: steps, accelerando and ritardando ramps and tempo trainers
+
+#ifndef MNOME_TEMPOPROGRAM_H
+#define MNOME_TEMPOPROGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+namespace mnome {
+
+/// How the tempo of a segment develops over its bars
+enum class TempoRamp
+{
+    hold,         //< constant tempo
+    linear,       //< the bpm change by the same amount every beat
+    exponential,  //< the bpm change by the same factor every beat
+    steps,        //< constant tempo that is changed every few bars, a tempo trainer
+};
+
+/// Stretch of a tempo program with one continuous tempo curve
+///
+/// The tempo is a function of the beat, not of the time. The time of every beat follows from the integral of
+/// 60 / bpm over the beats, which has a closed form for all ramps.
+struct TempoPiece
+{
+    TempoRamp     ramp{TempoRamp::hold};  //< hold, linear or exponential
+    double        startBpm{0};
+    double        endBpm{0};
+    std::uint64_t beats{0};  //< 0 = endless
+
+    /// Tempo at a beat counted from the start of the piece
+    [[nodiscard]] auto bpmAt(double beat) const -> double;
+
+    /// Seconds from the start of the piece to a beat counted from the start of the piece
+    [[nodiscard]] auto secondsUntil(double beat) const -> double;
+};
+
+/// Tempo for a number of bars
+struct TempoSegment
+{
+    size_t    bpm{0};   //< tempo at the start
+    size_t    bars{0};  //< 0 = until the end, only allowed for the last segment
+    TempoRamp ramp{TempoRamp::hold};
+    size_t    targetBpm{0};  //< tempo at the end of a linear or exponential ramp
+    long      stepBpm{0};    //< change of the tempo of a trainer, every stepBars bars
+    size_t    stepBars{0};
+
+    /// Number of pieces of the segment, 0 = endless
+    [[nodiscard]] auto pieces() const -> std::uint64_t;
+
+    /// Piece of the segment with the bars converted to beats
+    /// \param  piece  index of the piece, a trainer has one piece per step
+    [[nodiscard]] auto piece(std::uint64_t piece, size_t beatsPerBar) const -> TempoPiece;
+
+    /// Tempo at the end of the segment
+    [[nodiscard]] auto endBpm() const -> size_t;
+};
+
+/// Tempo changes over the bars, the last tempo is kept until the end
+///
+/// Consecutive linear ramps form a list of tempo breakpoints, e.g. 80-120:16,120-60:8 speeds up over 16 bars and
+/// slows down over the following 8.
+using BpmProgram = std::vector<TempoSegment>;
+
+/// Parse a bpm program, comma separated segments of the form `<tempo>[:<bars>]`
+///
+/// The tempo of a segment is one of
+///  - `<bpm>` constant, e.g. `120:8,140:8,160`
+///  - `<bpm>-<bpm>` linear ramp, e.g. `80-160:32`
+///  - `<bpm>~<bpm>` exponential ramp, e.g. `160~80:16`
+///  - `<bpm>+<bpm>/<bars>` or `<bpm>-<bpm>/<bars>` tempo trainer, e.g. `100+4/8:64` adds 4 bpm every 8 bars
+/// \throw  std::invalid_argument  when the program is malformed, see also checkBpmProgram()
+auto parseBpmProgram(std::string_view program) -> BpmProgram;
+
+/// Check that a bpm program can be played
+/// \throw  std::invalid_argument  when the program is empty, a tempo is 0 or a segment other than the last or a ramp
+///                                has no bars
+void checkBpmProgram(const BpmProgram& program);
+
+/// Format a bpm program in the syntax of parseBpmProgram()
+auto toString(const BpmProgram& program) -> std::string;
+
+}  // namespace mnome
+
+#endif  // MNOME_TEMPOPROGRAM_H
@@ -0,0 +1,240 @@
+/// Trace
+///
+/// Lock-free tracing spans that are written as Chrome trace JSON, see chrome://tracing or https://ui.perfetto.dev
+
+#include "Trace.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <ios>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace std;
+
+
+namespace mnome {
+
+constexpr unsigned PHASE_BITS = 8;
+
+TraceBuffer::TraceBuffer(size_t capacity)
+    : slots{make_unique<Slot[]>(bit_ceil(max<size_t>(capacity, 1)))},  // NOLINT(*-avoid-c-arrays)
+      mask{bit_ceil(max<size_t>(capacity, 1)) - 1}
+{
+}
+
+void TraceBuffer::record(const TraceEvent& event) noexcept
+{
+    const uint64_t number = next.fetch_add(1, memory_order_relaxed);
+    Slot&          slot   = slots[number & mask];
+
+    // odd while the event is written, a reader that sees the odd or a different number skips the slot
+    slot.sequence.store((2 * number) + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.name.store(event.name, memory_order_relaxed);
+    slot.start.store(event.start, memory_order_relaxed);
+    slot.duration.store(event.duration, memory_order_relaxed);
+    slot.threadAndPhase.store((uint64_t{event.thread} << PHASE_BITS) | static_cast<uint8_t>(event.phase),
+                              memory_order_relaxed);
+    slot.sequence.store((2 * number) + 2, memory_order_release);
+}
+
+auto TraceBuffer::snapshot() const -> vector<TraceEvent>
+{
+    vector<TraceEvent> events;
+    events.reserve(min<uint64_t>(recorded(), capacity()));
+    for (size_t index = 0; index < capacity(); ++index) {
+        const Slot&    slot     = slots[index];
+        const uint64_t sequence = slot.sequence.load(memory_order_acquire);
+        if (sequence == 0 || sequence % 2 != 0) {
+            continue;
+        }
+        const uint64_t threadAndPhase = slot.threadAndPhase.load(memory_order_relaxed);
+        const auto     event          = TraceEvent{
+                           .name     = slot.name.load(memory_order_relaxed),
+                           .start    = slot.start.load(memory_order_relaxed),
+                           .duration = slot.duration.load(memory_order_relaxed),
+                           .thread   = static_cast<uint32_t>(threadAndPhase >> PHASE_BITS),
+                           .phase    = static_cast<TraceEvent::Phase>(threadAndPhase & ((1U << PHASE_BITS) - 1)),
+        };
+        atomic_thread_fence(memory_order_acquire);
+        if (slot.sequence.load(memory_order_relaxed) == sequence) {
+            events.push_back(event);
+        }
+    }
+    ranges::sort(events, {}, &TraceEvent::start);
+    return events;
+}
+
+auto TraceBuffer::recorded() const -> uint64_t
+{
+    return next.load(memory_order_relaxed);
+}
+
+auto TraceBuffer::capacity() const -> size_t
+{
+    return mask + 1;
+}
+
+
+auto traceBuffer() -> TraceBuffer&
+{
+    static TraceBuffer buffer;
+    return buffer;
+}
+
+auto traceNanoseconds() -> uint64_t
+{
+    static const auto epoch = chrono::steady_clock::now();
+    return static_cast<uint64_t>(chrono::nanoseconds(chrono::steady_clock::now() - epoch).count());
+}
+
+auto traceThreadId() -> uint32_t
+{
+    static atomic<uint32_t>      threads{0};
+    static thread_local uint32_t thread = ++threads;
+    return thread;
+}
+
+void traceInstant(const char* name) noexcept
+{
+    traceBuffer().record(TraceEvent{
+        .name = name, .start = traceNanoseconds(), .thread = traceThreadId(), .phase = TraceEvent::Phase::instant});
+}
+
+TraceSpan::TraceSpan(const char* spanName) noexcept : name{spanName}, start{traceNanoseconds()} {}
+
+TraceSpan::~TraceSpan()
+{
+    traceBuffer().record(TraceEvent{.name     = name,
+                                    .start    = start,
+                                    .duration = traceNanoseconds() - start,
+                                    .thread   = traceThreadId(),
+                                    .phase    = TraceEvent::Phase::complete});
+}
+
+
+/// Write a string literal as JSON string
+static void writeJsonString(ostream& stream, const char* text)
+{
+    stream << '"';
+    for (const char* character = text; *character != '\0'; ++character) {
+        if (*character == '"' || *character == '\\') {
+            stream << '\\';
+        }
+        stream << *character;
+    }
+    stream << '"';
+}
+
+void writeChromeTrace(span<const TraceEvent> events, ostream& stream)
+{
+    constexpr double nanosecondsPerMicrosecond = 1'000;
+
+    const auto flags     = stream.flags();
+    const auto precision = stream.precision();
+    stream << fixed << setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    for (size_t index = 0; index < events.size(); ++index) {
+        const auto& event = events[index];
+        stream << ((index == 0) ? "\n" : ",\n") << "{\"name\":";
+        writeJsonString(stream, (event.name != nullptr) ? event.name : "");
+        stream << ",\"cat\":\"mnome\",\"ph\":\"" << static_cast<char>(event.phase) << '"';
+        stream << ",\"ts\":" << static_cast<double>(event.start) / nanosecondsPerMicrosecond;
+        if (event.phase == TraceEvent::Phase::complete) {
+            stream << ",\"dur\":" << static_cast<double>(event.duration) / nanosecondsPerMicrosecond;
+        }
+        else {
+            stream << ",\"s\":\"t\"";  // instant of the thread
+        }
+        stream << ",\"pid\":1,\"tid\":" << event.thread << '}';
+    }
+    stream << "\n]}\n";
+    stream.flags(flags);
+    stream.precision(precision);
+}
+
+auto writeTraceFile(const filesystem::path& file) -> size_t
+{
+    const auto events = traceBuffer().snapshot();
+    ofstream   stream(file, ios::trunc);
+    writeChromeTrace(events, stream);
+    stream.close();
+    if (!stream) {
+        throw runtime_error("Cannot write the trace to " + file.string());
+    }
+    return events.size();
+}
+
+
+TEST_CASE("TraceTest - events of several threads")
+{
+    TraceBuffer buffer(1'000);
+    CHECK_EQ(buffer.capacity(), 1'024);
+    CHECK(buffer.snapshot().empty());
+
+    constexpr size_t     threads         = 4;
+    constexpr size_t     eventsPerThread = 10'000;
+    vector<std::jthread> writers;
+    for (size_t thread = 0; thread < threads; ++thread) {
+        writers.emplace_back([&buffer, thread]() -> void {
+            for (size_t event = 0; event < eventsPerThread; ++event) {
+                buffer.record(TraceEvent{.name     = "event",
+                                         .start    = event,
+                                         .duration = 1,
+                                         .thread   = static_cast<uint32_t>(thread)});
+            }
+        });
+    }
+    writers.clear();
+
+    // the newest events are kept, none of them is torn
+    const auto events = buffer.snapshot();
+    CHECK_EQ(buffer.recorded(), threads * eventsPerThread);
+    CHECK_EQ(events.size(), buffer.capacity());
+    CHECK(ranges::is_sorted(events, {}, &TraceEvent::start));
+    CHECK(ranges::all_of(events, [](const TraceEvent& event) -> bool {
+        return string(event.name) == "event" && event.duration == 1 && event.thread < threads &&
+               event.phase == TraceEvent::Phase::complete;
+    }));
+}
+
+TEST_CASE("TraceTest - Chrome trace format")
+{
+    const vector<TraceEvent> events{
+        TraceEvent{.name = "Repl::parse", .start = 1'500, .duration = 2'000, .thread = 1},
+        TraceEvent{.name = "quote\"", .start = 4'000, .thread = 2, .phase = TraceEvent::Phase::instant},
+    };
+    stringstream stream;
+    writeChromeTrace(events, stream);
+    CHECK_EQ(stream.str(), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                           "{\"name\":\"Repl::parse\",\"cat\":\"mnome\",\"ph\":\"X\",\"ts\":1.500,\"dur\":2.000,"
+                           "\"pid\":1,\"tid\":1},\n"
+                           "{\"name\":\"quote\\\"\",\"cat\":\"mnome\",\"ph\":\"i\",\"ts\":4.000,\"s\":\"t\","
+                           "\"pid\":1,\"tid\":2}\n"
+                           "]}\n");
+
+    // the spans of the process are only recorded when they are compiled in
+    const auto recorded = traceBuffer().recorded();
+    {
+        MNOME_TRACE_SPAN("TraceTest");
+        MNOME_TRACE_INSTANT("TraceTest::instant");
+    }
+    CHECK_EQ(traceBuffer().recorded() - recorded, TRACING_ENABLED ? 2 : 0);
+}
+
+}  // namespace mnome
@@ -0,0 +1,142 @@
+/// Trace
+///
+/// Lock-free tracing spans that are written as Chrome trace JSON, see chrome://tracing or https://ui.perfetto.dev
+///
+/// The spans are only recorded when the program is built with MNOME_TRACING, e.g. `cmake -DMNOME_TRACING=ON`.
+/// Otherwise MNOME_TRACE_SPAN() and MNOME_TRACE_INSTANT() expand to nothing.
+
+#ifndef MNOME_TRACE_H
+#define MNOME_TRACE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <ostream>
+#include <span>
+#include <vector>
+
+
+#ifdef MNOME_TRACING
+#define MNOME_TRACE_CONCAT_IMPL(a, b) a##b
+#define MNOME_TRACE_CONCAT(a, b)      MNOME_TRACE_CONCAT_IMPL(a, b)
+/// Record the time from here to the end of the scope, \p name must be a string literal
+#define MNOME_TRACE_SPAN(name)        const ::mnome::TraceSpan MNOME_TRACE_CONCAT(traceSpan, __LINE__)(name)
+/// Record a point in time, \p name must be a string literal
+#define MNOME_TRACE_INSTANT(name)     ::mnome::traceInstant(name)
+#else
+#define MNOME_TRACE_SPAN(name)    static_cast<void>(0)
+#define MNOME_TRACE_INSTANT(name) static_cast<void>(0)
+#endif
+
+
+namespace mnome {
+
+/// Whether the tracing spans are compiled in
+#ifdef MNOME_TRACING
+constexpr bool TRACING_ENABLED = true;
+#else
+constexpr bool TRACING_ENABLED = false;
+#endif
+
+/// Number of events that the trace keeps, the oldest ones are overwritten
+constexpr size_t DEFAULT_TRACE_CAPACITY = size_t{1} << 16;
+
+/// Span or point in time of a trace
+struct TraceEvent
+{
+    enum class Phase : char
+    {
+        complete = 'X',  //< span with a duration
+        instant  = 'i',
+    };
+
+    const char*   name{nullptr};  //< string literal, it is not copied
+    std::uint64_t start{0};       //< [ns] since the start of the trace
+    std::uint64_t duration{0};    //< [ns]
+    std::uint32_t thread{0};      //< see traceThreadId()
+    Phase         phase{Phase::complete};
+};
+
+/// Ring of trace events that any number of threads record into and any thread reads
+///
+/// Recording takes a slot with a single atomic increment and neither locks nor allocates, so it can be done in the
+/// audio callback. Each slot carries the number of the event that was written into it last, a reader only takes
+/// events whose number has not changed while it copied them.
+class TraceBuffer
+{
+private:
+    struct Slot
+    {
+        std::atomic<std::uint64_t> sequence{0};  //< 2 * (number + 1) when complete, odd while it is written
+        std::atomic<const char*>   name{nullptr};
+        std::atomic<std::uint64_t> start{0};
+        std::atomic<std::uint64_t> duration{0};
+        std::atomic<std::uint64_t> threadAndPhase{0};
+    };
+
+    std::unique_ptr<Slot[]>    slots;  // NOLINT(*-avoid-c-arrays): atomics cannot be moved into a vector
+    size_t                     mask;
+    std::atomic<std::uint64_t> next{0};
+
+public:
+    /// Ctor
+    /// \param  capacity  number of events that are kept, rounded up to a power of two
+    explicit TraceBuffer(size_t capacity = DEFAULT_TRACE_CAPACITY);
+
+    /// Add an event, overwrites the oldest one when the buffer is full
+    void record(const TraceEvent& event) noexcept;
+
+    /// Copy the events that are in the buffer, ordered by their start
+    [[nodiscard]] auto snapshot() const -> std::vector<TraceEvent>;
+
+    /// Number of events that have been recorded, including the overwritten ones
+    [[nodiscard]] auto recorded() const -> std::uint64_t;
+
+    /// Number of events that are kept
+    [[nodiscard]] auto capacity() const -> size_t;
+};
+
+/// Buffer that the spans of the process are recorded into
+/// \note  It is created by the first call, which should not be made by the audio callback
+auto traceBuffer() -> TraceBuffer&;
+
+/// Nanoseconds since the start of the trace, the first call of this function
+auto traceNanoseconds() -> std::uint64_t;
+
+/// Small number that identifies the calling thread in the trace
+auto traceThreadId() -> std::uint32_t;
+
+/// Record a point in time into traceBuffer()
+void traceInstant(const char* name) noexcept;
+
+/// Records the time from its construction to its destruction into traceBuffer()
+class TraceSpan
+{
+private:
+    const char*   name;
+    std::uint64_t start;
+
+public:
+    /// \param  spanName  string literal, it is not copied
+    explicit TraceSpan(const char* spanName) noexcept;
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&)                    = delete;
+    TraceSpan(TraceSpan&&)                         = delete;
+    auto operator=(const TraceSpan&) -> TraceSpan& = delete;
+    auto operator=(TraceSpan&&) -> TraceSpan&      = delete;
+};
+
+/// Write events in the Chrome trace event format
+void writeChromeTrace(std::span<const TraceEvent> events, std::ostream& stream);
+
+/// Write the events of traceBuffer() into a file in the Chrome trace event format
+/// \return  number of events that have been written
+/// \throw  std::runtime_error  when the file cannot be written
+auto writeTraceFile(const std::filesystem::path& file) -> size_t;
+
+}  // namespace mnome
+
+#endif  // MNOME_TRACE_H
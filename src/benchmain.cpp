@@ -0,0 +1,550 @@
+/// Benchmarks of the audio processing hot paths
+///
+/// Usage: bench-mnome [--format table|csv|json] [--filter <text>] [--min-time <ms>]
+#include "AudioSignal.hpp"
+#include "BeatPlayer.hpp"
+#include "BeatScheduler.hpp"
+#include "Benchmark.hpp"
+#include "BiquadFilter.hpp"
+#include "ControlServer.hpp"
+#include "DefaultSounds.hpp"
+#include "MetronomeBeats.hpp"
+#include "MixKernels.hpp"
+#include "OfflineRenderer.hpp"
+#include "OnsetLog.hpp"
+#include "Repl.hpp"
+#include "Script.hpp"
+#include "SpscQueue.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+using namespace std;
+using namespace mnome;
+
+
+namespace {
+
+constexpr auto SAMPLE_RATES = {44'100.0, 48'000.0, 96'000.0};
+
+/// Length of the default beat sounds [s]
+constexpr double BEAT_LENGTH = 0.05;
+
+auto toString(double value) -> string
+{
+    return std::format("{}", value);
+}
+
+/// Tone generation as it was done before the phasors: sin() for every sample and partial
+auto generateToneReference(const AudioSignalConfiguration& audioConfig, const ToneConfiguration& toneConfig)
+    -> AudioSignal
+{
+    const auto samples = static_cast<size_t>(floor(audioConfig.sampleRate * toneConfig.length));
+
+    AudioDataType data;
+    data.reserve(samples);
+    for (size_t samIdx = 0; samIdx < samples; samIdx++) {
+        double sample = sin(static_cast<double>(samIdx) * 2 * numbers::pi * toneConfig.frequency / audioConfig.sampleRate);
+        double gain   = 0.5;
+        for (size_t harmonic = 0; harmonic < toneConfig.overtones; ++harmonic) {
+            gain *= 0.5;
+            sample += gain * sin(static_cast<double>(samIdx) * 2 * numbers::pi * static_cast<double>(harmonic + 2) *
+                                 toneConfig.frequency / audioConfig.sampleRate);
+        }
+        for (size_t channelIdx = 0; channelIdx < audioConfig.channels; ++channelIdx) {
+            data.emplace_back(static_cast<SampleType>(0.5 * sample));
+        }
+    }
+    return AudioSignal(audioConfig, std::move(data));
+}
+
+void benchmarkToneGeneration(BenchmarkSuite& suite)
+{
+    for (const double sampleRate : SAMPLE_RATES) {
+        const auto audioConfig = AudioSignalConfiguration{.sampleRate = sampleRate, .channels = 1};
+        for (const double length : {BEAT_LENGTH, 1.0}) {
+            for (const uint8_t overtones : {0, 1, 8, 32}) {
+                const auto toneConfig = ToneConfiguration{.length = length, .frequency = 440, .overtones = overtones};
+                const auto samples    = floor(sampleRate * length);
+
+                const BenchmarkParameters parameters{
+                    {"rate", toString(sampleRate)}, {"length", toString(length)}, {"overtones", to_string(overtones)}};
+                suite.run("generateTone", parameters, samples, [&]() -> void {
+                    doNotOptimize(generateTone(audioConfig, toneConfig).getAudioData().data());
+                });
+                suite.run("generateTone/sin-reference", parameters, samples, [&]() -> void {
+                    doNotOptimize(generateToneReference(audioConfig, toneConfig).getAudioData().data());
+                });
+            }
+        }
+    }
+}
+
+void benchmarkSignalProcessing(BenchmarkSuite& suite)
+{
+    for (const double sampleRate : SAMPLE_RATES) {
+        for (const uint8_t channels : {1, 2}) {
+            const auto audioConfig = AudioSignalConfiguration{.sampleRate = sampleRate, .channels = channels};
+            for (const double length : {BEAT_LENGTH, 1.0}) {
+                const auto toneConfig = ToneConfiguration{.length = length, .frequency = 440, .overtones = 8};
+                const auto original   = generateTone(audioConfig, toneConfig);
+                const auto samples    = static_cast<double>(original.numberSamples());
+
+                const BenchmarkParameters parameters{
+                    {"rate", toString(sampleRate)}, {"channels", to_string(channels)}, {"length", toString(length)}};
+
+                // every iteration starts from the original signal, copying it is part of the measured time
+                auto signal = original;
+                suite.run("AudioSignal::fadeInOut", parameters, samples, [&]() -> void {
+                    signal          = original;
+                    const auto ramp = static_cast<size_t>(0.3 * static_cast<double>(signal.numberSamples()));
+                    signal.fadeInOut(ramp, ramp);
+                    doNotOptimize(signal.getAudioData().data());
+                });
+                suite.run("AudioSignal::lowPass20KHz", parameters, samples, [&]() -> void {
+                    signal = original;
+                    signal.lowPass20KHz();
+                    doNotOptimize(signal.getAudioData().data());
+                });
+                suite.run("AudioSignal::highPass20Hz", parameters, samples, [&]() -> void {
+                    signal = original;
+                    signal.highPass20Hz();
+                    doNotOptimize(signal.getAudioData().data());
+                });
+            }
+        }
+    }
+
+    // streaming use of the filters, block by block with the state kept between the blocks
+    constexpr size_t blockFrames = 512;
+    for (const size_t order : {2, 4, 8}) {
+        for (const uint8_t channels : {1, 2, 8}) {
+            const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = channels};
+            const auto tone  = generateTone(audioConfig, ToneConfiguration{.length = 1, .frequency = 440, .overtones = 8});
+            const auto& data = tone.getAudioData();
+            auto        block    = vector<SampleType>(blockFrames * channels);
+            size_t      position = 0;
+
+            BiquadCascade cascade(designButterworth(FilterType::lowPass, 48'000, 1'000, order), channels);
+            suite.run("BiquadCascade::process",
+                      {{"order", to_string(order)}, {"channels", to_string(channels)}, {"frames", to_string(blockFrames)}},
+                      static_cast<double>(block.size()), [&]() -> void {
+                          position = (position + block.size()) % (data.size() - block.size());
+                          copy_n(data.begin() + static_cast<ptrdiff_t>(position), block.size(), block.begin());
+                          cascade.process(block);
+                          doNotOptimize(block.data());
+                      });
+        }
+    }
+}
+
+void benchmarkMixing(BenchmarkSuite& suite)
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+
+    for (const size_t samples : {64, 256, 1024, 4096, 65'536}) {
+        const auto                samplesString = to_string(samples);
+        const BenchmarkParameters parameters{{"samples", samplesString}};
+        vector<SampleType>        destination(samples, 0.25F);
+        vector<SampleType>        source(samples, 0.5F);
+
+        AudioSignal       sum(audioConfig, AudioDataType(samples, 0.25F));
+        const AudioSignal summand(audioConfig, AudioDataType(samples, 0.5F));
+        suite.run("AudioSignal::operator+=", parameters, static_cast<double>(samples), [&]() -> void {
+            sum += summand;
+            doNotOptimize(sum.getAudioData().data());
+        });
+
+        // the index loop that was used before the kernels
+        suite.run("mix/multiply-add/loop", parameters, static_cast<double>(samples), [&]() -> void {
+            for (size_t index = 0; index < source.size(); ++index) {
+                destination[index] += 0.5F * source[index];
+            }
+            doNotOptimize(destination.data());
+        });
+
+        for (const auto instructionSet : {InstructionSet::scalar, InstructionSet::sse2, InstructionSet::avx2}) {
+            const auto* kernels = mixKernels(instructionSet);
+            if (kernels == nullptr) {
+                continue;
+            }
+            const BenchmarkParameters kernelParameters{{"isa", string(instructionSetName(instructionSet))},
+                                                       {"samples", samplesString}};
+            suite.run("mix/add", kernelParameters, static_cast<double>(samples), [&]() -> void {
+                kernels->add(destination, source);
+                doNotOptimize(destination.data());
+            });
+            suite.run("mix/multiply-add", kernelParameters, static_cast<double>(samples), [&]() -> void {
+                kernels->multiplyAdd(destination, source, 0.5F);
+                doNotOptimize(destination.data());
+            });
+            // a factor of -1 keeps the samples from becoming subnormal
+            suite.run("mix/gain", kernelParameters, static_cast<double>(samples), [&]() -> void {
+                kernels->applyGain(destination, -1.0F);
+                doNotOptimize(destination.data());
+            });
+            suite.run("mix/clamp", kernelParameters, static_cast<double>(samples), [&]() -> void {
+                kernels->clamp(destination, -1.0F, 1.0F);
+                doNotOptimize(destination.data());
+            });
+        }
+    }
+}
+
+/// Pattern of a given length that starts with an accent and contains some pauses
+auto makePattern(size_t length) -> MetronomeBeats
+{
+    string pattern = "!";
+    for (size_t beat = 1; beat < length; ++beat) {
+        pattern += (beat % 5 == 4) ? '.' : '+';
+    }
+    return MetronomeBeats(pattern);
+}
+
+/// Accentuated and normal beat like the ones of the application
+auto makeBeats(const AudioSignalConfiguration& audioConfig) -> BeatSounds
+{
+    return BeatSounds{
+        .accent = generateTone(audioConfig, ToneConfiguration{.length = BEAT_LENGTH, .frequency = 740, .overtones = 1}),
+        .beat   = generateTone(audioConfig, ToneConfiguration{.length = BEAT_LENGTH, .frequency = 494, .overtones = 1}),
+    };
+}
+
+void benchmarkPatternRendering(BenchmarkSuite& suite)
+{
+    constexpr double durationS = 60;
+
+    for (const double sampleRate : SAMPLE_RATES) {
+        const auto audioConfig = AudioSignalConfiguration{.sampleRate = sampleRate, .channels = 1};
+        const auto beats       = makeBeats(audioConfig);
+
+        // what start() and every change of the beat sounds compute before the playback
+        suite.run("prepareBeatSounds", {{"rate", toString(sampleRate)}}, 2 * BEAT_LENGTH * sampleRate, [&]() -> void {
+            doNotOptimize(prepareBeatSounds(beats.beat, beats.accent).beat->getAudioData().data());
+        });
+
+        const auto sounds = prepareBeatSounds(beats.beat, beats.accent);
+        for (const size_t patternLength : {4, 16, 64}) {
+            for (const size_t bpm : {60, 120, 240}) {
+                const RenderConfiguration renderConfig{
+                    .outputFile = "",
+                    .pattern    = makePattern(patternLength),
+                    .bpmProgram = {TempoSegment{.bpm = bpm, .bars = 0}},
+                    .durationS  = durationS,
+                };
+                const BenchmarkParameters parameters{{"rate", toString(sampleRate)},
+                                                     {"pattern", to_string(patternLength)},
+                                                     {"bpm", to_string(bpm)},
+                                                     {"seconds", toString(durationS)}};
+                suite.run("renderBeats", parameters, durationS * sampleRate, [&]() -> void {
+                    doNotOptimize(renderBeats(renderConfig, sounds, audioConfig,
+                                              [](span<const SampleType> block) -> void { doNotOptimize(block.data()); }));
+                });
+            }
+        }
+    }
+
+    // the render command and --render, including the encoding and writing of the file
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 2};
+    const auto beats       = makeBeats(audioConfig);
+    const auto sounds      = prepareBeatSounds(beats.beat, beats.accent);
+    const auto file        = filesystem::temp_directory_path() / "bench-mnome-render.wav";
+    const RenderConfiguration renderConfig{
+        .outputFile = file.string(),
+        .pattern    = makePattern(4),
+        .bpmProgram = {TempoSegment{.bpm = 120, .bars = 0}},
+        .durationS  = durationS,
+    };
+    const BenchmarkParameters parameters{{"rate", toString(audioConfig.sampleRate)}, {"seconds", toString(durationS)}};
+    suite.run("renderToWav", parameters, durationS * audioConfig.sampleRate, [&]() -> void {
+        doNotOptimize(renderToWav(renderConfig, sounds, audioConfig).frames);
+    });
+    filesystem::remove(file);
+}
+
+/// Default beat sounds at start up, copied from the compile time tables or generated at run time
+void benchmarkDefaultSounds(BenchmarkSuite& suite)
+{
+    for (const double sampleRate : SAMPLE_RATES) {
+        const BenchmarkParameters parameters{{"rate", toString(sampleRate)}};
+        const auto                samples = 2 * floor(sampleRate * DEFAULT_BEAT_LENGTH);
+        if (hasEmbeddedBeatSounds(sampleRate)) {
+            suite.run("defaultBeatSounds/table", parameters, samples, [&]() -> void {
+                doNotOptimize(defaultBeatSounds(sampleRate).beat->getAudioData().data());
+            });
+        }
+        suite.run("defaultBeatSounds/generated", parameters, samples, [&]() -> void {
+            doNotOptimize(generateDefaultBeatSounds(sampleRate).beat->getAudioData().data());
+        });
+    }
+}
+
+/// Compiling a pattern on every change of its text, from a few steps to 100k onsets
+void benchmarkPatternCompiler(BenchmarkSuite& suite)
+{
+    for (const size_t repeats : {1, 100, 10'000}) {
+        const string pattern = std::format("(![++@80+] (+.)x2 [+++++]2 [+++]2)x{}", repeats);
+        const size_t onsets  = compilePattern(pattern).events.size();
+        suite.run("compilePattern", {{"onsets", to_string(onsets)}}, static_cast<double>(onsets), [&]() -> void {
+            doNotOptimize(compilePattern(pattern).events.data());
+        });
+    }
+}
+
+/// Parsing and validating a practice script of 100k lines
+void benchmarkScriptParser(BenchmarkSuite& suite)
+{
+    ReplCommandList commands;
+    for (const string_view name : {"bpm", "pattern", "layer", "stats"}) {
+        commands.emplace(name, ReplCommand{.function = [](string_view) -> void {}, .name = string(name), .help = ""});
+    }
+    string script;
+    for (size_t bar = 1; bar <= 25'000; ++bar) {
+        script += "at bar " + to_string(bar) + " bpm " + to_string(60 + (bar % 100)) + "\n" + "pattern ![++]+.+\n" +
+                  "# comment\n" + "wait 1 bars\n";
+    }
+    const size_t lines = 100'000;
+    suite.run("parseScript", {{"lines", to_string(lines)}}, static_cast<double>(lines), [&]() -> void {
+        doNotOptimize(parseScript(script, commands).steps.data());
+    });
+}
+
+#ifdef __linux__
+/// Round trip of a command through the control socket, from sending the line to receiving the reply
+void benchmarkControlSocket(BenchmarkSuite& suite)
+{
+    /// Playback without changes, every command is acknowledged right away
+    class IdleClock : public ControlClock
+    {
+    public:
+        [[nodiscard]] auto isRunning() const -> bool override
+        {
+            return false;
+        }
+        [[nodiscard]] auto threadChange() -> uint64_t override
+        {
+            return 0;
+        }
+        [[nodiscard]] auto appliedChanges() const -> uint64_t override
+        {
+            return 0;
+        }
+        [[nodiscard]] auto changeFrame(uint64_t) const -> optional<uint64_t> override
+        {
+            return nullopt;
+        }
+    };
+
+    IdleClock       clock;
+    ReplCommandList commands;
+    commands.emplace("stats", ReplCommand{.function = [](string_view) -> void {}, .name = "stats", .help = ""});
+    ControlServer server(commands, clock);
+    const string  address = "@mnome-bench-" + to_string(getpid());
+    server.start(address);
+
+    sockaddr_un socketAddr{};
+    socketAddr.sun_family = AF_UNIX;
+    ranges::copy(address, std::begin(socketAddr.sun_path));
+    socketAddr.sun_path[0] = '\0';
+    const int client       = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connect(client, reinterpret_cast<const sockaddr*>(&socketAddr),
+                static_cast<socklen_t>(offsetof(sockaddr_un, sun_path) + address.size())) != 0) {
+        close(client);
+        return;
+    }
+
+    constexpr string_view request = "stats\n";
+    array<char, 16>       reply{};
+    suite.run("control socket round trip", {{"command", "stats"}}, 1.0, [&]() -> void {
+        static_cast<void>(send(client, request.data(), request.size(), MSG_NOSIGNAL));
+        doNotOptimize(recv(client, reply.data(), reply.size(), 0));
+    });
+    close(client);
+}
+#endif
+
+/// Cost of one audio callback in steady state: drain the empty command queue and render one block
+void benchmarkCallbackBlock(BenchmarkSuite& suite)
+{
+    struct Command
+    {
+        int value;
+    };
+
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    const auto beats       = makeBeats(audioConfig);
+    const auto sounds      = prepareBeatSounds(beats.beat, beats.accent);
+
+    for (const size_t patternLength : {4, 64}) {
+        const auto pattern = makePattern(patternLength).getCompiledPattern();
+        for (const size_t bpm : {60, 240, 1000}) {
+            for (const size_t blockFrames : {64, 256, 1024, 4800}) {
+                BeatScheduler scheduler(audioConfig);
+                scheduler.setSounds(&sounds);
+                scheduler.setPattern(&pattern);
+                scheduler.setBPM(bpm);
+                SpscQueue<Command, 64> commands;
+                vector<SampleType>     block(blockFrames);
+
+                const BenchmarkParameters parameters{
+                    {"pattern", to_string(patternLength)}, {"bpm", to_string(bpm)}, {"frames", to_string(blockFrames)}};
+                suite.run("callback block", parameters, static_cast<double>(blockFrames), [&]() -> void {
+                    while (const auto command = commands.pop()) {
+                        doNotOptimize(command->value);
+                    }
+                    scheduler.render(block);
+                    doNotOptimize(block.data());
+                });
+            }
+        }
+    }
+}
+
+/// Cost of one block with polyrhythm layers, it grows with the number of onsets and layers, not with pattern lengths
+void benchmarkLayers(BenchmarkSuite& suite)
+{
+    const auto audioConfig = AudioSignalConfiguration{.sampleRate = 48'000, .channels = 1};
+    const auto beats       = makeBeats(audioConfig);
+    const auto sounds      = prepareBeatSounds(beats.beat, beats.accent);
+    const auto shared      = make_shared<const BeatSounds>(sounds);
+    const auto pattern     = makePattern(4).getCompiledPattern();
+
+    for (const size_t layerCount : {0, 1, 4, 8}) {
+        for (const size_t layerLength : {3, 64}) {
+            BeatLayers layers;
+            for (size_t layer = 0; layer < layerCount; ++layer) {
+                layers.push_back(BeatLayer{
+                    .pattern = makePattern(layerLength + layer).getBeatPattern(), .subdivision = 1, .sounds = shared});
+            }
+            BeatScheduler scheduler(audioConfig);
+            scheduler.setSounds(&sounds);
+            scheduler.setPattern(&pattern);
+            scheduler.setBPM(120);
+            scheduler.setLayers(&layers);
+            vector<SampleType> block(256);
+
+            const BenchmarkParameters parameters{{"layers", to_string(layerCount)},
+                                                 {"layer pattern", to_string(layerLength)}};
+            suite.run("layered block", parameters, static_cast<double>(block.size()), [&]() -> void {
+                scheduler.render(block);
+                doNotOptimize(block.data());
+            });
+        }
+    }
+}
+
+/// Cost of an onset for the audio callback, and of reading and encoding the onsets for a file or a subscriber
+void benchmarkOnsetLog(BenchmarkSuite& suite)
+{
+    OnsetLog    log;
+    OnsetRecord onset{.frame = 0, .deviceTime = 0, .bar = 1, .beat = 0, .layer = 0, .type = BeatType::beat};
+    suite.run("onset append", {}, 1, [&]() -> void {
+        ++onset.frame;
+        log.append(onset);
+    });
+
+    for (const size_t count : {16, 1'024}) {
+        vector<OnsetRecord> onsets;
+        string              encoded;
+        onsets.reserve(count);
+        suite.run("onset read", {{"onsets", to_string(count)}}, static_cast<double>(count), [&]() -> void {
+            for (size_t number = 0; number < count; ++number) {
+                ++onset.frame;
+                log.append(onset);
+            }
+            uint64_t cursor = log.appended() - count;
+            onsets.clear();
+            encoded.clear();
+            doNotOptimize(log.read(cursor, onsets));
+            encodeOnsets(onsets, encoded);
+            doNotOptimize(encoded.data());
+        });
+    }
+}
+
+}  // namespace
+
+
+auto main(int argc, char* argv[]) -> int
+{
+    constexpr string_view usage = "Usage: bench-mnome [--format table|csv|json] [--filter <text>] [--min-time <ms>]";
+
+    auto                      format    = BenchmarkFormat::table;
+    string                    filter;
+    size_t                    minTimeMs = 200;
+    const vector<string_view> args(argv + 1, argv + argc);
+    for (size_t idx = 0; idx < args.size(); ++idx) {
+        const bool hasValue = idx + 1 < args.size();
+        if (args[idx] == "--format" && hasValue) {
+            const auto value = args[++idx];
+            if (value == "table") {
+                format = BenchmarkFormat::table;
+            }
+            else if (value == "csv") {
+                format = BenchmarkFormat::csv;
+            }
+            else if (value == "json") {
+                format = BenchmarkFormat::json;
+            }
+            else {
+                println(stderr, "{}", usage);
+                return 1;
+            }
+        }
+        else if (args[idx] == "--filter" && hasValue) {
+            filter = args[++idx];
+        }
+        else if (args[idx] == "--min-time" && hasValue) {
+            const auto value  = args[++idx];
+            const auto result = from_chars(value.data(), value.data() + value.size(), minTimeMs);
+            if (result.ec != errc{} || result.ptr != value.data() + value.size()) {
+                println(stderr, "{}", usage);
+                return 1;
+            }
+        }
+        else {
+            println(stderr, "{}", usage);
+            return (args[idx] == "--help" || args[idx] == "-h") ? 0 : 1;
+        }
+    }
+
+    BenchmarkSuite suite(filter, chrono::milliseconds(minTimeMs));
+    benchmarkToneGeneration(suite);
+    benchmarkDefaultSounds(suite);
+    benchmarkSignalProcessing(suite);
+    benchmarkMixing(suite);
+    benchmarkPatternCompiler(suite);
+    benchmarkScriptParser(suite);
+#ifdef __linux__
+    benchmarkControlSocket(suite);
+#endif
+    benchmarkPatternRendering(suite);
+    benchmarkCallbackBlock(suite);
+    benchmarkLayers(suite);
+    benchmarkOnsetLog(suite);
+    suite.report(format);
+    return 0;
+}
@@ -2,14 +2,19 @@
 #include "Mnome.hpp"
 
 #include <csignal>
+#include <exception>
+#include <print>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
 
 
 using namespace std;
 
 namespace {
-auto getApp() -> mnome::Mnome&
+auto getApp(const mnome::MnomeOptions& options = {}) -> mnome::Mnome&
 {
-    static auto app = mnome::Mnome();
+    static auto app = mnome::Mnome(options);
     return app;
 }
 }  // namespace
@@ -21,16 +26,55 @@ void shutDownAppHandler(int signalCode)
     getApp().stop();
 }
 
-auto main() -> int
+auto main(int argc, char* argv[]) -> int
 {
+    mnome::MnomeOptions options;
+    try {
+        const vector<string_view> args(argv + 1, argv + argc);
+        options = mnome::parseCommandLine(args);
+    }
+    catch (const invalid_argument& e) {
+        println(stderr, "{}\n{}", e.what(), mnome::COMMAND_LINE_HELP);
+        return 1;
+    }
+    if (options.showHelp) {
+        print("{}", mnome::COMMAND_LINE_HELP);
+        return 0;
+    }
+    if (options.render) {
+        try {
+            mnome::printRenderStatistics(*options.render, mnome::renderClickTrack(*options.render, options.sounds));
+        }
+        catch (const exception& e) {
+            println(stderr, "Rendering failed: {}", e.what());
+            return 1;
+        }
+        return 0;
+    }
 
     signal(SIGINT, shutDownAppHandler);
     signal(SIGTERM, shutDownAppHandler);
     signal(SIGABRT, shutDownAppHandler);
 
+    try {
+        getApp(options);
+    }
+    catch (const exception& e) {
+        println(stderr, "{}", e.what());
+        return 1;
+    }
     auto& app = getApp();
 
     app.waitForStop();
+    if (!options.traceFile.empty()) {
+        try {
+            app.writeTrace(options.traceFile);
+        }
+        catch (const exception& e) {
+            println(stderr, "{}", e.what());
+            return 1;
+        }
+    }
 
     return 0;
 }